@@ -0,0 +1,283 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+/** This keeps a ring of (frame number, stage, TSC) events for each thread that records
+* any, so a frame's way through the FR and the FP plugins can be seen afterwards, eg
+* when a frame stalls now and then. It's only built in with -DPERCIVAL_TRACE (the cmake
+* option PERCIVAL_TRACE); otherwise the PERCIVAL_TRACE_* macros are nothing.
+*
+* Recording an event is a rdtsc and three relaxed stores into the thread's own ring,
+* with no lock; the ring keeps the last ringEvents and writes over the oldest. A thread
+* takes the lock once, the first time it records, to register its ring. toJson()/saveJson()
+* copy every ring without stopping the writers, dropping whatever was overwritten while
+* they copied, and write Chrome trace JSON (chrome://tracing, ui.perfetto.dev), with the
+* TSC turned into CLOCK_MONOTONIC us, so the FR's and FP's files can be put together.
+*
+* Everything is in this header so the FR decoder and the FP plugins can share it. The
+* registry is a static in an inline function, which the dynamic linker makes one per
+* process (a GNU unique symbol), so one save has every plugin's threads in it.
+*/
+
+class FrameTrace
+{
+public:
+    enum Stage
+    {
+        eDecoderFirstPacket = 0,
+        eDecoderComplete,
+        eDecoderTimeout,
+        eDecoderDrop,
+        eDecoderRelease,
+        eProcess2,
+        eProcess3,
+        eCalib,
+        eCalibReset,
+        eCalibSample,
+        eCalibRows,
+        eCalibStats,
+        eCalibDark,
+        ePush,
+        eNumStages,
+    };
+    enum Phase
+    {
+        eInstant = 0,
+        eBegin,
+        eEnd,
+    };
+    // a power of 2; each event is 16 bytes
+    static const uint64_t ringEvents = 1 << 14;
+
+    struct Event
+    {
+        uint64_t tsc;
+        uint32_t frame;
+        uint16_t stage;
+        uint16_t phase;
+    };
+
+    // one thread writes this, anyone can read it
+    struct Ring
+    {
+        Ring() : head(0), tid(syscall(SYS_gettid)) {}
+
+        void add(uint64_t tsc, uint32_t frame, int stage, int phase)
+        {
+            uint64_t i = head.load(std::memory_order_relaxed);
+            std::atomic<uint64_t>* slot = words + 2 * (i & (ringEvents - 1));
+            slot[0].store(tsc, std::memory_order_relaxed);
+            slot[1].store((uint64_t)frame << 32 | (uint64_t)stage << 16 | (uint64_t)phase, std::memory_order_relaxed);
+            head.store(i + 1, std::memory_order_release);
+        }
+
+        // the events still in the ring, oldest first
+        std::vector<Event> snapshot() const
+        {
+            uint64_t end = head.load(std::memory_order_acquire);
+            uint64_t begin = end < ringEvents ? 0 : end - ringEvents;
+            std::vector<Event> events;
+            events.reserve(end - begin);
+            for(uint64_t i=begin;i<end;++i)
+            {
+                const std::atomic<uint64_t>* slot = words + 2 * (i & (ringEvents - 1));
+                uint64_t packed = slot[1].load(std::memory_order_relaxed);
+                Event event = {slot[0].load(std::memory_order_relaxed), (uint32_t)(packed >> 32),
+                               (uint16_t)(packed >> 16), (uint16_t)packed};
+                events.push_back(event);
+            }
+            // the writer may have gone round onto the first of them, and be writing the
+            // one after what it has now
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t now = head.load(std::memory_order_relaxed);
+            uint64_t firstGood = now + 1 < ringEvents ? 0 : now + 1 - ringEvents;
+            if(begin < firstGood)
+                events.erase(events.begin(), events.begin() + std::min(firstGood - begin, (uint64_t)events.size()));
+            return events;
+        }
+
+        std::atomic<uint64_t> head;
+        std::atomic<uint64_t> words[2 * ringEvents];
+        long tid;
+    };
+
+    // a begin when it's made and an end when it goes
+    class Span
+    {
+    public:
+        Span(uint32_t frame, int stage) :
+            m_frame(frame),
+            m_stage(stage)
+        {
+            add(frame, stage, eBegin);
+            threadFrameRef() = frame;
+        }
+        ~Span()
+        {
+            add(m_frame, m_stage, eEnd);
+        }
+    protected:
+        uint32_t m_frame;
+        int m_stage;
+    };
+
+    static void add(uint32_t frame, int stage, int phase)
+    {
+        uint64_t tsc = __rdtsc();
+        threadRing().add(tsc, frame, stage, phase);
+    }
+
+    // the frame of the last Span made on this thread, for work it hands to other threads
+    static uint32_t threadFrame() { return threadFrameRef(); }
+
+    static const char* stageName(int stage)
+    {
+        static const char* names[eNumStages] = {
+            "decoder_first_packet", "decoder_complete", "decoder_timeout", "decoder_drop",
+            "decoder_release", "process2", "process3", "calib", "calib_reset", "calib_sample",
+            "calib_rows", "calib_stats", "calib_dark", "push"};
+        return (0 <= stage && stage < eNumStages) ? names[stage] : "unknown";
+    }
+
+    static bool compiledIn()
+    {
+#ifdef PERCIVAL_TRACE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // @ret the number of events written
+    static size_t toJson(std::ostream& os)
+    {
+        Registry& registry = theRegistry();
+        std::vector<std::shared_ptr<Ring> > rings;
+        {
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            rings = registry.rings;
+        }
+        // the TSC rate from how far it and the clock have gone since the registry started
+        uint64_t tscNow = __rdtsc();
+        double nsNow = monotonicNs();
+        double ticksPerNs = nsNow > registry.startNs ? (tscNow - registry.startTsc) / (nsNow - registry.startNs) : 0;
+        if(ticksPerNs <= 0)
+            ticksPerNs = 1;
+
+        uint64_t clearedTsc = registry.clearedTsc.load(std::memory_order_relaxed);
+        long pid = getpid();
+        size_t written = 0;
+        os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        for(auto& ring : rings)
+        {
+            for(const Event& event : ring->snapshot())
+            {
+                if(event.tsc < clearedTsc)
+                    continue;
+                static const char* phases[] = {"i", "B", "E"};
+                double us = (registry.startNs + ((int64_t)(event.tsc - registry.startTsc)) / ticksPerNs) / 1000.0;
+                os << (written ? ",\n" : "\n") << "{\"name\":\"" << stageName(event.stage)
+                   << "\",\"cat\":\"percival\",\"ph\":\"" << phases[event.phase < 3 ? event.phase : 0] << "\"";
+                if(event.phase == eInstant)
+                    os << ",\"s\":\"t\"";
+                os << std::fixed << ",\"ts\":" << us << std::defaultfloat
+                   << ",\"pid\":" << pid << ",\"tid\":" << ring->tid
+                   << ",\"args\":{\"frame\":" << event.frame << "}}";
+                ++written;
+            }
+        }
+        os << "\n]}\n";
+        return written;
+    }
+
+    // @ret the number of events written, or -1 if the file can't be written
+    static long saveJson(const std::string& filename)
+    {
+        std::ofstream os(filename.c_str());
+        if(!os)
+            return -1;
+        size_t written = toJson(os);
+        os.close();
+        return os ? (long)written : -1;
+    }
+
+    // the rings are kept when their threads go, and the writers don't stop, so this
+    // just leaves out of the JSON whatever was recorded before it
+    static void clear()
+    {
+        theRegistry().clearedTsc.store(__rdtsc(), std::memory_order_relaxed);
+    }
+
+// this are private really, but the testing needs to get hold of them!
+    struct Registry
+    {
+        Registry() : startTsc(__rdtsc()), startNs(monotonicNs()), clearedTsc(0) {}
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Ring> > rings;
+        uint64_t startTsc;
+        double startNs;
+        std::atomic<uint64_t> clearedTsc;
+    };
+
+    static Registry& theRegistry()
+    {
+        static Registry registry;
+        return registry;
+    }
+
+    static Ring& threadRing()
+    {
+        static thread_local Ring* ring = nullptr;
+        if(!ring)
+        {
+            std::shared_ptr<Ring> mine = std::make_shared<Ring>();
+            Registry& registry = theRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.rings.push_back(mine);
+            ring = mine.get();
+        }
+        return *ring;
+    }
+
+    static uint32_t& threadFrameRef()
+    {
+        static thread_local uint32_t frame = 0;
+        return frame;
+    }
+
+    static double monotonicNs()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (double)now.tv_sec * 1.0e9 + now.tv_nsec;
+    }
+};
+
+#ifdef PERCIVAL_TRACE
+// a begin now and an end when name goes out of scope
+#define PERCIVAL_TRACE_SPAN(name, frame, stage) FrameTrace::Span name((frame), FrameTrace::stage)
+#define PERCIVAL_TRACE_EVENT(frame, stage) FrameTrace::add((frame), FrameTrace::stage, FrameTrace::eInstant)
+// for a stage that doesn't fit a scope
+#define PERCIVAL_TRACE_BEGIN(frame, stage) FrameTrace::add((frame), FrameTrace::stage, FrameTrace::eBegin)
+#define PERCIVAL_TRACE_END(frame, stage) FrameTrace::add((frame), FrameTrace::stage, FrameTrace::eEnd)
+#define PERCIVAL_TRACE_FRAME() FrameTrace::threadFrame()
+#else
+#define PERCIVAL_TRACE_SPAN(name, frame, stage) do {} while(0)
+#define PERCIVAL_TRACE_EVENT(frame, stage) do {} while(0)
+#define PERCIVAL_TRACE_BEGIN(frame, stage) do {} while(0)
+#define PERCIVAL_TRACE_END(frame, stage) do {} while(0)
+#define PERCIVAL_TRACE_FRAME() 0
+#endif
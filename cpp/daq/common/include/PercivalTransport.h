@@ -30,6 +30,14 @@ namespace PercivalTransport {
 
     static const size_t frame_info_size        = 42;
 
+    // the FP passes FrameHeader::frame_start_time on in the FrameMetaData of the frames
+    // it makes, as a uint64_t of ns under this name. It's from the FR's clock, so a
+    // latency worked out from it only means something with the FR on the same host.
+    static const char* const frame_start_ns_param = "frame_start_ns";
+    // Process2/3 put the time they push each frame on under this name too, so the calib
+    // plugin can tell how long the frame waited for it. It's from gettime() as well.
+    static const char* const frame_pushed_ns_param = "frame_pushed_ns";
+
     // this is what appears at the start of a UDP payload from the detector
     // warning: these fields are big-endian on the network, so this struct is unhelpful.
     struct PacketHeaderFields
@@ -53,6 +61,8 @@ namespace PercivalTransport {
         uint32_t frame_number;
         uint32_t frame_state;
         struct timespec frame_start_time;
+        // when the FR handed the frame to the FP, complete or timed out
+        struct timespec frame_ready_time;
         uint32_t packets_received;
         uint8_t  frame_info[frame_info_size];
         uint8_t  packet_state[num_data_types][num_subframes][num_primary_packets + num_tail_packets];
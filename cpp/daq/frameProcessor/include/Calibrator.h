@@ -1,12 +1,16 @@
-
 #pragma once
 
 #include "FrameMem.h"
+#include "ParallelRows.h"
+#include "PerfCounters.h"
+#include "FrameTrace.h"
 #include <log4cxx/logger.h>
 
+#include <tbb/tbb.h>
+
 // this is common code to the CalibratorReset & CalibratorSample, which have different algorithms.
 // I think we could move this actually.
-class Calibrator
+class Calibrator : public ParallelRows
 {
 public:
 
@@ -20,9 +24,32 @@ public:
     // if you set these, you get some info about the calculations at that point.
     int m_debugRow=-1, m_debugCol;
 
+    // each processFrame*P is counted as a frame in this, if it's enabled. This does no
+    // copying, so keep it alive yourself; nullptr turns it off.
+    void setPerfCounters(PerfCounters* counters) { m_pPerf = counters; }
+
 protected:
     log4cxx::LoggerPtr m_logger;
 
+    // this runs fn over the row indices [0,numRows) with the current settings, counting
+    // the frame and tracing the chunks
+    template<typename Fn>
+    void parallelRows(int numRows, const Fn& fn)
+    {
+        PerfCounters* perf = m_pPerf;
+        PerfCounters::Frame frame(perf, (uint64_t)numRows * m_cols);
+        // the chunks run on tbb's threads, which don't know which frame this is
+        uint32_t traceFrame = PERCIVAL_TRACE_FRAME();
+        auto counted = [perf, &fn, traceFrame](const tbb::blocked_range<int>& rows)
+        {
+            PERCIVAL_TRACE_SPAN(span, traceFrame, eCalibRows);
+            PerfCounters::Scope scope(perf);
+            fn(rows);
+        };
+        ParallelRows::parallelRows(numRows, counted);
+    }
+
+    PerfCounters* m_pPerf = nullptr;
 };
 
 
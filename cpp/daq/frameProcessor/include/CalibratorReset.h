@@ -20,11 +20,16 @@
 class CalibratorReset : public Calibrator
 {
 public:
+    // rows per tbb chunk, unless setParallel says otherwise
+    static const int defaultGrain = 50;
+
     CalibratorReset(int rows, int cols);
     ~CalibratorReset();
     void processFrame(MemBlockI16& input, MemBlockF& output);
     void processFrameP(MemBlockI16& input, MemBlockF& output);
     int64_t loadADCGain(std::string filename);
+    // the bytes processFrameP has to move for each pixel: input 2, Gc/Oc/Gf/Of 16, output 4
+    int bytesPerPixel() { return 22; }
 
 // this are private really:
     void processFrameRow(MemBlockI16& input, MemBlockF& output, int row);
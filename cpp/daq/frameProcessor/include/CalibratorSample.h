@@ -3,14 +3,17 @@
 
 
 #include "Calibrator.h"
+#include "GainOccupancy.h"
 
 #include <tbb/tbb.h>
 
 #include <string>
+#include <vector>
 #include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <cassert>
+#include <mutex>
 
 /** This class does all the work in our calibration algorithm. We need to use a class
 * instead of a function here because there are several arrays of calibration data that
@@ -18,14 +21,63 @@
 * to have a log4cxx which is standard.
 */
 
+// a pixel (or 3x3 cluster centred on it) above the sparse threshold
+struct PhotonEvent
+{
+    uint16_t row;
+    uint16_t col;
+    float value;
+};
+
+// these are summed up as the frame is calibrated, so they cost no extra pass.
+// The mean is over the pixels that aren't NaN.
+struct FrameStats
+{
+    uint32_t gainCount[4];
+    uint32_t saturated;
+    uint32_t nanCount;
+    double sum;
+    float max;
+
+    void clear();
+    void add(const FrameStats& rhs);
+    uint32_t valid() const;
+    // the pixels calibrated, which is fewer than the frame's with active rows set
+    uint64_t pixels() const;
+    double mean() const;
+};
+
 class CalibratorSample : public Calibrator
 {
 public:
+    // these are the formats we can produce the electron-counts in
+    enum OutputFormat
+    {
+        eOutputFloat = 0,
+        eOutputHalf,
+        eOutputPhoton16,
+        eOutputPhoton8,
+        eOutputSparse,
+        eOutputMax,
+    };
+    // rows per tbb chunk, unless setParallel says otherwise
+    static const int defaultGrain = 150;
+
     CalibratorSample(int rows, int cols);
     ~CalibratorSample();
-    // these functions will destroy the data in input
+    // these functions will destroy the data in input, by writing the 2-bit gain of each
+    // pixel over it, unless a gain map is set.
     void processFrame(MemBlockI16& input, MemBlockF& output);
     void processFrameP(MemBlockI16& input, MemBlockF& output);
+    // these produce a narrower output; each row is converted as soon as it is calibrated
+    // so there is no second pass over the frame. Half is IEEE float16 electrons.
+    void processFrameHalfP(MemBlockI16& input, MemBlockI16& output);
+    void processFramePhotonP(MemBlockI16& input, MemBlockI16& output);
+    void processFramePhotonP(MemBlockI16& input, MemBlockI8& output);
+    // this calibrates into output as usual, and while each row is still in cache it
+    // lists the pixels above the sparse threshold into events, in row-major order.
+    // If clustering is on, only the local maxima are listed, with their 3x3 sums.
+    void processFrameSparseP(MemBlockI16& input, MemBlockF& output, std::vector<PhotonEvent>& events);
     int64_t loadADCGain(std::string filename);
     int64_t loadLatGain(std::string filename);
     // this does no copying, so keep reset alive yourself.
@@ -34,18 +86,104 @@ public:
     void setCMA(bool on, int firstCol);
     // @param firstCol this will be -1 if cma is off.
     void getCMA(bool& on, int& firstCol);
+    // the darkframe is subtracted from each row after cma. This does no copying either;
+    // pass nullptr to switch it off. Like all the set functions here it waits for the frame
+    // being calibrated, so once it returns the old darkframe can be changed or freed.
+    void setDarkFrame(MemBlockF* dark);
+    // photons = floor(electrons / electronsPerPhoton + rounding), clipped to [0,saturation].
+    // NaN pixels come out as the max value of the output type, which is above saturation.
+    void setPhotonConversion(float electronsPerPhoton, float rounding, int saturation);
+    void getPhotonConversion(float& electronsPerPhoton, float& rounding, int& saturation);
+    // threshold is in electrons, after the darkframe.
+    void setSparse(float threshold, bool cluster);
+    // this makes m_Ped0 follow drift: every interval frames, a gain 0 pixel whose
+    // electrons (after cma and darkframe) are below threshold moves its pedestal by
+    // alpha times its residual. It's done on each row as it is calibrated.
+    void setPedestalTracking(bool on, float alpha, float threshold, int interval);
+    // with a gain map set, the input is only read, and the gains are packed into the map
+    // instead: 4 pixels per byte, pixel c of a row in bits 2*(c%4) of byte c/4. So the
+    // map is rows x cols/4. Set it before each frame; nullptr goes back to overwriting.
+    void setGainMap(MemBlockI8* map);
+    // the half and photon formats calibrate each row into a float row that stays in L1
+    // while it is converted. With a float frame set, the rows go into it instead and it is
+    // kept, eg for the dark accumulator. Set it before each frame; nullptr goes back to rows.
+    void setFloatFrame(MemBlockF* frame);
+    // this is where the 16-bit gains are for a frame that has just been calibrated
+    MemBlockI16& gainSource(MemBlockI16& input);
+    static uint16_t unpackGain(MemBlockI8& map, int row, int col);
+    // with stats on, each processFrame*P fills in m_frameStats. A pixel is saturated
+    // if it has at least saturation electrons.
+    void setStats(bool on, float saturation);
+    // only these rows are calibrated by the processFrame*P functions, eg the rows some
+    // ROIs cover. The other rows of the output are all 0xff bytes, which is NaN for
+    // float and half, and the NaN value of the photon formats. Empty means all rows.
+    // This can be called while a frame is being calibrated; it waits for it to finish.
+    void setActiveRows(const std::vector<int>& rows);
+    // each processFrame*P adds every calibrated row's gains to this; nullptr turns it off.
+    // This does no copying, so keep it alive yourself. It waits for the frame being
+    // calibrated, so after setting nullptr the old one can be cleared or freed.
+    void setGainOccupancy(GainOccupancy* occupancy);
+    // the bytes processFrameP has to move for each pixel with the current settings: input 2,
+    // gains 2, output 4, Gc/Oc/Gf/Of 16, reset 4, ped 4, gain 4, and 4 for a darkframe
+    int bytesPerPixel() { return m_pDarkFrame ? 40 : 36; }
 
 // this are private really, but the testing needs to get hold of them!
+    // The row functions that take a float* take just that row's electrons, so the
+    // narrow formats can calibrate into a row of their own. The MemBlockF versions
+    // hand them the row of a whole frame.
     // this can return NaN.
-    float getCMAVal(MemBlockI16& input, MemBlockF& output, int row);
-    void processFrameRow(MemBlockI16& input, MemBlockF& output, int row);
-    void applyCMA(MemBlockI16& gain, MemBlockF& inout, int row);
+    float getCMAVal(MemBlockI16& input, const float* electrons, int row);
+    float getCMAVal(MemBlockI16& input, MemBlockF& output, int row) { return getCMAVal(input, rowOf(output, row), row); }
+    void processFrameRow(MemBlockI16& input, float* electrons, int row);
+    void processFrameRow(MemBlockI16& input, MemBlockF& output, int row) { processFrameRow(input, rowOf(output, row), row); }
+    void applyCMA(MemBlockI16& gain, float* electrons, int row);
+    void applyCMA(MemBlockI16& gain, MemBlockF& inout, int row) { applyCMA(gain, rowOf(inout, row), row); }
 
     void processFrameRowSIMD(MemBlockI16& input, MemBlockF& output, int row);
     void applyCMA_SIMD(MemBlockI16& gain, MemBlockF& inout, int row);
 
+    void subtractDarkRow(float* electrons, int row);
+    void subtractDarkRow(MemBlockF& inout, int row) { subtractDarkRow(rowOf(inout, row), row); }
+    void packGainRow(MemBlockI16& gain, int row);
+    void trackPedestalRow(MemBlockI16& gain, const float* electrons, int row);
+    void trackPedestalRow(MemBlockI16& gain, MemBlockF& output, int row) { trackPedestalRow(gain, rowOf(output, row), row); }
+    void trackPedestalRowSIMD(MemBlockI16& gain, const float* electrons, int row);
+    void trackPedestalRowSIMD(MemBlockI16& gain, MemBlockF& output, int row) { trackPedestalRowSIMD(gain, rowOf(output, row), row); }
+    // this counts the frames, and says if this one updates the pedestals
+    void startFrame();
+    // these add one row into stats
+    void statsRow(MemBlockI16& gain, const float* electrons, int row, FrameStats& stats);
+    void statsRow(MemBlockI16& gain, MemBlockF& output, int row, FrameStats& stats) { statsRow(gain, rowOf(output, row), row, stats); }
+    void statsRowSIMD(MemBlockI16& gain, const float* electrons, int row, FrameStats& stats);
+    void statsRowSIMD(MemBlockI16& gain, MemBlockF& output, int row, FrameStats& stats) { statsRowSIMD(gain, rowOf(output, row), row, stats); }
+    // each tbb chunk sums its own rows, then adds them in here
+    void addStats(const FrameStats& chunkStats);
+    void convertRowToHalf(const float* electrons, MemBlockI16& output, int row);
+    void convertRowToHalf(MemBlockF& input, MemBlockI16& output, int row) { convertRowToHalf(rowOf(input, row), output, row); }
+    void convertRowToHalfSIMD(const float* electrons, MemBlockI16& output, int row);
+    void convertRowToHalfSIMD(MemBlockF& input, MemBlockI16& output, int row) { convertRowToHalfSIMD(rowOf(input, row), output, row); }
+    template<typename T>
+    void convertRowToPhotons(const float* electrons, FrameMem<T>& output, int row);
+    template<typename T>
+    void convertRowToPhotons(MemBlockF& input, FrameMem<T>& output, int row) { convertRowToPhotons(rowOf(input, row), output, row); }
+    void convertRowToPhotonsSIMD(const float* electrons, MemBlockI16& output, int row);
+    void convertRowToPhotonsSIMD(MemBlockF& input, MemBlockI16& output, int row) { convertRowToPhotonsSIMD(rowOf(input, row), output, row); }
+    void convertRowToPhotonsSIMD(const float* electrons, MemBlockI8& output, int row);
+    void convertRowToPhotonsSIMD(MemBlockF& input, MemBlockI8& output, int row) { convertRowToPhotonsSIMD(rowOf(input, row), output, row); }
+    // these append to events
+    void findEventsRow(MemBlockF& input, std::vector<PhotonEvent>& events, int row);
+    void findEventsRowSIMD(MemBlockF& input, std::vector<PhotonEvent>& events, int row);
+    void clusterEvents(MemBlockF& frame, std::vector<PhotonEvent>& events);
+
     // had to use MemBlock* here because boost:bind didn't like references
     void processFrameRowsTBB(MemBlockI16* input, MemBlockF* output, tbb::blocked_range<int> rows);
+    // output is a MemBlockI16 or MemBlockI8 depending on format
+    void processFrameRowsConvertTBB(MemBlockI16* input, void* output, int format, tbb::blocked_range<int> rows);
+    void processFrameRowsSparseTBB(MemBlockI16* input, MemBlockF* output, tbb::blocked_range<int> rows);
+    int numActiveRows() { return m_activeRows.empty() ? m_rows : m_activeRows.size(); }
+    int activeRow(int i) { return m_activeRows.empty() ? i : m_activeRows[i]; }
+    void clearInactiveRows(void* output, int elemSize);
+    float* rowOf(MemBlockF& frame, int row) { return frame.data() + row * m_cols; }
     // rename allocFrameMem later
     void allocGainMem();
 
@@ -62,6 +200,49 @@ public:
 
     bool m_cmaFlag = false;
     int m_cmaFirstCol = 0;
+
+    MemBlockF* m_pDarkFrame = nullptr;
+
+    float m_photonScale = 1.0f;
+    float m_photonRounding = 0.5f;
+    int m_photonSaturation = 0xfffe;
+
+    // the narrow formats calibrate into here first if it's set, rather than into a row
+    MemBlockF* m_pFloatFrame = nullptr;
+    // ...which is one of these, one per tbb thread. They are made on first use and kept.
+    tbb::enumerable_thread_specific<MemBlockF> m_rowBuffers;
+
+    float m_sparseThreshold = 100.0f;
+    bool m_sparseCluster = false;
+    // each row gets its own list so the tbb tasks don't have to share one
+    std::vector<std::vector<PhotonEvent>> m_rowEvents;
+
+    bool m_pedTrack = false;
+    float m_pedTrackAlpha = 0.01f;
+    float m_pedTrackThreshold = 100.0f;
+    int m_pedTrackInterval = 1;
+    uint64_t m_frameCount = 0;
+    // true while calibrating a frame that updates the pedestals
+    bool m_pedTrackNow = false;
+
+    MemBlockI8* m_pGainMap = nullptr;
+    // the gains go in here instead of the input when there's a map
+    MemBlockI16 m_gain;
+
+    bool m_stats = false;
+    float m_statsSaturation = 1.0e6f;
+    FrameStats m_frameStats;
+    tbb::spin_mutex m_statsMutex;
+
+    // empty when all rows are calibrated
+    std::vector<int> m_activeRows;
+    std::vector<bool> m_rowActive;
+
+    GainOccupancy* m_pOccupancy = nullptr;
+
+    // each processFrame*P holds this from start to finish, and the set functions take it,
+    // so the settings can't change under a frame
+    std::mutex m_frameMutex;
 };
 
 static const int numCMACols = 32;
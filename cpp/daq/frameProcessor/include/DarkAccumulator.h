@@ -0,0 +1,72 @@
+#pragma once
+
+#include "FrameMem.h"
+#include "ParallelRows.h"
+
+#include <log4cxx/logger.h>
+
+#include <tbb/tbb.h>
+
+#include <string>
+#include <cstdint>
+
+/** This keeps a running per-pixel mean and variance of the calibrated frames, separately
+* for each gain mode, using Welford's update:
+*   n += 1; delta = x - mean; mean += delta / n; m2 += delta * (x - mean)
+* so we only need three frames per gain however many frames go through, and the
+* answer is ready as soon as the last frame is in. The variance is m2 / n.
+* NaN pixels (eg gain 3) are not counted.
+*
+* The frames it gets usually have a darkframe subtracted already, so the means are
+* residuals. Give it that darkframe with setSubtracted() and the darkframe it hands
+* back has it added on, so it can replace the old one.
+*/
+
+class DarkAccumulator : public ParallelRows
+{
+public:
+    static const int numGains = 3;
+    // rows per tbb chunk, unless setParallel says otherwise
+    static const int defaultGrain = 150;
+
+    DarkAccumulator(int rows, int cols);
+    ~DarkAccumulator();
+
+    void clear();
+    // this makes it a copy of source, sums and subtracted darkframe, eg to save it
+    // while source goes on accumulating.
+    void clone(DarkAccumulator& source);
+    // the darkframe the frames have had subtracted; it is copied. nullptr is none.
+    void setSubtracted(MemBlockF* dark);
+    // gain is the 2-bit gain of each pixel, from CalibratorSample::gainSource().
+    void accumulate(MemBlockI16& gain, MemBlockF& frame);
+    void accumulateP(MemBlockI16& gain, MemBlockF& frame);
+    // pixels with no frames in that gain get NaN.
+    void getVariance(int gainMode, MemBlockF& variance);
+    // this is the gain 0 mean plus the subtracted darkframe; where a pixel never was in
+    // gain 0 it is just the subtracted darkframe (0 if there's none).
+    void getDarkFrame(MemBlockF& dark);
+    // this saves g<n>_mean, g<n>_var, g<n>_count for each gain, and also a "darkframe"
+    // dataset of doubles which PercivalCalibPlugin can load as its darkframe. The means
+    // are residuals after the subtracted darkframe; "darkframe" is a whole one.
+    // @ret negative is failure.
+    int64_t saveToH5(std::string filename);
+    uint64_t frames() { return m_frames; }
+
+// this are private really, but the testing needs to get hold of them!
+    void accumulateRow(MemBlockI16& gain, MemBlockF& frame, int row);
+    void accumulateRowSIMD(MemBlockI16& gain, MemBlockF& frame, int row);
+    void accumulateRowsTBB(MemBlockI16* gain, MemBlockF* frame, tbb::blocked_range<int> rows);
+
+    int m_rows, m_cols;
+    uint64_t m_frames;
+    // counts are floats so the SIMD update can use them directly; exact up to 2^24 frames.
+    MemBlockF m_count[numGains];
+    MemBlockF m_mean[numGains];
+    MemBlockF m_m2[numGains];
+    bool m_hasSubtracted;
+    MemBlockF m_subtracted;
+
+protected:
+    log4cxx::LoggerPtr m_logger;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "FrameMem.h"
+
+#include <log4cxx/logger.h>
+
+#include <tbb/tbb.h>
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+/** This turns a frame in the order the detector sends it into pixels in image order,
+* in the same bit layout as CalibratorSample wants (gain<<13 | fine<<5 | coarse), so it
+* can go in front of the calibration. It does what descramble_to_crs_fn_gn() in
+* python/live_viewer/descrambler.py does for the sample frame, with refColH1_0_Flag off.
+*
+* The frame is 212 row groups of 7 ADCs. In each group, the odin quarter reorder and the
+* 2-word interleave over the 44 data pads only move words about, so they go into one
+* gather table. Each pad is then a stream of 224 15-bit words (MSB first) holding 15
+* bit-planes of 224 pixels, with the bits inverted; we undo that with a byte->8 pixels
+* lookup table. Last, the pixels of each pad go to their (ADC, column) in the image
+* through a scatter table, which has the ADCcolArray_1DA and iP2M_ColGrp orders in it.
+* The reference column pad is dropped, so the output is 1484 x 1408 like the input.
+*
+* A row group whose first word is 0xffff had a missing packet, and all its pixels get
+* 0xffff (gain 3, so they calibrate to NaN). Groups are independent, so they are done
+* in parallel with tbb.
+*/
+
+class Descrambler
+{
+public:
+    static const int numGroups = 212;
+    static const int numADCs = 7;
+    static const int numPads = 44;
+    static const int padCols = 32;
+    static const int padPixels = numADCs * padCols;
+    static const int bitsPerPixel = 15;
+    static const uint16_t missingPixel = 0xffff;
+
+    Descrambler();
+    ~Descrambler();
+
+    // input and output must both be FRAME_ROWS x FRAME_COLS.
+    // @ret the number of row groups with missing packets, negative is failure.
+    int descramble(MemBlockI16& input, MemBlockI16& output);
+    int descrambleP(MemBlockI16& input, MemBlockI16& output);
+
+// this are private really, but the testing needs to get hold of them!
+    // @ret true if the group was missing.
+    bool descrambleGroup(MemBlockI16& input, MemBlockI16& output, int group);
+    bool descrambleGroupSIMD(MemBlockI16& input, MemBlockI16& output, int group);
+    // had to use MemBlock* here because boost:bind didn't like references
+    void descrambleGroupsTBB(MemBlockI16* input, MemBlockI16* output, tbb::blocked_range<int> groups);
+    // words are the 224 byte-swapped words of a pad, pixels are in ADCcolArray_1DA order.
+    void unpackPad(const uint16_t* words, uint16_t* pixels);
+    void unpackPadSIMD(const uint16_t* words, uint16_t* pixels);
+    int checkShape(MemBlockI16& input, MemBlockI16& output);
+
+    // both offsets are from the first pixel of the group's first row, [pad * padPixels + i]
+    std::vector<uint32_t> m_gather;
+    std::vector<uint32_t> m_scatter;
+    // for each byte of a bit-plane, which of its 8 pixels have that bit set
+    uint16_t m_bitTable[256][8];
+    std::atomic<int> m_missingGroups;
+
+protected:
+    log4cxx::LoggerPtr m_logger;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "FrameMem.h"
+#include "ParallelRows.h"
+
+#include <log4cxx/logger.h>
+
+#include <tbb/tbb.h>
+
+/** This sums calibrated float frames, to integrate N frames into one. The sums can be
+* float or double; float is half the memory traffic, double doesn't lose the small
+* signals when thousands of frames go in.
+*
+* With countValid on, NaN pixels (gain 3, missing packets, rows blanked out of the
+* ROIs) are left out of the sum, and each pixel counts the frames that did go in, so
+* sum/count is the mean of the good ones. A pixel which was never good has a sum of 0
+* and a count of 0. With it off, a NaN in any frame makes that pixel's sum NaN.
+*/
+
+class FrameAccumulator : public ParallelRows
+{
+public:
+    // rows per tbb chunk, unless setParallel says otherwise
+    static const int defaultGrain = 150;
+
+    FrameAccumulator();
+    ~FrameAccumulator();
+
+    // this sets the frame size and how to sum, and clears the sums.
+    void init(int rows, int cols, bool doublePrecision, bool countValid);
+    void clear();
+
+    // input must be the size given to init().
+    // @ret negative is failure.
+    int add(MemBlockF& input);
+    int addP(MemBlockF& input);
+
+    int frames() { return m_frames; }
+    bool doublePrecision() { return m_doublePrecision; }
+    bool countValid() { return m_countValid; }
+    // only the one for the precision in use has anything in it
+    MemBlockF& sumF() { return m_sumF; }
+    MemBlockD& sumD() { return m_sumD; }
+    MemBlockI32& counts() { return m_counts; }
+
+// this are private really, but the testing needs to get hold of them!
+    void addRow(MemBlockF& input, int row);
+    void addRowSIMD(MemBlockF& input, int row);
+    // had to use MemBlock* here because boost:bind didn't like references
+    void addRowsTBB(MemBlockF* input, tbb::blocked_range<int> rows);
+    int checkShape(MemBlockF& input);
+
+    bool m_doublePrecision;
+    bool m_countValid;
+    int m_frames;
+    MemBlockF m_sumF;
+    MemBlockD m_sumD;
+    MemBlockI32 m_counts;
+
+protected:
+    log4cxx::LoggerPtr m_logger;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "FrameMem.h"
+
+#include <log4cxx/logger.h>
+
+#include <tbb/tbb.h>
+
+/** This bins a float frame down by 2x2 or 4x4 for the live view, giving the sum or the
+* mean of each bin. Rows and columns that don't make a whole bin are dropped, and a NaN
+* pixel makes its bin NaN. A factor of 1 just copies. The input is only read, so it can
+* be the calibrated frame itself.
+*/
+
+class FrameBinner
+{
+public:
+    FrameBinner();
+    ~FrameBinner();
+
+    // output must be input.rows()/factor x input.cols()/factor.
+    // @ret negative is failure.
+    int bin(MemBlockF& input, MemBlockF& output, int factor, bool mean);
+    int binP(MemBlockF& input, MemBlockF& output, int factor, bool mean);
+
+// this are private really, but the testing needs to get hold of them!
+    // row is the output row, scale is 1 for the sum or 1/(factor*factor) for the mean
+    void binRow(MemBlockF& input, MemBlockF& output, int factor, float scale, int row);
+    void binRowSIMD(MemBlockF& input, MemBlockF& output, int factor, float scale, int row);
+    // had to use MemBlock* here because boost:bind didn't like references
+    void binRowsTBB(MemBlockF* input, MemBlockF* output, int factor, float scale, tbb::blocked_range<int> rows);
+    int checkShape(MemBlockF& input, MemBlockF& output, int factor);
+
+protected:
+    log4cxx::LoggerPtr m_logger;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <log4cxx/logger.h>
+
+#include <tbb/tbb.h>
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+/** This compresses a frame into the bitshuffle+LZ4 chunk format that the hdf5
+* bitshuffle filter (id 32008) reads, so the file writer can do a direct chunk write.
+* The format is a 12-byte header (uint64 BE uncompressed bytes, uint32 BE block bytes)
+* then for each block a uint32 BE compressed size and the LZ4 data of the bitshuffled
+* block. Any trailing elements that don't make a group of 8 are copied raw at the end.
+*
+* The blocks are independent, so we compress them in parallel with tbb, then
+* gather them into the output in order.
+*/
+
+class FrameCompressor
+{
+public:
+    FrameCompressor();
+    ~FrameCompressor();
+
+    // this returns the number of bytes gather() will write. Keep the input alive and
+    // unchanged until you have called gather().
+    // @ret negative is failure.
+    int64_t compressP(const void* input, size_t nbytes, int elemSize);
+    void gather(void* output);
+
+    // these work on a group of numElems elements, which must be a multiple of 8.
+    // tmp must be the same size as in.
+    static void bitshuffle(const uint8_t* in, uint8_t* out, uint8_t* tmp, size_t numElems, int elemSize);
+    static void bitunshuffle(const uint8_t* in, uint8_t* out, uint8_t* tmp, size_t numElems, int elemSize);
+    static size_t blockElems(int elemSize);
+
+// this are private really:
+    void compressBlocksTBB(const uint8_t* input, tbb::blocked_range<int> blocks);
+
+    static const int headerSize = 12;
+
+    const uint8_t* m_input = nullptr;
+    size_t m_nbytes = 0;
+    int m_elemSize = 0;
+    size_t m_blockElems = 0;
+    int m_numBlocks = 0;
+    // each block gets a slot of this many bytes in m_scratch
+    size_t m_slotSize = 0;
+    std::vector<uint8_t> m_scratch;
+    std::vector<int> m_blockSizes;
+
+protected:
+    log4cxx::LoggerPtr m_logger;
+};
+
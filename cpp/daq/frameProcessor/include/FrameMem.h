@@ -141,4 +141,6 @@ typedef FrameMem<float> MemBlockF;
 typedef FrameMem<double> MemBlockD;
 // rename MemBlockI16
 typedef FrameMem<uint16_t> MemBlockI16;
+typedef FrameMem<uint32_t> MemBlockI32;
+typedef FrameMem<uint8_t> MemBlockI8;
 
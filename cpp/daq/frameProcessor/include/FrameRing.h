@@ -0,0 +1,137 @@
+#pragma once
+
+#include <log4cxx/logger.h>
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/** This is a ring of frames in POSIX shared memory, so processes on the same node can
+* read the calibrated frames in place, with no sockets and no more copies.
+*
+* There is one writer, which never waits. Each slot has a sequence number which is
+* 2n+1 while frame n is being written into it and 2n+2 once it is all there, like a
+* seqlock. A reader checks the sequence before and after using a frame; if it changed,
+* the writer lapped the reader and the frame can't be trusted. A reader which falls
+* more than a ring behind skips to the oldest frame still in the ring.
+*
+* Readers take an entry in the header with their pid and the next frame they want,
+* so the writer can count the slow ones. Layout of the shared memory:
+*   FrameRingHeader, numSlots x FrameRingSlot, then at dataOffset numSlots x slotBytes.
+*/
+
+struct FrameRingSlot
+{
+    std::atomic<uint64_t> seq;
+    uint64_t frameNumber;
+    int32_t dataType;
+    int32_t rows;
+    int32_t cols;
+    int32_t spare;
+    uint64_t bytes;
+    uint64_t pad[3];
+};
+
+struct FrameRingReaderEntry
+{
+    // 0 is a free entry
+    std::atomic<uint64_t> pid;
+    std::atomic<uint64_t> next;
+};
+
+struct FrameRingHeader
+{
+    static const uint64_t ringMagic = 0x474e495256524550ULL;  // "PERVRING"
+    static const uint32_t ringVersion = 1;
+    static const int maxReaders = 8;
+
+    // the writer sets this last, so a reader never sees a half made ring
+    std::atomic<uint64_t> magic;
+    uint32_t version;
+    uint32_t numSlots;
+    uint64_t slotBytes;
+    uint64_t dataOffset;
+    // the number of frames written so far
+    std::atomic<uint64_t> written;
+    FrameRingReaderEntry readers[maxReaders];
+};
+
+// what a reader gets: data points into the shared memory.
+struct FrameRingView
+{
+    uint64_t seq;
+    uint64_t frameNumber;
+    int dataType;
+    int rows;
+    int cols;
+    size_t bytes;
+    const void* data;
+};
+
+class FrameRing
+{
+public:
+    FrameRing();
+    ~FrameRing();
+
+    // this replaces any ring of the same name. name is like "/percival_ecount".
+    // @ret negative is failure.
+    int64_t create(std::string name, int numSlots, size_t slotBytes);
+    // unmaps and unlinks it
+    void destroy();
+    bool isOpen() { return m_header != nullptr; }
+
+    // @ret negative is failure, eg the frame is bigger than a slot.
+    int64_t write(const void* data, size_t bytes, int rows, int cols, int dataType, uint64_t frameNumber);
+
+    // these look at the reader entries; readers whose process has gone are removed.
+    int readers();
+    // slow readers are a whole ring behind, so they are losing frames
+    int slowReaders();
+    uint64_t written() { return m_header ? m_header->written.load() : 0; }
+    const std::string& name() { return m_name; }
+
+// this are private really:
+    void reapReaders();
+
+    std::string m_name;
+    size_t m_size;
+    FrameRingHeader* m_header;
+    FrameRingSlot* m_slots;
+    uint8_t* m_data;
+
+protected:
+    log4cxx::LoggerPtr m_logger;
+};
+
+class FrameRingReader
+{
+public:
+    FrameRingReader();
+    ~FrameRingReader();
+
+    // @ret negative is failure, eg no ring of that name or no free reader entry.
+    int64_t open(std::string name);
+    void close();
+
+    // this gets the next frame, and returns false if there isn't a new one yet.
+    bool next(FrameRingView& view);
+    // call this when finished with the view's data; false means the writer overwrote
+    // it meanwhile, so the data can't be trusted.
+    bool done(const FrameRingView& view);
+    // frames lost because we were too slow, including those done() said were overwritten
+    uint64_t skipped() { return m_skipped; }
+
+// this are private really:
+    size_t m_size;
+    FrameRingHeader* m_header;
+    FrameRingSlot* m_slots;
+    uint8_t* m_data;
+    int m_entry;
+    uint64_t m_next;
+    uint64_t m_skipped;
+
+protected:
+    log4cxx::LoggerPtr m_logger;
+};
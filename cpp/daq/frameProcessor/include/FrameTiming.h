@@ -0,0 +1,82 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+
+/** This is what each of our plugins keeps to show in status how well it's keeping up:
+* how long each process_frame took, how long the frames waited before process_frame got
+* them, and how many frames a second are coming through. The histograms are
+* LatencyHistograms, so process_frame adds to them while status() reads, with no lock.
+*
+* The wait is from when the frame was handed on (by the FR, or by the plugin before)
+* to the start of process_frame, so it's the time in the FR->FP channel and the plugin's
+* queue. A plugin that's falling behind shows it here before the FR runs out of buffers.
+*/
+
+class FrameTiming
+{
+public:
+    // put one of these at the top of process_frame
+    class Scope
+    {
+    public:
+        // waitNs is -1 if it's not known for this frame
+        Scope(FrameTiming& timing, int64_t waitNs) :
+            m_timing(timing),
+            m_waitNs(waitNs),
+            m_start(std::chrono::steady_clock::now())
+        {
+        }
+        ~Scope()
+        {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+            m_timing.add(ns, m_waitNs);
+        }
+    protected:
+        FrameTiming& m_timing;
+        int64_t m_waitNs;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    FrameTiming();
+
+    void clear();
+    void add(uint64_t processNs, int64_t waitNs);
+    // the frames a second since the last time this was called, which is 0 the first time
+    double framesPerS();
+
+    // for the times from gettime(), which is what the FR stamps the frames with
+    static uint64_t toNs(const struct timespec& time) { return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec; }
+    // now - thenNs, or -1 if then is 0 (not set) or after now
+    static int64_t waitSince(uint64_t thenNs, uint64_t nowNs) { return (thenNs && thenNs <= nowNs) ? nowNs - thenNs : -1; }
+
+    LatencyHistogram m_process;
+    LatencyHistogram m_wait;
+
+protected:
+    std::mutex m_rateMutex;
+    uint64_t m_rateFrames;
+    std::chrono::steady_clock::time_point m_rateTime;
+};
+
+// this puts the timing into a status message under prefix, eg "calib/timing/".
+// Message is an OdinData::IpcMessage, which this library doesn't otherwise need.
+template<typename Message>
+void timingStatus(Message& status, const std::string& prefix, FrameTiming& timing)
+{
+    status.set_param(prefix + "frames", timing.m_process.count());
+    status.set_param(prefix + "frames_per_s", timing.framesPerS());
+    status.set_param(prefix + "process_p50_us", timing.m_process.percentile(50) / 1000.0);
+    status.set_param(prefix + "process_p90_us", timing.m_process.percentile(90) / 1000.0);
+    status.set_param(prefix + "process_p99_us", timing.m_process.percentile(99) / 1000.0);
+    status.set_param(prefix + "process_max_us", timing.m_process.max() / 1000.0);
+    status.set_param(prefix + "wait_p50_us", timing.m_wait.percentile(50) / 1000.0);
+    status.set_param(prefix + "wait_p90_us", timing.m_wait.percentile(90) / 1000.0);
+    status.set_param(prefix + "wait_p99_us", timing.m_wait.percentile(99) / 1000.0);
+    status.set_param(prefix + "wait_max_us", timing.m_wait.max() / 1000.0);
+}
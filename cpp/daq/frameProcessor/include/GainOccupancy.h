@@ -0,0 +1,63 @@
+#pragma once
+
+#include "FrameMem.h"
+
+#include <log4cxx/logger.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/** This counts, for each pixel, how many frames it was in each of the 4 gain modes.
+* CalibratorSample feeds it each row's gains while the row is still in cache, so it
+* needs no pass of its own over the frame.
+*
+* The counts go first into a byte per pixel per gain, which is 16 pixels per SSE add.
+* Each row adds its bytes into the uint32 counts every 255 frames of that row, before
+* they can overflow, so the full count is always the uint32 plus the byte. Each row
+* also keeps its totals per gain, for the percentages in status.
+*/
+
+class GainOccupancy
+{
+public:
+    static const int numGains = 4;
+    static const int flushFrames = 255;
+
+    GainOccupancy(int rows, int cols);
+    ~GainOccupancy();
+
+    void clear();
+    // gain is the 2-bit gain of each pixel, from CalibratorSample::gainSource(). Each
+    // row must only be added by one thread at a time, as the tbb loops do.
+    void addRow(MemBlockI16& gain, int row);
+    void addRowSIMD(MemBlockI16& gain, int row);
+    // call this once per frame, before its rows go in
+    void startFrame() { ++m_frames; }
+
+    uint32_t count(int gain, int row, int col);
+    // the percentage of all the pixels counted so far that were in this gain
+    double percent(int gain);
+    uint64_t frames() { return m_frames; }
+    // this saves g<n>_count, rows x cols uint32 for each gain, and "frames".
+    // It only reads the counts, so it can be called while frames are going in, but
+    // then a row being flushed can be out by up to 255 frames.
+    // @ret negative is failure.
+    int64_t saveToH5(std::string filename);
+
+// this are private really, but the testing needs to get hold of them!
+    void flushRow(int row);
+
+    int m_rows, m_cols;
+    std::atomic<uint64_t> m_frames;
+    MemBlockI8 m_recent[numGains];
+    MemBlockI32 m_count[numGains];
+    // frames added to each row since it was last flushed
+    std::vector<uint8_t> m_rowFrames;
+    // [row * numGains + gain]
+    std::vector<std::atomic<uint64_t>> m_rowTotals;
+
+protected:
+    log4cxx::LoggerPtr m_logger;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/** This counts latencies (or any other durations) into log-spaced buckets, so any
+* percentile can be read back afterwards without keeping the samples.
+*
+* Each power of 2 is split into 8 buckets, so a percentile comes back at most 12.5%
+* high, from 1ns up to the whole of uint64. Everything is a relaxed atomic: any number
+* of threads can add while another reads, and the add is a handful of instructions.
+*/
+
+class LatencyHistogram
+{
+public:
+    static const int subBits = 3;
+    static const int numBuckets = (64 - subBits + 1) << subBits;
+
+    LatencyHistogram();
+
+    void clear();
+    void add(uint64_t ns);
+
+    uint64_t count() const;
+    uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+    // this is the top of the bucket the p'th percent of the samples are in, or 0 if
+    // there are none yet. p is 0-100.
+    uint64_t percentile(double p) const;
+
+// this are private really, but the testing needs to get hold of them!
+    static int bucketOf(uint64_t ns);
+    static uint64_t bucketTop(int bucket);
+
+    std::atomic<uint64_t> m_buckets[numBuckets];
+    std::atomic<uint64_t> m_max;
+};
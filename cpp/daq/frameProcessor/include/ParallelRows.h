@@ -0,0 +1,109 @@
+#pragma once
+
+#include <tbb/tbb.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/** These say how the tbb loops of a calibrator split a frame's rows between threads.
+* grain is the blocked_range grain, in rows. threads is the concurrency of the task_arena
+* the loops run in; 0 runs them in tbb's default arena, which has all the hardware threads.
+*/
+struct ParallelSettings
+{
+    enum Partitioner
+    {
+        eSimple = 0,
+        eAuto,
+        eStatic,
+        ePartitionerMax,
+    };
+    // the calibrators used to start tbb with this many threads for the whole process
+    static const int defaultThreads = 6;
+
+    int grain;
+    int partitioner;
+    int threads;
+
+    static const char* partitionerName(int partitioner)
+    {
+        static const char* names[ePartitionerMax] = {"simple", "auto", "static"};
+        return (0 <= partitioner && partitioner < ePartitionerMax) ? names[partitioner] : "unknown";
+    }
+    // @ret -1 if there's no partitioner called name
+    static int partitionerFromName(const std::string& name)
+    {
+        for(int p=0;p<ePartitionerMax;++p)
+            if(name == partitionerName(p))
+                return p;
+        return -1;
+    }
+};
+
+/** This runs a loop over a frame's rows on tbb with ParallelSettings that can be changed
+* while frames go through, for the calibrators and anything else that works a frame row
+* by row, so they all split their frames the same way and can be tuned the same way.
+*/
+class ParallelRows
+{
+public:
+    // the settings for the tbb loops. These can be changed while frames are being
+    // worked on; a frame that has started keeps the old ones.
+    void setParallel(const ParallelSettings& settings)
+    {
+        std::shared_ptr<tbb::task_arena> arena;
+        if(0 < settings.threads)
+            arena = std::make_shared<tbb::task_arena>(settings.threads);
+        std::lock_guard<std::mutex> lock(m_parallelMutex);
+        m_parallel = settings;
+        m_parallel.grain = std::max(1, settings.grain);
+        m_arena = arena;
+    }
+    ParallelSettings getParallel()
+    {
+        std::lock_guard<std::mutex> lock(m_parallelMutex);
+        return m_parallel;
+    }
+
+protected:
+    // this runs fn over the row indices [0,numRows) with the current settings
+    template<typename Fn>
+    void parallelRows(int numRows, const Fn& fn)
+    {
+        ParallelSettings settings;
+        std::shared_ptr<tbb::task_arena> arena;
+        {
+            std::lock_guard<std::mutex> lock(m_parallelMutex);
+            settings = m_parallel;
+            arena = m_arena;
+        }
+        auto loop = [&]()
+        {
+            tbb::blocked_range<int> rows(0, numRows, settings.grain);
+            switch(settings.partitioner)
+            {
+            case ParallelSettings::eAuto:
+                tbb::parallel_for(rows, fn, tbb::auto_partitioner());
+                break;
+            case ParallelSettings::eStatic:
+                tbb::parallel_for(rows, fn, tbb::static_partitioner());
+                break;
+            default:
+                // simple_partitioner guarantees that ceil(grain/2) <= chunksize <= grain.
+                tbb::parallel_for(rows, fn, tbb::simple_partitioner());
+                break;
+            }
+        };
+        if(arena)
+            arena->execute(loop);
+        else
+            loop();
+    }
+
+    ParallelSettings m_parallel;
+    std::shared_ptr<tbb::task_arena> m_arena;
+    // this is also held while the settings are copied for a frame
+    std::mutex m_parallelMutex;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Calibrator.h"
+
+#include <log4cxx/logger.h>
+
+#include <functional>
+#include <vector>
+
+/** This finds the tbb settings that calibrate a frame fastest on this host. It makes a
+* calibrator with made-up constants and a made-up frame (90% gain 0, the rest spread
+* over the other gains), and times processFrameP with every grain, partitioner and
+* thread count in the lists below. The settings with the lowest median time win.
+*
+* It takes a few seconds for a full sized frame, and uses all the cores while it runs,
+* so the calib plugin only does it when it's asked to.
+*/
+
+class ParallelTuner
+{
+public:
+    struct Trial
+    {
+        ParallelSettings settings;
+        double msPerFrame;
+    };
+
+    // the lists start off as a sensible sweep for this host
+    ParallelTuner(int rows, int cols);
+
+    // these return the fastest settings; every trial is left in m_trials
+    Trial tuneSample();
+    Trial tuneReset();
+    // prepare is called before each frame, and run is the frame that is timed
+    Trial tune(Calibrator& calibrator, std::function<void()> prepare, std::function<void()> run);
+
+    std::vector<int> m_grains;
+    std::vector<int> m_partitioners;
+    std::vector<int> m_threads;
+    // frames timed for each settings, after one that isn't
+    int m_repeats;
+    std::vector<Trial> m_trials;
+
+protected:
+    int m_rows, m_cols;
+    log4cxx::LoggerPtr m_logger;
+};
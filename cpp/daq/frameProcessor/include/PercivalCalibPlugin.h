@@ -11,11 +11,22 @@ using namespace log4cxx::helpers;
 
 #include "CalibratorReset.h"
 #include "CalibratorSample.h"
+#include "DarkAccumulator.h"
+#include "RoiExtractor.h"
+#include "LatencyHistogram.h"
+#include "ParallelTuner.h"
+#include "PerfCounters.h"
+#include "FrameTiming.h"
+#include "FrameTrace.h"
 #include "FrameProcessorPlugin.h"
 #include "PercivalTransport.h"
 #include "ClassLoader.h"
 
 #include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <deque>
 
 namespace FrameProcessor
 {
@@ -39,6 +50,14 @@ namespace FrameProcessor
     void process_frame(boost::shared_ptr<Frame> frame);
     void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
     void status(OdinData::IpcMessage& reply);
+    // this sends m_events on as the "events" dataset
+    void pushEvents(const FrameMetaData& sampleMetaData);
+    // this sends the calibrator's m_frameStats on as the "stats" dataset
+    void pushStats(const FrameMetaData& sampleMetaData);
+    // this adds the time since the FR saw the frame's first packet to m_latency
+    void addLatency(FrameMetaData& sampleMetaData);
+    // this does the autotune and tbb* parts of configure()
+    void configureParallel(OdinData::IpcMessage& config);
 
     size_t concurrent_processes_;
     size_t concurrent_rank_;
@@ -52,7 +71,68 @@ namespace FrameProcessor
     bool m_loadedConstants;
 
     bool m_loadedDarkFrame;
-    MemBlockF m_darkFrame;
+    // a new darkframe is loaded into a buffer of its own, then swapped for this one
+    // once the calibrator has it, so a frame never sees a half-loaded one
+    std::unique_ptr<MemBlockF> m_darkFrame;
+
+    // one of CalibratorSample::OutputFormat
+    int m_outputFormat;
+    float m_photonEnergy;
+    float m_photonRounding;
+    int m_photonSaturation;
+
+    float m_sparseThreshold;
+    bool m_sparseCluster;
+    int m_sparseDenseEvery;
+    int m_sparseMaxEvents;
+    // the sparse frames that don't go out dense are calibrated into here
+    MemBlockF m_sparseFrame;
+    std::vector<PhotonEvent> m_events;
+    uint64_t m_sparseFrames;
+    uint64_t m_sparseLastEvents;
+    uint64_t m_sparseOverflows;
+
+    bool m_pedTrack;
+    float m_pedTrackAlpha;
+    float m_pedTrackThreshold;
+    int m_pedTrackInterval;
+
+    bool m_gainMap;
+    std::vector<Roi> m_rois;
+
+    bool m_stats;
+    float m_statsSaturation;
+    size_t m_statsWindow;
+    // the status thread reads this
+    std::deque<FrameStats> m_statsHistory;
+    std::mutex m_statsHistoryMutex;
+
+    // process_frame reads this once a frame, configure sets it
+    std::atomic<bool> m_darkAccumulating;
+    std::unique_ptr<DarkAccumulator> m_darkAccumulator;
+    // process_frame holds this while it adds a frame to the dark accumulator, so
+    // configure can't clear, save or install it under a frame
+    std::mutex m_darkMutex;
+    // the float electrons of the narrow formats, for the dark accumulator
+    MemBlockF m_floatFrame;
+
+    bool m_gainOccupancyOn;
+    std::unique_ptr<GainOccupancy> m_gainOccupancy;
+
+    // from the FR's frame_start_time to the calibrated frame going on
+    LatencyHistogram m_latency;
+    // how long process_frame takes, and how long the frames waited for it
+    FrameTiming m_timing;
+
+    // true if the calibrators' tbb settings are the ones the last autotune picked
+    bool m_autotuned;
+    double m_autotuneSampleMs;
+    double m_autotuneResetMs;
+
+    // hardware counters round each calibration, if they're on
+    PerfCounters m_perfSample;
+    PerfCounters m_perfReset;
+    double m_perfPeakGbPerS;
   };
 
   /**
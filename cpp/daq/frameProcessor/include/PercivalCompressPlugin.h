@@ -0,0 +1,66 @@
+#ifndef TOOLS_FILEWRITER_PercivalCompressPlugin_H_
+#define TOOLS_FILEWRITER_PercivalCompressPlugin_H_
+
+#include <log4cxx/logger.h>
+#include <log4cxx/basicconfigurator.h>
+#include <log4cxx/propertyconfigurator.h>
+#include <log4cxx/helpers/exception.h>
+using namespace log4cxx;
+using namespace log4cxx::helpers;
+
+#include "FrameCompressor.h"
+#include "FrameProcessorPlugin.h"
+#include "PercivalTransport.h"
+#include "ClassLoader.h"
+
+#include <set>
+#include <mutex>
+
+namespace FrameProcessor
+{
+
+  /** Compression of Percival frames before they reach the file writer.
+   *
+   * The PercivalCompressPlugin bitshuffle+LZ4 compresses the datasets it is configured
+   * for, using all the tbb threads, and marks them bslz4 so the FileWriterPlugin
+   * does a direct chunk write instead of compressing in its own thread. The writer
+   * dataset must be configured with "compression": "bslz4" and one frame per chunk.
+   * Other datasets pass through untouched.
+   */
+  class PercivalCompressPlugin : public FrameProcessorPlugin
+  {
+  public:
+    PercivalCompressPlugin();
+    virtual ~PercivalCompressPlugin();
+    bool reset_statistics();
+    int get_version_major();
+    int get_version_minor();
+    int get_version_patch();
+    std::string get_version_short();
+    std::string get_version_long();
+
+  private:
+    void process_frame(boost::shared_ptr<Frame> frame);
+    void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
+    void status(OdinData::IpcMessage& reply);
+    // configure can change the datasets while frames are being compressed
+    bool isCompressedDataset(const std::string& name);
+
+    FrameCompressor m_compressor;
+    std::set<std::string> m_datasets;
+    std::mutex m_datasetsMutex;
+
+    uint64_t m_framesCompressed;
+    uint64_t m_bytesIn;
+    uint64_t m_bytesOut;
+  };
+
+  /**
+   * Registration of this plugin through the ClassLoader.  This macro
+   * registers the class without needing to worry about name mangling
+   */
+  REGISTER(FrameProcessorPlugin, PercivalCompressPlugin, "PercivalCompressPlugin");
+
+} /* namespace FrameProcessor */
+
+#endif /* TOOLS_FILEWRITER_PercivalCompressPlugin_H_ */
@@ -0,0 +1,67 @@
+#ifndef TOOLS_FILEWRITER_PercivalDescramblePlugin_H_
+#define TOOLS_FILEWRITER_PercivalDescramblePlugin_H_
+
+#include <log4cxx/logger.h>
+#include <log4cxx/basicconfigurator.h>
+#include <log4cxx/propertyconfigurator.h>
+#include <log4cxx/helpers/exception.h>
+using namespace log4cxx;
+using namespace log4cxx::helpers;
+
+#include "Descrambler.h"
+#include "FrameProcessorPlugin.h"
+#include "PercivalTransport.h"
+#include "ClassLoader.h"
+
+#include <set>
+#include <mutex>
+
+namespace FrameProcessor
+{
+
+  /** Descrambling of Percival frames that are still in detector order.
+   *
+   * Until the descrambler board does it, the frames odin receives have the pixels in
+   * the order the ADCs send them. When it is enabled, the PercivalDescramblePlugin
+   * replaces each configured dataset with the image-order frame, in the bit layout
+   * the calibration wants, so it goes in front of PercivalCalibPlugin. See Descrambler.
+   */
+  class PercivalDescramblePlugin : public FrameProcessorPlugin
+  {
+  public:
+    PercivalDescramblePlugin();
+    virtual ~PercivalDescramblePlugin();
+    bool reset_statistics();
+    int get_version_major();
+    int get_version_minor();
+    int get_version_patch();
+    std::string get_version_short();
+    std::string get_version_long();
+
+  private:
+    void process_frame(boost::shared_ptr<Frame> frame);
+    void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
+    void status(OdinData::IpcMessage& reply);
+    // configure can change the datasets while frames are being descrambled
+    bool isDescrambledDataset(const std::string& name);
+
+    Descrambler m_descrambler;
+    std::set<std::string> m_datasets;
+    std::mutex m_datasetsMutex;
+    bool m_enable;
+
+    uint64_t m_framesDescrambled;
+    // frames with at least one row group missing, and how many groups were missing
+    uint64_t m_framesIncomplete;
+    uint64_t m_groupsMissing;
+  };
+
+  /**
+   * Registration of this plugin through the ClassLoader.  This macro
+   * registers the class without needing to worry about name mangling
+   */
+  REGISTER(FrameProcessorPlugin, PercivalDescramblePlugin, "PercivalDescramblePlugin");
+
+} /* namespace FrameProcessor */
+
+#endif /* TOOLS_FILEWRITER_PercivalDescramblePlugin_H_ */
@@ -0,0 +1,79 @@
+#ifndef TOOLS_FILEWRITER_PercivalHistogramPlugin_H_
+#define TOOLS_FILEWRITER_PercivalHistogramPlugin_H_
+
+#include <log4cxx/logger.h>
+#include <log4cxx/basicconfigurator.h>
+#include <log4cxx/propertyconfigurator.h>
+#include <log4cxx/helpers/exception.h>
+using namespace log4cxx;
+using namespace log4cxx::helpers;
+
+#include "PixelHistogram.h"
+#include "FrameProcessorPlugin.h"
+#include "PercivalTransport.h"
+#include "ClassLoader.h"
+
+#include <boost/shared_ptr.hpp>
+#include <mutex>
+
+namespace FrameProcessor
+{
+
+  /** Per-pixel histograms over an acquisition.
+   *
+   * The PercivalHistogramPlugin adds each frame of the configured dataset, float
+   * electrons or uint16 ADC values, to a histogram per pixel, and passes the frame on.
+   * The histograms go to "file" every "checkpoint" frames, and when "save" is sent;
+   * "clear" starts them again. The file is the one PixelHistogram::saveToH5 writes,
+   * the same as the pixel-hist tool makes offline.
+   */
+  class PercivalHistogramPlugin : public FrameProcessorPlugin
+  {
+  public:
+    PercivalHistogramPlugin();
+    virtual ~PercivalHistogramPlugin();
+    bool reset_statistics();
+    int get_version_major();
+    int get_version_minor();
+    int get_version_patch();
+    std::string get_version_short();
+    std::string get_version_long();
+
+// this are private really, but the testing needs to get hold of them!
+    // this adds the image to the histograms if md says it's a frame to histogram. It
+    // takes m_mutex, so configure can't clear or restart them under it.
+    // @ret negative if it wasn't added.
+    int64_t add(const FrameMetaData& md, void* image);
+    boost::shared_ptr<PixelHistogram> histogram();
+
+  private:
+    void process_frame(boost::shared_ptr<Frame> frame);
+    void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
+    void status(OdinData::IpcMessage& reply);
+    // call it with m_mutex held
+    void save();
+
+    std::string m_edgesText;
+    std::vector<float> m_edges;
+    int m_counterBits;
+    std::string m_dataset;
+    std::string m_file;
+    int m_checkpointEvery;
+    // this is made on the first frame, when we know its size
+    boost::shared_ptr<PixelHistogram> m_histogram;
+
+    uint64_t m_framesAdded;
+    uint64_t m_checkpoints;
+    // configure can clear, restart or save the histograms while a frame is being added
+    std::mutex m_mutex;
+  };
+
+  /**
+   * Registration of this plugin through the ClassLoader.  This macro
+   * registers the class without needing to worry about name mangling
+   */
+  REGISTER(FrameProcessorPlugin, PercivalHistogramPlugin, "PercivalHistogramPlugin");
+
+} /* namespace FrameProcessor */
+
+#endif /* TOOLS_FILEWRITER_PercivalHistogramPlugin_H_ */
@@ -0,0 +1,76 @@
+#ifndef TOOLS_FILEWRITER_PercivalLiveViewPlugin_H_
+#define TOOLS_FILEWRITER_PercivalLiveViewPlugin_H_
+
+#include <log4cxx/logger.h>
+#include <log4cxx/basicconfigurator.h>
+#include <log4cxx/propertyconfigurator.h>
+#include <log4cxx/helpers/exception.h>
+using namespace log4cxx;
+using namespace log4cxx::helpers;
+
+#include "FrameBinner.h"
+#include "FrameProcessorPlugin.h"
+#include "PercivalTransport.h"
+#include "ClassLoader.h"
+#include "IpcChannel.h"
+
+#include <set>
+#include <chrono>
+#include <mutex>
+
+namespace FrameProcessor
+{
+
+  /** Decimated live view of the calibrated frames.
+   *
+   * The PercivalLiveViewPlugin publishes a binned preview of the configured float
+   * datasets on a ZMQ PUB socket, at most "persecond" times a second, with the same
+   * multipart JSON header as odin's live view, so python/live_viewer can show it.
+   * The preview is binned straight from the frame; frames which aren't published
+   * cost nothing but a clock read. All frames are passed on.
+   */
+  class PercivalLiveViewPlugin : public FrameProcessorPlugin
+  {
+  public:
+    PercivalLiveViewPlugin();
+    virtual ~PercivalLiveViewPlugin();
+    bool reset_statistics();
+    int get_version_major();
+    int get_version_minor();
+    int get_version_patch();
+    std::string get_version_short();
+    std::string get_version_long();
+
+  private:
+    void process_frame(boost::shared_ptr<Frame> frame);
+    void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
+    void status(OdinData::IpcMessage& reply);
+    // this publishes the frame if it's one to preview; call it with m_mutex held
+    void preview(boost::shared_ptr<Frame> frame);
+    void publish(const FrameMetaData& md, MemBlockF& image);
+
+    OdinData::IpcChannel m_publishSocket;
+    std::string m_endpoint;
+    FrameBinner m_binner;
+    MemBlockF m_preview;
+    std::set<std::string> m_datasets;
+    int m_binning;
+    bool m_mean;
+    double m_perSecond;
+    std::chrono::steady_clock::time_point m_lastPublished;
+
+    uint64_t m_framesPublished;
+    uint64_t m_framesSkipped;
+    // configure can change everything above, and bind the socket, while frames are previewed
+    std::mutex m_mutex;
+  };
+
+  /**
+   * Registration of this plugin through the ClassLoader.  This macro
+   * registers the class without needing to worry about name mangling
+   */
+  REGISTER(FrameProcessorPlugin, PercivalLiveViewPlugin, "PercivalLiveViewPlugin");
+
+} /* namespace FrameProcessor */
+
+#endif /* TOOLS_FILEWRITER_PercivalLiveViewPlugin_H_ */
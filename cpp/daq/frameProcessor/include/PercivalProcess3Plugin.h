@@ -11,6 +11,9 @@ using namespace log4cxx::helpers;
 
 #include "FrameProcessorPlugin.h"
 #include "PercivalTransport.h"
+#include "PerfCounters.h"
+#include "FrameTiming.h"
+#include "FrameTrace.h"
 #include "ClassLoader.h"
 
 namespace FrameProcessor
@@ -32,6 +35,7 @@ namespace FrameProcessor
     virtual ~PercivalProcess3Plugin();
     void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
     void configureProcess(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
+    void status(OdinData::IpcMessage& reply);
     bool reset_statistics();
     int get_version_major();
     int get_version_minor();
@@ -46,6 +50,14 @@ namespace FrameProcessor
     static const std::string CONFIG_PROCESS_NUMBER;
     /** Configuration constant for this process rank */
     static const std::string CONFIG_PROCESS_RANK;
+    /** Configuration constant for counting the copies with perf_event_open */
+    static const std::string CONFIG_PERF;
+    /** Configuration constant for the frames each perf window covers */
+    static const std::string CONFIG_PERFWINDOW;
+    /** Configuration constant for the host's memory bandwidth, for the roofline */
+    static const std::string CONFIG_PERFPEAKGBS;
+    /** Configuration constant for saving the FP's frame trace as Chrome trace JSON */
+    static const std::string CONFIG_TRACESAVE;
 
     void process_frame(boost::shared_ptr<Frame> frame);
 
@@ -55,6 +67,13 @@ namespace FrameProcessor
     size_t concurrent_processes_;
     size_t concurrent_rank_;
 
+    // hardware counters round the copies into the data and reset frames
+    PerfCounters perf_;
+    double perf_peak_gbs_;
+
+    // how long process_frame takes, and how long the frames waited for it
+    FrameTiming timing_;
+
     /* Frame counter */
     uint32_t frame_counter_;
   };
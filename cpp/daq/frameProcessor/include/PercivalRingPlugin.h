@@ -0,0 +1,66 @@
+#ifndef TOOLS_FILEWRITER_PercivalRingPlugin_H_
+#define TOOLS_FILEWRITER_PercivalRingPlugin_H_
+
+#include <log4cxx/logger.h>
+#include <log4cxx/basicconfigurator.h>
+#include <log4cxx/propertyconfigurator.h>
+#include <log4cxx/helpers/exception.h>
+using namespace log4cxx;
+using namespace log4cxx::helpers;
+
+#include "FrameRing.h"
+#include "FrameProcessorPlugin.h"
+#include "PercivalTransport.h"
+#include "ClassLoader.h"
+
+#include <set>
+#include <mutex>
+
+namespace FrameProcessor
+{
+
+  /** Shared-memory ring of calibrated frames for local consumers.
+   *
+   * The PercivalRingPlugin writes every "everyn"th frame of the configured datasets
+   * into a FrameRing, so analysis processes on the same node can read them in place
+   * with a FrameRingReader. The writer never waits for readers; the slow ones skip
+   * frames, and are counted in the status. All frames are passed on.
+   */
+  class PercivalRingPlugin : public FrameProcessorPlugin
+  {
+  public:
+    PercivalRingPlugin();
+    virtual ~PercivalRingPlugin();
+    bool reset_statistics();
+    int get_version_major();
+    int get_version_minor();
+    int get_version_patch();
+    std::string get_version_short();
+    std::string get_version_long();
+
+  private:
+    void process_frame(boost::shared_ptr<Frame> frame);
+    void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
+    void status(OdinData::IpcMessage& reply);
+
+    FrameRing m_ring;
+    std::string m_name;
+    int m_slots;
+    int m_everyN;
+    std::set<std::string> m_datasets;
+
+    uint64_t m_framesSeen;
+    uint64_t m_framesWritten;
+    // configure can remake the ring, or change the datasets, while a frame is written
+    std::mutex m_mutex;
+  };
+
+  /**
+   * Registration of this plugin through the ClassLoader.  This macro
+   * registers the class without needing to worry about name mangling
+   */
+  REGISTER(FrameProcessorPlugin, PercivalRingPlugin, "PercivalRingPlugin");
+
+} /* namespace FrameProcessor */
+
+#endif /* TOOLS_FILEWRITER_PercivalRingPlugin_H_ */
@@ -0,0 +1,67 @@
+#ifndef TOOLS_FILEWRITER_PercivalRoiPlugin_H_
+#define TOOLS_FILEWRITER_PercivalRoiPlugin_H_
+
+#include <log4cxx/logger.h>
+#include <log4cxx/basicconfigurator.h>
+#include <log4cxx/propertyconfigurator.h>
+#include <log4cxx/helpers/exception.h>
+using namespace log4cxx;
+using namespace log4cxx::helpers;
+
+#include "RoiExtractor.h"
+#include "FrameProcessorPlugin.h"
+#include "PercivalTransport.h"
+#include "ClassLoader.h"
+
+#include <set>
+#include <mutex>
+
+namespace FrameProcessor
+{
+
+  /** Region of interest extraction.
+   *
+   * The PercivalRoiPlugin cuts the configured rectangles out of each frame of the
+   * configured datasets and pushes each as its own dataset, <name>_roi0, <name>_roi1
+   * and so on, in the order the ROIs were given. With "passfull" false the full frame
+   * is dropped, so only the ROIs are written. Give PercivalCalibPlugin the same "rois"
+   * and it only calibrates the rows they cover.
+   */
+  class PercivalRoiPlugin : public FrameProcessorPlugin
+  {
+  public:
+    PercivalRoiPlugin();
+    virtual ~PercivalRoiPlugin();
+    bool reset_statistics();
+    int get_version_major();
+    int get_version_minor();
+    int get_version_patch();
+    std::string get_version_short();
+    std::string get_version_long();
+
+  private:
+    void process_frame(boost::shared_ptr<Frame> frame);
+    void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
+    void status(OdinData::IpcMessage& reply);
+    // this cuts the ROIs out of the frame if it's one to cut, and adds the frames to
+    // push on to out; call it with m_mutex held
+    void extract(boost::shared_ptr<Frame> frame, std::vector<boost::shared_ptr<Frame> >& out);
+
+    std::vector<Roi> m_rois;
+    std::set<std::string> m_datasets;
+    bool m_passFull;
+
+    uint64_t m_framesExtracted;
+    // configure can change the ROIs or the datasets while a frame is being cut up
+    std::mutex m_mutex;
+  };
+
+  /**
+   * Registration of this plugin through the ClassLoader.  This macro
+   * registers the class without needing to worry about name mangling
+   */
+  REGISTER(FrameProcessorPlugin, PercivalRoiPlugin, "PercivalRoiPlugin");
+
+} /* namespace FrameProcessor */
+
+#endif /* TOOLS_FILEWRITER_PercivalRoiPlugin_H_ */
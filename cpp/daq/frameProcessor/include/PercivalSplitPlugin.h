@@ -0,0 +1,68 @@
+#ifndef TOOLS_FILEWRITER_PercivalSplitPlugin_H_
+#define TOOLS_FILEWRITER_PercivalSplitPlugin_H_
+
+#include <log4cxx/logger.h>
+#include <log4cxx/basicconfigurator.h>
+#include <log4cxx/propertyconfigurator.h>
+#include <log4cxx/helpers/exception.h>
+using namespace log4cxx;
+using namespace log4cxx::helpers;
+
+#include "PlaneSplitter.h"
+#include "FrameProcessorPlugin.h"
+#include "PercivalTransport.h"
+#include "ClassLoader.h"
+
+#include <set>
+#include <mutex>
+
+namespace FrameProcessor
+{
+
+  /** Splitting of raw Percival frames into gain, coarse and fine planes.
+   *
+   * When it is enabled, the PercivalSplitPlugin pushes three uint8 frames for each
+   * configured dataset, named like decode_raw_frames_hdf5.py does: gain_<name>,
+   * coarse_adc_<name> and fine_adc_<name>. The raw frame is passed on as well, so
+   * this can go in front of PercivalCalibPlugin. Turn it on and off per acquisition
+   * with the "enable" config.
+   */
+  class PercivalSplitPlugin : public FrameProcessorPlugin
+  {
+  public:
+    PercivalSplitPlugin();
+    virtual ~PercivalSplitPlugin();
+    bool reset_statistics();
+    int get_version_major();
+    int get_version_minor();
+    int get_version_patch();
+    std::string get_version_short();
+    std::string get_version_long();
+
+  private:
+    void process_frame(boost::shared_ptr<Frame> frame);
+    void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
+    void status(OdinData::IpcMessage& reply);
+    // this makes a uint8 frame the same shape as the raw one
+    boost::shared_ptr<Frame> makePlane(const FrameMetaData& rawMetaData, const std::string& name);
+    // configure can change the datasets while frames are being split
+    bool isSplitDataset(const std::string& name);
+
+    PlaneSplitter m_splitter;
+    std::set<std::string> m_datasets;
+    std::mutex m_datasetsMutex;
+    bool m_enable;
+    bool m_passRaw;
+
+    uint64_t m_framesSplit;
+  };
+
+  /**
+   * Registration of this plugin through the ClassLoader.  This macro
+   * registers the class without needing to worry about name mangling
+   */
+  REGISTER(FrameProcessorPlugin, PercivalSplitPlugin, "PercivalSplitPlugin");
+
+} /* namespace FrameProcessor */
+
+#endif /* TOOLS_FILEWRITER_PercivalSplitPlugin_H_ */
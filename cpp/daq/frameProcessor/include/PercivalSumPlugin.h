@@ -0,0 +1,82 @@
+#ifndef TOOLS_FILEWRITER_PercivalSumPlugin_H_
+#define TOOLS_FILEWRITER_PercivalSumPlugin_H_
+
+#include <log4cxx/logger.h>
+#include <log4cxx/basicconfigurator.h>
+#include <log4cxx/propertyconfigurator.h>
+#include <log4cxx/helpers/exception.h>
+using namespace log4cxx;
+using namespace log4cxx::helpers;
+
+#include "FrameAccumulator.h"
+#include "FrameProcessorPlugin.h"
+#include "PercivalTransport.h"
+#include "ClassLoader.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace FrameProcessor
+{
+
+  /** N-frame integration.
+   *
+   * The PercivalSumPlugin adds up each "frames" float frames of the configured datasets
+   * and pushes the sum as <name>_sum, numbered from 0. With "validcounts" on, NaN pixels
+   * are left out and <name>_count (uint32) says how many frames went into each pixel.
+   * The sums are float, or double with "precision" "double"; odin-data has no double
+   * type, so those go out as raw_64bit and readers must reinterpret the bits. With
+   * "passframes" false only the sums are pushed on. Changing any of these starts the
+   * sums again; changing the tbb settings, as for PercivalCalibPlugin, doesn't.
+   */
+  class PercivalSumPlugin : public FrameProcessorPlugin
+  {
+  public:
+    PercivalSumPlugin();
+    virtual ~PercivalSumPlugin();
+    bool reset_statistics();
+    int get_version_major();
+    int get_version_minor();
+    int get_version_patch();
+    std::string get_version_short();
+    std::string get_version_long();
+
+  private:
+    void process_frame(boost::shared_ptr<Frame> frame);
+    void configure(OdinData::IpcMessage &config, OdinData::IpcMessage &reply);
+    void status(OdinData::IpcMessage& reply);
+    // this sums the frame if it's one to sum, and adds the frames to push on to out;
+    // call it with m_mutex held
+    void sum(boost::shared_ptr<Frame> frame, std::vector<boost::shared_ptr<Frame> >& out);
+    void makeSums(const FrameMetaData& md, FrameAccumulator& accumulator, std::vector<boost::shared_ptr<Frame> >& out);
+
+    int m_frames;
+    bool m_doublePrecision;
+    bool m_countValid;
+    bool m_passFrames;
+    // each accumulator gets these
+    ParallelSettings m_parallel;
+    std::set<std::string> m_datasets;
+    // one per dataset, made on its first frame
+    std::map<std::string, boost::shared_ptr<FrameAccumulator> > m_accumulators;
+    std::map<std::string, uint64_t> m_sumsPushed;
+
+    uint64_t m_framesSummed;
+    uint64_t m_sumsEmitted;
+    // configure can throw the accumulators away, or change the datasets, while a frame is summed
+    std::mutex m_mutex;
+  };
+
+  /**
+   * Registration of this plugin through the ClassLoader.  This macro
+   * registers the class without needing to worry about name mangling
+   */
+  REGISTER(FrameProcessorPlugin, PercivalSumPlugin, "PercivalSumPlugin");
+
+} /* namespace FrameProcessor */
+
+#endif /* TOOLS_FILEWRITER_PercivalSumPlugin_H_ */
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/** This counts cycles, instructions and last level cache misses with perf_event_open,
+* for work that may be spread over several threads, eg a calibration's tbb chunks.
+*
+* Each thread opens its own group of counters the first time it needs them, and reads
+* them at the start and end of each Scope it runs, so only the work itself is counted.
+* A Frame is a Scope that also times the frame on the wall clock, and ends the frame when
+* it goes; every framesPerWindow frames the counts so far become the window that
+* lastWindow() returns. Scopes and Frames inside another on the same thread do nothing,
+* so a caller can count a whole frame around a function that counts its own.
+*
+* The cache misses (PERF_COUNT_HW_CACHE_MISSES, which is the last level on most cpus)
+* times the line size are an estimate of the bytes that came from memory. If this host
+* doesn't allow the counters (see /proc/sys/kernel/perf_event_paranoid, or a VM without
+* a PMU) the counts stay at 0 and available() is false.
+*/
+
+class PerfCounters
+{
+public:
+    enum Counter
+    {
+        eCycles = 0,
+        eInstructions,
+        eCacheMisses,
+        eNumCounters,
+    };
+    static const int cacheLineBytes = 64;
+
+    struct Window
+    {
+        uint64_t frames;
+        uint64_t ns;
+        uint64_t pixels;
+        uint64_t counts[eNumCounters];
+
+        double perPixel(int counter) const { return pixels ? (double)counts[counter] / pixels : 0.0; }
+        double ipc() const { return counts[eCycles] ? (double)counts[eInstructions] / counts[eCycles] : 0.0; }
+        double msPerFrame() const { return frames ? ns / 1.0e6 / frames : 0.0; }
+        // from the cache misses, so the bytes that really came from memory
+        double memoryBytesPerPixel() const { return perPixel(eCacheMisses) * cacheLineBytes; }
+        double memoryGbPerS() const { return ns ? (double)counts[eCacheMisses] * cacheLineBytes / ns : 0.0; }
+        // if each pixel moves bytesPerPixel, as the code is written
+        double modelGbPerS(double bytesPerPixel) const { return ns ? bytesPerPixel * pixels / ns : 0.0; }
+        // the fastest a frame could go if it only had to move bytesPerPixel at peakGbPerS
+        double rooflineFramesPerS(double bytesPerPixel, double peakGbPerS) const;
+    };
+
+    class Scope
+    {
+    public:
+        // counters can be nullptr, for nothing
+        Scope(PerfCounters* counters);
+        ~Scope();
+        // this adds the counts so far, and stops counting before the scope goes
+        void end();
+    protected:
+        // true while this is open on the thread, even if it's not the outermost
+        bool m_entered;
+        // only set if this is the outermost, and the thread has counters
+        PerfCounters* m_counters;
+        uint64_t m_start[eNumCounters];
+    };
+
+    class Frame : public Scope
+    {
+    public:
+        Frame(PerfCounters* counters, uint64_t pixels);
+        ~Frame();
+        // this ends the frame before the Frame goes, eg before the frame is pushed on
+        void end();
+    protected:
+        PerfCounters* m_frameCounters;
+        uint64_t m_pixels;
+        uint64_t m_startNs;
+    };
+
+    PerfCounters(int framesPerWindow = 100);
+
+    // they're off until this turns them on
+    void setEnabled(bool on);
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    void setFramesPerWindow(int frames);
+    int framesPerWindow();
+    // true once a thread has opened its counters
+    bool available() const { return m_available.load(std::memory_order_relaxed); }
+    // this starts a new window, and forgets the last one
+    void clear();
+    Window lastWindow();
+
+    // this thread's counts since it opened them; false if it can't have any
+    static bool readThread(uint64_t counts[eNumCounters]);
+
+// this are private really, but the testing needs to get hold of them!
+    void add(const uint64_t counts[eNumCounters]);
+    void endFrame(uint64_t ns, uint64_t pixels);
+
+    std::atomic<bool> m_enabled;
+    std::atomic<bool> m_available;
+    // the frames that haven't ended yet
+    std::atomic<uint64_t> m_counts[eNumCounters];
+
+    std::mutex m_mutex;
+    int m_framesPerWindow;
+    Window m_window;
+    Window m_last;
+};
+
+// this puts a window into a status message under prefix, eg "calib/perf/sample/".
+// Message is an OdinData::IpcMessage, which this library doesn't otherwise need.
+// bytesPerPixel is what the code should move for each pixel, and peakGbPerS what the
+// host can do; 0 leaves the roofline out.
+template<typename Message>
+void perfStatus(Message& status, const std::string& prefix, const PerfCounters::Window& window,
+                double bytesPerPixel, double peakGbPerS)
+{
+    status.set_param(prefix + "frames", window.frames);
+    status.set_param(prefix + "ms_per_frame", window.msPerFrame());
+    status.set_param(prefix + "cycles_per_pixel", window.perPixel(PerfCounters::eCycles));
+    status.set_param(prefix + "instructions_per_pixel", window.perPixel(PerfCounters::eInstructions));
+    status.set_param(prefix + "ipc", window.ipc());
+    status.set_param(prefix + "cache_misses_per_pixel", window.perPixel(PerfCounters::eCacheMisses));
+    status.set_param(prefix + "memory_bytes_per_pixel", window.memoryBytesPerPixel());
+    status.set_param(prefix + "memory_gb_per_s", window.memoryGbPerS());
+    status.set_param(prefix + "model_bytes_per_pixel", bytesPerPixel);
+    status.set_param(prefix + "model_gb_per_s", window.modelGbPerS(bytesPerPixel));
+    double roofline = window.rooflineFramesPerS(bytesPerPixel, peakGbPerS);
+    if(0 < roofline)
+    {
+        status.set_param(prefix + "roofline_frames_per_s", roofline);
+        status.set_param(prefix + "roofline_percent", 100.0 * 1000.0 / window.msPerFrame() / roofline);
+    }
+}
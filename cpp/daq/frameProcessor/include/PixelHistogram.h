@@ -0,0 +1,84 @@
+#pragma once
+
+#include "FrameMem.h"
+
+#include <log4cxx/logger.h>
+
+#include <tbb/tbb.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/** This keeps a histogram for each pixel over many frames, eg of electrons for photon
+* spectra, or of ADC values for gain calibration.
+*
+* The bins are [edges[i], edges[i+1]), so n+1 edges make n bins. Values outside the edges,
+* and NaNs, go in no bin but are counted. The counters are 16 or 32 bit; the 16 bit ones
+* stop at 65535 rather than wrap. They are held pixel by pixel, rows x (cols * bins), so
+* a pixel's histogram is contiguous and saves as a rows x cols x bins dataset.
+*
+* Evenly spaced edges (eg from "0:1000:100") find the bin with one multiply; otherwise the
+* bin is the number of edges at or below the value, which is done 8 pixels at a time, so
+* keep the number of uneven edges modest.
+*/
+
+class PixelHistogram
+{
+public:
+    PixelHistogram();
+    ~PixelHistogram();
+
+    // this allocates the counters and clears them. counterBits is 16 or 32; the edges must
+    // go up and there must be at least 2.
+    // @ret negative is failure.
+    int64_t init(int rows, int cols, const std::vector<float>& edges, int counterBits);
+    void clear();
+
+    // input must be the size given to init().
+    // @ret negative is failure.
+    int64_t add(MemBlockF& input);
+    int64_t addP(MemBlockF& input);
+    // for raw ADC values
+    int64_t addP(MemBlockI16& input);
+
+    // this writes "counts" (rows x cols x bins), "edges" and "frames" to a new file, via a
+    // temporary file, so a reader never sees half a checkpoint.
+    // @ret negative is failure.
+    int64_t saveToH5(std::string filename);
+
+    // edges are a comma-separated list "0,5,10,50", or "first:last:bins" for even ones.
+    // @ret negative is failure, and edges is left alone.
+    static int64_t parseEdges(const std::string& text, std::vector<float>& edges);
+
+    int bins() { return m_bins; }
+    int counterBits() { return m_counterBits; }
+    uint64_t frames() { return m_frames; }
+    uint64_t outOfRange() { return m_outOfRange; }
+    const std::vector<float>& edges() { return m_edges; }
+    uint32_t count(int row, int col, int bin);
+
+// this are private really, but the testing needs to get hold of them!
+    // bin is -1 for values out of range or NaN
+    int binOf(float value);
+    void addRow(const float* values, int row);
+    void addRowSIMD(const float* values, int row);
+    void increment(size_t pixel, int bin);
+    // had to use MemBlock* here because boost:bind didn't like references
+    void addRowsTBB(MemBlockF* input, tbb::blocked_range<int> rows);
+    void addRowsI16TBB(MemBlockI16* input, tbb::blocked_range<int> rows);
+    int64_t checkShape(int rows, int cols);
+
+    int m_rows, m_cols, m_bins;
+    int m_counterBits;
+    std::vector<float> m_edges;
+    bool m_uniform;
+    float m_scale;
+    uint64_t m_frames;
+    std::atomic<uint64_t> m_outOfRange;
+    MemBlockI16 m_counts16;
+    MemBlockI32 m_counts32;
+
+protected:
+    log4cxx::LoggerPtr m_logger;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "FrameMem.h"
+
+#include <log4cxx/logger.h>
+
+#include <tbb/tbb.h>
+
+/** This splits raw Percival pixels into separate gain, coarse and fine planes of
+* uint8, using the same bits as CalibratorSample: gain (0x6000)>>13, fine (0x1fe0)>>5
+* and coarse 0x1f. The input is only read. Rows are split in parallel with tbb.
+*/
+
+class PlaneSplitter
+{
+public:
+    PlaneSplitter();
+    ~PlaneSplitter();
+
+    void split(MemBlockI16& input, MemBlockI8& gain, MemBlockI8& coarse, MemBlockI8& fine);
+    void splitP(MemBlockI16& input, MemBlockI8& gain, MemBlockI8& coarse, MemBlockI8& fine);
+
+// this are private really, but the testing needs to get hold of them!
+    void splitRow(MemBlockI16& input, MemBlockI8& gain, MemBlockI8& coarse, MemBlockI8& fine, int row);
+    void splitRowSIMD(MemBlockI16& input, MemBlockI8& gain, MemBlockI8& coarse, MemBlockI8& fine, int row);
+    // had to use MemBlock* here because boost:bind didn't like references
+    void splitRowsTBB(MemBlockI16* input, MemBlockI8* gain, MemBlockI8* coarse, MemBlockI8* fine, tbb::blocked_range<int> rows);
+
+protected:
+    log4cxx::LoggerPtr m_logger;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// a rectangle of a frame: the top left pixel, then its size
+struct Roi
+{
+    int row;
+    int col;
+    int rows;
+    int cols;
+};
+
+/** This cuts rectangular regions of interest out of a frame, a row at a time.
+* ROIs are written as "row,col,rows,cols" and a list of them is separated by ';',
+* eg "0,0,100,200;700,300,64,64".
+*/
+
+class RoiExtractor
+{
+public:
+    // this checks each ROI fits in a frameRows x frameCols frame.
+    // @ret negative is failure, and rois is left as it was.
+    static int parse(const std::string& text, int frameRows, int frameCols, std::vector<Roi>& rois);
+    static std::string toString(const std::vector<Roi>& rois);
+    // the rows any of the ROIs cover, in order and only once each
+    static std::vector<int> rowsCovered(const std::vector<Roi>& rois, int frameRows);
+    // output is roi.rows x roi.cols elements of elemSize bytes
+    static void extract(const void* input, int inputCols, int elemSize, const Roi& roi, void* output);
+};
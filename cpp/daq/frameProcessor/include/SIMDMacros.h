@@ -23,9 +23,11 @@
 // avx is missing integer operations on 8i, so we may need 4i registers from SSE.
 
 typedef __m256 SIMD8f;  // 8 floats
+typedef __m128 SIMD4f;  // 4 floats
 typedef __m128i SIMD4i; // 4 integers
 typedef __m128i SIMD8i16; // 8x 16 bit integers
 typedef __m256i SIMD8i;
+typedef __m256d SIMD4d; // 4 doubles
 
 
 #define SIMD_MEM_ALIGN 32
@@ -36,6 +38,7 @@ typedef __m256i SIMD8i;
 // warning! be careful to put brackets around pointers, as (SIMD8f*)p+8 is different from (p+8).
 #define Store8f(p,x) _mm256_store_ps(p,x)
 #define Store4f(p,x) _mm_store_ps(p,x)
+#define Store4fu(p,x) _mm_storeu_ps(p,x)
 #define Store4i(p,x) _mm_store_si128((SIMD4i*)(p),x)
 #define Store8i(p,x) _mm256_store_si256((SIMD8i*)(p),x)
 // must have 16-byte alignment
@@ -43,6 +46,12 @@ typedef __m256i SIMD8i;
 // must have 32-byte alignment
 #define Load8i(p) _mm256_load_si256((SIMD8i*)(p))
 #define Load8f(p) _mm256_load_ps(p)
+#define Load8fu(p) _mm256_loadu_ps(p)
+#define Store8fu(p,x) _mm256_storeu_ps(p,x)
+#define Load4iu(p) _mm_loadu_si128((SIMD4i*)(p))
+#define Store4iu(p,x) _mm_storeu_si128((SIMD4i*)(p),x)
+#define Load4du(p) _mm256_loadu_pd(p)
+#define Store4du(p,x) _mm256_storeu_pd(p,x)
 // #define Set8f(x,y,z,w,a,b,c,d) _mm256_set_ps(x,y,z,w,a,b,c,d)
 #define Set4f(a,b,c,d) _mm_set_ps(d,c,b,a)
 #define Set4i(a,b,c,d) _mm_set_epi32(d,c,b,a)
@@ -54,6 +63,7 @@ typedef __m256i SIMD8i;
 // I have checked this shifts in zeros
 #define ShiftRight4i(x,bits) _mm_srli_epi32(x, bits)
 #define ShiftRight8i16(x,bits) _mm_srli_epi16(x, bits)
+#define ShiftLeft8i16(x,bits) _mm_slli_epi16(x, bits)
 #define Convert4ito4f(x) _mm_cvtepi32_ps(x)
 #define Convert8ito8f(x) _mm256_cvtepi32_ps(x)
 #define Cast4ito4f(x) _mm_castsi128_ps(x)
@@ -69,10 +79,50 @@ typedef __m256i SIMD8i;
 #define Extend8i16to8i(x) Set8i(ExtendLoto4i(x), ExtendHito4i(x))
 #define And8i(x,y) Cast8fto8i(_mm256_and_ps(Cast8ito8f(x), Cast8ito8f(y)))
 #define And4i(x,y) _mm_and_si128(x,y)
+#define Or4i(x,y) _mm_or_si128(x,y)
+#define Xor4i(x,y) _mm_xor_si128(x,y)
 #define Multiply8f(x,y) _mm256_mul_ps(x,y)
 #define Add8f(x,y) _mm256_add_ps(x,y)
 #define Add8i16(x,y) _mm_add_epi16(x,y)
 #define Sub8f(x,y) _mm256_sub_ps(x,y)
+#define Divide8f(x,y) _mm256_div_ps(x,y)
+#define Min8f(x,y) _mm256_min_ps(x,y)
+#define Max8f(x,y) _mm256_max_ps(x,y)
+#define Lo4fOf8f(x) _mm256_castps256_ps128(x)
+#define Hi4fOf8f(x) _mm256_extractf128_ps(x,1)
+// x0 x2 y0 y2 and x1 x3 y1 y3, ie the even and odd elements of each
+#define EvenOf4f4f(x,y) _mm_shuffle_ps(x,y,0x88)
+#define OddOf4f4f(x,y) _mm_shuffle_ps(x,y,0xdd)
+#define Multiply4f(x,y) _mm_mul_ps(x,y)
+#define Add4f(x,y) _mm_add_ps(x,y)
+#define Add4d(x,y) _mm256_add_pd(x,y)
+#define Convert4fto4d(x) _mm256_cvtps_pd(x)
+#define Sub4i(x,y) _mm_sub_epi32(x,y)
+#define Floor8f(x) _mm256_floor_ps(x)
+// this truncates towards zero
+#define Convert8fto8i(x) _mm256_cvttps_epi32(x)
+#define Lo4iOf8i(x) _mm256_castsi256_si128(x)
+#define Hi4iOf8i(x) _mm256_extractf128_si256(x,1)
+// these saturate, so out-of-range values clip to 0 or the max
+#define Pack4i4ito8i16(lo,hi) _mm_packus_epi32(lo,hi)
+#define Pack8i16to8i8(x) _mm_packus_epi16(x,x)
+// stores the low 8 bytes only, no alignment needed
+#define Store8i8(p,x) _mm_storel_epi64((SIMD4i*)(p),x)
+// these treat a SIMD4i as 16x 8 bit integers
+#define Load16i8u(p) _mm_loadu_si128((SIMD4i*)(p))
+#define Add16i8(x,y) _mm_add_epi8(x,y)
+#define Sub16i8(x,y) _mm_sub_epi8(x,y)
+// all-ones bytes where x and y are equal
+#define Equal16i8(x,y) _mm_cmpeq_epi8(x,y)
+#define SetAll16i8(x) _mm_set1_epi8(x)
+// the sums of bytes 0-7 and 8-15, as 2x 64 bit integers
+#define SumOf16i8(x) _mm_sad_epu8(x,_mm_setzero_si128())
+#define Add2i64(x,y) _mm_add_epi64(x,y)
+// this gathers the top bit of each byte into a 16 bit int
+#define MoveMask16i8(x) _mm_movemask_epi8(x)
+#define Store16i8u(p,x) _mm_storeu_si128((SIMD4i*)(p),x)
+// 16 uint16 (each <256) to 16 uint8
+#define Pack8i16x2to16i8(lo,hi) _mm_packus_epi16(lo,hi)
 
 #define SetAll8f(x) _mm256_set1_ps(x)
 #define SetAll4f(x) _mm_set1_ps(x)
@@ -81,6 +131,19 @@ typedef __m256i SIMD8i;
 
 #define Equal8i(x,y) Cast8fto8i(_mm256_cmp_ps(Cast8ito8f(x),Cast8ito8f(y),_CMP_EQ_OQ))
 #define SelectXorY8f(x,y,m) _mm256_blendv_ps(x,y,Cast8ito8f(m))
+// this is a float mask, all-ones where x is NaN
+#define IsNan8f(x) _mm256_cmp_ps(x,x,_CMP_UNORD_Q)
+#define IsNotNan8f(x) _mm256_cmp_ps(x,x,_CMP_ORD_Q)
+#define SelectXorY8fm(x,y,m) _mm256_blendv_ps(x,y,m)
+// this is a float mask too; NaN is never greater
+#define Greater8f(x,y) _mm256_cmp_ps(x,y,_CMP_GT_OQ)
+#define GreaterOrEqual8f(x,y) _mm256_cmp_ps(x,y,_CMP_GE_OQ)
+#define Equal8f(x,y) _mm256_cmp_ps(x,y,_CMP_EQ_OQ)
+#define And8fm(x,y) _mm256_and_ps(x,y)
+// this is (not x) and y
+#define AndNot8fm(x,y) _mm256_andnot_ps(x,y)
+// one bit per lane of a float mask
+#define MoveMask8f(x) _mm256_movemask_ps(x)
 
 #define SetZero() _mm256_setzero_ps()
 #define SetOnei16(x) _mm_set1_epi16(x)
@@ -133,3 +196,9 @@ static inline void logRegister8i(std::string comment, const SIMD8i& x)
 #define Extend8i16To8i(x) _mm256_cvtepu16_epi32(x)
 #endif
 
+// use gcc flag -mf16c to get these; gcc will define __F16C__
+#ifdef __F16C__
+// 8 floats to 8 IEEE halfs, rounding to nearest
+#define Convert8fto8h(x) _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT)
+#endif
+
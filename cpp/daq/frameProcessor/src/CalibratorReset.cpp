@@ -10,16 +10,13 @@
 using namespace boost::placeholders;
 #endif
 
-// it's probably a bad idea to put this here!
-static const int max_threads = 6;
-static tbb::task_scheduler_init init(max_threads);
-
 CalibratorReset::CalibratorReset(int rows, int cols)
 {
     m_logger = log4cxx::Logger::getLogger("FP.RCalibrator");
     m_rows = rows;
     m_cols = cols;
     allocGainMem();
+    setParallel({defaultGrain, ParallelSettings::eSimple, ParallelSettings::defaultThreads});
 }
 
 CalibratorReset::~CalibratorReset()
@@ -38,7 +35,7 @@ void CalibratorReset::processFrame(MemBlockI16& input, MemBlockF& output)
 void CalibratorReset::processFrameP(MemBlockI16& input, MemBlockF& output)
 {
     auto fn = boost::bind(&CalibratorReset::processFrameRowsTBB, this, &input, &output, _1);
-    tbb::parallel_for( tbb::blocked_range<int>(0,m_rows,50), fn, tbb::simple_partitioner());
+    parallelRows(m_rows, fn);
 }
 
 void CalibratorReset::processFrameRowsTBB(MemBlockI16* pInput, MemBlockF* pOutput, tbb::blocked_range<int> rows)
@@ -50,7 +47,7 @@ void CalibratorReset::processFrameRowsTBB(MemBlockI16* pInput, MemBlockF* pOutpu
 }
 
 
-inline void CalibratorReset::processFrameRow(MemBlockI16& input, MemBlockF& output, int row)
+void CalibratorReset::processFrameRow(MemBlockI16& input, MemBlockF& output, int row)
 {
     // seems that we have 7 rows in the calib arrays
     float idealOf = 128.0f * 32.0f;
@@ -73,7 +70,7 @@ inline void CalibratorReset::processFrameRow(MemBlockI16& input, MemBlockF& outp
 }
 
 
-inline void CalibratorReset::processFrameRowSIMD(MemBlockI16& input, MemBlockF& output, int row)
+void CalibratorReset::processFrameRowSIMD(MemBlockI16& input, MemBlockF& output, int row)
 {
     float idealOf = 128.0f * 32.0f;
     int row_start_idx = row * m_cols;
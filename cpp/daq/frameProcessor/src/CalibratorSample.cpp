@@ -6,14 +6,51 @@
 #include <boost/bind/bind.hpp>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <cmath>
 
 #if 106000 <= BOOST_VERSION
 using namespace boost::placeholders;
 #endif
 
-// it's probably a bad idea to put this here!
-static const int max_threads = 6;
-static tbb::task_scheduler_init init(max_threads);
+void FrameStats::clear()
+{
+    for(auto& count : gainCount)
+        count = 0;
+    saturated = 0;
+    nanCount = 0;
+    sum = 0.0;
+    max = -std::numeric_limits<float>::infinity();
+}
+
+void FrameStats::add(const FrameStats& rhs)
+{
+    for(int g=0;g<4;++g)
+        gainCount[g] += rhs.gainCount[g];
+    saturated += rhs.saturated;
+    nanCount += rhs.nanCount;
+    sum += rhs.sum;
+    max = std::max(max, rhs.max);
+}
+
+uint32_t FrameStats::valid() const
+{
+    return gainCount[0] + gainCount[1] + gainCount[2] + gainCount[3] - nanCount;
+}
+
+uint64_t FrameStats::pixels() const
+{
+    return (uint64_t)gainCount[0] + gainCount[1] + gainCount[2] + gainCount[3];
+}
+
+double FrameStats::mean() const
+{
+    uint32_t n = valid();
+    return n ? sum / n : 0.0;
+}
+
+// the tests take references to this, so it needs a home
+const int CalibratorSample::defaultGrain;
 
 CalibratorSample::CalibratorSample(int rows, int cols)
 {
@@ -22,6 +59,8 @@ CalibratorSample::CalibratorSample(int rows, int cols)
     m_cols = cols;
 
     allocGainMem();
+    m_frameStats.clear();
+    setParallel({defaultGrain, ParallelSettings::eSimple, ParallelSettings::defaultThreads});
 }
 
 CalibratorSample::~CalibratorSample()
@@ -37,6 +76,7 @@ void CalibratorSample::getCMA(bool& on, int& firstCol)
 
 void CalibratorSample::setCMA(bool on, int firstCol)
 {
+    std::lock_guard<std::mutex> lock(m_frameMutex);
     m_cmaFlag = false;
     if(on)
     {
@@ -54,6 +94,201 @@ void CalibratorSample::setCMA(bool on, int firstCol)
     LOG4CXX_INFO(m_logger, "Setting cma " << (m_cmaFlag?"on":"off"));
 }
 
+void CalibratorSample::setDarkFrame(MemBlockF* dark)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_pDarkFrame = nullptr;
+    if(dark)
+    {
+        if(dark->rows() == m_rows && dark->cols() == m_cols)
+        {
+            m_pDarkFrame = dark;
+        }
+        else
+        {
+            LOG4CXX_ERROR(m_logger, "darkframe has dims " << dark->rows() << "x" << dark->cols() << " but calibrator has " << m_rows << "x" << m_cols);
+        }
+    }
+    LOG4CXX_INFO(m_logger, "Setting darkframe " << (m_pDarkFrame?"on":"off"));
+}
+
+void CalibratorSample::setPhotonConversion(float electronsPerPhoton, float rounding, int saturation)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    if(0.0f < electronsPerPhoton && 0 < saturation)
+    {
+        m_photonScale = 1.0f / electronsPerPhoton;
+        m_photonRounding = rounding;
+        m_photonSaturation = saturation;
+        LOG4CXX_INFO(m_logger, "Photon conversion " << electronsPerPhoton << "e/ph rounding " << rounding << " saturation " << saturation);
+    }
+    else
+    {
+        LOG4CXX_ERROR(m_logger, "Photon conversion invalid: " << electronsPerPhoton << "e/ph saturation " << saturation);
+    }
+}
+
+void CalibratorSample::getPhotonConversion(float& electronsPerPhoton, float& rounding, int& saturation)
+{
+    electronsPerPhoton = 1.0f / m_photonScale;
+    rounding = m_photonRounding;
+    saturation = m_photonSaturation;
+}
+
+void CalibratorSample::setSparse(float threshold, bool cluster)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_sparseThreshold = threshold;
+    m_sparseCluster = cluster;
+    LOG4CXX_INFO(m_logger, "Sparse threshold " << threshold << "e clustering " << (cluster?"on":"off"));
+}
+
+void CalibratorSample::setPedestalTracking(bool on, float alpha, float threshold, int interval)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_pedTrack = false;
+    if(!on)
+    {
+        LOG4CXX_INFO(m_logger, "Pedestal tracking off");
+    }
+    else if(0.0f < alpha && alpha <= 1.0f && 0 < interval)
+    {
+        m_pedTrack = true;
+        m_pedTrackAlpha = alpha;
+        m_pedTrackThreshold = threshold;
+        m_pedTrackInterval = interval;
+        LOG4CXX_INFO(m_logger, "Pedestal tracking alpha " << alpha << " threshold " << threshold << "e every " << interval << " frames");
+    }
+    else
+    {
+        LOG4CXX_ERROR(m_logger, "Pedestal tracking invalid: alpha " << alpha << " interval " << interval);
+    }
+}
+
+void CalibratorSample::setFloatFrame(MemBlockF* frame)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_pFloatFrame = nullptr;
+    if(frame)
+    {
+        if(frame->rows() == m_rows && frame->cols() == m_cols)
+            m_pFloatFrame = frame;
+        else
+            LOG4CXX_ERROR(m_logger, "float frame has dims " << frame->rows() << "x" << frame->cols() << " but calibrator has " << m_rows << "x" << m_cols);
+    }
+}
+
+void CalibratorSample::setGainMap(MemBlockI8* map)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_pGainMap = nullptr;
+    if(map)
+    {
+        if(map->rows() == m_rows && map->cols() == m_cols / 4 && m_cols % 4 == 0)
+        {
+            m_pGainMap = map;
+            if(m_gain.rows() != m_rows)
+                m_gain.init(m_logger, m_rows, m_cols);
+        }
+        else
+        {
+            LOG4CXX_ERROR(m_logger, "gain map has dims " << map->rows() << "x" << map->cols() << " but needs " << m_rows << "x" << m_cols / 4);
+        }
+    }
+}
+
+MemBlockI16& CalibratorSample::gainSource(MemBlockI16& input)
+{
+    return m_pGainMap ? m_gain : input;
+}
+
+uint16_t CalibratorSample::unpackGain(MemBlockI8& map, int row, int col)
+{
+    return (map.at(row, col / 4) >> (2 * (col % 4))) & 0x3;
+}
+
+void CalibratorSample::packGainRow(MemBlockI16& gainBlock, int row)
+{
+    const uint16_t* pGain = gainBlock.data() + row * m_cols;
+    uint8_t* pMap = m_pGainMap->data() + row * (m_cols / 4);
+    for(int i=0;i<m_cols/4;++i)
+    {
+        pMap[i] = pGain[4*i] | (pGain[4*i+1] << 2) | (pGain[4*i+2] << 4) | (pGain[4*i+3] << 6);
+    }
+}
+
+void CalibratorSample::setStats(bool on, float saturation)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_stats = on;
+    m_statsSaturation = saturation;
+    LOG4CXX_INFO(m_logger, "Frame stats " << (on?"on":"off") << " saturation " << saturation << "e");
+}
+
+void CalibratorSample::startFrame()
+{
+    m_pedTrackNow = m_pedTrack && m_frameCount % m_pedTrackInterval == 0;
+    ++m_frameCount;
+    m_frameStats.clear();
+    if(m_pOccupancy)
+        m_pOccupancy->startFrame();
+}
+
+void CalibratorSample::addStats(const FrameStats& chunkStats)
+{
+    tbb::spin_mutex::scoped_lock lock(m_statsMutex);
+    m_frameStats.add(chunkStats);
+}
+
+void CalibratorSample::setActiveRows(const std::vector<int>& rows)
+{
+    std::vector<int> activeRows;
+    std::vector<bool> rowActive(m_rows, rows.empty());
+    for(int r : rows)
+    {
+        if(0 <= r && r < m_rows)
+            rowActive[r] = true;
+    }
+    if(rows.size())
+    {
+        for(int r=0;r<m_rows;++r)
+        {
+            if(rowActive[r])
+                activeRows.push_back(r);
+        }
+    }
+    // a frame that has started keeps the rows it started with
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_activeRows.swap(activeRows);
+    m_rowActive.swap(rowActive);
+    LOG4CXX_INFO(m_logger, "calibrating " << numActiveRows() << " of " << m_rows << " rows");
+}
+
+void CalibratorSample::setGainOccupancy(GainOccupancy* occupancy)
+{
+    if(occupancy && (occupancy->m_rows != m_rows || occupancy->m_cols != m_cols))
+    {
+        LOG4CXX_ERROR(m_logger, "gain occupancy has dims " << occupancy->m_rows << "x" << occupancy->m_cols << " but needs " << m_rows << "x" << m_cols);
+        occupancy = nullptr;
+    }
+    // so once this returns, no frame is adding to the old one
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    m_pOccupancy = occupancy;
+}
+
+void CalibratorSample::clearInactiveRows(void* output, int elemSize)
+{
+    if(m_activeRows.empty())
+        return;
+    // all ones is NaN as a float or a half, and the NaN value of the photon formats
+    const size_t rowBytes = (size_t)m_cols * elemSize;
+    for(int r=0;r<m_rows;++r)
+    {
+        if(!m_rowActive[r])
+            memset(static_cast<uint8_t*>(output) + r * rowBytes, 0xff, rowBytes);
+    }
+}
+
 void CalibratorSample::processFrame(MemBlockI16& input, MemBlockF& output)
 {
     for(int r=0;r<m_rows;++r)
@@ -64,21 +299,156 @@ void CalibratorSample::processFrame(MemBlockI16& input, MemBlockF& output)
 
 void CalibratorSample::processFrameP(MemBlockI16& input, MemBlockF& output)
 {
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    startFrame();
     auto fn = boost::bind(&CalibratorSample::processFrameRowsTBB, this, &input, &output, _1);
-    // blocked_range(begin, end, grain G)
-    // Using simple_partitioner guarantees that ⌈G/2⌉ ≤ chunksize ≤ G. 
-    tbb::parallel_for( tbb::blocked_range<int>(0,m_rows,150), fn, tbb::simple_partitioner());
+    parallelRows(numActiveRows(), fn);
+    clearInactiveRows(output.data(), sizeof(float));
 }
 
 void CalibratorSample::processFrameRowsTBB(MemBlockI16* pInput, MemBlockF* pOutput, tbb::blocked_range<int> rows)
 {
-    for(int r = rows.begin(); r<rows.end(); ++r)
+    FrameStats stats;
+    stats.clear();
+    for(int i = rows.begin(); i<rows.end(); ++i)
     {
+         int r = activeRow(i);
          processFrameRow(*pInput, *pOutput, r);
+         if(m_pDarkFrame)
+             subtractDarkRow(*pOutput, r);
+         if(m_pedTrackNow)
+             trackPedestalRowSIMD(gainSource(*pInput), *pOutput, r);
+         if(m_stats)
+             statsRowSIMD(gainSource(*pInput), *pOutput, r, stats);
+         if(m_pOccupancy)
+             m_pOccupancy->addRowSIMD(gainSource(*pInput), r);
     }
+    if(m_stats)
+        addStats(stats);
 }
 
-float CalibratorSample::getCMAVal(MemBlockI16& gainBlock, MemBlockF& output, int row)
+void CalibratorSample::processFrameHalfP(MemBlockI16& input, MemBlockI16& output)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    startFrame();
+    auto fn = boost::bind(&CalibratorSample::processFrameRowsConvertTBB, this, &input, &output, eOutputHalf, _1);
+    parallelRows(numActiveRows(), fn);
+    clearInactiveRows(output.data(), sizeof(uint16_t));
+    if(m_pFloatFrame)
+        clearInactiveRows(m_pFloatFrame->data(), sizeof(float));
+}
+
+void CalibratorSample::processFramePhotonP(MemBlockI16& input, MemBlockI16& output)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    startFrame();
+    auto fn = boost::bind(&CalibratorSample::processFrameRowsConvertTBB, this, &input, &output, eOutputPhoton16, _1);
+    parallelRows(numActiveRows(), fn);
+    clearInactiveRows(output.data(), sizeof(uint16_t));
+    if(m_pFloatFrame)
+        clearInactiveRows(m_pFloatFrame->data(), sizeof(float));
+}
+
+void CalibratorSample::processFramePhotonP(MemBlockI16& input, MemBlockI8& output)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    startFrame();
+    auto fn = boost::bind(&CalibratorSample::processFrameRowsConvertTBB, this, &input, &output, eOutputPhoton8, _1);
+    parallelRows(numActiveRows(), fn);
+    clearInactiveRows(output.data(), sizeof(uint8_t));
+    if(m_pFloatFrame)
+        clearInactiveRows(m_pFloatFrame->data(), sizeof(float));
+}
+
+void CalibratorSample::processFrameSparseP(MemBlockI16& input, MemBlockF& output, std::vector<PhotonEvent>& events)
+{
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+    startFrame();
+    m_rowEvents.resize(m_rows);
+    auto fn = boost::bind(&CalibratorSample::processFrameRowsSparseTBB, this, &input, &output, _1);
+    parallelRows(numActiveRows(), fn);
+    clearInactiveRows(output.data(), sizeof(float));
+
+    events.clear();
+    for(int i=0;i<numActiveRows();++i)
+    {
+        auto& rowEvents = m_rowEvents[activeRow(i)];
+        events.insert(events.end(), rowEvents.begin(), rowEvents.end());
+    }
+
+    // this needs the rows above and below, so it can't go in the row loop
+    if(m_sparseCluster)
+        clusterEvents(output, events);
+}
+
+void CalibratorSample::processFrameRowsSparseTBB(MemBlockI16* pInput, MemBlockF* pOutput, tbb::blocked_range<int> rows)
+{
+    FrameStats stats;
+    stats.clear();
+    for(int i = rows.begin(); i<rows.end(); ++i)
+    {
+        int r = activeRow(i);
+        processFrameRow(*pInput, *pOutput, r);
+        if(m_pDarkFrame)
+            subtractDarkRow(*pOutput, r);
+        if(m_pedTrackNow)
+            trackPedestalRowSIMD(gainSource(*pInput), *pOutput, r);
+        if(m_stats)
+            statsRowSIMD(gainSource(*pInput), *pOutput, r, stats);
+        if(m_pOccupancy)
+            m_pOccupancy->addRowSIMD(gainSource(*pInput), r);
+        // the vectors keep their capacity, so this doesn't allocate after the first few frames
+        m_rowEvents[r].clear();
+        findEventsRowSIMD(*pOutput, m_rowEvents[r], r);
+    }
+    if(m_stats)
+        addStats(stats);
+}
+
+void CalibratorSample::processFrameRowsConvertTBB(MemBlockI16* pInput, void* pOutput, int format, tbb::blocked_range<int> rows)
+{
+    // the float row is still in L1 when we convert it, so this is not a second pass.
+    // Unless there's a float frame, each row is calibrated into this thread's row buffer.
+    MemBlockF& rowBuffer = m_rowBuffers.local();
+    if(!m_pFloatFrame && rowBuffer.cols() != m_cols)
+        rowBuffer.init(m_logger, 1, m_cols);
+    FrameStats stats;
+    stats.clear();
+    for(int i = rows.begin(); i<rows.end(); ++i)
+    {
+        int r = activeRow(i);
+        float* electrons = m_pFloatFrame ? rowOf(*m_pFloatFrame, r) : rowBuffer.data();
+        processFrameRow(*pInput, electrons, r);
+        if(m_pDarkFrame)
+            subtractDarkRow(electrons, r);
+        if(m_pedTrackNow)
+            trackPedestalRowSIMD(gainSource(*pInput), electrons, r);
+        if(m_stats)
+            statsRowSIMD(gainSource(*pInput), electrons, r, stats);
+        if(m_pOccupancy)
+            m_pOccupancy->addRowSIMD(gainSource(*pInput), r);
+
+        switch(format)
+        {
+          case eOutputHalf:
+            convertRowToHalfSIMD(electrons, *static_cast<MemBlockI16*>(pOutput), r);
+            break;
+          case eOutputPhoton16:
+            convertRowToPhotonsSIMD(electrons, *static_cast<MemBlockI16*>(pOutput), r);
+            break;
+          case eOutputPhoton8:
+            convertRowToPhotonsSIMD(electrons, *static_cast<MemBlockI8*>(pOutput), r);
+            break;
+          default:
+            assert(false);
+            break;
+        }
+    }
+    if(m_stats)
+        addStats(stats);
+}
+
+float CalibratorSample::getCMAVal(MemBlockI16& gainBlock, const float* electrons, int row)
 {
     // we calculate an average value across this range subject to the constraint that they are all G0
     const int row_start_idx = row * m_cols;
@@ -89,7 +459,7 @@ float CalibratorSample::getCMAVal(MemBlockI16& gainBlock, MemBlockF& output, int
         uint16_t gain = gainBlock.at(pixel_index);
         if(gain == 0)
         {
-            total += output.at(pixel_index);
+            total += electrons[col];
         }
         else
         {
@@ -104,11 +474,11 @@ float CalibratorSample::getCMAVal(MemBlockI16& gainBlock, MemBlockF& output, int
     return cmaVal;
 }
 
-void CalibratorSample::applyCMA(MemBlockI16& gainBlock, MemBlockF& output, int row)
+void CalibratorSample::applyCMA(MemBlockI16& gainBlock, float* electrons, int row)
 {
     // this does not need to be a member function
     const int row_start_idx = row * m_cols;
-    float cmaVal = getCMAVal(gainBlock, output, row);
+    float cmaVal = getCMAVal(gainBlock, electrons, row);
 
     for(int col=0;col<m_cols;++col)
     {
@@ -117,13 +487,14 @@ void CalibratorSample::applyCMA(MemBlockI16& gainBlock, MemBlockF& output, int r
         uint16_t gain = gainBlock.at(pixel_index);
         if(gain == 0)
         {
-            output.at(row,col) -= cmaVal;
+            electrons[col] -= cmaVal;
         }
     }
 }
 
-void CalibratorSample::processFrameRow(MemBlockI16& input, MemBlockF& output, int row)
+void CalibratorSample::processFrameRow(MemBlockI16& input, float* electrons, int row)
 {
+    MemBlockI16& gainBlock = gainSource(input);
     float idealOf = 128.0f * 32.0f;
     const int row_start_idx = row * m_cols;
     for(int col=0;col<m_cols;++col)
@@ -135,7 +506,7 @@ void CalibratorSample::processFrameRow(MemBlockI16& input, MemBlockF& output, in
           register uint16_t gain = (pixel & 0x6000) >> 13;
           register uint16_t fine = (pixel & 0x1fe0) >> 5;
           register uint16_t coarse = (pixel & 0x001f);
-          input.at(pixel_index) = gain;
+          gainBlock.at(pixel_index) = gain;
 
           // ADC Combination; rename CADC
           register float valueADC = idealOf + ( m_Gc.at(pixel_index) * (coarse - m_Oc.at(pixel_index)) )
@@ -195,17 +566,20 @@ void CalibratorSample::processFrameRow(MemBlockI16& input, MemBlockF& output, in
               break;
           }
 
-          output.at(pixel_index) = valueADC;
+          electrons[col] = valueADC;
     }
 
     if(m_cmaFlag)
-        applyCMA(input, output, row);
+        applyCMA(gainBlock, electrons, row);
+    if(m_pGainMap)
+        packGainRow(gainBlock, row);
 }
 
 #ifdef __AVX__
 
 void CalibratorSample::processFrameRowSIMD(MemBlockI16& input, MemBlockF& output, int row)
 {
+    MemBlockI16& gainBlock = gainSource(input);
     for(int c=0;c<input.cols();c+=8)
     {
         int curElt = row * input.cols() + c;
@@ -225,7 +599,7 @@ void CalibratorSample::processFrameRowSIMD(MemBlockI16& input, MemBlockF& output
         SIMD8i16 fineStep1 = And4i(ShiftRight8i16(in, 5), maskFine);
         SIMD8i16 inK = And4i(ShiftRight8i16(in, 13), maskK);
 
-        Store4i(pIn, inK);
+        Store4i(gainBlock.data() + curElt, inK);
 #ifdef __AVX2__
         SIMD8i coarseStep3 = Extend8i16To8i(coarseStep1);
         SIMD8i fineStep3 = Extend8i16To8i(fineStep1);
@@ -290,6 +664,8 @@ void CalibratorSample::processFrameRowSIMD(MemBlockI16& input, MemBlockF& output
         SIMD8f resultStep4 = Multiply8f(resultStep3, K_8f);
         Store8f(pOut, resultStep4);
     }
+    if(m_pGainMap)
+        packGainRow(gainBlock, row);
 }
 #endif
 
@@ -312,6 +688,10 @@ void CalibratorSample::allocGainMem()
     // set the values to something nilpotent mainly for the benefit
     // of testing.
     m_resetFrame.setAll(0.0f);
+    m_Gc.setAll(0.0f);
+    m_Oc.setAll(0.0f);
+    m_Gf.setAll(0.0f);
+    m_Of.setAll(0.0f);
     m_Ped0.setAll(0.0f);
     m_Ped1.setAll(0.0f);
     m_Ped2.setAll(0.0f);
@@ -461,3 +841,353 @@ void CalibratorSample::applyCMA_SIMD(MemBlockI16& gainBlock, MemBlockF& output,
 }
 
 #endif
+
+void CalibratorSample::subtractDarkRow(float* pRow, int row)
+{
+    const float* pDark = m_pDarkFrame->data() + row * m_cols;
+#ifdef __AVX__
+    for(int col=0;col<m_cols;col+=8)
+    {
+        SIMD8f pixels = Load8f(pRow+col);
+        pixels = Sub8f(pixels, Load8f(pDark+col));
+        Store8f(pRow+col, pixels);
+    }
+#else
+    for(int col=0;col<m_cols;++col)
+    {
+        pRow[col] -= pDark[col];
+    }
+#endif
+}
+
+void CalibratorSample::trackPedestalRow(MemBlockI16& gainBlock, const float* pRow, int row)
+{
+    // the residual is in electrons, and the pedestal is in ADU, hence the divide.
+    // This only changes the next frame; this one is already calibrated.
+    const int row_start_idx = row * m_cols;
+    for(int col=0;col<m_cols;++col)
+    {
+        size_t pixel_index = row_start_idx + col;
+        float electrons = pRow[col];
+        if(gainBlock.at(pixel_index) == 0 && electrons < m_pedTrackThreshold)
+        {
+            float step = m_pedTrackAlpha * electrons / m_Gain0.at(pixel_index);
+            if(!std::isnan(step))
+                m_Ped0.at(pixel_index) += step;
+        }
+    }
+}
+
+void CalibratorSample::statsRow(MemBlockI16& gainBlock, const float* pRow, int row, FrameStats& stats)
+{
+    const int row_start_idx = row * m_cols;
+    for(int col=0;col<m_cols;++col)
+    {
+        size_t pixel_index = row_start_idx + col;
+        float electrons = pRow[col];
+        stats.gainCount[gainBlock.at(pixel_index) & 0x3] += 1;
+        if(std::isnan(electrons))
+        {
+            stats.nanCount += 1;
+        }
+        else
+        {
+            if(m_statsSaturation <= electrons)
+                stats.saturated += 1;
+            stats.sum += electrons;
+            stats.max = std::max(stats.max, electrons);
+        }
+    }
+}
+
+// IEEE float32 to float16 rounding to nearest-even; this matches what F16C does.
+static inline uint16_t floatToHalf(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t absx = x & 0x7fffffff;
+
+    if(0x7f800000 <= absx)
+    {
+        // inf stays inf, NaN stays a quiet NaN
+        return sign | 0x7c00 | (0x7f800000 < absx ? (0x200 | ((absx >> 13) & 0x3ff)) : 0);
+    }
+    if(0x477ff000 <= absx)
+    {
+        // this rounds beyond 65504, the biggest half
+        return sign | 0x7c00;
+    }
+    if(absx < 0x38800000)
+    {
+        // denormal half, or zero
+        if(absx <= 0x33000000)
+            return sign;
+        int shift = 126 - (absx >> 23);
+        uint32_t mant = (absx & 0x7fffff) | 0x800000;
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if(halfway < rem || (rem == halfway && (h & 1)))
+            ++h;
+        return sign | h;
+    }
+
+    // rebias the exponent from 127 to 15
+    uint32_t h = (absx - 0x38000000) >> 13;
+    uint32_t rem = absx & 0x1fff;
+    if(0x1000 < rem || (rem == 0x1000 && (h & 1)))
+        ++h;
+    return sign | h;
+}
+
+void CalibratorSample::convertRowToHalf(const float* pRow, MemBlockI16& output, int row)
+{
+    const int row_start_idx = row * m_cols;
+    for(int col=0;col<m_cols;++col)
+    {
+        size_t pixel_index = row_start_idx + col;
+        output.at(pixel_index) = floatToHalf(pRow[col]);
+    }
+}
+
+void CalibratorSample::findEventsRow(MemBlockF& input, std::vector<PhotonEvent>& events, int row)
+{
+    const int row_start_idx = row * m_cols;
+    for(int col=0;col<m_cols;++col)
+    {
+        float value = input.at(row_start_idx + col);
+        // NaN fails this too
+        if(m_sparseThreshold < value)
+            events.push_back(PhotonEvent{static_cast<uint16_t>(row), static_cast<uint16_t>(col), value});
+    }
+}
+
+void CalibratorSample::clusterEvents(MemBlockF& frame, std::vector<PhotonEvent>& events)
+{
+    // we keep an event if it is the biggest pixel in its 3x3; ties go to the first
+    // in row-major order. Its value becomes the sum of the 3x3, ignoring NaNs.
+    size_t kept = 0;
+    for(size_t i=0;i<events.size();++i)
+    {
+        PhotonEvent ev = events[i];
+        bool isMax = true;
+        float sum = 0.0f;
+        for(int r=std::max(0, ev.row-1); r<=std::min(m_rows-1, ev.row+1); ++r)
+        {
+            for(int c=std::max(0, ev.col-1); c<=std::min(m_cols-1, ev.col+1); ++c)
+            {
+                float value = frame.at(r,c);
+                if(std::isnan(value))
+                    continue;
+                sum += value;
+                bool before = r < ev.row || (r == ev.row && c < ev.col);
+                if(ev.value < value || (before && ev.value == value))
+                    isMax = false;
+            }
+        }
+        if(isMax)
+        {
+            ev.value = sum;
+            events[kept++] = ev;
+        }
+    }
+    events.resize(kept);
+}
+
+template<typename T>
+void CalibratorSample::convertRowToPhotons(const float* pRow, FrameMem<T>& output, int row)
+{
+    // the max value is reserved for NaN
+    const T maxVal = std::numeric_limits<T>::max();
+    const float saturation = std::min(static_cast<float>(m_photonSaturation), maxVal - 1.0f);
+    const int row_start_idx = row * m_cols;
+    for(int col=0;col<m_cols;++col)
+    {
+        size_t pixel_index = row_start_idx + col;
+        float electrons = pRow[col];
+        if(std::isnan(electrons))
+        {
+            output.at(pixel_index) = maxVal;
+        }
+        else
+        {
+            float photons = std::floor(electrons * m_photonScale + m_photonRounding);
+            photons = std::max(0.0f, std::min(photons, saturation));
+            output.at(pixel_index) = static_cast<T>(photons);
+        }
+    }
+}
+
+template void CalibratorSample::convertRowToPhotons<uint16_t>(const float*, MemBlockI16&, int);
+template void CalibratorSample::convertRowToPhotons<uint8_t>(const float*, MemBlockI8&, int);
+
+#ifdef __AVX__
+
+void CalibratorSample::convertRowToHalfSIMD(const float* pRow, MemBlockI16& output, int row)
+{
+#ifdef __F16C__
+    const int row_start_idx = row * m_cols;
+    for(int col=0;col<m_cols;col+=8)
+    {
+        size_t pixel_index = row_start_idx + col;
+        SIMD8f pixels = Load8f(pRow + col);
+        Store4i(output.data() + pixel_index, Convert8fto8h(pixels));
+    }
+#else
+    convertRowToHalf(pRow, output, row);
+#endif
+}
+
+// this does the arithmetic for both photon widths. The result is 8 int32s
+// in [0, nanVal].
+static inline SIMD8i photonsSIMD(SIMD8f electrons, SIMD8f scale, SIMD8f rounding, SIMD8f saturation, SIMD8f nanVal)
+{
+    SIMD8f photons = Floor8f(Add8f(Multiply8f(electrons, scale), rounding));
+    // max comes first so that NaN becomes 0 here, then we fix it with the blend
+    photons = Min8f(Max8f(photons, SetZero()), saturation);
+    photons = SelectXorY8fm(photons, nanVal, IsNan8f(electrons));
+    return Convert8fto8i(photons);
+}
+
+void CalibratorSample::convertRowToPhotonsSIMD(const float* pRow, MemBlockI16& output, int row)
+{
+    const int row_start_idx = row * m_cols;
+    SIMD8f scale = SetAll8f(m_photonScale);
+    SIMD8f rounding = SetAll8f(m_photonRounding);
+    SIMD8f saturation = SetAll8f(std::min(static_cast<float>(m_photonSaturation), 65534.0f));
+    SIMD8f nanVal = SetAll8f(65535.0f);
+    for(int col=0;col<m_cols;col+=8)
+    {
+        size_t pixel_index = row_start_idx + col;
+        SIMD8i photons = photonsSIMD(Load8f(pRow + col), scale, rounding, saturation, nanVal);
+        SIMD8i16 packed = Pack4i4ito8i16(Lo4iOf8i(photons), Hi4iOf8i(photons));
+        Store4i(output.data() + pixel_index, packed);
+    }
+}
+
+void CalibratorSample::convertRowToPhotonsSIMD(const float* pRow, MemBlockI8& output, int row)
+{
+    const int row_start_idx = row * m_cols;
+    SIMD8f scale = SetAll8f(m_photonScale);
+    SIMD8f rounding = SetAll8f(m_photonRounding);
+    SIMD8f saturation = SetAll8f(std::min(static_cast<float>(m_photonSaturation), 254.0f));
+    SIMD8f nanVal = SetAll8f(255.0f);
+    for(int col=0;col<m_cols;col+=8)
+    {
+        size_t pixel_index = row_start_idx + col;
+        SIMD8i photons = photonsSIMD(Load8f(pRow + col), scale, rounding, saturation, nanVal);
+        SIMD8i16 packed = Pack4i4ito8i16(Lo4iOf8i(photons), Hi4iOf8i(photons));
+        Store8i8(output.data() + pixel_index, Pack8i16to8i8(packed));
+    }
+}
+
+void CalibratorSample::trackPedestalRowSIMD(MemBlockI16& gainBlock, const float* pRow, int row)
+{
+    const int row_start_idx = row * m_cols;
+    SIMD8f alpha = SetAll8f(m_pedTrackAlpha);
+    SIMD8f threshold = SetAll8f(m_pedTrackThreshold);
+    SIMD8f zerosF = SetAll8f(0.0f);
+    for(int col=0;col<m_cols;col+=8)
+    {
+        size_t pixel_index = row_start_idx + col;
+        SIMD8f electrons = Load8f(pRow + col);
+        SIMD8i gainI = Extend8i16to8i(Load4i(gainBlock.data() + pixel_index));
+        SIMD8f gain = Convert8ito8f(gainI);
+        // NaN electrons fail the threshold compare, so they never get in
+        SIMD8f mask = And8fm(Equal8f(gain, zerosF), Greater8f(threshold, electrons));
+        SIMD8f step = Divide8f(Multiply8f(alpha, electrons), Load8f(m_Gain0.data() + pixel_index));
+        mask = AndNot8fm(IsNan8f(step), mask);
+        float* pPed = m_Ped0.data() + pixel_index;
+        Store8f(pPed, Add8f(Load8f(pPed), And8fm(mask, step)));
+    }
+}
+
+void CalibratorSample::statsRowSIMD(MemBlockI16& gainBlock, const float* pRow, int row, FrameStats& stats)
+{
+    // the counts go in float lanes (exact for a row) and the sum is per row in float,
+    // which is then added into the double.
+    const int row_start_idx = row * m_cols;
+    SIMD8f one = SetAll8f(1.0f);
+    SIMD8f zerosF = SetAll8f(0.0f);
+    SIMD8f saturation = SetAll8f(m_statsSaturation);
+    SIMD8f gainCount[4] = {zerosF, zerosF, zerosF, zerosF};
+    SIMD8f nanCount = zerosF, satCount = zerosF, sum = zerosF;
+    SIMD8f max = SetAll8f(-std::numeric_limits<float>::infinity());
+    for(int col=0;col<m_cols;col+=8)
+    {
+        size_t pixel_index = row_start_idx + col;
+        SIMD8f electrons = Load8f(pRow + col);
+        SIMD8i gainI = Extend8i16to8i(Load4i(gainBlock.data() + pixel_index));
+        SIMD8f gain = Convert8ito8f(gainI);
+        for(int g=0;g<4;++g)
+            gainCount[g] = Add8f(gainCount[g], And8fm(Equal8f(gain, SetAll8f(g)), one));
+
+        SIMD8f isNan = IsNan8f(electrons);
+        nanCount = Add8f(nanCount, And8fm(isNan, one));
+        // NaN never passes this compare
+        satCount = Add8f(satCount, And8fm(GreaterOrEqual8f(electrons, saturation), one));
+        sum = Add8f(sum, AndNot8fm(isNan, electrons));
+        // max gives the second operand if either is NaN
+        max = Max8f(electrons, max);
+    }
+
+    float __attribute__ ((aligned (SIMD_MEM_ALIGN))) lanes[8];
+    for(int g=0;g<4;++g)
+    {
+        Store8f(lanes, gainCount[g]);
+        for(int i=0;i<8;++i)
+            stats.gainCount[g] += static_cast<uint32_t>(lanes[i]);
+    }
+    Store8f(lanes, nanCount);
+    for(int i=0;i<8;++i)
+        stats.nanCount += static_cast<uint32_t>(lanes[i]);
+    Store8f(lanes, satCount);
+    for(int i=0;i<8;++i)
+        stats.saturated += static_cast<uint32_t>(lanes[i]);
+    Store8f(lanes, sum);
+    float rowSum = 0.0f;
+    for(int i=0;i<8;++i)
+        rowSum += lanes[i];
+    stats.sum += rowSum;
+    Store8f(lanes, max);
+    for(int i=0;i<8;++i)
+        stats.max = std::max(stats.max, lanes[i]);
+}
+
+void CalibratorSample::findEventsRowSIMD(MemBlockF& input, std::vector<PhotonEvent>& events, int row)
+{
+    // most pixels are noise, so we only look at the lanes the compare picks out
+    const int row_start_idx = row * m_cols;
+    SIMD8f threshold = SetAll8f(m_sparseThreshold);
+    for(int col=0;col<m_cols;col+=8)
+    {
+        const float* pIn = input.data() + row_start_idx + col;
+        int mask = MoveMask8f(Greater8f(Load8f(pIn), threshold));
+        while(mask)
+        {
+            int lane = __builtin_ctz(mask);
+            events.push_back(PhotonEvent{static_cast<uint16_t>(row), static_cast<uint16_t>(col + lane), pIn[lane]});
+            mask &= mask - 1;
+        }
+    }
+}
+
+#else
+
+void CalibratorSample::statsRowSIMD(MemBlockI16& gainBlock, const float* pRow, int row, FrameStats& stats)
+{
+    statsRow(gainBlock, pRow, row, stats);
+}
+
+void CalibratorSample::trackPedestalRowSIMD(MemBlockI16& gainBlock, const float* pRow, int row)
+{
+    trackPedestalRow(gainBlock, pRow, row);
+}
+
+void CalibratorSample::findEventsRowSIMD(MemBlockF& input, std::vector<PhotonEvent>& events, int row)
+{
+    findEventsRow(input, events, row);
+}
+
+#endif
@@ -0,0 +1,243 @@
+#include "DarkAccumulator.h"
+#include "SIMDMacros.h"
+
+#include <boost/version.hpp>
+#include <boost/bind/bind.hpp>
+#include <cmath>
+#include <limits>
+
+#include <H5Fpublic.h>
+#include <H5Ppublic.h>
+#include <H5Dpublic.h>
+#include <H5Spublic.h>
+#include <H5Tpublic.h>
+
+#if 106000 <= BOOST_VERSION
+using namespace boost::placeholders;
+#endif
+
+DarkAccumulator::DarkAccumulator(int rows, int cols)
+{
+    m_logger = log4cxx::Logger::getLogger("FP.DarkAccumulator");
+    m_rows = rows;
+    m_cols = cols;
+    m_hasSubtracted = false;
+    setParallel({defaultGrain, ParallelSettings::eSimple, ParallelSettings::defaultThreads});
+
+    for(int g=0;g<numGains;++g)
+    {
+        m_count[g].init(m_logger, m_rows, m_cols);
+        m_mean[g].init(m_logger, m_rows, m_cols);
+        m_m2[g].init(m_logger, m_rows, m_cols);
+    }
+    clear();
+}
+
+DarkAccumulator::~DarkAccumulator()
+{
+
+}
+
+void DarkAccumulator::clear()
+{
+    m_frames = 0;
+    for(int g=0;g<numGains;++g)
+    {
+        m_count[g].setAll(0.0f);
+        m_mean[g].setAll(0.0f);
+        m_m2[g].setAll(0.0f);
+    }
+}
+
+void DarkAccumulator::clone(DarkAccumulator& source)
+{
+    m_rows = source.m_rows;
+    m_cols = source.m_cols;
+    m_frames = source.m_frames;
+    for(int g=0;g<numGains;++g)
+    {
+        m_count[g].clone(source.m_count[g]);
+        m_mean[g].clone(source.m_mean[g]);
+        m_m2[g].clone(source.m_m2[g]);
+    }
+    m_hasSubtracted = source.m_hasSubtracted;
+    if(m_hasSubtracted)
+        m_subtracted.clone(source.m_subtracted);
+}
+
+void DarkAccumulator::setSubtracted(MemBlockF* dark)
+{
+    m_hasSubtracted = false;
+    if(dark)
+    {
+        if(dark->rows() == m_rows && dark->cols() == m_cols)
+        {
+            m_subtracted.clone(*dark);
+            m_hasSubtracted = true;
+        }
+        else
+        {
+            LOG4CXX_ERROR(m_logger, "subtracted darkframe has dims " << dark->rows() << "x" << dark->cols() << " but accumulator has " << m_rows << "x" << m_cols);
+        }
+    }
+}
+
+void DarkAccumulator::accumulate(MemBlockI16& gain, MemBlockF& frame)
+{
+    for(int r=0;r<m_rows;++r)
+    {
+        accumulateRow(gain, frame, r);
+    }
+    ++m_frames;
+}
+
+void DarkAccumulator::accumulateP(MemBlockI16& gain, MemBlockF& frame)
+{
+    auto fn = boost::bind(&DarkAccumulator::accumulateRowsTBB, this, &gain, &frame, _1);
+    parallelRows(m_rows, fn);
+    ++m_frames;
+}
+
+void DarkAccumulator::accumulateRowsTBB(MemBlockI16* pGain, MemBlockF* pFrame, tbb::blocked_range<int> rows)
+{
+    for(int r = rows.begin(); r<rows.end(); ++r)
+    {
+        accumulateRowSIMD(*pGain, *pFrame, r);
+    }
+}
+
+void DarkAccumulator::accumulateRow(MemBlockI16& gainBlock, MemBlockF& frame, int row)
+{
+    const int row_start_idx = row * m_cols;
+    for(int col=0;col<m_cols;++col)
+    {
+        size_t pixel_index = row_start_idx + col;
+        uint16_t gain = gainBlock.at(pixel_index);
+        float x = frame.at(pixel_index);
+        if(gain < numGains && !std::isnan(x))
+        {
+            float n = m_count[gain].at(pixel_index) + 1.0f;
+            float delta = x - m_mean[gain].at(pixel_index);
+            float mean = m_mean[gain].at(pixel_index) + delta / n;
+            m_count[gain].at(pixel_index) = n;
+            m_mean[gain].at(pixel_index) = mean;
+            m_m2[gain].at(pixel_index) += delta * (x - mean);
+        }
+    }
+}
+
+#ifdef __AVX__
+
+void DarkAccumulator::accumulateRowSIMD(MemBlockI16& gainBlock, MemBlockF& frame, int row)
+{
+    const int row_start_idx = row * m_cols;
+    const SIMD8f one = SetAll8f(1.0f);
+    for(int col=0;col<m_cols;col+=8)
+    {
+        size_t pixel_index = row_start_idx + col;
+        SIMD8f x = Load8f(frame.data() + pixel_index);
+        SIMD8i gainI = Extend8i16to8i(Load4i(gainBlock.data() + pixel_index));
+        SIMD8f gain = Convert8ito8f(gainI);
+        SIMD8f isNan = IsNan8f(x);
+
+        // every pixel is in exactly one gain, so only one of these updates is live per lane
+        for(int g=0;g<numGains;++g)
+        {
+            SIMD8f mask = AndNot8fm(isNan, Equal8f(gain, SetAll8f(g)));
+            float* pCount = m_count[g].data() + pixel_index;
+            float* pMean = m_mean[g].data() + pixel_index;
+            float* pM2 = m_m2[g].data() + pixel_index;
+
+            SIMD8f n = Add8f(Load8f(pCount), And8fm(mask, one));
+            SIMD8f mean = Load8f(pMean);
+            SIMD8f delta = Sub8f(x, mean);
+            // the lanes that aren't in this gain may divide by 0 here, but the mask zeroes them
+            mean = Add8f(mean, And8fm(mask, Divide8f(delta, n)));
+            SIMD8f m2 = Add8f(Load8f(pM2), And8fm(mask, Multiply8f(delta, Sub8f(x, mean))));
+
+            Store8f(pCount, n);
+            Store8f(pMean, mean);
+            Store8f(pM2, m2);
+        }
+    }
+}
+
+#else
+
+void DarkAccumulator::accumulateRowSIMD(MemBlockI16& gainBlock, MemBlockF& frame, int row)
+{
+    accumulateRow(gainBlock, frame, row);
+}
+
+#endif
+
+void DarkAccumulator::getVariance(int gainMode, MemBlockF& variance)
+{
+    for(int i=0;i<m_rows*m_cols;++i)
+    {
+        float n = m_count[gainMode].at(i);
+        variance.at(i) = n ? m_m2[gainMode].at(i) / n : std::numeric_limits<float>::quiet_NaN();
+    }
+}
+
+void DarkAccumulator::getDarkFrame(MemBlockF& dark)
+{
+    for(int i=0;i<m_rows*m_cols;++i)
+    {
+        float subtracted = m_hasSubtracted ? m_subtracted.at(i) : 0.0f;
+        dark.at(i) = m_count[0].at(i) ? m_mean[0].at(i) + subtracted : subtracted;
+    }
+}
+
+static herr_t writeFloatDataset(hid_t fh, hid_t space, std::string name, hid_t fileType, float* data)
+{
+    hid_t dset = H5Dcreate (fh, name.c_str(), fileType, space, H5P_DEFAULT,
+                H5P_DEFAULT, H5P_DEFAULT);
+    if(dset < 0)
+        return -1;
+    // hdf5 converts the floats if the file type is wider
+    herr_t status = H5Dwrite (dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+    status |= H5Dclose (dset);
+    return status;
+}
+
+int64_t DarkAccumulator::saveToH5(std::string filename)
+{
+    const int ndims = 2;
+    hsize_t  	dims[ndims] = {(hsize_t)m_rows, (hsize_t)m_cols};
+    hid_t fh = H5Fcreate (filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if(fh < 0)
+    {
+        LOG4CXX_ERROR(m_logger, "could not create file " << filename);
+        return -1;
+    }
+
+    hid_t space = H5Screate_simple (ndims, dims, NULL);
+    herr_t status = 0;
+
+    MemBlockF temp;
+    temp.init(m_logger, m_rows, m_cols);
+    for(int g=0;g<numGains;++g)
+    {
+        std::string prefix = "g" + std::to_string(g) + "_";
+        status |= writeFloatDataset(fh, space, prefix + "mean", H5T_NATIVE_FLOAT, m_mean[g].data());
+        getVariance(g, temp);
+        status |= writeFloatDataset(fh, space, prefix + "var", H5T_NATIVE_FLOAT, temp.data());
+        status |= writeFloatDataset(fh, space, prefix + "count", H5T_NATIVE_FLOAT, m_count[g].data());
+    }
+
+    // the darkframe loader only reads doubles
+    getDarkFrame(temp);
+    status |= writeFloatDataset(fh, space, "darkframe", H5T_IEEE_F64LE, temp.data());
+
+    status |= H5Sclose (space);
+    status |= H5Fclose (fh);
+
+    if(status < 0)
+    {
+        LOG4CXX_ERROR(m_logger, "failed writing dark statistics to " << filename);
+        return -1;
+    }
+    LOG4CXX_INFO(m_logger, "saved dark statistics of " << m_frames << " frames to " << filename);
+    return 0;
+}
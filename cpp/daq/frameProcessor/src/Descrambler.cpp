@@ -0,0 +1,248 @@
+#include "Descrambler.h"
+#include "SIMDMacros.h"
+
+#include <boost/version.hpp>
+#include <boost/bind/bind.hpp>
+
+#if 106000 <= BOOST_VERSION
+using namespace boost::placeholders;
+#endif
+
+// the tests take references to these, so they need a home
+const int Descrambler::numGroups;
+const int Descrambler::numADCs;
+const int Descrambler::numPads;
+const int Descrambler::padCols;
+const int Descrambler::padPixels;
+const int Descrambler::bitsPerPixel;
+const uint16_t Descrambler::missingPixel;
+
+Descrambler::Descrambler() :
+    m_gather(numPads * padPixels),
+    m_scatter(numPads * padPixels),
+    m_missingGroups(0)
+{
+    m_logger = log4cxx::Logger::getLogger("FP.Descrambler");
+
+    const int cols = FRAME_COLS;
+    const int halfCols = cols / 2;
+    const int quarter = numADCs * cols / 4;
+    for(int pad=0;pad<numPads;++pad)
+    {
+        // gather: the words of a pad are interleaved 2 at a time with the other pads
+        for(int word=0;word<padPixels;++word)
+        {
+            int mezz = (word / 2) * numPads * 2 + pad * 2 + word % 2;
+            // odin sends the quarters of a group in the order [0,0],[1,0],[0,1],[1,1]
+            int q = mezz / quarter;
+            int half = q & 1;
+            int rem = (q >> 1) * quarter + mezz % quarter;
+            int adc = rem / halfCols;
+            int col = half * halfCols + rem % halfCols;
+            m_gather[pad * padPixels + word] = adc * cols + col;
+        }
+
+        // scatter: data pad p is pad p+1 after the reference column, and iP2M_ColGrp
+        // puts pads 22..1 and 44..23 in order
+        int fromPad = pad + 1;
+        int toPad = (fromPad <= numPads / 2) ? numPads / 2 + 1 - fromPad : numPads + numPads / 2 + 1 - fromPad;
+        for(int pixel=0;pixel<padPixels;++pixel)
+        {
+            // ADCcolArray_1DA goes col%8, then ADC 6..0, then col/8 reversed
+            int n = pixel / (numADCs * 4);
+            int adc = numADCs - 1 - (pixel % (numADCs * 4)) / 4;
+            int x = pixel % 4;
+            int col = (3 - x) * 8 + n;
+            m_scatter[pad * padPixels + pixel] = adc * cols + (toPad - 1) * padCols + col;
+        }
+    }
+
+    // the bit-planes are sent MSB first, so the first pixel is the top bit of the byte
+    for(int v=0;v<256;++v)
+    {
+        for(int i=0;i<8;++i)
+        {
+            m_bitTable[v][i] = (v >> (7 - i)) & 1;
+        }
+    }
+}
+
+Descrambler::~Descrambler()
+{
+
+}
+
+int Descrambler::checkShape(MemBlockI16& input, MemBlockI16& output)
+{
+    if(input.rows() != numGroups * numADCs || input.cols() != FRAME_COLS
+        || output.rows() != input.rows() || output.cols() != input.cols())
+    {
+        LOG4CXX_ERROR(m_logger, "can't descramble a " << input.rows() << "x" << input.cols() << " frame into "
+            << output.rows() << "x" << output.cols() << "; both must be " << numGroups * numADCs << "x" << FRAME_COLS);
+        return -1;
+    }
+    return 0;
+}
+
+int Descrambler::descramble(MemBlockI16& input, MemBlockI16& output)
+{
+    if(checkShape(input, output) < 0)
+        return -1;
+    int missing = 0;
+    for(int g=0;g<numGroups;++g)
+    {
+        if(descrambleGroup(input, output, g))
+            ++missing;
+    }
+    return missing;
+}
+
+int Descrambler::descrambleP(MemBlockI16& input, MemBlockI16& output)
+{
+    if(checkShape(input, output) < 0)
+        return -1;
+    m_missingGroups = 0;
+    auto fn = boost::bind(&Descrambler::descrambleGroupsTBB, this, &input, &output, _1);
+    // a group is 7 rows, so 4 groups is about the calibrator's row chunks
+    tbb::parallel_for( tbb::blocked_range<int>(0,numGroups,4), fn, tbb::simple_partitioner());
+    return m_missingGroups;
+}
+
+void Descrambler::descrambleGroupsTBB(MemBlockI16* pInput, MemBlockI16* pOutput, tbb::blocked_range<int> groups)
+{
+    int missing = 0;
+    for(int g = groups.begin(); g<groups.end(); ++g)
+    {
+        if(descrambleGroupSIMD(*pInput, *pOutput, g))
+            ++missing;
+    }
+    if(missing)
+        m_missingGroups += missing;
+}
+
+bool Descrambler::descrambleGroup(MemBlockI16& input, MemBlockI16& output, int group)
+{
+    const size_t start = (size_t)group * numADCs * input.cols();
+    const uint16_t* src = input.data() + start;
+    uint16_t* dst = output.data() + start;
+    if(src[0] == 0xffff)
+    {
+        std::fill(dst, dst + numADCs * input.cols(), missingPixel);
+        return true;
+    }
+
+    uint16_t words[padPixels];
+    uint16_t pixels[padPixels];
+    for(int pad=0;pad<numPads;++pad)
+    {
+        const uint32_t* gather = &m_gather[pad * padPixels];
+        const uint32_t* scatter = &m_scatter[pad * padPixels];
+        for(int i=0;i<padPixels;++i)
+        {
+            uint16_t word = src[gather[i]];
+            words[i] = (word >> 8) | (word << 8);
+        }
+        unpackPad(words, pixels);
+        for(int i=0;i<padPixels;++i)
+        {
+            dst[scatter[i]] = pixels[i];
+        }
+    }
+    return false;
+}
+
+void Descrambler::unpackPad(const uint16_t* words, uint16_t* pixels)
+{
+    // stream bit s is bit 14 - s%15 of word s/15, and bit-plane b is stream bits
+    // b*224 .. b*224+223, for output bit 14 - b
+    for(int i=0;i<padPixels;++i)
+    {
+        uint16_t value = 0;
+        for(int b=0;b<bitsPerPixel;++b)
+        {
+            int s = b * padPixels + i;
+            int bit = (words[s / bitsPerPixel] >> (bitsPerPixel - 1 - s % bitsPerPixel)) & 1;
+            value |= (bit ^ 1) << (bitsPerPixel - 1 - b);
+        }
+        pixels[i] = value;
+    }
+}
+
+#ifdef __AVX__
+
+bool Descrambler::descrambleGroupSIMD(MemBlockI16& input, MemBlockI16& output, int group)
+{
+    const size_t start = (size_t)group * numADCs * input.cols();
+    const uint16_t* src = input.data() + start;
+    uint16_t* dst = output.data() + start;
+    if(src[0] == 0xffff)
+    {
+        std::fill(dst, dst + numADCs * input.cols(), missingPixel);
+        return true;
+    }
+
+    // the gather and scatter are all over the place, so only the bit-planes are simd
+    uint16_t words[padPixels];
+    uint16_t pixels[padPixels];
+    for(int pad=0;pad<numPads;++pad)
+    {
+        const uint32_t* gather = &m_gather[pad * padPixels];
+        const uint32_t* scatter = &m_scatter[pad * padPixels];
+        for(int i=0;i<padPixels;++i)
+        {
+            words[i] = __builtin_bswap16(src[gather[i]]);
+        }
+        unpackPadSIMD(words, pixels);
+        for(int i=0;i<padPixels;++i)
+        {
+            dst[scatter[i]] = pixels[i];
+        }
+    }
+    return false;
+}
+
+void Descrambler::unpackPadSIMD(const uint16_t* words, uint16_t* pixels)
+{
+    // pack the 15-bit words into a byte stream; each bit-plane is then 28 whole bytes
+    const int planeBytes = padPixels / 8;
+    uint8_t stream[planeBytes * bitsPerPixel];
+    uint64_t acc = 0;
+    int nbits = 0;
+    int n = 0;
+    for(int i=0;i<padPixels;++i)
+    {
+        acc = (acc << bitsPerPixel) | (words[i] & 0x7fff);
+        nbits += bitsPerPixel;
+        while(nbits >= 8)
+        {
+            nbits -= 8;
+            stream[n++] = acc >> nbits;
+        }
+    }
+
+    // then 8 pixels at a time, shift in one bit-plane after another, top bit first
+    const SIMD4i invert = SetAll8i16(0x7fff);
+    for(int j=0;j<planeBytes;++j)
+    {
+        SIMD4i value = Load16i8u(m_bitTable[stream[j]]);
+        for(int b=1;b<bitsPerPixel;++b)
+        {
+            value = Or4i(ShiftLeft8i16(value, 1), Load16i8u(m_bitTable[stream[b * planeBytes + j]]));
+        }
+        Store16i8u(pixels + j * 8, Xor4i(value, invert));
+    }
+}
+
+#else
+
+bool Descrambler::descrambleGroupSIMD(MemBlockI16& input, MemBlockI16& output, int group)
+{
+    return descrambleGroup(input, output, group);
+}
+
+void Descrambler::unpackPadSIMD(const uint16_t* words, uint16_t* pixels)
+{
+    unpackPad(words, pixels);
+}
+
+#endif
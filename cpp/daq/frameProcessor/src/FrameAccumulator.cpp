@@ -0,0 +1,166 @@
+#include "FrameAccumulator.h"
+#include "SIMDMacros.h"
+
+#include <boost/version.hpp>
+#include <boost/bind/bind.hpp>
+
+#if 106000 <= BOOST_VERSION
+using namespace boost::placeholders;
+#endif
+
+#include <cmath>
+#include <cstring>
+
+FrameAccumulator::FrameAccumulator() :
+    m_doublePrecision(false),
+    m_countValid(false),
+    m_frames(0)
+{
+    m_logger = log4cxx::Logger::getLogger("FP.FrameAccumulator");
+    setParallel({defaultGrain, ParallelSettings::eSimple, ParallelSettings::defaultThreads});
+}
+
+FrameAccumulator::~FrameAccumulator()
+{
+
+}
+
+void FrameAccumulator::init(int rows, int cols, bool doublePrecision, bool countValid)
+{
+    m_doublePrecision = doublePrecision;
+    m_countValid = countValid;
+    // only keep the memory we need; a whole frame of doubles is 16MB
+    m_sumF.init(m_logger, doublePrecision ? 0 : rows, doublePrecision ? 0 : cols);
+    m_sumD.init(m_logger, doublePrecision ? rows : 0, doublePrecision ? cols : 0);
+    m_counts.init(m_logger, countValid ? rows : 0, countValid ? cols : 0);
+    clear();
+}
+
+void FrameAccumulator::clear()
+{
+    memset(m_sumF.data(), 0, (size_t)m_sumF.rows() * m_sumF.cols() * sizeof(float));
+    memset(m_sumD.data(), 0, (size_t)m_sumD.rows() * m_sumD.cols() * sizeof(double));
+    memset(m_counts.data(), 0, (size_t)m_counts.rows() * m_counts.cols() * sizeof(uint32_t));
+    m_frames = 0;
+}
+
+int FrameAccumulator::checkShape(MemBlockF& input)
+{
+    int rows = m_doublePrecision ? m_sumD.rows() : m_sumF.rows();
+    int cols = m_doublePrecision ? m_sumD.cols() : m_sumF.cols();
+    if(input.rows() != rows || input.cols() != cols || rows == 0)
+    {
+        LOG4CXX_ERROR(m_logger, "can't add a " << input.rows() << "x" << input.cols() << " frame to "
+            << rows << "x" << cols << " sums");
+        return -1;
+    }
+    return 0;
+}
+
+int FrameAccumulator::add(MemBlockF& input)
+{
+    if(checkShape(input) < 0)
+        return -1;
+    for(int r=0;r<input.rows();++r)
+    {
+        addRow(input, r);
+    }
+    ++m_frames;
+    return 0;
+}
+
+int FrameAccumulator::addP(MemBlockF& input)
+{
+    if(checkShape(input) < 0)
+        return -1;
+    auto fn = boost::bind(&FrameAccumulator::addRowsTBB, this, &input, _1);
+    parallelRows(input.rows(), fn);
+    ++m_frames;
+    return 0;
+}
+
+void FrameAccumulator::addRowsTBB(MemBlockF* pInput, tbb::blocked_range<int> rows)
+{
+    for(int r = rows.begin(); r<rows.end(); ++r)
+    {
+        addRowSIMD(*pInput, r);
+    }
+}
+
+void FrameAccumulator::addRow(MemBlockF& input, int row)
+{
+    const int cols = input.cols();
+    const size_t start = (size_t)row * cols;
+    for(int col=0;col<cols;++col)
+    {
+        float value = input.at(start + col);
+        if(m_countValid)
+        {
+            if(std::isnan(value))
+                continue;
+            ++m_counts.at(start + col);
+        }
+        if(m_doublePrecision)
+            m_sumD.at(start + col) += value;
+        else
+            m_sumF.at(start + col) += value;
+    }
+}
+
+#ifdef __AVX__
+
+void FrameAccumulator::addRowSIMD(MemBlockF& input, int row)
+{
+    // odin frames aren't necessarily aligned, and nor are rows of odd widths
+    const int cols = input.cols();
+    const size_t start = (size_t)row * cols;
+    const float* in = input.data() + start;
+    int col = 0;
+    for(;col+8<=cols;col+=8)
+    {
+        SIMD8f value = Load8fu(in + col);
+        if(m_countValid)
+        {
+            // the valid mask is all-ones, ie -1, so subtracting it counts the frame
+            SIMD8f valid = IsNotNan8f(value);
+            value = And8fm(value, valid);
+            uint32_t* count = m_counts.data() + start + col;
+            Store4iu(count, Sub4i(Load4iu(count), Lo4iOf8i(Cast8fto8i(valid))));
+            Store4iu(count + 4, Sub4i(Load4iu(count + 4), Hi4iOf8i(Cast8fto8i(valid))));
+        }
+        if(m_doublePrecision)
+        {
+            double* sum = m_sumD.data() + start + col;
+            Store4du(sum, Add4d(Load4du(sum), Convert4fto4d(Lo4fOf8f(value))));
+            Store4du(sum + 4, Add4d(Load4du(sum + 4), Convert4fto4d(Hi4fOf8f(value))));
+        }
+        else
+        {
+            float* sum = m_sumF.data() + start + col;
+            Store8fu(sum, Add8f(Load8fu(sum), value));
+        }
+    }
+    for(;col<cols;++col)
+    {
+        float value = in[col];
+        if(m_countValid)
+        {
+            if(std::isnan(value))
+                continue;
+            ++m_counts.data()[start + col];
+        }
+        if(m_doublePrecision)
+            m_sumD.data()[start + col] += value;
+        else
+            m_sumF.data()[start + col] += value;
+    }
+}
+
+#else
+
+void FrameAccumulator::addRowSIMD(MemBlockF& input, int row)
+{
+    addRow(input, row);
+}
+
+#endif
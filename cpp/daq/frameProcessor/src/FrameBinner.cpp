@@ -0,0 +1,150 @@
+#include "FrameBinner.h"
+#include "SIMDMacros.h"
+
+#include <boost/version.hpp>
+#include <boost/bind/bind.hpp>
+
+#if 106000 <= BOOST_VERSION
+using namespace boost::placeholders;
+#endif
+
+#include <cstring>
+
+FrameBinner::FrameBinner()
+{
+    m_logger = log4cxx::Logger::getLogger("FP.FrameBinner");
+}
+
+FrameBinner::~FrameBinner()
+{
+
+}
+
+int FrameBinner::checkShape(MemBlockF& input, MemBlockF& output, int factor)
+{
+    if(factor != 1 && factor != 2 && factor != 4)
+    {
+        LOG4CXX_ERROR(m_logger, "can't bin by " << factor << "; it must be 1, 2 or 4");
+        return -1;
+    }
+    if(output.rows() != input.rows() / factor || output.cols() != input.cols() / factor)
+    {
+        LOG4CXX_ERROR(m_logger, "can't bin a " << input.rows() << "x" << input.cols() << " frame by " << factor
+            << " into " << output.rows() << "x" << output.cols());
+        return -1;
+    }
+    return 0;
+}
+
+int FrameBinner::bin(MemBlockF& input, MemBlockF& output, int factor, bool mean)
+{
+    if(checkShape(input, output, factor) < 0)
+        return -1;
+    float scale = mean ? 1.0f / (factor * factor) : 1.0f;
+    for(int r=0;r<output.rows();++r)
+    {
+        binRow(input, output, factor, scale, r);
+    }
+    return 0;
+}
+
+int FrameBinner::binP(MemBlockF& input, MemBlockF& output, int factor, bool mean)
+{
+    if(checkShape(input, output, factor) < 0)
+        return -1;
+    float scale = mean ? 1.0f / (factor * factor) : 1.0f;
+    auto fn = boost::bind(&FrameBinner::binRowsTBB, this, &input, &output, factor, scale, _1);
+    // each output row reads factor input rows, so keep the input chunks about the same
+    tbb::parallel_for( tbb::blocked_range<int>(0,output.rows(),50/factor), fn, tbb::simple_partitioner());
+    return 0;
+}
+
+void FrameBinner::binRowsTBB(MemBlockF* pInput, MemBlockF* pOutput, int factor, float scale, tbb::blocked_range<int> rows)
+{
+    for(int r = rows.begin(); r<rows.end(); ++r)
+    {
+        binRowSIMD(*pInput, *pOutput, factor, scale, r);
+    }
+}
+
+void FrameBinner::binRow(MemBlockF& input, MemBlockF& output, int factor, float scale, int row)
+{
+    const int cols = input.cols();
+    for(int col=0;col<output.cols();++col)
+    {
+        float sum = 0.0f;
+        for(int dr=0;dr<factor;++dr)
+        {
+            size_t pixel_index = (size_t)(row * factor + dr) * cols + col * factor;
+            for(int dc=0;dc<factor;++dc)
+            {
+                sum += input.at(pixel_index + dc);
+            }
+        }
+        output.at(row, col) = sum * scale;
+    }
+}
+
+#ifdef __AVX__
+
+void FrameBinner::binRowSIMD(MemBlockF& input, MemBlockF& output, int factor, float scale, int row)
+{
+    // odin frames aren't necessarily aligned, so the loads and stores are unaligned ones
+    const int cols = input.cols();
+    const float* in = input.data() + (size_t)row * factor * cols;
+    float* out = output.data() + (size_t)row * output.cols();
+    const SIMD4f scale4 = SetAll4f(scale);
+    int col = 0;
+    if(factor == 1)
+    {
+        memcpy(out, in, cols * sizeof(float));
+        return;
+    }
+    else if(factor == 2)
+    {
+        // 8 input columns make 4 output pixels
+        for(;col+4<=output.cols();col+=4)
+        {
+            SIMD8f v = Add8f(Load8fu(in + col*2), Load8fu(in + cols + col*2));
+            SIMD4f lo = Lo4fOf8f(v);
+            SIMD4f hi = Hi4fOf8f(v);
+            SIMD4f sum = Add4f(EvenOf4f4f(lo, hi), OddOf4f4f(lo, hi));
+            Store4fu(out + col, Multiply4f(sum, scale4));
+        }
+    }
+    else
+    {
+        // 16 input columns make 4 output pixels: pairs first, then pairs of pairs
+        for(;col+4<=output.cols();col+=4)
+        {
+            const float* p = in + col*4;
+            SIMD8f a = Add8f(Add8f(Load8fu(p), Load8fu(p + cols)), Add8f(Load8fu(p + 2*cols), Load8fu(p + 3*cols)));
+            SIMD8f b = Add8f(Add8f(Load8fu(p + 8), Load8fu(p + 8 + cols)), Add8f(Load8fu(p + 8 + 2*cols), Load8fu(p + 8 + 3*cols)));
+            SIMD4f pairsA = Add4f(EvenOf4f4f(Lo4fOf8f(a), Hi4fOf8f(a)), OddOf4f4f(Lo4fOf8f(a), Hi4fOf8f(a)));
+            SIMD4f pairsB = Add4f(EvenOf4f4f(Lo4fOf8f(b), Hi4fOf8f(b)), OddOf4f4f(Lo4fOf8f(b), Hi4fOf8f(b)));
+            SIMD4f sum = Add4f(EvenOf4f4f(pairsA, pairsB), OddOf4f4f(pairsA, pairsB));
+            Store4fu(out + col, Multiply4f(sum, scale4));
+        }
+    }
+    for(;col<output.cols();++col)
+    {
+        float sum = 0.0f;
+        for(int dr=0;dr<factor;++dr)
+        {
+            for(int dc=0;dc<factor;++dc)
+            {
+                sum += in[dr * cols + col * factor + dc];
+            }
+        }
+        out[col] = sum * scale;
+    }
+}
+
+#else
+
+void FrameBinner::binRowSIMD(MemBlockF& input, MemBlockF& output, int factor, float scale, int row)
+{
+    binRow(input, output, factor, scale, row);
+}
+
+#endif
@@ -0,0 +1,195 @@
+#include "FrameCompressor.h"
+#include "SIMDMacros.h"
+
+#include <lz4.h>
+
+#include <boost/version.hpp>
+#include <boost/bind/bind.hpp>
+#include <cstring>
+
+#if 106000 <= BOOST_VERSION
+using namespace boost::placeholders;
+#endif
+
+// these match the defaults in the bitshuffle library
+static const size_t targetBlockBytes = 8192;
+static const size_t minBlockElems = 128;
+static const int maxElemSize = 8;
+
+static inline void writeUint32BE(uint8_t* p, uint32_t val)
+{
+    p[0] = val >> 24; p[1] = val >> 16; p[2] = val >> 8; p[3] = val;
+}
+
+static inline void writeUint64BE(uint8_t* p, uint64_t val)
+{
+    writeUint32BE(p, val >> 32);
+    writeUint32BE(p + 4, val & 0xffffffff);
+}
+
+FrameCompressor::FrameCompressor()
+{
+    m_logger = log4cxx::Logger::getLogger("FP.FrameCompressor");
+}
+
+FrameCompressor::~FrameCompressor()
+{
+
+}
+
+size_t FrameCompressor::blockElems(int elemSize)
+{
+    size_t elems = targetBlockBytes / elemSize;
+    elems -= elems % 8;
+    return std::max(elems, minBlockElems);
+}
+
+void FrameCompressor::bitshuffle(const uint8_t* in, uint8_t* out, uint8_t* tmp, size_t numElems, int elemSize)
+{
+    // first transpose the bytes, so byte j of every element is in row j
+    for(size_t i=0;i<numElems;++i)
+        for(int j=0;j<elemSize;++j)
+            tmp[j*numElems + i] = in[i*elemSize + j];
+
+    // then transpose the bits of each row, so bit k of byte j goes to row j*8+k.
+    // element i lands in bit i%8 of byte i/8 of its row.
+    const size_t rowBytes = numElems / 8;
+    for(int j=0;j<elemSize;++j)
+    {
+        const uint8_t* pIn = tmp + j*numElems;
+        uint8_t* pOut = out + j*8*rowBytes;
+        size_t i = 0;
+#ifdef __AVX__
+        for(;i+16<=numElems;i+=16)
+        {
+            SIMD4i bytes = Load16i8u(pIn + i);
+            for(int k=7;0<=k;--k)
+            {
+                uint16_t bits = MoveMask16i8(bytes);
+                memcpy(pOut + k*rowBytes + i/8, &bits, sizeof(bits));
+                bytes = Add16i8(bytes, bytes);
+            }
+        }
+#endif
+        for(;i<numElems;i+=8)
+        {
+            for(int k=0;k<8;++k)
+            {
+                uint8_t bits = 0;
+                for(int t=0;t<8;++t)
+                    bits |= ((pIn[i+t] >> k) & 1) << t;
+                pOut[k*rowBytes + i/8] = bits;
+            }
+        }
+    }
+}
+
+void FrameCompressor::bitunshuffle(const uint8_t* in, uint8_t* out, uint8_t* tmp, size_t numElems, int elemSize)
+{
+    // this doesn't need to be fast; it's for testing and offline tools.
+    const size_t rowBytes = numElems / 8;
+    for(int j=0;j<elemSize;++j)
+    {
+        for(size_t i=0;i<numElems;++i)
+        {
+            uint8_t byte = 0;
+            for(int k=0;k<8;++k)
+                byte |= ((in[(j*8+k)*rowBytes + i/8] >> (i%8)) & 1) << k;
+            tmp[j*numElems + i] = byte;
+        }
+    }
+
+    for(size_t i=0;i<numElems;++i)
+        for(int j=0;j<elemSize;++j)
+            out[i*elemSize + j] = tmp[j*numElems + i];
+}
+
+int64_t FrameCompressor::compressP(const void* input, size_t nbytes, int elemSize)
+{
+    if(elemSize <= 0 || maxElemSize < elemSize || nbytes % elemSize)
+    {
+        LOG4CXX_ERROR(m_logger, "can not compress " << nbytes << " bytes with element size " << elemSize);
+        return -1;
+    }
+
+    size_t numElems = nbytes / elemSize;
+    m_input = static_cast<const uint8_t*>(input);
+    m_nbytes = nbytes;
+    m_elemSize = elemSize;
+    m_blockElems = blockElems(elemSize);
+    size_t lastElems = numElems % m_blockElems;
+    lastElems -= lastElems % 8;
+    m_numBlocks = numElems / m_blockElems + (lastElems ? 1 : 0);
+    m_slotSize = 4 + LZ4_compressBound(m_blockElems * elemSize);
+
+    // these only allocate the first time, or if the frame grows
+    if(m_scratch.size() < m_numBlocks * m_slotSize)
+        m_scratch.resize(m_numBlocks * m_slotSize);
+    m_blockSizes.resize(m_numBlocks);
+
+    auto fn = boost::bind(&FrameCompressor::compressBlocksTBB, this, m_input, _1);
+    tbb::parallel_for( tbb::blocked_range<int>(0,m_numBlocks,32), fn, tbb::simple_partitioner());
+
+    int64_t total = headerSize;
+    for(int b=0;b<m_numBlocks;++b)
+    {
+        if(m_blockSizes[b] < 0)
+        {
+            LOG4CXX_ERROR(m_logger, "LZ4 failed on block " << b);
+            return -1;
+        }
+        total += m_blockSizes[b];
+    }
+    // the leftover elements are copied raw
+    total += nbytes - (size_t)(numElems - numElems % 8) * elemSize;
+    return total;
+}
+
+void FrameCompressor::compressBlocksTBB(const uint8_t* input, tbb::blocked_range<int> blocks)
+{
+    uint8_t __attribute__ ((aligned (SIMD_MEM_ALIGN))) shuffled[targetBlockBytes];
+    uint8_t __attribute__ ((aligned (SIMD_MEM_ALIGN))) tmp[targetBlockBytes];
+
+    const size_t numElems = m_nbytes / m_elemSize;
+    for(int b=blocks.begin();b<blocks.end();++b)
+    {
+        size_t firstElem = b * m_blockElems;
+        size_t elems = std::min(m_blockElems, numElems - firstElem);
+        elems -= elems % 8;
+        size_t blockBytes = elems * m_elemSize;
+
+        bitshuffle(input + firstElem * m_elemSize, shuffled, tmp, elems, m_elemSize);
+
+        uint8_t* slot = m_scratch.data() + b * m_slotSize;
+        int csize = LZ4_compress_default(reinterpret_cast<const char*>(shuffled), reinterpret_cast<char*>(slot + 4),
+                                         blockBytes, m_slotSize - 4);
+        if(0 < csize)
+        {
+            writeUint32BE(slot, csize);
+            m_blockSizes[b] = 4 + csize;
+        }
+        else
+        {
+            m_blockSizes[b] = -1;
+        }
+    }
+}
+
+void FrameCompressor::gather(void* output)
+{
+    uint8_t* pOut = static_cast<uint8_t*>(output);
+    writeUint64BE(pOut, m_nbytes);
+    writeUint32BE(pOut + 8, m_blockElems * m_elemSize);
+    pOut += headerSize;
+
+    for(int b=0;b<m_numBlocks;++b)
+    {
+        memcpy(pOut, m_scratch.data() + b * m_slotSize, m_blockSizes[b]);
+        pOut += m_blockSizes[b];
+    }
+
+    // the leftover elements go on the end raw; there are none for our frames.
+    size_t numElems = m_nbytes / m_elemSize;
+    size_t shuffledBytes = (numElems - numElems % 8) * m_elemSize;
+    memcpy(pOut, m_input + shuffledBytes, m_nbytes - shuffledBytes);
+}
@@ -0,0 +1,325 @@
+#include "FrameRing.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <cstring>
+#include <new>
+
+#if ATOMIC_LLONG_LOCK_FREE != 2
+#error "the frame ring needs lock-free 64 bit atomics to share them between processes"
+#endif
+
+const uint64_t FrameRingHeader::ringMagic;
+const uint32_t FrameRingHeader::ringVersion;
+const int FrameRingHeader::maxReaders;
+
+// slots start on a page, so readers can hand them to anything that wants alignment
+static size_t roundToPage(size_t bytes)
+{
+    const size_t page = 4096;
+    return (bytes + page - 1) / page * page;
+}
+
+FrameRing::FrameRing() :
+    m_size(0),
+    m_header(nullptr),
+    m_slots(nullptr),
+    m_data(nullptr)
+{
+    m_logger = log4cxx::Logger::getLogger("FP.FrameRing");
+}
+
+FrameRing::~FrameRing()
+{
+    destroy();
+}
+
+int64_t FrameRing::create(std::string name, int numSlots, size_t slotBytes)
+{
+    destroy();
+    if(numSlots < 2 || slotBytes == 0)
+    {
+        LOG4CXX_ERROR(m_logger, "a frame ring needs at least 2 slots, not " << numSlots);
+        return -1;
+    }
+
+    slotBytes = roundToPage(slotBytes);
+    size_t dataOffset = roundToPage(sizeof(FrameRingHeader) + numSlots * sizeof(FrameRingSlot));
+    size_t size = dataOffset + numSlots * slotBytes;
+
+    // a reader still mapping an old ring keeps it until it closes
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if(fd < 0)
+    {
+        LOG4CXX_ERROR(m_logger, "could not create shared memory " << name << ": " << strerror(errno));
+        return -1;
+    }
+    if(ftruncate(fd, size) < 0)
+    {
+        LOG4CXX_ERROR(m_logger, "could not size shared memory " << name << " to " << size << ": " << strerror(errno));
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return -1;
+    }
+    void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mem == MAP_FAILED)
+    {
+        LOG4CXX_ERROR(m_logger, "could not map shared memory " << name << ": " << strerror(errno));
+        shm_unlink(name.c_str());
+        return -1;
+    }
+
+    // ftruncate gave us zeros, so the atomics only need constructing
+    m_header = new(mem) FrameRingHeader;
+    m_header->version = FrameRingHeader::ringVersion;
+    m_header->numSlots = numSlots;
+    m_header->slotBytes = slotBytes;
+    m_header->dataOffset = dataOffset;
+    m_header->written.store(0);
+    for(int i=0;i<FrameRingHeader::maxReaders;++i)
+    {
+        m_header->readers[i].pid.store(0);
+        m_header->readers[i].next.store(0);
+    }
+    m_slots = reinterpret_cast<FrameRingSlot*>(m_header + 1);
+    for(int i=0;i<numSlots;++i)
+    {
+        new(&m_slots[i]) FrameRingSlot;
+        m_slots[i].seq.store(0);
+    }
+    m_data = static_cast<uint8_t*>(mem) + dataOffset;
+    m_header->magic.store(FrameRingHeader::ringMagic, std::memory_order_release);
+
+    m_name = name;
+    m_size = size;
+    LOG4CXX_INFO(m_logger, "created frame ring " << name << " of " << numSlots << " x " << slotBytes << " bytes");
+    return 0;
+}
+
+void FrameRing::destroy()
+{
+    if(m_header)
+    {
+        munmap(m_header, m_size);
+        shm_unlink(m_name.c_str());
+    }
+    m_header = nullptr;
+    m_slots = nullptr;
+    m_data = nullptr;
+    m_size = 0;
+    m_name.clear();
+}
+
+int64_t FrameRing::write(const void* data, size_t bytes, int rows, int cols, int dataType, uint64_t frameNumber)
+{
+    if(!m_header)
+        return -1;
+    if(m_header->slotBytes < bytes)
+    {
+        LOG4CXX_ERROR(m_logger, "frame of " << bytes << " bytes doesn't fit in a " << m_header->slotBytes << " byte slot");
+        return -1;
+    }
+
+    uint64_t n = m_header->written.load(std::memory_order_relaxed);
+    FrameRingSlot& slot = m_slots[n % m_header->numSlots];
+    slot.seq.store(2*n + 1, std::memory_order_relaxed);
+    // nothing below may be seen before the odd sequence
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.frameNumber = frameNumber;
+    slot.dataType = dataType;
+    slot.rows = rows;
+    slot.cols = cols;
+    slot.bytes = bytes;
+    memcpy(m_data + (n % m_header->numSlots) * m_header->slotBytes, data, bytes);
+
+    slot.seq.store(2*n + 2, std::memory_order_release);
+    m_header->written.store(n + 1, std::memory_order_release);
+    return 0;
+}
+
+void FrameRing::reapReaders()
+{
+    for(int i=0;i<FrameRingHeader::maxReaders;++i)
+    {
+        uint64_t pid = m_header->readers[i].pid.load();
+        if(pid && kill(pid, 0) < 0 && errno == ESRCH)
+        {
+            LOG4CXX_INFO(m_logger, "frame ring reader " << pid << " has gone");
+            m_header->readers[i].pid.compare_exchange_strong(pid, 0);
+        }
+    }
+}
+
+int FrameRing::readers()
+{
+    if(!m_header)
+        return 0;
+    reapReaders();
+    int count = 0;
+    for(int i=0;i<FrameRingHeader::maxReaders;++i)
+    {
+        if(m_header->readers[i].pid.load())
+            ++count;
+    }
+    return count;
+}
+
+int FrameRing::slowReaders()
+{
+    if(!m_header)
+        return 0;
+    uint64_t written = m_header->written.load();
+    int count = 0;
+    for(int i=0;i<FrameRingHeader::maxReaders;++i)
+    {
+        if(m_header->readers[i].pid.load() && written - m_header->readers[i].next.load() >= m_header->numSlots)
+            ++count;
+    }
+    return count;
+}
+
+FrameRingReader::FrameRingReader() :
+    m_size(0),
+    m_header(nullptr),
+    m_slots(nullptr),
+    m_data(nullptr),
+    m_entry(-1),
+    m_next(0),
+    m_skipped(0)
+{
+    m_logger = log4cxx::Logger::getLogger("FP.FrameRingReader");
+}
+
+FrameRingReader::~FrameRingReader()
+{
+    close();
+}
+
+int64_t FrameRingReader::open(std::string name)
+{
+    close();
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if(fd < 0)
+    {
+        LOG4CXX_ERROR(m_logger, "could not open shared memory " << name << ": " << strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(FrameRingHeader))
+    {
+        LOG4CXX_ERROR(m_logger, "shared memory " << name << " is not a frame ring");
+        ::close(fd);
+        return -1;
+    }
+    void* mem = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mem == MAP_FAILED)
+    {
+        LOG4CXX_ERROR(m_logger, "could not map shared memory " << name << ": " << strerror(errno));
+        return -1;
+    }
+    m_header = static_cast<FrameRingHeader*>(mem);
+    m_size = st.st_size;
+    if(m_header->magic.load(std::memory_order_acquire) != FrameRingHeader::ringMagic
+       || m_header->version != FrameRingHeader::ringVersion)
+    {
+        LOG4CXX_ERROR(m_logger, "shared memory " << name << " is not a version " << FrameRingHeader::ringVersion << " frame ring");
+        close();
+        return -1;
+    }
+    m_slots = reinterpret_cast<FrameRingSlot*>(m_header + 1);
+    m_data = static_cast<uint8_t*>(mem) + m_header->dataOffset;
+
+    // start with the next frame written
+    m_next = m_header->written.load(std::memory_order_acquire);
+    uint64_t pid = getpid();
+    for(int i=0;i<FrameRingHeader::maxReaders;++i)
+    {
+        uint64_t free = 0;
+        if(m_header->readers[i].pid.compare_exchange_strong(free, pid))
+        {
+            m_entry = i;
+            m_header->readers[i].next.store(m_next);
+            return 0;
+        }
+    }
+    LOG4CXX_ERROR(m_logger, "frame ring " << name << " already has " << FrameRingHeader::maxReaders << " readers");
+    close();
+    return -1;
+}
+
+void FrameRingReader::close()
+{
+    if(m_header)
+    {
+        if(m_entry >= 0)
+            m_header->readers[m_entry].pid.store(0);
+        munmap(m_header, m_size);
+    }
+    m_header = nullptr;
+    m_slots = nullptr;
+    m_data = nullptr;
+    m_entry = -1;
+    m_size = 0;
+}
+
+bool FrameRingReader::next(FrameRingView& view)
+{
+    if(!m_header)
+        return false;
+    const uint64_t numSlots = m_header->numSlots;
+    while(true)
+    {
+        uint64_t written = m_header->written.load(std::memory_order_acquire);
+        if(m_next >= written)
+            return false;
+        // frame 'written' is going into the slot of written - numSlots, so that one is gone too
+        if(written - m_next >= numSlots)
+        {
+            m_skipped += written - numSlots + 1 - m_next;
+            m_next = written - numSlots + 1;
+        }
+
+        FrameRingSlot& slot = m_slots[m_next % numSlots];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if(seq != 2*m_next + 2)
+        {
+            // the writer got there first
+            ++m_skipped;
+            ++m_next;
+            continue;
+        }
+        view.seq = m_next;
+        view.frameNumber = slot.frameNumber;
+        view.dataType = slot.dataType;
+        view.rows = slot.rows;
+        view.cols = slot.cols;
+        view.bytes = slot.bytes;
+        view.data = m_data + (m_next % numSlots) * m_header->slotBytes;
+        ++m_next;
+        m_header->readers[m_entry].next.store(m_next, std::memory_order_relaxed);
+        return true;
+    }
+}
+
+bool FrameRingReader::done(const FrameRingView& view)
+{
+    if(!m_header)
+        return false;
+    // the reads of the data must all be before this
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const FrameRingSlot& slot = m_slots[view.seq % m_header->numSlots];
+    if(slot.seq.load(std::memory_order_relaxed) != 2*view.seq + 2)
+    {
+        ++m_skipped;
+        return false;
+    }
+    return true;
+}
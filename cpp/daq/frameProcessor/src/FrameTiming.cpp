@@ -0,0 +1,39 @@
+#include "FrameTiming.h"
+
+FrameTiming::FrameTiming() :
+    m_rateFrames(0)
+{
+}
+
+void FrameTiming::clear()
+{
+    m_process.clear();
+    m_wait.clear();
+    std::lock_guard<std::mutex> lock(m_rateMutex);
+    m_rateFrames = 0;
+    m_rateTime = std::chrono::steady_clock::time_point();
+}
+
+void FrameTiming::add(uint64_t processNs, int64_t waitNs)
+{
+    m_process.add(processNs);
+    if(0 <= waitNs)
+        m_wait.add(waitNs);
+}
+
+double FrameTiming::framesPerS()
+{
+    auto now = std::chrono::steady_clock::now();
+    uint64_t frames = m_process.count();
+    std::lock_guard<std::mutex> lock(m_rateMutex);
+    double rate = 0.0;
+    if(m_rateTime != std::chrono::steady_clock::time_point())
+    {
+        double s = std::chrono::duration<double>(now - m_rateTime).count();
+        if(0 < s && m_rateFrames <= frames)
+            rate = (frames - m_rateFrames) / s;
+    }
+    m_rateFrames = frames;
+    m_rateTime = now;
+    return rate;
+}
@@ -0,0 +1,193 @@
+#include "GainOccupancy.h"
+#include "SIMDMacros.h"
+
+#include <hdf5.h>
+
+#include <cstring>
+
+// the tests take references to these, so they need a home
+const int GainOccupancy::numGains;
+const int GainOccupancy::flushFrames;
+
+GainOccupancy::GainOccupancy(int rows, int cols) :
+    m_rows(rows),
+    m_cols(cols),
+    m_frames(0),
+    m_rowFrames(rows),
+    m_rowTotals(rows * numGains)
+{
+    m_logger = log4cxx::Logger::getLogger("FP.GainOccupancy");
+    for(int g=0;g<numGains;++g)
+    {
+        m_recent[g].init(m_logger, rows, cols);
+        m_count[g].init(m_logger, rows, cols);
+    }
+    clear();
+}
+
+GainOccupancy::~GainOccupancy()
+{
+
+}
+
+void GainOccupancy::clear()
+{
+    for(int g=0;g<numGains;++g)
+    {
+        memset(m_recent[g].data(), 0, (size_t)m_rows * m_cols);
+        memset(m_count[g].data(), 0, (size_t)m_rows * m_cols * sizeof(uint32_t));
+    }
+    std::fill(m_rowFrames.begin(), m_rowFrames.end(), 0);
+    for(auto& total : m_rowTotals)
+        total.store(0);
+    m_frames = 0;
+}
+
+void GainOccupancy::flushRow(int row)
+{
+    const size_t start = (size_t)row * m_cols;
+    for(int g=0;g<numGains;++g)
+    {
+        uint8_t* recent = m_recent[g].data() + start;
+        uint32_t* count = m_count[g].data() + start;
+        for(int col=0;col<m_cols;++col)
+        {
+            count[col] += recent[col];
+        }
+        memset(recent, 0, m_cols);
+    }
+    m_rowFrames[row] = 0;
+}
+
+void GainOccupancy::addRow(MemBlockI16& gain, int row)
+{
+    const size_t start = (size_t)row * m_cols;
+    uint64_t totals[numGains] = {};
+    for(int col=0;col<m_cols;++col)
+    {
+        int g = gain.at(start + col) & 3;
+        ++m_recent[g].at(start + col);
+        ++totals[g];
+    }
+    for(int g=0;g<numGains;++g)
+        m_rowTotals[row * numGains + g].fetch_add(totals[g], std::memory_order_relaxed);
+    if(++m_rowFrames[row] == flushFrames)
+        flushRow(row);
+}
+
+#ifdef __AVX__
+
+void GainOccupancy::addRowSIMD(MemBlockI16& gain, int row)
+{
+    // 16 gains are packed into bytes, then each gain's bytes subtract its all-ones mask
+    const size_t start = (size_t)row * m_cols;
+    const uint16_t* pGain = gain.data() + start;
+    const SIMD4i one = SetAll16i8(1);
+    SIMD4i gains[numGains];
+    SIMD4i sums[numGains];
+    for(int g=0;g<numGains;++g)
+    {
+        gains[g] = SetAll16i8(g);
+        sums[g] = SetAll16i8(0);
+    }
+    int col = 0;
+    for(;col+16<=m_cols;col+=16)
+    {
+        SIMD4i packed = Pack8i16x2to16i8(Load4iu(pGain + col), Load4iu(pGain + col + 8));
+        for(int g=0;g<numGains;++g)
+        {
+            SIMD4i is = Equal16i8(packed, gains[g]);
+            uint8_t* recent = m_recent[g].data() + start + col;
+            Store16i8u(recent, Sub16i8(Load16i8u(recent), is));
+            sums[g] = Add2i64(sums[g], SumOf16i8(And4i(is, one)));
+        }
+    }
+
+    uint64_t __attribute__ ((aligned (16))) lanes[2];
+    uint64_t totals[numGains];
+    for(int g=0;g<numGains;++g)
+    {
+        Store4i(lanes, sums[g]);
+        totals[g] = lanes[0] + lanes[1];
+    }
+    for(;col<m_cols;++col)
+    {
+        int g = pGain[col] & 3;
+        ++m_recent[g].data()[start + col];
+        ++totals[g];
+    }
+    for(int g=0;g<numGains;++g)
+        m_rowTotals[row * numGains + g].fetch_add(totals[g], std::memory_order_relaxed);
+    if(++m_rowFrames[row] == flushFrames)
+        flushRow(row);
+}
+
+#else
+
+void GainOccupancy::addRowSIMD(MemBlockI16& gain, int row)
+{
+    addRow(gain, row);
+}
+
+#endif
+
+uint32_t GainOccupancy::count(int gain, int row, int col)
+{
+    return m_count[gain].at(row, col) + m_recent[gain].at(row, col);
+}
+
+double GainOccupancy::percent(int gain)
+{
+    uint64_t totals[numGains] = {};
+    uint64_t all = 0;
+    for(int r=0;r<m_rows;++r)
+    {
+        for(int g=0;g<numGains;++g)
+        {
+            uint64_t total = m_rowTotals[r * numGains + g].load(std::memory_order_relaxed);
+            totals[g] += total;
+            all += total;
+        }
+    }
+    return all ? 100.0 * totals[gain] / all : 0.0;
+}
+
+int64_t GainOccupancy::saveToH5(std::string filename)
+{
+    hid_t fh = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if(fh < 0)
+    {
+        LOG4CXX_ERROR(m_logger, "could not create " << filename);
+        return -1;
+    }
+
+    herr_t status = 0;
+    hsize_t dims[2] = {(hsize_t)m_rows, (hsize_t)m_cols};
+    hid_t space = H5Screate_simple(2, dims, NULL);
+    std::vector<uint32_t> counts((size_t)m_rows * m_cols);
+    for(int g=0;g<numGains;++g)
+    {
+        for(size_t i=0;i<counts.size();++i)
+            counts[i] = m_count[g].data()[i] + m_recent[g].data()[i];
+        std::string name = "g" + std::to_string(g) + "_count";
+        hid_t dset = H5Dcreate(fh, name.c_str(), H5T_NATIVE_UINT32, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        status |= H5Dwrite(dset, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, counts.data());
+        H5Dclose(dset);
+    }
+    H5Sclose(space);
+
+    uint64_t frames = m_frames;
+    space = H5Screate(H5S_SCALAR);
+    hid_t dset = H5Dcreate(fh, "frames", H5T_NATIVE_UINT64, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    status |= H5Dwrite(dset, H5T_NATIVE_UINT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, &frames);
+    H5Dclose(dset);
+    H5Sclose(space);
+    status |= H5Fclose(fh);
+    if(status < 0)
+    {
+        LOG4CXX_ERROR(m_logger, "could not save gain occupancy to " << filename);
+        return -1;
+    }
+    LOG4CXX_INFO(m_logger, "saved gain occupancy of " << frames << " frames to " << filename);
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+// the tests take references to these, so they need a home
+const int LatencyHistogram::subBits;
+const int LatencyHistogram::numBuckets;
+
+LatencyHistogram::LatencyHistogram()
+{
+    clear();
+}
+
+void LatencyHistogram::clear()
+{
+    for(auto& bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucketOf(uint64_t ns)
+{
+    const uint64_t subCount = 1 << subBits;
+    if(ns < subCount)
+        return ns;
+    // the top bit picks the power of 2, and the subBits below it the bucket in it
+    int top = 63 - __builtin_clzll(ns);
+    int shift = top - subBits;
+    return ((shift + 1) << subBits) + ((ns >> shift) & (subCount - 1));
+}
+
+uint64_t LatencyHistogram::bucketTop(int bucket)
+{
+    const int subCount = 1 << subBits;
+    if(bucket < subCount)
+        return bucket;
+    int shift = (bucket >> subBits) - 1;
+    uint64_t bottom = (uint64_t)(subCount + (bucket & (subCount - 1))) << shift;
+    return bottom + ((uint64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::add(uint64_t ns)
+{
+    m_buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while(max < ns && !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+        ;
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    uint64_t total = 0;
+    for(auto& bucket : m_buckets)
+        total += bucket.load(std::memory_order_relaxed);
+    return total;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    uint64_t counts[numBuckets];
+    uint64_t total = 0;
+    for(int i=0;i<numBuckets;++i)
+    {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if(total == 0)
+        return 0;
+
+    // nearest-rank, counting from 1
+    uint64_t rank = (uint64_t)std::ceil(p / 100.0 * total);
+    rank = rank < 1 ? 1 : rank > total ? total : rank;
+    uint64_t seen = 0;
+    for(int i=0;i<numBuckets;++i)
+    {
+        seen += counts[i];
+        if(rank <= seen)
+            return std::min(bucketTop(i), max());
+    }
+    return max();
+}
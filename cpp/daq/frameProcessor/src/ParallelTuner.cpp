@@ -0,0 +1,139 @@
+#include "ParallelTuner.h"
+#include "CalibratorSample.h"
+#include "CalibratorReset.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+
+// push_back takes a reference to this, so it needs a home
+const int ParallelSettings::defaultThreads;
+
+ParallelTuner::ParallelTuner(int rows, int cols) :
+    m_repeats(5),
+    m_rows(rows),
+    m_cols(cols)
+{
+    m_logger = log4cxx::Logger::getLogger("FP.ParallelTuner");
+    m_grains = {8, 25, 50, 100, 150, 300};
+    for(int p=0;p<ParallelSettings::ePartitionerMax;++p)
+        m_partitioners.push_back(p);
+    // powers of 2, the old fixed count, and every hardware thread
+    int hardware = std::max(1u, std::thread::hardware_concurrency());
+    for(int t=1;t<hardware;t*=2)
+        m_threads.push_back(t);
+    if(ParallelSettings::defaultThreads < hardware)
+        m_threads.push_back(ParallelSettings::defaultThreads);
+    m_threads.push_back(hardware);
+    std::sort(m_threads.begin(), m_threads.end());
+    m_threads.erase(std::unique(m_threads.begin(), m_threads.end()), m_threads.end());
+}
+
+ParallelTuner::Trial ParallelTuner::tune(Calibrator& calibrator, std::function<void()> prepare, std::function<void()> run)
+{
+    ParallelSettings original = calibrator.getParallel();
+    Trial best = {original, -1.0};
+    std::vector<double> times(m_repeats);
+    m_trials.clear();
+    for(int threads : m_threads)
+    {
+        for(int partitioner : m_partitioners)
+        {
+            for(int grain : m_grains)
+            {
+                calibrator.setParallel({grain, partitioner, threads});
+                prepare();
+                run();
+                for(int i=0;i<m_repeats;++i)
+                {
+                    prepare();
+                    auto t1 = std::chrono::steady_clock::now();
+                    run();
+                    auto t2 = std::chrono::steady_clock::now();
+                    times[i] = std::chrono::duration<double, std::milli>(t2 - t1).count();
+                }
+                std::sort(times.begin(), times.end());
+                Trial trial = {calibrator.getParallel(), times[times.size() / 2]};
+                m_trials.push_back(trial);
+                LOG4CXX_DEBUG(m_logger, "grain " << grain << " " << ParallelSettings::partitionerName(partitioner)
+                              << " threads " << threads << ": " << trial.msPerFrame << " ms");
+                if(best.msPerFrame < 0 || trial.msPerFrame < best.msPerFrame)
+                    best = trial;
+            }
+        }
+    }
+    calibrator.setParallel(best.settings);
+    return best;
+}
+
+ParallelTuner::Trial ParallelTuner::tuneSample()
+{
+    CalibratorSample calib(m_rows, m_cols);
+    MemBlockI16 frame, input;
+    MemBlockF output;
+    frame.init(m_logger, m_rows, m_cols);
+    input.init(m_logger, m_rows, m_cols);
+    output.init(m_logger, m_rows, m_cols);
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+    std::uniform_int_distribution<int> fine(0, 255), coarse(0, 31), gainPick(0, 99);
+    for(int i=0;i<m_rows*m_cols;++i)
+    {
+        calib.m_Gc.at(i) = 1.0f + jitter(rng);
+        calib.m_Oc.at(i) = 16.0f + jitter(rng);
+        calib.m_Gf.at(i) = 1.0f/32 + jitter(rng)/32;
+        calib.m_Of.at(i) = 128.0f + jitter(rng);
+        calib.m_Ped0.at(i) = 100.0f;
+        calib.m_Ped1.at(i) = 200.0f;
+        calib.m_Ped2.at(i) = 300.0f;
+        calib.m_Gain0.at(i) = 1.0f + jitter(rng);
+        calib.m_Gain1.at(i) = 0.1f;
+        calib.m_Gain2.at(i) = 0.01f;
+        calib.m_resetFrame.at(i) = 50.0f;
+        int p = gainPick(rng);
+        uint16_t gain = p < 90 ? 0 : p < 96 ? 1 : p < 99 ? 2 : 3;
+        frame.at(i) = (gain << 13) | (fine(rng) << 5) | coarse(rng);
+    }
+
+    // processFrameP writes the gains over its input, so it gets a fresh copy each time
+    const size_t bytes = (size_t)m_rows * m_cols * sizeof(uint16_t);
+    Trial best = tune(calib,
+                      [&]() { memcpy(input.data(), frame.data(), bytes); },
+                      [&]() { calib.processFrameP(input, output); });
+    LOG4CXX_INFO(m_logger, "sample calibration is fastest with grain " << best.settings.grain << ", "
+                 << ParallelSettings::partitionerName(best.settings.partitioner) << " partitioner and "
+                 << best.settings.threads << " threads: " << best.msPerFrame << " ms/frame");
+    return best;
+}
+
+ParallelTuner::Trial ParallelTuner::tuneReset()
+{
+    CalibratorReset calib(m_rows, m_cols);
+    MemBlockI16 input;
+    MemBlockF output;
+    input.init(m_logger, m_rows, m_cols);
+    output.init(m_logger, m_rows, m_cols);
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+    std::uniform_int_distribution<int> fine(0, 255), coarse(0, 31);
+    for(int i=0;i<m_rows*m_cols;++i)
+    {
+        calib.m_Gc.at(i) = 1.0f + jitter(rng);
+        calib.m_Oc.at(i) = 16.0f + jitter(rng);
+        calib.m_Gf.at(i) = 1.0f/32 + jitter(rng)/32;
+        calib.m_Of.at(i) = 128.0f + jitter(rng);
+        input.at(i) = (fine(rng) << 5) | coarse(rng);
+    }
+
+    Trial best = tune(calib,
+                      [&]() {},
+                      [&]() { calib.processFrameP(input, output); });
+    LOG4CXX_INFO(m_logger, "reset calibration is fastest with grain " << best.settings.grain << ", "
+                 << ParallelSettings::partitionerName(best.settings.partitioner) << " partitioner and "
+                 << best.settings.threads << " threads: " << best.msPerFrame << " ms/frame");
+    return best;
+}
@@ -8,6 +8,7 @@
 #include "PercivalCalibPlugin.h"
 #include "percival_version.h"
 #include "SIMDMacros.h"
+#include "gettime.h"
 
 #include <FrameMetaData.h>
 #include <DataBlockFrame.h>
@@ -19,6 +20,7 @@
 #include <log4cxx/helpers/exception.h>
 #include <log4cxx/simplelayout.h>
 
+#include <algorithm>
 #include <thread>
 #include <chrono>
 
@@ -42,16 +44,149 @@ namespace FrameProcessor
     // if it exists. To switch off darkframe, just supply "off" or "" as the filename.
     const std::string CONFIG_DARKFRAME                 = "darkframe";
 
+    // This chooses what the "ecount" dataset contains: "float" electrons (default),
+    // "half" IEEE float16 electrons, or "photon16" / "photon8" which are integer photon
+    // counts in uint16 / uint8. The half format goes out typed as raw_16bit because
+    // odin-data has no half type, so readers must reinterpret the bits.
+    // "sparse" sends an "events" dataset every frame instead, and a float "ecount"
+    // only every sparsedenseevery frames.
+    const std::string CONFIG_OUTPUTFORMAT              = "outputformat";
+    // These control the photon formats. Photon energy is in eV; a pixel's count is
+    // floor(photons + rounding) so 0.5 rounds to nearest. Counts are clipped to the
+    // saturation value, and NaN pixels are set to the type max (0xff or 0xffff).
+    const std::string CONFIG_PHOTONENERGY              = "photonenergy";
+    const std::string CONFIG_PHOTONROUNDING            = "photonrounding";
+    const std::string CONFIG_PHOTONSATURATION          = "photonsaturation";
+
+    // These control the sparse format. Pixels above the threshold (electrons, after
+    // the darkframe) go in the "events" dataset, which is sparsemaxevents x 3 floats of
+    // (row, col, electrons). Unused rows are -1,-1,0 and events past the max are dropped,
+    // so put the events dataset through PercivalCompressPlugin to get it down to kB.
+    // With sparsecluster the events are the local maxima and their 3x3 sums.
+    // A dense ecount frame goes out every sparsedenseevery frames; 0 means never.
+    const std::string CONFIG_SPARSETHRESHOLD           = "sparsethreshold";
+    const std::string CONFIG_SPARSECLUSTER             = "sparsecluster";
+    const std::string CONFIG_SPARSEDENSEEVERY          = "sparsedenseevery";
+    const std::string CONFIG_SPARSEMAXEVENTS           = "sparsemaxevents";
+
+    // These take darks on-line. Setting darkaccumulate true clears the per-pixel,
+    // per-gain mean and variance and starts adding every calibrated frame to them;
+    // false stops. The frames have the loaded darkframe subtracted, so the means are
+    // residuals. darksave writes them to the given h5 file, with a "darkframe" dataset
+    // of the gain 0 residual plus the darkframe that was loaded when accumulation
+    // started, so it can be loaded with CONFIG_DARKFRAME in place of the old one.
+    // darkinstall true makes that the live darkframe straight away. Changing the
+    // darkframe while accumulating mixes the residuals of the two.
+    const std::string CONFIG_DARKACCUMULATE            = "darkaccumulate";
+    const std::string CONFIG_DARKSAVE                  = "darksave";
+    const std::string CONFIG_DARKINSTALL               = "darkinstall";
+
+    // These count how often each pixel is in each gain mode. Setting gainoccupancy true
+    // clears the counts and starts counting in the calibration itself; false stops.
+    // gainoccupancysave writes g0_count..g3_count to the given h5 file. status() shows
+    // the percentage of pixels in each gain since it started.
+    const std::string CONFIG_GAINOCCUPANCY             = "gainoccupancy";
+    const std::string CONFIG_GAINOCCUPANCYSAVE         = "gainoccupancysave";
+
+    // These make the gain 0 pedestals follow drift during long runs. When pedtrack is
+    // true, every pedtrackinterval frames each gain 0 pixel below pedtrackthreshold
+    // electrons moves its pedestal by pedtrackalpha of its residual (an exponential
+    // moving average). Reloading the constants file puts the pedestals back.
+    const std::string CONFIG_PEDTRACK                  = "pedtrack";
+    const std::string CONFIG_PEDTRACKALPHA             = "pedtrackalpha";
+    const std::string CONFIG_PEDTRACKTHRESHOLD         = "pedtrackthreshold";
+    const std::string CONFIG_PEDTRACKINTERVAL          = "pedtrackinterval";
+
+    // These turn on the per-frame statistics which are summed up inside the calibration
+    // kernel. Each frame gets a "stats" dataset of 1 x 9 floats: the pixel counts in
+    // gain 0,1,2,3, the count at or above statssaturation electrons, the NaN count, then
+    // the sum, mean and max electrons. status() shows the last frame and the aggregates
+    // over the last statswindow frames.
+    const std::string CONFIG_STATS                     = "stats";
+    const std::string CONFIG_STATSSATURATION           = "statssaturation";
+    const std::string CONFIG_STATSWINDOW               = "statswindow";
+
+    static const int statsSize = 9;
+
+    // With gainmap true, the gains go out as a "gain" dataset of 1484 x 352 bytes,
+    // 4 pixels per byte (pixel c in bits 2*(c%4) of byte c/4), and the raw data frame
+    // is not written over.
+    const std::string CONFIG_GAINMAP                   = "gainmap";
+
+    // These are ROIs like PercivalRoiPlugin takes, eg "0,0,100,200;700,300,64,64".
+    // Only the rows they cover are calibrated; the other rows of "ecount" come out as
+    // NaN (or the NaN value of the photon formats). Put PercivalRoiPlugin after this to
+    // cut the ROIs out. An empty string calibrates the whole frame.
+    const std::string CONFIG_ROIS                      = "rois";
+
+    // autotune true times the calibration on a made-up frame with a range of tbb grains,
+    // partitioners and thread counts, and uses the fastest. It takes a few seconds, and
+    // should be done before the frames start. The others set the tbb settings directly;
+    // sent with autotune, they fix that setting and the tuning only tries the rest.
+    // tbbgrain is for the sample frames, tbbresetgrain for the reset frames, and the
+    // partitioner (simple, auto or static) and threads (0 for all) are for both.
+    const std::string CONFIG_AUTOTUNE                  = "autotune";
+    const std::string CONFIG_TBBGRAIN                  = "tbbgrain";
+    const std::string CONFIG_TBBRESETGRAIN             = "tbbresetgrain";
+    const std::string CONFIG_TBBPARTITIONER            = "tbbpartitioner";
+    const std::string CONFIG_TBBTHREADS                = "tbbthreads";
+
+    // perf true counts the cycles, instructions and cache misses of each calibration
+    // with perf_event_open, and status() shows them per pixel for the last perfwindow
+    // frames, next to the bytes per pixel the kernel should move. Give perfpeakgbs the
+    // host's memory bandwidth to see how near each kernel is to its memory-bound roofline.
+    const std::string CONFIG_PERF                      = "perf";
+    const std::string CONFIG_PERFWINDOW                = "perfwindow";
+    const std::string CONFIG_PERFPEAKGBS               = "perfpeakgbs";
+
+    // This is a command: tracesave writes the frame trace of every thread in the FP to
+    // the given file as Chrome trace JSON. It needs the build to have PERCIVAL_TRACE on.
+    const std::string CONFIG_TRACESAVE                 = "tracesave";
+
+    // energy to create one electron-hole pair in silicon
+    static const float eVPerElectron = 3.6f;
+
+    static const std::string outputFormatNames[CalibratorSample::eOutputMax] = {"float", "half", "photon16", "photon8", "sparse"};
+
     PercivalCalibPlugin::PercivalCalibPlugin() :
-    frame_counter_(0),
     concurrent_processes_(1),
     concurrent_rank_(0),
+    m_calibratorSample(FRAME_ROWS, FRAME_COLS),
+    m_calibratorReset(FRAME_ROWS, FRAME_COLS),
+    frame_counter_(0),
     m_loadedConstants(false),
     m_loadedDarkFrame(false),
-    m_calibratorReset(FRAME_ROWS, FRAME_COLS),
-    m_calibratorSample(FRAME_ROWS, FRAME_COLS)
+    m_outputFormat(CalibratorSample::eOutputFloat),
+    m_photonEnergy(8000.0f),
+    m_photonRounding(0.5f),
+    m_photonSaturation(0xfffe),
+    m_sparseThreshold(100.0f),
+    m_sparseCluster(false),
+    m_sparseDenseEvery(100),
+    m_sparseMaxEvents(10000),
+    m_sparseFrames(0),
+    m_sparseLastEvents(0),
+    m_sparseOverflows(0),
+    m_pedTrack(false),
+    m_pedTrackAlpha(0.01f),
+    m_pedTrackThreshold(100.0f),
+    m_pedTrackInterval(10),
+    m_gainMap(false),
+    m_stats(false),
+    m_statsSaturation(1.0e6f),
+    m_statsWindow(100),
+    m_darkAccumulating(false),
+    m_gainOccupancyOn(false),
+    m_autotuned(false),
+    m_autotuneSampleMs(0.0),
+    m_autotuneResetMs(0.0),
+    m_perfPeakGbPerS(0.0)
   {
     logger_ = Logger::getLogger("FP.PercivalCalibPlugin");
+    m_calibratorSample.setPerfCounters(&m_perfSample);
+    m_calibratorReset.setPerfCounters(&m_perfReset);
+    // so the photon formats use the defaults above even if no photon* is ever sent
+    m_calibratorSample.setPhotonConversion(m_photonEnergy / eVPerElectron, m_photonRounding, m_photonSaturation);
 
     LOG4CXX_INFO(logger_, "PercivalCalibPlugin version " << this->get_version_long() << " loaded");
   }
@@ -125,7 +260,7 @@ namespace FrameProcessor
     if (config.has_param(CONFIG_DARKFRAME))
     {
       std::string filename(config.get_param<std::string>(CONFIG_DARKFRAME));
-      m_loadedDarkFrame = false;
+      std::unique_ptr<MemBlockF> dark;
       if(filename=="off" || filename.size()==0)
       {
         LOG4CXX_INFO(logger_, "darkframe off");
@@ -141,12 +276,11 @@ namespace FrameProcessor
             if(rc==0)
             {
                 LOG4CXX_INFO(logger_, "darkframe loaded from " << filename);
-                m_darkFrame.init(logger_, FRAME_ROWS, FRAME_COLS);
+                dark.reset(new MemBlockF);
+                dark->init(logger_, FRAME_ROWS, FRAME_COLS);
                 for(int r=0;r<FRAME_ROWS;++r)
                     for(int c=0;c<FRAME_COLS;++c)
-                        m_darkFrame.at(r,c) = darkFrame.at(r,c);
-
-                m_loadedDarkFrame = true;
+                        dark->at(r,c) = darkFrame.at(r,c);
             }
             else
             {
@@ -158,6 +292,307 @@ namespace FrameProcessor
             LOG4CXX_ERROR(logger_, "can not find/open file: " << filename);
         }
       }
+      // this waits for the frame being calibrated, so the old one can go after it
+      m_calibratorSample.setDarkFrame(dark.get());
+      m_darkFrame.swap(dark);
+      m_loadedDarkFrame = m_darkFrame != nullptr;
+    }
+
+    if (config.has_param(CONFIG_OUTPUTFORMAT))
+    {
+      std::string format(config.get_param<std::string>(CONFIG_OUTPUTFORMAT));
+      int i = 0;
+      while(i < CalibratorSample::eOutputMax && outputFormatNames[i] != format)
+        ++i;
+      if(i < CalibratorSample::eOutputMax)
+      {
+        m_outputFormat = i;
+        LOG4CXX_INFO(logger_, "output format " << format);
+      }
+      else
+      {
+        LOG4CXX_ERROR(logger_, "unknown output format " << format);
+      }
+    }
+
+    if (config.has_param(CONFIG_PHOTONENERGY))
+      m_photonEnergy = config.get_param<double>(CONFIG_PHOTONENERGY);
+    if (config.has_param(CONFIG_PHOTONROUNDING))
+      m_photonRounding = config.get_param<double>(CONFIG_PHOTONROUNDING);
+    if (config.has_param(CONFIG_PHOTONSATURATION))
+      m_photonSaturation = config.get_param<int>(CONFIG_PHOTONSATURATION);
+
+    if (config.has_param(CONFIG_PHOTONENERGY) || config.has_param(CONFIG_PHOTONROUNDING)
+         || config.has_param(CONFIG_PHOTONSATURATION))
+    {
+      m_calibratorSample.setPhotonConversion(m_photonEnergy / eVPerElectron, m_photonRounding, m_photonSaturation);
+    }
+
+    if (config.has_param(CONFIG_DARKACCUMULATE))
+    {
+      bool on = config.get_param<bool>(CONFIG_DARKACCUMULATE);
+      std::lock_guard<std::mutex> lock(m_darkMutex);
+      if(on)
+      {
+        // this is 9 frames of floats, so we only allocate it if someone takes darks
+        if(!m_darkAccumulator)
+          m_darkAccumulator.reset(new DarkAccumulator(FRAME_ROWS, FRAME_COLS));
+        m_darkAccumulator->setParallel(m_calibratorSample.getParallel());
+        m_darkAccumulator->clear();
+        m_darkAccumulator->setSubtracted(m_darkFrame.get());
+      }
+      m_darkAccumulating = on;
+      LOG4CXX_INFO(logger_, "dark accumulation " << (on?"started":"stopped"));
+    }
+
+    if (config.has_param(CONFIG_DARKSAVE))
+    {
+      std::string filename(config.get_param<std::string>(CONFIG_DARKSAVE));
+      // the frames go on accumulating while a copy of the sums is saved
+      std::unique_ptr<DarkAccumulator> darks;
+      {
+        std::lock_guard<std::mutex> lock(m_darkMutex);
+        if(m_darkAccumulator)
+        {
+          darks.reset(new DarkAccumulator(FRAME_ROWS, FRAME_COLS));
+          darks->clone(*m_darkAccumulator);
+        }
+      }
+      if(darks)
+      {
+        rc = darks->saveToH5(filename);
+        if(rc)
+          LOG4CXX_ERROR(logger_, "can not save darks to " << filename);
+      }
+      else
+      {
+        LOG4CXX_ERROR(logger_, "no darks have been accumulated to save");
+      }
+    }
+
+    if (config.has_param(CONFIG_DARKINSTALL) && config.get_param<bool>(CONFIG_DARKINSTALL))
+    {
+      // this already has the darkframe the frames had subtracted added back on
+      std::unique_ptr<MemBlockF> dark;
+      uint64_t frames = 0;
+      {
+        std::lock_guard<std::mutex> lock(m_darkMutex);
+        if(m_darkAccumulator && m_darkAccumulator->frames())
+        {
+          frames = m_darkAccumulator->frames();
+          dark.reset(new MemBlockF);
+          dark->init(logger_, FRAME_ROWS, FRAME_COLS);
+          m_darkAccumulator->getDarkFrame(*dark);
+        }
+      }
+      if(dark)
+      {
+        // as for darkframe=, the old one goes once the calibrator has the new one
+        m_calibratorSample.setDarkFrame(dark.get());
+        m_darkFrame.swap(dark);
+        m_loadedDarkFrame = true;
+        LOG4CXX_INFO(logger_, "darkframe installed from " << frames << " accumulated frames");
+      }
+      else
+      {
+        LOG4CXX_ERROR(logger_, "no darks have been accumulated to install");
+      }
+    }
+
+    if (config.has_param(CONFIG_GAINOCCUPANCY))
+    {
+      bool on = config.get_param<bool>(CONFIG_GAINOCCUPANCY);
+      // this waits for the frame being calibrated, so nothing is adding to it after
+      m_calibratorSample.setGainOccupancy(nullptr);
+      if(on)
+      {
+        // this is 20 bytes a pixel, so only allocate it if someone wants it
+        if(!m_gainOccupancy)
+          m_gainOccupancy.reset(new GainOccupancy(FRAME_ROWS, FRAME_COLS));
+        m_gainOccupancy->clear();
+        m_calibratorSample.setGainOccupancy(m_gainOccupancy.get());
+      }
+      m_gainOccupancyOn = on;
+      LOG4CXX_INFO(logger_, "gain occupancy " << (on?"started":"stopped"));
+    }
+
+    if (config.has_param(CONFIG_GAINOCCUPANCYSAVE))
+    {
+      std::string filename(config.get_param<std::string>(CONFIG_GAINOCCUPANCYSAVE));
+      if(m_gainOccupancy)
+      {
+        rc = m_gainOccupancy->saveToH5(filename);
+        if(rc)
+          LOG4CXX_ERROR(logger_, "can not save gain occupancy to " << filename);
+      }
+      else
+      {
+        LOG4CXX_ERROR(logger_, "no gain occupancy has been counted to save");
+      }
+    }
+
+    if (config.has_param(CONFIG_PEDTRACK))
+      m_pedTrack = config.get_param<bool>(CONFIG_PEDTRACK);
+    if (config.has_param(CONFIG_PEDTRACKALPHA))
+      m_pedTrackAlpha = config.get_param<double>(CONFIG_PEDTRACKALPHA);
+    if (config.has_param(CONFIG_PEDTRACKTHRESHOLD))
+      m_pedTrackThreshold = config.get_param<double>(CONFIG_PEDTRACKTHRESHOLD);
+    if (config.has_param(CONFIG_PEDTRACKINTERVAL))
+      m_pedTrackInterval = config.get_param<int>(CONFIG_PEDTRACKINTERVAL);
+    if (config.has_param(CONFIG_PEDTRACK) || config.has_param(CONFIG_PEDTRACKALPHA)
+         || config.has_param(CONFIG_PEDTRACKTHRESHOLD) || config.has_param(CONFIG_PEDTRACKINTERVAL))
+    {
+      m_calibratorSample.setPedestalTracking(m_pedTrack, m_pedTrackAlpha, m_pedTrackThreshold, m_pedTrackInterval);
+    }
+
+    if (config.has_param(CONFIG_GAINMAP))
+      m_gainMap = config.get_param<bool>(CONFIG_GAINMAP);
+
+    if (config.has_param(CONFIG_STATS))
+      m_stats = config.get_param<bool>(CONFIG_STATS);
+    if (config.has_param(CONFIG_STATSSATURATION))
+      m_statsSaturation = config.get_param<double>(CONFIG_STATSSATURATION);
+    if (config.has_param(CONFIG_STATS) || config.has_param(CONFIG_STATSSATURATION))
+      m_calibratorSample.setStats(m_stats, m_statsSaturation);
+    if (config.has_param(CONFIG_STATSWINDOW))
+    {
+      int window = config.get_param<int>(CONFIG_STATSWINDOW);
+      if(0 < window)
+        m_statsWindow = window;
+      else
+        LOG4CXX_ERROR(logger_, "stats window must be positive, not " << window);
+    }
+
+    if (config.has_param(CONFIG_ROIS))
+    {
+      std::string rois = config.get_param<std::string>(CONFIG_ROIS);
+      if(RoiExtractor::parse(rois, FRAME_ROWS, FRAME_COLS, m_rois) < 0)
+        LOG4CXX_ERROR(logger_, "can't use rois \"" << rois << "\"; they must be row,col,rows,cols;... inside the frame");
+      else
+        m_calibratorSample.setActiveRows(RoiExtractor::rowsCovered(m_rois, FRAME_ROWS));
+    }
+
+    if (config.has_param(CONFIG_SPARSETHRESHOLD))
+      m_sparseThreshold = config.get_param<double>(CONFIG_SPARSETHRESHOLD);
+    if (config.has_param(CONFIG_SPARSECLUSTER))
+      m_sparseCluster = config.get_param<bool>(CONFIG_SPARSECLUSTER);
+    if (config.has_param(CONFIG_SPARSETHRESHOLD) || config.has_param(CONFIG_SPARSECLUSTER))
+      m_calibratorSample.setSparse(m_sparseThreshold, m_sparseCluster);
+
+    if (config.has_param(CONFIG_SPARSEDENSEEVERY))
+      m_sparseDenseEvery = std::max(0, config.get_param<int>(CONFIG_SPARSEDENSEEVERY));
+    if (config.has_param(CONFIG_SPARSEMAXEVENTS))
+    {
+      int maxEvents = config.get_param<int>(CONFIG_SPARSEMAXEVENTS);
+      if(0 < maxEvents)
+        m_sparseMaxEvents = maxEvents;
+      else
+        LOG4CXX_ERROR(logger_, "sparse max events must be positive, not " << maxEvents);
+    }
+
+    configureParallel(config);
+
+    if (config.has_param(CONFIG_PERF))
+    {
+      bool on = config.get_param<bool>(CONFIG_PERF);
+      m_perfSample.setEnabled(on);
+      m_perfReset.setEnabled(on);
+    }
+    if (config.has_param(CONFIG_PERFWINDOW))
+    {
+      int window = config.get_param<int>(CONFIG_PERFWINDOW);
+      if(0 < window)
+      {
+        m_perfSample.setFramesPerWindow(window);
+        m_perfReset.setFramesPerWindow(window);
+      }
+      else
+        LOG4CXX_ERROR(logger_, "perf window must be positive, not " << window);
+    }
+    if (config.has_param(CONFIG_PERFPEAKGBS))
+      m_perfPeakGbPerS = std::max(0.0, config.get_param<double>(CONFIG_PERFPEAKGBS));
+
+    if (config.has_param(CONFIG_TRACESAVE))
+    {
+      std::string filename(config.get_param<std::string>(CONFIG_TRACESAVE));
+      if (!FrameTrace::compiledIn())
+        LOG4CXX_ERROR(logger_, "can't save the frame trace; this was built without PERCIVAL_TRACE");
+      else
+      {
+        long events = FrameTrace::saveJson(filename);
+        if (events < 0)
+          LOG4CXX_ERROR(logger_, "can not save the frame trace to " << filename);
+        else
+          LOG4CXX_INFO(logger_, "saved " << events << " frame trace events to " << filename);
+      }
+    }
+  }
+
+  void PercivalCalibPlugin::configureParallel(OdinData::IpcMessage& config)
+  {
+    ParallelSettings sample = m_calibratorSample.getParallel();
+    ParallelSettings reset = m_calibratorReset.getParallel();
+    bool changed = false;
+    if (config.has_param(CONFIG_TBBGRAIN))
+    {
+      sample.grain = std::max(1, config.get_param<int>(CONFIG_TBBGRAIN));
+      changed = true;
+    }
+    if (config.has_param(CONFIG_TBBRESETGRAIN))
+    {
+      reset.grain = std::max(1, config.get_param<int>(CONFIG_TBBRESETGRAIN));
+      changed = true;
+    }
+    if (config.has_param(CONFIG_TBBPARTITIONER))
+    {
+      std::string name = config.get_param<std::string>(CONFIG_TBBPARTITIONER);
+      int partitioner = ParallelSettings::partitionerFromName(name);
+      if(0 <= partitioner)
+      {
+        sample.partitioner = reset.partitioner = partitioner;
+        changed = true;
+      }
+      else
+        LOG4CXX_ERROR(logger_, "unknown tbb partitioner " << name << "; it can be simple, auto or static");
+    }
+    if (config.has_param(CONFIG_TBBTHREADS))
+    {
+      sample.threads = reset.threads = std::max(0, config.get_param<int>(CONFIG_TBBTHREADS));
+      changed = true;
+    }
+
+    if (config.has_param(CONFIG_AUTOTUNE) && config.get_param<bool>(CONFIG_AUTOTUNE))
+    {
+      LOG4CXX_INFO(logger_, "tuning the tbb settings for the calibration");
+      ParallelTuner tuner(FRAME_ROWS, FRAME_COLS);
+      std::vector<int> grains = tuner.m_grains;
+      if (config.has_param(CONFIG_TBBPARTITIONER))
+        tuner.m_partitioners = {sample.partitioner};
+      if (config.has_param(CONFIG_TBBTHREADS))
+        tuner.m_threads = {sample.threads};
+      tuner.m_grains = config.has_param(CONFIG_TBBGRAIN) ? std::vector<int>{sample.grain} : grains;
+      ParallelTuner::Trial sampleBest = tuner.tuneSample();
+      tuner.m_grains = config.has_param(CONFIG_TBBRESETGRAIN) ? std::vector<int>{reset.grain} : grains;
+      ParallelTuner::Trial resetBest = tuner.tuneReset();
+      sample = sampleBest.settings;
+      reset = resetBest.settings;
+      m_autotuneSampleMs = sampleBest.msPerFrame;
+      m_autotuneResetMs = resetBest.msPerFrame;
+      m_autotuned = true;
+      changed = true;
+    }
+    else if (changed)
+    {
+      m_autotuned = false;
+    }
+
+    if (changed)
+    {
+      m_calibratorSample.setParallel(sample);
+      m_calibratorReset.setParallel(reset);
+      // the dark accumulator goes through the same rows as the sample calibration
+      if(m_darkAccumulator)
+        m_darkAccumulator->setParallel(sample);
     }
   }
 
@@ -173,12 +608,126 @@ namespace FrameProcessor
     status.set_param(get_name() + "/" + CONFIG_DARKFRAME, m_loadedDarkFrame);
 
     status.set_param(get_name() + "/" + CONFIG_CONSTANTSFILE, m_loadedConstants);
+
+    status.set_param(get_name() + "/" + CONFIG_OUTPUTFORMAT, outputFormatNames[m_outputFormat]);
+    status.set_param(get_name() + "/" + CONFIG_PHOTONENERGY, m_photonEnergy);
+    status.set_param(get_name() + "/" + CONFIG_PHOTONROUNDING, m_photonRounding);
+    status.set_param(get_name() + "/" + CONFIG_PHOTONSATURATION, m_photonSaturation);
+    // what the calibrator is really using, in electrons per photon
+    float electronsPerPhoton, rounding;
+    int saturation;
+    m_calibratorSample.getPhotonConversion(electronsPerPhoton, rounding, saturation);
+    status.set_param(get_name() + "/photon_electrons", electronsPerPhoton);
+
+    status.set_param(get_name() + "/" + CONFIG_SPARSETHRESHOLD, m_sparseThreshold);
+    status.set_param(get_name() + "/" + CONFIG_SPARSECLUSTER, m_sparseCluster);
+    status.set_param(get_name() + "/" + CONFIG_SPARSEDENSEEVERY, m_sparseDenseEvery);
+    status.set_param(get_name() + "/" + CONFIG_SPARSEMAXEVENTS, m_sparseMaxEvents);
+    status.set_param(get_name() + "/sparse_last_events", m_sparseLastEvents);
+    status.set_param(get_name() + "/sparse_overflows", m_sparseOverflows);
+
+    status.set_param(get_name() + "/" + CONFIG_PEDTRACK, m_calibratorSample.m_pedTrack);
+    status.set_param(get_name() + "/" + CONFIG_PEDTRACKALPHA, m_pedTrackAlpha);
+    status.set_param(get_name() + "/" + CONFIG_PEDTRACKTHRESHOLD, m_pedTrackThreshold);
+    status.set_param(get_name() + "/" + CONFIG_PEDTRACKINTERVAL, m_pedTrackInterval);
+
+    status.set_param(get_name() + "/" + CONFIG_GAINMAP, m_gainMap);
+    status.set_param(get_name() + "/" + CONFIG_ROIS, RoiExtractor::toString(m_rois));
+
+    status.set_param(get_name() + "/" + CONFIG_STATS, m_stats);
+    status.set_param(get_name() + "/" + CONFIG_STATSSATURATION, m_statsSaturation);
+    status.set_param(get_name() + "/" + CONFIG_STATSWINDOW, m_statsWindow);
+    {
+      std::lock_guard<std::mutex> lock(m_statsHistoryMutex);
+      if(m_statsHistory.size())
+      {
+        const FrameStats& last = m_statsHistory.back();
+        FrameStats total;
+        total.clear();
+        for(auto& stats : m_statsHistory)
+          total.add(stats);
+        double frames = m_statsHistory.size();
+        // only the active rows are counted, so it's out of the pixels calibrated
+        double pixels = std::max(total.pixels(), (uint64_t)1);
+
+        status.set_param(get_name() + "/stats_last/mean", last.mean());
+        status.set_param(get_name() + "/stats_last/max", last.max);
+        status.set_param(get_name() + "/stats_last/saturated", last.saturated);
+        status.set_param(get_name() + "/stats_last/nan", last.nanCount);
+        status.set_param(get_name() + "/stats_window/frames", m_statsHistory.size());
+        status.set_param(get_name() + "/stats_window/mean", total.mean());
+        status.set_param(get_name() + "/stats_window/max", total.max);
+        status.set_param(get_name() + "/stats_window/saturated_per_frame", total.saturated / frames);
+        status.set_param(get_name() + "/stats_window/nan_per_frame", total.nanCount / frames);
+        for(int g=0;g<4;++g)
+        {
+          std::string gain = std::to_string(g);
+          status.set_param(get_name() + "/stats_last/gain" + gain, last.gainCount[g]);
+          status.set_param(get_name() + "/stats_window/gain" + gain + "_percent", 100.0 * total.gainCount[g] / pixels);
+        }
+      }
+    }
+
+    status.set_param(get_name() + "/" + CONFIG_DARKACCUMULATE, m_darkAccumulating.load());
+    {
+      std::lock_guard<std::mutex> lock(m_darkMutex);
+      status.set_param(get_name() + "/dark_frames", m_darkAccumulator ? m_darkAccumulator->frames() : 0);
+    }
+
+    status.set_param(get_name() + "/" + CONFIG_GAINOCCUPANCY, m_gainOccupancyOn);
+    if(m_gainOccupancy)
+    {
+      status.set_param(get_name() + "/gain_occupancy/frames", m_gainOccupancy->frames());
+      for(int g=0;g<GainOccupancy::numGains;++g)
+        status.set_param(get_name() + "/gain_occupancy/gain" + std::to_string(g) + "_percent", m_gainOccupancy->percent(g));
+    }
+
+    status.set_param(get_name() + "/latency/frames", m_latency.count());
+    status.set_param(get_name() + "/latency/p50_us", m_latency.percentile(50) / 1000.0);
+    status.set_param(get_name() + "/latency/p90_us", m_latency.percentile(90) / 1000.0);
+    status.set_param(get_name() + "/latency/p99_us", m_latency.percentile(99) / 1000.0);
+    status.set_param(get_name() + "/latency/max_us", m_latency.max() / 1000.0);
+    timingStatus(status, get_name() + "/timing/", m_timing);
+
+    ParallelSettings sample = m_calibratorSample.getParallel();
+    ParallelSettings reset = m_calibratorReset.getParallel();
+    status.set_param(get_name() + "/" + CONFIG_TBBGRAIN, sample.grain);
+    status.set_param(get_name() + "/" + CONFIG_TBBRESETGRAIN, reset.grain);
+    status.set_param(get_name() + "/" + CONFIG_TBBPARTITIONER, std::string(ParallelSettings::partitionerName(sample.partitioner)));
+    status.set_param(get_name() + "/" + CONFIG_TBBTHREADS, sample.threads);
+    status.set_param(get_name() + "/" + CONFIG_AUTOTUNE, m_autotuned);
+    if(m_autotuned)
+    {
+      status.set_param(get_name() + "/autotune_ms_per_frame", m_autotuneSampleMs);
+      status.set_param(get_name() + "/autotune_reset_ms_per_frame", m_autotuneResetMs);
+    }
+
+    status.set_param(get_name() + "/" + CONFIG_PERF, m_perfSample.enabled());
+    status.set_param(get_name() + "/" + CONFIG_PERFWINDOW, m_perfSample.framesPerWindow());
+    status.set_param(get_name() + "/" + CONFIG_PERFPEAKGBS, m_perfPeakGbPerS);
+    if(m_perfSample.enabled())
+    {
+      status.set_param(get_name() + "/perf/available", m_perfSample.available() || m_perfReset.available());
+      perfStatus(status, get_name() + "/perf/sample/", m_perfSample.lastWindow(), m_calibratorSample.bytesPerPixel(), m_perfPeakGbPerS);
+      perfStatus(status, get_name() + "/perf/reset/", m_perfReset.lastWindow(), m_calibratorReset.bytesPerPixel(), m_perfPeakGbPerS);
+    }
   }
 
   bool PercivalCalibPlugin::reset_statistics()
   {
     LOG4CXX_INFO(logger_, "PercivalCalibPlugin reset_statistics called");
     frame_counter_ = this->concurrent_rank_;
+    m_sparseFrames = 0;
+    m_sparseLastEvents = 0;
+    m_sparseOverflows = 0;
+    {
+      std::lock_guard<std::mutex> lock(m_statsHistoryMutex);
+      m_statsHistory.clear();
+    }
+    m_latency.clear();
+    m_timing.clear();
+    m_perfSample.clear();
+    m_perfReset.clear();
     return true;
   }
 
@@ -207,28 +756,96 @@ namespace FrameProcessor
     return PERCIVAL_VERSION_STR;
   }
 
-#ifdef __AVX__
-  // this is a bit of temporary code we use 'cos it is faster; if we like it,
-  // we will move it. There is still a possibility of using TBB too.
-  static inline void subtractSIMD(MemBlockF& lhs, MemBlockF& rhs)
+  void PercivalCalibPlugin::pushEvents(const FrameMetaData& sampleMetaData)
   {
-     for(int r=0;r<lhs.rows();++r)
-     {
-        for(int c=0;c<lhs.cols();c += 8)
-        {
-            float* plhs1 = &lhs.at(r,c);
-            float* prhs1 = &rhs.at(r,c);
-            SIMD8f lhs1 = Load8f(plhs1);
-            SIMD8f rhs1 = Load8f(prhs1);
-            lhs1 = Sub8f(lhs1,rhs1);
-            Store8f(plhs1,lhs1);
-        }
-     }
+    m_sparseLastEvents = m_events.size();
+    size_t maxEvents = m_sparseMaxEvents;
+    size_t numEvents = m_events.size();
+    if(maxEvents < numEvents)
+    {
+      LOG4CXX_DEBUG(logger_, "frame " << sampleMetaData.get_frame_number() << " has " << numEvents << " events; keeping " << m_sparseMaxEvents);
+      ++m_sparseOverflows;
+      numEvents = maxEvents;
+    }
+
+    FrameMetaData md(sampleMetaData);
+    dimensions_t dims(2); dims[0] = m_sparseMaxEvents; dims[1] = 3;
+    md.set_dataset_name("events");
+    md.set_data_type(FrameProcessor::raw_float);
+    md.set_dimensions(dims);
+    boost::shared_ptr<Frame> evfr(new DataBlockFrame(md, maxEvents * 3 * sizeof(float)));
+
+    float* pOut = static_cast<float*>(evfr->get_data_ptr());
+    for(size_t i=0;i<numEvents;++i)
+    {
+      *pOut++ = m_events[i].row;
+      *pOut++ = m_events[i].col;
+      *pOut++ = m_events[i].value;
+    }
+    for(size_t i=numEvents;i<maxEvents;++i)
+    {
+      *pOut++ = -1.0f;
+      *pOut++ = -1.0f;
+      *pOut++ = 0.0f;
+    }
+    PERCIVAL_TRACE_EVENT(PERCIVAL_TRACE_FRAME(), ePush);
+    this->push(evfr);
+  }
+
+  void PercivalCalibPlugin::pushStats(const FrameMetaData& sampleMetaData)
+  {
+    const FrameStats& stats = m_calibratorSample.m_frameStats;
+    {
+      std::lock_guard<std::mutex> lock(m_statsHistoryMutex);
+      m_statsHistory.push_back(stats);
+      while(m_statsWindow < m_statsHistory.size())
+        m_statsHistory.pop_front();
+    }
+
+    FrameMetaData md(sampleMetaData);
+    dimensions_t dims(2); dims[0] = 1; dims[1] = statsSize;
+    md.set_dataset_name("stats");
+    md.set_data_type(FrameProcessor::raw_float);
+    md.set_dimensions(dims);
+    boost::shared_ptr<Frame> statsfr(new DataBlockFrame(md, statsSize * sizeof(float)));
+
+    float* pOut = static_cast<float*>(statsfr->get_data_ptr());
+    for(int g=0;g<4;++g)
+      *pOut++ = stats.gainCount[g];
+    *pOut++ = stats.saturated;
+    *pOut++ = stats.nanCount;
+    *pOut++ = stats.sum;
+    *pOut++ = stats.mean();
+    *pOut++ = stats.max;
+    PERCIVAL_TRACE_EVENT(PERCIVAL_TRACE_FRAME(), ePush);
+    this->push(statsfr);
+  }
+
+  void PercivalCalibPlugin::addLatency(FrameMetaData& sampleMetaData)
+  {
+    // frames that didn't come through Process2/3 have no start time
+    if(sampleMetaData.has_parameter(PercivalTransport::frame_start_ns_param))
+    {
+      struct timespec now;
+      gettime(&now);
+      uint64_t nowNs = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+      uint64_t startNs = sampleMetaData.get_parameter<uint64_t>(PercivalTransport::frame_start_ns_param);
+      if(startNs <= nowNs)
+        m_latency.add(nowNs - startNs);
+    }
   }
-#endif
 
   void PercivalCalibPlugin::process_frame(boost::shared_ptr<Frame> frame)
   {
+    int64_t waitNs = -1;
+    if(frame->meta_data().has_parameter(PercivalTransport::frame_pushed_ns_param))
+    {
+      struct timespec now;
+      gettime(&now);
+      waitNs = FrameTiming::waitSince(frame->meta_data().get_parameter<uint64_t>(PercivalTransport::frame_pushed_ns_param), FrameTiming::toNs(now));
+    }
+    FrameTiming::Scope timing(m_timing, waitNs);
+    PERCIVAL_TRACE_SPAN(trace, frame->get_meta_data().get_frame_number(), eCalib);
     if(m_loadedConstants == false)
     {
         LOG4CXX_ERROR(logger_, "calibration constants need to be loaded");
@@ -242,26 +859,128 @@ namespace FrameProcessor
         // temp turn this on until reset frame numbers are fixed on the descrambler.
         if(true || frame->get_meta_data().get_frame_number() == m_resetFrameNumber)
         {
-            int sz = dims[0] * dims[1] * sizeof(float);
-            newfr.reset(new DataBlockFrame(frame->get_meta_data(), sz));
-            newfr->meta_data().set_dataset_name("ecount");
-            newfr->meta_data().set_data_type(FrameProcessor::raw_float);
-
             MemBlockI16 in;
-            MemBlockF out;
             in.init(logger_, FRAME_ROWS, FRAME_COLS, frame->get_image_ptr());
-            out.init(logger_, FRAME_ROWS, FRAME_COLS, newfr->get_image_ptr());
 
+            // with the gain map on, the calibrator packs the gains into this frame
+            // and leaves the input alone.
+            boost::shared_ptr<Frame> gainfr;
+            MemBlockI8 gainMap;
+            if(m_gainMap)
+            {
+                FrameMetaData md(frame->get_meta_data());
+                dimensions_t gain_dims(2); gain_dims[0] = FRAME_ROWS; gain_dims[1] = FRAME_COLS / 4;
+                md.set_dataset_name("gain");
+                md.set_data_type(FrameProcessor::raw_8bit);
+                md.set_dimensions(gain_dims);
+                gainfr.reset(new DataBlockFrame(md, FRAME_ROWS * FRAME_COLS / 4));
+                gainMap.init(logger_, FRAME_ROWS, FRAME_COLS / 4, gainfr->get_data_ptr());
+                m_calibratorSample.setGainMap(&gainMap);
+            }
+
+            // the darkframe is subtracted inside the calibrator if it is loaded
             LOG4CXX_TRACE(logger_, "Processing calib frame");
-            m_calibratorSample.processFrameP(in,out);
+            int format = m_outputFormat;
+            PERCIVAL_TRACE_BEGIN(PERCIVAL_TRACE_FRAME(), eCalibSample);
+            // this points at the float electrons whatever the output format. The narrow
+            // formats only keep them as a whole frame if the dark accumulator needs them.
+            MemBlockF calibrated;
+            bool darkAccumulating = m_darkAccumulating;
+            bool narrow = format == CalibratorSample::eOutputHalf || format == CalibratorSample::eOutputPhoton16
+                           || format == CalibratorSample::eOutputPhoton8;
+            if(narrow && darkAccumulating)
+            {
+                if(m_floatFrame.rows() != FRAME_ROWS)
+                    m_floatFrame.init(logger_, FRAME_ROWS, FRAME_COLS);
+                m_calibratorSample.setFloatFrame(&m_floatFrame);
+                calibrated.init(logger_, FRAME_ROWS, FRAME_COLS, m_floatFrame.data());
+            }
+            if(format == CalibratorSample::eOutputHalf || format == CalibratorSample::eOutputPhoton16)
+            {
+                int sz = dims[0] * dims[1] * sizeof(uint16_t);
+                newfr.reset(new DataBlockFrame(frame->get_meta_data(), sz));
+                newfr->meta_data().set_data_type(FrameProcessor::raw_16bit);
+                MemBlockI16 out;
+                out.init(logger_, FRAME_ROWS, FRAME_COLS, newfr->get_image_ptr());
+                if(format == CalibratorSample::eOutputHalf)
+                    m_calibratorSample.processFrameHalfP(in,out);
+                else
+                    m_calibratorSample.processFramePhotonP(in,out);
+            }
+            else if(format == CalibratorSample::eOutputPhoton8)
+            {
+                int sz = dims[0] * dims[1] * sizeof(uint8_t);
+                newfr.reset(new DataBlockFrame(frame->get_meta_data(), sz));
+                newfr->meta_data().set_data_type(FrameProcessor::raw_8bit);
+                MemBlockI8 out;
+                out.init(logger_, FRAME_ROWS, FRAME_COLS, newfr->get_image_ptr());
+                m_calibratorSample.processFramePhotonP(in,out);
+            }
+            else if(format == CalibratorSample::eOutputSparse)
+            {
+                MemBlockF out;
+                if(m_sparseDenseEvery && m_sparseFrames % m_sparseDenseEvery == 0)
+                {
+                    int sz = dims[0] * dims[1] * sizeof(float);
+                    newfr.reset(new DataBlockFrame(frame->get_meta_data(), sz));
+                    newfr->meta_data().set_data_type(FrameProcessor::raw_float);
+                    out.init(logger_, FRAME_ROWS, FRAME_COLS, newfr->get_image_ptr());
+                }
+                else
+                {
+                    if(m_sparseFrame.rows() != FRAME_ROWS)
+                        m_sparseFrame.init(logger_, FRAME_ROWS, FRAME_COLS);
+                    out.init(logger_, FRAME_ROWS, FRAME_COLS, m_sparseFrame.data());
+                }
+                ++m_sparseFrames;
+                m_calibratorSample.processFrameSparseP(in, out, m_events);
+                pushEvents(frame->get_meta_data());
+                calibrated.init(logger_, FRAME_ROWS, FRAME_COLS, out.data());
+            }
+            else
+            {
+                int sz = dims[0] * dims[1] * sizeof(float);
+                newfr.reset(new DataBlockFrame(frame->get_meta_data(), sz));
+                newfr->meta_data().set_data_type(FrameProcessor::raw_float);
+                MemBlockF out;
+                out.init(logger_, FRAME_ROWS, FRAME_COLS, newfr->get_image_ptr());
+                m_calibratorSample.processFrameP(in,out);
+                calibrated.init(logger_, FRAME_ROWS, FRAME_COLS, out.data());
+            }
+
+            m_calibratorSample.setFloatFrame(nullptr);
+            PERCIVAL_TRACE_END(PERCIVAL_TRACE_FRAME(), eCalibSample);
+
+            if(m_stats)
+            {
+                PERCIVAL_TRACE_SPAN(traceStats, PERCIVAL_TRACE_FRAME(), eCalibStats);
+                pushStats(frame->get_meta_data());
+            }
 
-            if(m_loadedDarkFrame)
+            if(darkAccumulating)
             {
-                // out -= m_darkFrame;
-                subtractSIMD(out, m_darkFrame);
+                PERCIVAL_TRACE_SPAN(traceDark, PERCIVAL_TRACE_FRAME(), eCalibDark);
+                std::lock_guard<std::mutex> lock(m_darkMutex);
+                // it may have been stopped while this frame was calibrated
+                if(m_darkAccumulating)
+                    m_darkAccumulator->accumulateP(m_calibratorSample.gainSource(in), calibrated);
             }
 
-            this->push(newfr);
+            if(gainfr)
+            {
+                m_calibratorSample.setGainMap(nullptr);
+                PERCIVAL_TRACE_EVENT(PERCIVAL_TRACE_FRAME(), ePush);
+                this->push(gainfr);
+            }
+
+            // the sparse format only has a dense frame now and then
+            if(newfr)
+            {
+                newfr->meta_data().set_dataset_name("ecount");
+                PERCIVAL_TRACE_EVENT(PERCIVAL_TRACE_FRAME(), ePush);
+                this->push(newfr);
+            }
+            addLatency(frame->meta_data());
         }
         else
         {
@@ -276,12 +995,15 @@ namespace FrameProcessor
         outtemp.init(logger_, FRAME_ROWS, FRAME_COLS);
         // temporary disable reset frame until firmware is fixed
         //m_calibratorReset.processFrameP(in, m_calibratorSample.m_resetFrame);
+        PERCIVAL_TRACE_BEGIN(PERCIVAL_TRACE_FRAME(), eCalibReset);
         m_calibratorReset.processFrameP(in, outtemp);
+        PERCIVAL_TRACE_END(PERCIVAL_TRACE_FRAME(), eCalibReset);
         m_resetFrameNumber = frame->meta_data().get_frame_number();
     }
     else
     {
         // other frames pass onto next stage
+        PERCIVAL_TRACE_EVENT(PERCIVAL_TRACE_FRAME(), ePush);
         this->push(frame);
     }
   }
@@ -0,0 +1,175 @@
+/*
+ * PercivalCompressPlugin.cpp
+ *
+ * This moves the compression out of the single hdf writer thread and into
+ * the tbb thread-pool. See FrameCompressor for the chunk format.
+ */
+
+#include "PercivalCompressPlugin.h"
+#include "percival_version.h"
+
+#include <FrameMetaData.h>
+#include <DataBlockFrame.h>
+
+#include <sstream>
+
+namespace FrameProcessor
+{
+    // This is a comma-separated list of the dataset names to compress, eg "data,reset".
+    // Datasets not in the list are passed on uncompressed. An empty string compresses nothing.
+    const std::string CONFIG_DATASETS                  = "datasets";
+
+    static int elementSize(DataType type)
+    {
+      switch(type)
+      {
+        case raw_8bit: return 1;
+        case raw_16bit: return 2;
+        case raw_32bit: return 4;
+        case raw_64bit: return 8;
+        case raw_float: return 4;
+        default: return 0;
+      }
+    }
+
+    PercivalCompressPlugin::PercivalCompressPlugin() :
+    m_framesCompressed(0),
+    m_bytesIn(0),
+    m_bytesOut(0)
+  {
+    logger_ = Logger::getLogger("FP.PercivalCompressPlugin");
+
+    m_datasets.insert("data");
+    m_datasets.insert("reset");
+    m_datasets.insert("ecount");
+
+    LOG4CXX_INFO(logger_, "PercivalCompressPlugin version " << this->get_version_long() << " loaded");
+  }
+
+  PercivalCompressPlugin::~PercivalCompressPlugin()
+  {
+  }
+
+  /**
+   * Set configuration options for the Percival compression plugin.
+   *
+   * The options are searched for:
+   * CONFIG_DATASETS - the datasets to compress
+   *
+   * \param[in] config - IpcMessage containing configuration data.
+   * \param[out] reply - Response IpcMessage.
+   */
+  void PercivalCompressPlugin::configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply)
+  {
+    LOG4CXX_DEBUG(logger_, "configure() msg: " << config.encode());
+
+    if (config.has_param(CONFIG_DATASETS))
+    {
+      std::stringstream names(config.get_param<std::string>(CONFIG_DATASETS));
+      std::string name;
+      std::set<std::string> datasets;
+      while(std::getline(names, name, ','))
+      {
+        if(name.size())
+        {
+          datasets.insert(name);
+          LOG4CXX_INFO(logger_, "compressing dataset " << name);
+        }
+      }
+      std::lock_guard<std::mutex> lock(m_datasetsMutex);
+      m_datasets.swap(datasets);
+    }
+  }
+
+  void PercivalCompressPlugin::status(OdinData::IpcMessage& status)
+  {
+    LOG4CXX_DEBUG(logger_, "status() called");
+
+    std::string names;
+    {
+      std::lock_guard<std::mutex> lock(m_datasetsMutex);
+      for(auto& name : m_datasets)
+      {
+        names += (names.size() ? "," : "") + name;
+      }
+    }
+    status.set_param(get_name() + "/" + CONFIG_DATASETS, names);
+    status.set_param(get_name() + "/frames_compressed", m_framesCompressed);
+    status.set_param(get_name() + "/ratio", m_bytesOut ? (double)m_bytesIn / m_bytesOut : 0.0);
+  }
+
+  bool PercivalCompressPlugin::reset_statistics()
+  {
+    LOG4CXX_INFO(logger_, "PercivalCompressPlugin reset_statistics called");
+    m_framesCompressed = 0;
+    m_bytesIn = 0;
+    m_bytesOut = 0;
+    return true;
+  }
+
+  int PercivalCompressPlugin::get_version_major()
+  {
+    return PERCIVAL_VERSION_MAJOR;
+  }
+
+  int PercivalCompressPlugin::get_version_minor()
+  {
+    return PERCIVAL_VERSION_MINOR;
+  }
+
+  int PercivalCompressPlugin::get_version_patch()
+  {
+    return PERCIVAL_VERSION_PATCH;
+  }
+
+  std::string PercivalCompressPlugin::get_version_short()
+  {
+    return PERCIVAL_VERSION_STR_SHORT;
+  }
+
+  std::string PercivalCompressPlugin::get_version_long()
+  {
+    return PERCIVAL_VERSION_STR;
+  }
+
+  bool PercivalCompressPlugin::isCompressedDataset(const std::string& name)
+  {
+    std::lock_guard<std::mutex> lock(m_datasetsMutex);
+    return m_datasets.count(name) != 0;
+  }
+
+  void PercivalCompressPlugin::process_frame(boost::shared_ptr<Frame> frame)
+  {
+    const FrameMetaData& md = frame->get_meta_data();
+    if(!isCompressedDataset(md.get_dataset_name()) || md.get_compression_type() != no_compression)
+    {
+      this->push(frame);
+      return;
+    }
+
+    int elemSize = elementSize(md.get_data_type());
+    size_t nbytes = elemSize;
+    for(auto dim : md.get_dimensions())
+      nbytes *= dim;
+
+    int64_t csize = m_compressor.compressP(frame->get_image_ptr(), nbytes, elemSize);
+    if(csize < 0)
+    {
+      LOG4CXX_ERROR(logger_, "compression failed on " << md.get_dataset_name() << " frame " << md.get_frame_number() << "; passing it on uncompressed");
+      this->push(frame);
+      return;
+    }
+
+    FrameMetaData newmd(md);
+    newmd.set_compression_type(bslz4);
+    boost::shared_ptr<Frame> newfr(new DataBlockFrame(newmd, csize));
+    m_compressor.gather(newfr->get_data_ptr());
+
+    ++m_framesCompressed;
+    m_bytesIn += nbytes;
+    m_bytesOut += csize;
+
+    LOG4CXX_TRACE(logger_, "compressed " << md.get_dataset_name() << " " << nbytes << " to " << csize << " bytes");
+    this->push(newfr);
+  }
+} /* namespace FrameProcessor */
@@ -0,0 +1,176 @@
+/*
+ * PercivalDescramblePlugin.cpp
+ *
+ * This does in C++ what python/live_viewer/descrambler.py does for the live view,
+ * so the frames can be calibrated straight away.
+ */
+
+#include "PercivalDescramblePlugin.h"
+#include "percival_version.h"
+
+#include <FrameMetaData.h>
+#include <DataBlockFrame.h>
+
+#include <sstream>
+
+namespace FrameProcessor
+{
+    // This turns the descrambling on or off; it is off by default, as frames that come
+    // through the descrambler board are already in image order.
+    const std::string CONFIG_ENABLE                    = "enable";
+    // This is a comma-separated list of the dataset names to descramble, eg "data,reset".
+    const std::string CONFIG_DATASETS                  = "datasets";
+
+    PercivalDescramblePlugin::PercivalDescramblePlugin() :
+    m_enable(false),
+    m_framesDescrambled(0),
+    m_framesIncomplete(0),
+    m_groupsMissing(0)
+  {
+    logger_ = Logger::getLogger("FP.PercivalDescramblePlugin");
+
+    m_datasets.insert("data");
+    m_datasets.insert("reset");
+
+    LOG4CXX_INFO(logger_, "PercivalDescramblePlugin version " << this->get_version_long() << " loaded");
+  }
+
+  PercivalDescramblePlugin::~PercivalDescramblePlugin()
+  {
+  }
+
+  /**
+   * Set configuration options for the Percival descramble plugin.
+   *
+   * The options are searched for:
+   * CONFIG_ENABLE - descramble frames or not
+   * CONFIG_DATASETS - the datasets to descramble
+   *
+   * \param[in] config - IpcMessage containing configuration data.
+   * \param[out] reply - Response IpcMessage.
+   */
+  void PercivalDescramblePlugin::configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply)
+  {
+    LOG4CXX_DEBUG(logger_, "configure() msg: " << config.encode());
+
+    if (config.has_param(CONFIG_ENABLE))
+    {
+      m_enable = config.get_param<bool>(CONFIG_ENABLE);
+      LOG4CXX_INFO(logger_, "descrambling " << (m_enable?"on":"off"));
+    }
+
+    if (config.has_param(CONFIG_DATASETS))
+    {
+      std::stringstream names(config.get_param<std::string>(CONFIG_DATASETS));
+      std::string name;
+      std::set<std::string> datasets;
+      while(std::getline(names, name, ','))
+      {
+        if(name.size())
+          datasets.insert(name);
+      }
+      std::lock_guard<std::mutex> lock(m_datasetsMutex);
+      m_datasets.swap(datasets);
+    }
+  }
+
+  void PercivalDescramblePlugin::status(OdinData::IpcMessage& status)
+  {
+    LOG4CXX_DEBUG(logger_, "status() called");
+
+    std::string names;
+    {
+      std::lock_guard<std::mutex> lock(m_datasetsMutex);
+      for(auto& name : m_datasets)
+      {
+        names += (names.size() ? "," : "") + name;
+      }
+    }
+    status.set_param(get_name() + "/" + CONFIG_ENABLE, m_enable);
+    status.set_param(get_name() + "/" + CONFIG_DATASETS, names);
+    status.set_param(get_name() + "/frames_descrambled", m_framesDescrambled);
+    status.set_param(get_name() + "/frames_incomplete", m_framesIncomplete);
+    status.set_param(get_name() + "/groups_missing", m_groupsMissing);
+  }
+
+  bool PercivalDescramblePlugin::reset_statistics()
+  {
+    LOG4CXX_INFO(logger_, "PercivalDescramblePlugin reset_statistics called");
+    m_framesDescrambled = 0;
+    m_framesIncomplete = 0;
+    m_groupsMissing = 0;
+    return true;
+  }
+
+  int PercivalDescramblePlugin::get_version_major()
+  {
+    return PERCIVAL_VERSION_MAJOR;
+  }
+
+  int PercivalDescramblePlugin::get_version_minor()
+  {
+    return PERCIVAL_VERSION_MINOR;
+  }
+
+  int PercivalDescramblePlugin::get_version_patch()
+  {
+    return PERCIVAL_VERSION_PATCH;
+  }
+
+  std::string PercivalDescramblePlugin::get_version_short()
+  {
+    return PERCIVAL_VERSION_STR_SHORT;
+  }
+
+  std::string PercivalDescramblePlugin::get_version_long()
+  {
+    return PERCIVAL_VERSION_STR;
+  }
+
+  bool PercivalDescramblePlugin::isDescrambledDataset(const std::string& name)
+  {
+    std::lock_guard<std::mutex> lock(m_datasetsMutex);
+    return m_datasets.count(name) != 0;
+  }
+
+  void PercivalDescramblePlugin::process_frame(boost::shared_ptr<Frame> frame)
+  {
+    const FrameMetaData& md = frame->get_meta_data();
+    if(!m_enable || !isDescrambledDataset(md.get_dataset_name()))
+    {
+      this->push(frame);
+      return;
+    }
+    const dimensions_t& dims = md.get_dimensions();
+    if(md.get_data_type() != raw_16bit || md.get_compression_type() != no_compression
+       || dims.size() != 2 || dims[0] != FRAME_ROWS || dims[1] != FRAME_COLS)
+    {
+      LOG4CXX_ERROR(logger_, "can't descramble frame " << md.get_frame_number() << " of " << md.get_dataset_name()
+                    << "; it isn't an uncompressed " << FRAME_ROWS << "x" << FRAME_COLS << " raw_16bit frame");
+      this->push(frame);
+      return;
+    }
+
+    // the groups are scattered all over their 7 rows, so it can't be done in place
+    boost::shared_ptr<Frame> outfr(new DataBlockFrame(md, FRAME_ROWS * FRAME_COLS * sizeof(uint16_t)));
+    MemBlockI16 in, out;
+    in.init(logger_, FRAME_ROWS, FRAME_COLS, frame->get_image_ptr());
+    out.init(logger_, FRAME_ROWS, FRAME_COLS, outfr->get_data_ptr());
+    int missing = m_descrambler.descrambleP(in, out);
+    if(missing < 0)
+    {
+      LOG4CXX_ERROR(logger_, "can't descramble " << md.get_dataset_name() << " frame " << md.get_frame_number() << "; passing it on as it is");
+      this->push(frame);
+      return;
+    }
+
+    ++m_framesDescrambled;
+    if(missing)
+    {
+      ++m_framesIncomplete;
+      m_groupsMissing += missing;
+      LOG4CXX_DEBUG(logger_, md.get_dataset_name() << " frame " << md.get_frame_number() << " has " << missing << " row groups missing");
+    }
+    this->push(outfr);
+  }
+} /* namespace FrameProcessor */
@@ -0,0 +1,240 @@
+/*
+ * PercivalHistogramPlugin.cpp
+ *
+ * This builds the per-pixel histograms for gain calibration and photon spectra while
+ * the data comes in, instead of in another pass over the files afterwards.
+ */
+
+#include "PercivalHistogramPlugin.h"
+#include "percival_version.h"
+
+#include <FrameMetaData.h>
+
+namespace FrameProcessor
+{
+    // These are the bin edges, a list "0,5,10,50" or "first:last:bins" for even bins.
+    // Setting them clears the histograms.
+    const std::string CONFIG_EDGES                     = "edges";
+    // This is 16 or 32; 16 bit counters stop at 65535.
+    const std::string CONFIG_COUNTERBITS               = "counterbits";
+    // This is the dataset to histogram, float or uint16.
+    const std::string CONFIG_DATASET                   = "dataset";
+    // This is the hdf5 file the histograms are saved to.
+    const std::string CONFIG_FILE                      = "file";
+    // The histograms are saved every this many frames; 0 only saves them when asked.
+    const std::string CONFIG_CHECKPOINT                = "checkpoint";
+    // These are commands: save the histograms now, or clear them.
+    const std::string CONFIG_SAVE                      = "save";
+    const std::string CONFIG_CLEAR                     = "clear";
+
+  PercivalHistogramPlugin::PercivalHistogramPlugin() :
+    m_counterBits(16),
+    m_dataset("ecount"),
+    m_checkpointEvery(0),
+    m_framesAdded(0),
+    m_checkpoints(0)
+  {
+    logger_ = Logger::getLogger("FP.PercivalHistogramPlugin");
+
+    LOG4CXX_INFO(logger_, "PercivalHistogramPlugin version " << this->get_version_long() << " loaded");
+  }
+
+  PercivalHistogramPlugin::~PercivalHistogramPlugin()
+  {
+  }
+
+  /**
+   * Set configuration options for the Percival histogram plugin.
+   *
+   * The options are searched for:
+   * CONFIG_EDGES - the bin edges; histogramming is off until these are set
+   * CONFIG_COUNTERBITS - 16 or 32 bit counters
+   * CONFIG_DATASET - the dataset to histogram
+   * CONFIG_FILE - where to save them
+   * CONFIG_CHECKPOINT - how often to save them
+   * CONFIG_SAVE - save them now
+   * CONFIG_CLEAR - start them again
+   *
+   * \param[in] config - IpcMessage containing configuration data.
+   * \param[out] reply - Response IpcMessage.
+   */
+  void PercivalHistogramPlugin::configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply)
+  {
+    LOG4CXX_DEBUG(logger_, "configure() msg: " << config.encode());
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    bool restart = false;
+    if (config.has_param(CONFIG_EDGES))
+    {
+      std::string edges = config.get_param<std::string>(CONFIG_EDGES);
+      if(PixelHistogram::parseEdges(edges, m_edges) < 0)
+      {
+        LOG4CXX_ERROR(logger_, "can't use edges \"" << edges << "\"; they must be a rising list a,b,c or first:last:bins");
+      }
+      else
+      {
+        m_edgesText = edges;
+        restart = true;
+      }
+    }
+
+    if (config.has_param(CONFIG_COUNTERBITS))
+    {
+      int bits = config.get_param<int>(CONFIG_COUNTERBITS);
+      if(bits == 16 || bits == 32)
+      {
+        m_counterBits = bits;
+        restart = true;
+      }
+      else
+        LOG4CXX_ERROR(logger_, "histogram counters must be 16 or 32 bits, not " << bits);
+    }
+
+    if (config.has_param(CONFIG_DATASET))
+    {
+      m_dataset = config.get_param<std::string>(CONFIG_DATASET);
+      restart = true;
+    }
+
+    if (config.has_param(CONFIG_FILE))
+      m_file = config.get_param<std::string>(CONFIG_FILE);
+
+    if (config.has_param(CONFIG_CHECKPOINT))
+      m_checkpointEvery = std::max(0, config.get_param<int>(CONFIG_CHECKPOINT));
+
+    if (config.has_param(CONFIG_SAVE) && config.get_param<bool>(CONFIG_SAVE))
+      save();
+
+    if (restart)
+    {
+      m_histogram.reset();
+    }
+    else if (config.has_param(CONFIG_CLEAR) && config.get_param<bool>(CONFIG_CLEAR) && m_histogram)
+    {
+      LOG4CXX_INFO(logger_, "clearing the histograms after " << m_histogram->frames() << " frames");
+      m_histogram->clear();
+    }
+  }
+
+  void PercivalHistogramPlugin::save()
+  {
+    if(!m_histogram || m_file.empty())
+    {
+      LOG4CXX_ERROR(logger_, "can't save the histograms; there are none yet, or no file is set");
+      return;
+    }
+    if(m_histogram->saveToH5(m_file) == 0)
+    {
+      ++m_checkpoints;
+      LOG4CXX_INFO(logger_, "saved the histograms of " << m_histogram->frames() << " frames to " << m_file);
+    }
+  }
+
+  void PercivalHistogramPlugin::status(OdinData::IpcMessage& status)
+  {
+    LOG4CXX_DEBUG(logger_, "status() called");
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    status.set_param(get_name() + "/" + CONFIG_EDGES, m_edgesText);
+    status.set_param(get_name() + "/" + CONFIG_COUNTERBITS, m_counterBits);
+    status.set_param(get_name() + "/" + CONFIG_DATASET, m_dataset);
+    status.set_param(get_name() + "/" + CONFIG_FILE, m_file);
+    status.set_param(get_name() + "/" + CONFIG_CHECKPOINT, m_checkpointEvery);
+    status.set_param(get_name() + "/frames_added", m_framesAdded);
+    status.set_param(get_name() + "/frames_in_histograms", m_histogram ? m_histogram->frames() : (uint64_t)0);
+    status.set_param(get_name() + "/out_of_range", m_histogram ? m_histogram->outOfRange() : (uint64_t)0);
+    status.set_param(get_name() + "/checkpoints", m_checkpoints);
+  }
+
+  bool PercivalHistogramPlugin::reset_statistics()
+  {
+    LOG4CXX_INFO(logger_, "PercivalHistogramPlugin reset_statistics called");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_framesAdded = 0;
+    m_checkpoints = 0;
+    return true;
+  }
+
+  int PercivalHistogramPlugin::get_version_major()
+  {
+    return PERCIVAL_VERSION_MAJOR;
+  }
+
+  int PercivalHistogramPlugin::get_version_minor()
+  {
+    return PERCIVAL_VERSION_MINOR;
+  }
+
+  int PercivalHistogramPlugin::get_version_patch()
+  {
+    return PERCIVAL_VERSION_PATCH;
+  }
+
+  std::string PercivalHistogramPlugin::get_version_short()
+  {
+    return PERCIVAL_VERSION_STR_SHORT;
+  }
+
+  std::string PercivalHistogramPlugin::get_version_long()
+  {
+    return PERCIVAL_VERSION_STR;
+  }
+
+  void PercivalHistogramPlugin::process_frame(boost::shared_ptr<Frame> frame)
+  {
+    add(frame->get_meta_data(), frame->get_image_ptr());
+    this->push(frame);
+  }
+
+  boost::shared_ptr<PixelHistogram> PercivalHistogramPlugin::histogram()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_histogram;
+  }
+
+  int64_t PercivalHistogramPlugin::add(const FrameMetaData& md, void* image)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const dimensions_t& dims = md.get_dimensions();
+    DataType type = md.get_data_type();
+    if(m_edges.empty() || md.get_dataset_name() != m_dataset || (type != raw_float && type != raw_16bit)
+       || md.get_compression_type() != no_compression || dims.size() != 2)
+    {
+      return -1;
+    }
+
+    if(!m_histogram)
+    {
+      m_histogram.reset(new PixelHistogram);
+      if(m_histogram->init(dims[0], dims[1], m_edges, m_counterBits) < 0)
+      {
+        LOG4CXX_ERROR(logger_, "can't make the histograms; histogramming is off until the edges are set again");
+        m_histogram.reset();
+        m_edges.clear();
+        return -1;
+      }
+    }
+
+    int64_t rc;
+    if(type == raw_float)
+    {
+      MemBlockF values;
+      values.init(logger_, dims[0], dims[1], image);
+      rc = m_histogram->addP(values);
+    }
+    else
+    {
+      MemBlockI16 values;
+      values.init(logger_, dims[0], dims[1], image);
+      rc = m_histogram->addP(values);
+    }
+    if(rc == 0)
+    {
+      ++m_framesAdded;
+      // this holds up the frames while the file is written, so don't do it too often
+      if(m_checkpointEvery && m_histogram->frames() % m_checkpointEvery == 0)
+        save();
+    }
+    return rc;
+  }
+} /* namespace FrameProcessor */
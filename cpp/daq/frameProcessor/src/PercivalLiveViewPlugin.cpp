@@ -0,0 +1,244 @@
+/*
+ * PercivalLiveViewPlugin.cpp
+ *
+ * This sends small previews to python/live_viewer, so the full frames don't have to
+ * go over the network and be reduced in python.
+ */
+
+#include "PercivalLiveViewPlugin.h"
+#include "percival_version.h"
+
+#include <FrameMetaData.h>
+#include <DataBlockFrame.h>
+
+#include <sstream>
+
+namespace FrameProcessor
+{
+    // This is the ZMQ address the previews are published on, eg "tcp://0.0.0.0:5020".
+    // Nothing is published until it is set, and it can only be set once.
+    const std::string CONFIG_ENDPOINT                  = "endpoint";
+    // This is a comma-separated list of the dataset names to publish, eg "ecount"; they must be floats.
+    const std::string CONFIG_DATASETS                  = "datasets";
+    // The preview is binned by this in both directions: 1, 2 or 4.
+    const std::string CONFIG_BINNING                   = "binning";
+    // This is "mean" or "sum" of each bin.
+    const std::string CONFIG_MODE                      = "mode";
+    // This is the most previews a second to publish; 0 publishes every frame.
+    const std::string CONFIG_PERSECOND                 = "persecond";
+
+  PercivalLiveViewPlugin::PercivalLiveViewPlugin() :
+    m_publishSocket(ZMQ_PUB),
+    m_binning(4),
+    m_mean(true),
+    m_perSecond(2.0),
+    m_framesPublished(0),
+    m_framesSkipped(0)
+  {
+    logger_ = Logger::getLogger("FP.PercivalLiveViewPlugin");
+
+    m_datasets.insert("ecount");
+
+    LOG4CXX_INFO(logger_, "PercivalLiveViewPlugin version " << this->get_version_long() << " loaded");
+  }
+
+  PercivalLiveViewPlugin::~PercivalLiveViewPlugin()
+  {
+    m_publishSocket.close();
+  }
+
+  /**
+   * Set configuration options for the Percival live view plugin.
+   *
+   * The options are searched for:
+   * CONFIG_ENDPOINT - where to publish
+   * CONFIG_DATASETS - the datasets to publish
+   * CONFIG_BINNING - 1, 2 or 4
+   * CONFIG_MODE - mean or sum
+   * CONFIG_PERSECOND - the most previews a second
+   *
+   * \param[in] config - IpcMessage containing configuration data.
+   * \param[out] reply - Response IpcMessage.
+   */
+  void PercivalLiveViewPlugin::configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply)
+  {
+    LOG4CXX_DEBUG(logger_, "configure() msg: " << config.encode());
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (config.has_param(CONFIG_ENDPOINT))
+    {
+      std::string endpoint = config.get_param<std::string>(CONFIG_ENDPOINT);
+      if(m_endpoint.size())
+      {
+        if(endpoint != m_endpoint)
+          LOG4CXX_ERROR(logger_, "live view is already published on " << m_endpoint << "; restart to use " << endpoint);
+      }
+      else
+      {
+        try
+        {
+          m_publishSocket.bind(endpoint.c_str());
+          m_endpoint = endpoint;
+          LOG4CXX_INFO(logger_, "publishing live view on " << m_endpoint);
+        }
+        catch(std::exception& e)
+        {
+          LOG4CXX_ERROR(logger_, "can't bind live view to " << endpoint << ": " << e.what());
+        }
+      }
+    }
+
+    if (config.has_param(CONFIG_BINNING))
+    {
+      int binning = config.get_param<int>(CONFIG_BINNING);
+      if(binning == 1 || binning == 2 || binning == 4)
+        m_binning = binning;
+      else
+        LOG4CXX_ERROR(logger_, "binning must be 1, 2 or 4, not " << binning);
+    }
+
+    if (config.has_param(CONFIG_MODE))
+    {
+      std::string mode = config.get_param<std::string>(CONFIG_MODE);
+      if(mode == "mean" || mode == "sum")
+        m_mean = (mode == "mean");
+      else
+        LOG4CXX_ERROR(logger_, "mode must be mean or sum, not " << mode);
+    }
+
+    if (config.has_param(CONFIG_PERSECOND))
+      m_perSecond = config.get_param<double>(CONFIG_PERSECOND);
+
+    if (config.has_param(CONFIG_DATASETS))
+    {
+      std::stringstream names(config.get_param<std::string>(CONFIG_DATASETS));
+      std::string name;
+      m_datasets.clear();
+      while(std::getline(names, name, ','))
+      {
+        if(name.size())
+          m_datasets.insert(name);
+      }
+    }
+  }
+
+  void PercivalLiveViewPlugin::status(OdinData::IpcMessage& status)
+  {
+    LOG4CXX_DEBUG(logger_, "status() called");
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::string names;
+    for(auto& name : m_datasets)
+    {
+      names += (names.size() ? "," : "") + name;
+    }
+    status.set_param(get_name() + "/" + CONFIG_ENDPOINT, m_endpoint);
+    status.set_param(get_name() + "/" + CONFIG_DATASETS, names);
+    status.set_param(get_name() + "/" + CONFIG_BINNING, m_binning);
+    status.set_param(get_name() + "/" + CONFIG_MODE, std::string(m_mean ? "mean" : "sum"));
+    status.set_param(get_name() + "/" + CONFIG_PERSECOND, m_perSecond);
+    status.set_param(get_name() + "/frames_published", m_framesPublished);
+    status.set_param(get_name() + "/frames_skipped", m_framesSkipped);
+  }
+
+  bool PercivalLiveViewPlugin::reset_statistics()
+  {
+    LOG4CXX_INFO(logger_, "PercivalLiveViewPlugin reset_statistics called");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_framesPublished = 0;
+    m_framesSkipped = 0;
+    return true;
+  }
+
+  int PercivalLiveViewPlugin::get_version_major()
+  {
+    return PERCIVAL_VERSION_MAJOR;
+  }
+
+  int PercivalLiveViewPlugin::get_version_minor()
+  {
+    return PERCIVAL_VERSION_MINOR;
+  }
+
+  int PercivalLiveViewPlugin::get_version_patch()
+  {
+    return PERCIVAL_VERSION_PATCH;
+  }
+
+  std::string PercivalLiveViewPlugin::get_version_short()
+  {
+    return PERCIVAL_VERSION_STR_SHORT;
+  }
+
+  std::string PercivalLiveViewPlugin::get_version_long()
+  {
+    return PERCIVAL_VERSION_STR;
+  }
+
+  // this is the header live_view_producer.py sends, followed by the pixels
+  void PercivalLiveViewPlugin::publish(const FrameMetaData& md, MemBlockF& image)
+  {
+    size_t nbytes = (size_t)image.rows() * image.cols() * sizeof(float);
+    std::stringstream header;
+    header << "{\"frame\": " << md.get_frame_number()
+           << ", \"dtype\": \"float32\""
+           << ", \"dsize\": " << nbytes
+           << ", \"shape\": [" << image.rows() << ", " << image.cols() << "]"
+           << ", \"acquisition_id\": \"" << md.get_acquisition_ID() << "\""
+           << ", \"dataset\": \"" << md.get_dataset_name() << "\""
+           << ", \"compression\": \"none\""
+           << ", \"tags\": [\"lv_data\"]"
+           << ", \"binning\": " << m_binning << "}";
+    std::string headerStr = header.str();
+    m_publishSocket.send(headerStr, ZMQ_SNDMORE);
+    m_publishSocket.send(nbytes, image.data(), 0);
+  }
+
+  void PercivalLiveViewPlugin::process_frame(boost::shared_ptr<Frame> frame)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      preview(frame);
+    }
+    this->push(frame);
+  }
+
+  void PercivalLiveViewPlugin::preview(boost::shared_ptr<Frame> frame)
+  {
+    const FrameMetaData& md = frame->get_meta_data();
+    if(m_endpoint.empty() || m_datasets.count(md.get_dataset_name()) == 0
+       || md.get_data_type() != raw_float || md.get_dimensions().size() != 2)
+      return;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(0 < m_perSecond && m_framesPublished
+       && std::chrono::duration<double>(now - m_lastPublished).count() < 1.0 / m_perSecond)
+    {
+      ++m_framesSkipped;
+      return;
+    }
+
+    MemBlockF image;
+    image.init(logger_, md.get_dimensions()[0], md.get_dimensions()[1], frame->get_image_ptr());
+    try
+    {
+      if(m_binning == 1)
+      {
+        publish(md, image);
+      }
+      else
+      {
+        if(m_preview.rows() != image.rows() / m_binning || m_preview.cols() != image.cols() / m_binning)
+          m_preview.init(logger_, image.rows() / m_binning, image.cols() / m_binning);
+        m_binner.binP(image, m_preview, m_binning, m_mean);
+        publish(md, m_preview);
+      }
+      m_lastPublished = now;
+      ++m_framesPublished;
+    }
+    catch(std::exception& e)
+    {
+      LOG4CXX_ERROR(logger_, "can't publish live view of frame " << md.get_frame_number() << ": " << e.what());
+    }
+  }
+} /* namespace FrameProcessor */
@@ -9,6 +9,7 @@
 #include <PercivalProcess2Plugin.h>
 #include <DataBlockFrame.h>
 #include "percival_version.h"
+#include "gettime.h"
 
 namespace FrameProcessor
 {
@@ -16,11 +17,19 @@ namespace FrameProcessor
     const std::string PercivalProcess2Plugin::CONFIG_PROCESS             = "process";
     const std::string PercivalProcess2Plugin::CONFIG_PROCESS_NUMBER      = "number";
     const std::string PercivalProcess2Plugin::CONFIG_PROCESS_RANK        = "rank";
+    const std::string PercivalProcess2Plugin::CONFIG_PERF                = "perf";
+    const std::string PercivalProcess2Plugin::CONFIG_PERFWINDOW          = "perfwindow";
+    const std::string PercivalProcess2Plugin::CONFIG_PERFPEAKGBS         = "perfpeakgbs";
+    const std::string PercivalProcess2Plugin::CONFIG_TRACESAVE           = "tracesave";
+
+    // each pixel is read and written once for the data frame and once for the reset frame
+    static const int copyBytesPerPixel = 8;
 
     PercivalProcess2Plugin::PercivalProcess2Plugin() :
     frame_base_(UNSET),
     concurrent_processes_(1),
-    concurrent_rank_(0)
+    concurrent_rank_(0),
+    perf_peak_gbs_(0.0)
   {
     logger_ = Logger::getLogger("FP.PercivalProcess2Plugin");
     LOG4CXX_INFO(logger_, "PercivalProcess2Plugin version " << this->get_version_long() << " loaded");
@@ -50,6 +59,39 @@ namespace FrameProcessor
       OdinData::IpcMessage processConfig(config.get_param<const rapidjson::Value&>(PercivalProcess2Plugin::CONFIG_PROCESS));
       this->configureProcess(processConfig, reply);
     }
+
+    if (config.has_param(PercivalProcess2Plugin::CONFIG_PERF))
+      perf_.setEnabled(config.get_param<bool>(PercivalProcess2Plugin::CONFIG_PERF));
+    if (config.has_param(PercivalProcess2Plugin::CONFIG_PERFWINDOW))
+      perf_.setFramesPerWindow(config.get_param<int>(PercivalProcess2Plugin::CONFIG_PERFWINDOW));
+    if (config.has_param(PercivalProcess2Plugin::CONFIG_PERFPEAKGBS))
+      perf_peak_gbs_ = std::max(0.0, config.get_param<double>(PercivalProcess2Plugin::CONFIG_PERFPEAKGBS));
+
+    if (config.has_param(PercivalProcess2Plugin::CONFIG_TRACESAVE)) {
+      std::string filename = config.get_param<std::string>(PercivalProcess2Plugin::CONFIG_TRACESAVE);
+      if (!FrameTrace::compiledIn())
+        LOG4CXX_ERROR(logger_, "can't save the frame trace; this was built without PERCIVAL_TRACE");
+      else {
+        long events = FrameTrace::saveJson(filename);
+        if (events < 0)
+          LOG4CXX_ERROR(logger_, "can not save the frame trace to " << filename);
+        else
+          LOG4CXX_INFO(logger_, "saved " << events << " frame trace events to " << filename);
+      }
+    }
+  }
+
+  void PercivalProcess2Plugin::status(OdinData::IpcMessage& status)
+  {
+    status.set_param(get_name() + "/" + PercivalProcess2Plugin::CONFIG_PERF, perf_.enabled());
+    status.set_param(get_name() + "/" + PercivalProcess2Plugin::CONFIG_PERFWINDOW, perf_.framesPerWindow());
+    status.set_param(get_name() + "/" + PercivalProcess2Plugin::CONFIG_PERFPEAKGBS, perf_peak_gbs_);
+    if (perf_.enabled())
+    {
+      status.set_param(get_name() + "/perf/available", perf_.available());
+      perfStatus(status, get_name() + "/perf/copy/", perf_.lastWindow(), copyBytesPerPixel, perf_peak_gbs_);
+    }
+    timingStatus(status, get_name() + "/timing/", timing_);
   }
 
   /**
@@ -80,6 +122,8 @@ namespace FrameProcessor
   {
     LOG4CXX_INFO(logger_, "PercivalProcess2Plugin reset_statistics called");
     frame_base_ = UNSET;
+    perf_.clear();
+    timing_.clear();
     return true;
   }
 
@@ -160,6 +204,10 @@ namespace FrameProcessor
 
     // Read out the frame header from the raw frame
     const PercivalTransport::FrameHeader* hdrPtr = static_cast<const PercivalTransport::FrameHeader*>(frame->get_data_ptr());
+    struct timespec now;
+    gettime(&now);
+    FrameTiming::Scope timing(timing_, FrameTiming::waitSince(FrameTiming::toNs(hdrPtr->frame_ready_time), FrameTiming::toNs(now)));
+    PERCIVAL_TRACE_SPAN(trace, hdrPtr->frame_number, eProcess2);
     if(frame_base_==UNSET)
     {
         // we need hdrPtr->frame_number + frame_base_ == concurrent_rank_ for this first frame
@@ -173,12 +221,16 @@ namespace FrameProcessor
     FrameMetaData md = frame->meta_data();
     md.set_frame_number(hdrPtr->frame_number);
     md.set_frame_offset(frame_base_);
+    const struct timespec& start = hdrPtr->frame_start_time;
+    md.set_parameter<uint64_t>(PercivalTransport::frame_start_ns_param, (uint64_t)start.tv_sec * 1000000000 + start.tv_nsec);
     processInfoField(hdrPtr, md);
  // keep this for debug   addFrameNumField(hdrPtr, md);
     
     md.set_dimensions(p2m_dims);
     md.set_data_type(FrameProcessor::raw_16bit);
     md.set_dataset_name("data");
+    // the copies are counted, up to the pushes
+    PerfCounters::Frame perfFrame(&perf_, p2m_dims[0] * p2m_dims[1]);
     boost::shared_ptr<Frame> data_frame;
     data_frame.reset(new DataBlockFrame(md, PercivalTransport::data_type_size));
 
@@ -217,10 +269,17 @@ namespace FrameProcessor
         src_ptr += step_pos * bpp;
     }
 
+    perfFrame.end();
+    gettime(&now);
+    reset_frame->meta_data().set_parameter<uint64_t>(PercivalTransport::frame_pushed_ns_param, FrameTiming::toNs(now));
+    data_frame->meta_data().set_parameter<uint64_t>(PercivalTransport::frame_pushed_ns_param, FrameTiming::toNs(now));
+
     LOG4CXX_TRACE(logger_, "Pushing reset frame.");
+    PERCIVAL_TRACE_EVENT(hdrPtr->frame_number, ePush);
     this->push(reset_frame);
 
     LOG4CXX_TRACE(logger_, "Pushing data frame.");
+    PERCIVAL_TRACE_EVENT(hdrPtr->frame_number, ePush);
     this->push(data_frame);
   }
 
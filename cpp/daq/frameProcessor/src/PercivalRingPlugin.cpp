@@ -0,0 +1,189 @@
+/*
+ * PercivalRingPlugin.cpp
+ *
+ * This gives local analysis processes full frames without copying them through
+ * sockets. See FrameRing for the shared memory layout.
+ */
+
+#include "PercivalRingPlugin.h"
+#include "FrameMem.h"
+#include "percival_version.h"
+
+#include <FrameMetaData.h>
+#include <DataBlockFrame.h>
+
+#include <sstream>
+
+namespace FrameProcessor
+{
+    // This is the POSIX shared memory name of the ring, eg "/percival_ecount".
+    // The ring is made when this is set, and nothing is written until then.
+    const std::string CONFIG_NAME                      = "name";
+    // This is how many frames the ring holds; setting it remakes the ring.
+    const std::string CONFIG_SLOTS                     = "slots";
+    // Only every nth frame is written.
+    const std::string CONFIG_EVERYN                    = "everyn";
+    // This is a comma-separated list of the dataset names to write, eg "ecount".
+    const std::string CONFIG_DATASETS                  = "datasets";
+
+    static int elementSize(DataType type)
+    {
+      switch(type)
+      {
+        case raw_8bit: return 1;
+        case raw_16bit: return 2;
+        case raw_32bit: return 4;
+        case raw_64bit: return 8;
+        case raw_float: return 4;
+        default: return 0;
+      }
+    }
+
+  PercivalRingPlugin::PercivalRingPlugin() :
+    m_slots(8),
+    m_everyN(1),
+    m_framesSeen(0),
+    m_framesWritten(0)
+  {
+    logger_ = Logger::getLogger("FP.PercivalRingPlugin");
+
+    m_datasets.insert("ecount");
+
+    LOG4CXX_INFO(logger_, "PercivalRingPlugin version " << this->get_version_long() << " loaded");
+  }
+
+  PercivalRingPlugin::~PercivalRingPlugin()
+  {
+  }
+
+  /**
+   * Set configuration options for the Percival ring plugin.
+   *
+   * The options are searched for:
+   * CONFIG_NAME - the shared memory name
+   * CONFIG_SLOTS - the frames in the ring
+   * CONFIG_EVERYN - which frames to write
+   * CONFIG_DATASETS - the datasets to write
+   *
+   * \param[in] config - IpcMessage containing configuration data.
+   * \param[out] reply - Response IpcMessage.
+   */
+  void PercivalRingPlugin::configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply)
+  {
+    LOG4CXX_DEBUG(logger_, "configure() msg: " << config.encode());
+    // the ring mustn't be destroyed under a frame that's being written
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    bool remake = false;
+    if (config.has_param(CONFIG_NAME))
+    {
+      m_name = config.get_param<std::string>(CONFIG_NAME);
+      remake = true;
+    }
+
+    if (config.has_param(CONFIG_SLOTS))
+    {
+      m_slots = config.get_param<int>(CONFIG_SLOTS);
+      remake = true;
+    }
+
+    if (config.has_param(CONFIG_EVERYN))
+    {
+      int everyN = config.get_param<int>(CONFIG_EVERYN);
+      if(0 < everyN)
+        m_everyN = everyN;
+      else
+        LOG4CXX_ERROR(logger_, "everyn must be at least 1, not " << everyN);
+    }
+
+    if (config.has_param(CONFIG_DATASETS))
+    {
+      std::stringstream names(config.get_param<std::string>(CONFIG_DATASETS));
+      std::string name;
+      m_datasets.clear();
+      while(std::getline(names, name, ','))
+      {
+        if(name.size())
+          m_datasets.insert(name);
+      }
+    }
+
+    if(remake)
+    {
+      m_ring.destroy();
+      // a slot holds a float frame, so it holds any of the calibrated formats
+      if(m_name.size())
+        m_ring.create(m_name, m_slots, FRAME_ROWS * FRAME_COLS * sizeof(float));
+    }
+  }
+
+  void PercivalRingPlugin::status(OdinData::IpcMessage& status)
+  {
+    LOG4CXX_DEBUG(logger_, "status() called");
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::string names;
+    for(auto& name : m_datasets)
+    {
+      names += (names.size() ? "," : "") + name;
+    }
+    status.set_param(get_name() + "/" + CONFIG_NAME, m_name);
+    status.set_param(get_name() + "/" + CONFIG_SLOTS, m_slots);
+    status.set_param(get_name() + "/" + CONFIG_EVERYN, m_everyN);
+    status.set_param(get_name() + "/" + CONFIG_DATASETS, names);
+    status.set_param(get_name() + "/frames_written", m_framesWritten);
+    status.set_param(get_name() + "/readers", m_ring.readers());
+    status.set_param(get_name() + "/slow_readers", m_ring.slowReaders());
+  }
+
+  bool PercivalRingPlugin::reset_statistics()
+  {
+    LOG4CXX_INFO(logger_, "PercivalRingPlugin reset_statistics called");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_framesSeen = 0;
+    m_framesWritten = 0;
+    return true;
+  }
+
+  int PercivalRingPlugin::get_version_major()
+  {
+    return PERCIVAL_VERSION_MAJOR;
+  }
+
+  int PercivalRingPlugin::get_version_minor()
+  {
+    return PERCIVAL_VERSION_MINOR;
+  }
+
+  int PercivalRingPlugin::get_version_patch()
+  {
+    return PERCIVAL_VERSION_PATCH;
+  }
+
+  std::string PercivalRingPlugin::get_version_short()
+  {
+    return PERCIVAL_VERSION_STR_SHORT;
+  }
+
+  std::string PercivalRingPlugin::get_version_long()
+  {
+    return PERCIVAL_VERSION_STR;
+  }
+
+  void PercivalRingPlugin::process_frame(boost::shared_ptr<Frame> frame)
+  {
+    const FrameMetaData& md = frame->get_meta_data();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_ring.isOpen() && m_datasets.count(md.get_dataset_name())
+       && md.get_compression_type() == no_compression && md.get_dimensions().size() == 2
+       && m_framesSeen++ % m_everyN == 0)
+    {
+      const dimensions_t& dims = md.get_dimensions();
+      size_t nbytes = elementSize(md.get_data_type()) * dims[0] * dims[1];
+      if(m_ring.write(frame->get_image_ptr(), nbytes, dims[0], dims[1], md.get_data_type(), md.get_frame_number()) == 0)
+        ++m_framesWritten;
+    }
+    lock.unlock();
+    this->push(frame);
+  }
+} /* namespace FrameProcessor */
@@ -0,0 +1,185 @@
+/*
+ * PercivalRoiPlugin.cpp
+ *
+ * This is for experiments which only use a few regions of the sensor, so they
+ * don't have to write whole frames.
+ */
+
+#include "PercivalRoiPlugin.h"
+#include "FrameMem.h"
+#include "percival_version.h"
+
+#include <FrameMetaData.h>
+#include <DataBlockFrame.h>
+
+#include <sstream>
+
+namespace FrameProcessor
+{
+    // This is the list of ROIs, each row,col,rows,cols, separated by ';'
+    // eg "0,0,100,200;700,300,64,64". They must be inside a 1484 x 1408 frame.
+    const std::string CONFIG_ROIS                      = "rois";
+    // This is a comma-separated list of the dataset names to cut ROIs from, eg "ecount".
+    const std::string CONFIG_DATASETS                  = "datasets";
+    // If this is false the full frames of those datasets are dropped.
+    const std::string CONFIG_PASSFULL                  = "passfull";
+
+    static int elementSize(DataType type)
+    {
+      switch(type)
+      {
+        case raw_8bit: return 1;
+        case raw_16bit: return 2;
+        case raw_32bit: return 4;
+        case raw_64bit: return 8;
+        case raw_float: return 4;
+        default: return 0;
+      }
+    }
+
+  PercivalRoiPlugin::PercivalRoiPlugin() :
+    m_passFull(true),
+    m_framesExtracted(0)
+  {
+    logger_ = Logger::getLogger("FP.PercivalRoiPlugin");
+
+    m_datasets.insert("ecount");
+
+    LOG4CXX_INFO(logger_, "PercivalRoiPlugin version " << this->get_version_long() << " loaded");
+  }
+
+  PercivalRoiPlugin::~PercivalRoiPlugin()
+  {
+  }
+
+  /**
+   * Set configuration options for the Percival ROI plugin.
+   *
+   * The options are searched for:
+   * CONFIG_ROIS - the rectangles to cut out
+   * CONFIG_DATASETS - the datasets to cut them from
+   * CONFIG_PASSFULL - pass the full frames on too
+   *
+   * \param[in] config - IpcMessage containing configuration data.
+   * \param[out] reply - Response IpcMessage.
+   */
+  void PercivalRoiPlugin::configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply)
+  {
+    LOG4CXX_DEBUG(logger_, "configure() msg: " << config.encode());
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (config.has_param(CONFIG_ROIS))
+    {
+      std::string rois = config.get_param<std::string>(CONFIG_ROIS);
+      if(RoiExtractor::parse(rois, FRAME_ROWS, FRAME_COLS, m_rois) < 0)
+        LOG4CXX_ERROR(logger_, "can't use rois \"" << rois << "\"; they must be row,col,rows,cols;... inside the frame");
+      else
+        LOG4CXX_INFO(logger_, "extracting " << m_rois.size() << " rois");
+    }
+
+    if (config.has_param(CONFIG_PASSFULL))
+      m_passFull = config.get_param<bool>(CONFIG_PASSFULL);
+
+    if (config.has_param(CONFIG_DATASETS))
+    {
+      std::stringstream names(config.get_param<std::string>(CONFIG_DATASETS));
+      std::string name;
+      m_datasets.clear();
+      while(std::getline(names, name, ','))
+      {
+        if(name.size())
+          m_datasets.insert(name);
+      }
+    }
+  }
+
+  void PercivalRoiPlugin::status(OdinData::IpcMessage& status)
+  {
+    LOG4CXX_DEBUG(logger_, "status() called");
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::string names;
+    for(auto& name : m_datasets)
+    {
+      names += (names.size() ? "," : "") + name;
+    }
+    status.set_param(get_name() + "/" + CONFIG_ROIS, RoiExtractor::toString(m_rois));
+    status.set_param(get_name() + "/" + CONFIG_DATASETS, names);
+    status.set_param(get_name() + "/" + CONFIG_PASSFULL, m_passFull);
+    status.set_param(get_name() + "/frames_extracted", m_framesExtracted);
+  }
+
+  bool PercivalRoiPlugin::reset_statistics()
+  {
+    LOG4CXX_INFO(logger_, "PercivalRoiPlugin reset_statistics called");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_framesExtracted = 0;
+    return true;
+  }
+
+  int PercivalRoiPlugin::get_version_major()
+  {
+    return PERCIVAL_VERSION_MAJOR;
+  }
+
+  int PercivalRoiPlugin::get_version_minor()
+  {
+    return PERCIVAL_VERSION_MINOR;
+  }
+
+  int PercivalRoiPlugin::get_version_patch()
+  {
+    return PERCIVAL_VERSION_PATCH;
+  }
+
+  std::string PercivalRoiPlugin::get_version_short()
+  {
+    return PERCIVAL_VERSION_STR_SHORT;
+  }
+
+  std::string PercivalRoiPlugin::get_version_long()
+  {
+    return PERCIVAL_VERSION_STR;
+  }
+
+  void PercivalRoiPlugin::process_frame(boost::shared_ptr<Frame> frame)
+  {
+    std::vector<boost::shared_ptr<Frame> > out;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      extract(frame, out);
+    }
+    for(auto& outfr : out)
+      this->push(outfr);
+  }
+
+  void PercivalRoiPlugin::extract(boost::shared_ptr<Frame> frame, std::vector<boost::shared_ptr<Frame> >& out)
+  {
+    const FrameMetaData& md = frame->get_meta_data();
+    const std::string& name = md.get_dataset_name();
+    const dimensions_t& dims = md.get_dimensions();
+    int elemSize = elementSize(md.get_data_type());
+    if(m_rois.empty() || m_datasets.count(name) == 0 || md.get_compression_type() != no_compression
+       || dims.size() != 2 || dims[0] != FRAME_ROWS || dims[1] != FRAME_COLS || elemSize == 0)
+    {
+      out.push_back(frame);
+      return;
+    }
+
+    for(size_t i=0;i<m_rois.size();++i)
+    {
+      const Roi& roi = m_rois[i];
+      FrameMetaData roimd(md);
+      roimd.set_dataset_name(name + "_roi" + std::to_string(i));
+      dimensions_t roidims(2); roidims[0] = roi.rows; roidims[1] = roi.cols;
+      roimd.set_dimensions(roidims);
+      boost::shared_ptr<Frame> roifr(new DataBlockFrame(roimd, (size_t)roi.rows * roi.cols * elemSize));
+      RoiExtractor::extract(frame->get_image_ptr(), dims[1], elemSize, roi, roifr->get_data_ptr());
+      out.push_back(roifr);
+    }
+    ++m_framesExtracted;
+
+    if(m_passFull)
+      out.push_back(frame);
+  }
+} /* namespace FrameProcessor */
@@ -0,0 +1,183 @@
+/*
+ * PercivalSplitPlugin.cpp
+ *
+ * This does live what python/tools/decode_raw_frames_hdf5.py does offline,
+ * for detector-tuning runs.
+ */
+
+#include "PercivalSplitPlugin.h"
+#include "percival_version.h"
+
+#include <FrameMetaData.h>
+#include <DataBlockFrame.h>
+
+#include <sstream>
+
+namespace FrameProcessor
+{
+    // This turns the splitting on or off; it is off by default, so set it per acquisition.
+    const std::string CONFIG_ENABLE                    = "enable";
+    // This is a comma-separated list of the dataset names to split, eg "data,reset".
+    const std::string CONFIG_DATASETS                  = "datasets";
+    // If this is false the raw frames of the split datasets are dropped.
+    const std::string CONFIG_PASSRAW                   = "passraw";
+
+    PercivalSplitPlugin::PercivalSplitPlugin() :
+    m_enable(false),
+    m_passRaw(true),
+    m_framesSplit(0)
+  {
+    logger_ = Logger::getLogger("FP.PercivalSplitPlugin");
+
+    m_datasets.insert("data");
+    m_datasets.insert("reset");
+
+    LOG4CXX_INFO(logger_, "PercivalSplitPlugin version " << this->get_version_long() << " loaded");
+  }
+
+  PercivalSplitPlugin::~PercivalSplitPlugin()
+  {
+  }
+
+  /**
+   * Set configuration options for the Percival split plugin.
+   *
+   * The options are searched for:
+   * CONFIG_ENABLE - split frames or not
+   * CONFIG_DATASETS - the datasets to split
+   * CONFIG_PASSRAW - pass the raw frames on too
+   *
+   * \param[in] config - IpcMessage containing configuration data.
+   * \param[out] reply - Response IpcMessage.
+   */
+  void PercivalSplitPlugin::configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply)
+  {
+    LOG4CXX_DEBUG(logger_, "configure() msg: " << config.encode());
+
+    if (config.has_param(CONFIG_ENABLE))
+    {
+      m_enable = config.get_param<bool>(CONFIG_ENABLE);
+      LOG4CXX_INFO(logger_, "splitting " << (m_enable?"on":"off"));
+    }
+
+    if (config.has_param(CONFIG_PASSRAW))
+      m_passRaw = config.get_param<bool>(CONFIG_PASSRAW);
+
+    if (config.has_param(CONFIG_DATASETS))
+    {
+      std::stringstream names(config.get_param<std::string>(CONFIG_DATASETS));
+      std::string name;
+      std::set<std::string> datasets;
+      while(std::getline(names, name, ','))
+      {
+        if(name.size())
+          datasets.insert(name);
+      }
+      std::lock_guard<std::mutex> lock(m_datasetsMutex);
+      m_datasets.swap(datasets);
+    }
+  }
+
+  void PercivalSplitPlugin::status(OdinData::IpcMessage& status)
+  {
+    LOG4CXX_DEBUG(logger_, "status() called");
+
+    std::string names;
+    {
+      std::lock_guard<std::mutex> lock(m_datasetsMutex);
+      for(auto& name : m_datasets)
+      {
+        names += (names.size() ? "," : "") + name;
+      }
+    }
+    status.set_param(get_name() + "/" + CONFIG_ENABLE, m_enable);
+    status.set_param(get_name() + "/" + CONFIG_DATASETS, names);
+    status.set_param(get_name() + "/" + CONFIG_PASSRAW, m_passRaw);
+    status.set_param(get_name() + "/frames_split", m_framesSplit);
+  }
+
+  bool PercivalSplitPlugin::reset_statistics()
+  {
+    LOG4CXX_INFO(logger_, "PercivalSplitPlugin reset_statistics called");
+    m_framesSplit = 0;
+    return true;
+  }
+
+  int PercivalSplitPlugin::get_version_major()
+  {
+    return PERCIVAL_VERSION_MAJOR;
+  }
+
+  int PercivalSplitPlugin::get_version_minor()
+  {
+    return PERCIVAL_VERSION_MINOR;
+  }
+
+  int PercivalSplitPlugin::get_version_patch()
+  {
+    return PERCIVAL_VERSION_PATCH;
+  }
+
+  std::string PercivalSplitPlugin::get_version_short()
+  {
+    return PERCIVAL_VERSION_STR_SHORT;
+  }
+
+  std::string PercivalSplitPlugin::get_version_long()
+  {
+    return PERCIVAL_VERSION_STR;
+  }
+
+  bool PercivalSplitPlugin::isSplitDataset(const std::string& name)
+  {
+    std::lock_guard<std::mutex> lock(m_datasetsMutex);
+    return m_datasets.count(name) != 0;
+  }
+
+  boost::shared_ptr<Frame> PercivalSplitPlugin::makePlane(const FrameMetaData& rawMetaData, const std::string& name)
+  {
+    FrameMetaData md(rawMetaData);
+    md.set_dataset_name(name);
+    md.set_data_type(FrameProcessor::raw_8bit);
+    return boost::shared_ptr<Frame>(new DataBlockFrame(md, FRAME_ROWS * FRAME_COLS));
+  }
+
+  void PercivalSplitPlugin::process_frame(boost::shared_ptr<Frame> frame)
+  {
+    const FrameMetaData& md = frame->get_meta_data();
+    const std::string& name = md.get_dataset_name();
+    if(!m_enable || !isSplitDataset(name))
+    {
+      this->push(frame);
+      return;
+    }
+    const dimensions_t& dims = md.get_dimensions();
+    if(md.get_data_type() != raw_16bit || md.get_compression_type() != no_compression
+       || dims.size() != 2 || dims[0] != FRAME_ROWS || dims[1] != FRAME_COLS)
+    {
+      LOG4CXX_ERROR(logger_, "can't split frame " << md.get_frame_number() << " of " << name
+                    << "; it isn't an uncompressed " << FRAME_ROWS << "x" << FRAME_COLS << " raw_16bit frame");
+      this->push(frame);
+      return;
+    }
+
+    boost::shared_ptr<Frame> gainfr = makePlane(md, "gain_" + name);
+    boost::shared_ptr<Frame> coarsefr = makePlane(md, "coarse_adc_" + name);
+    boost::shared_ptr<Frame> finefr = makePlane(md, "fine_adc_" + name);
+
+    MemBlockI16 in;
+    MemBlockI8 gain, coarse, fine;
+    in.init(logger_, FRAME_ROWS, FRAME_COLS, frame->get_image_ptr());
+    gain.init(logger_, FRAME_ROWS, FRAME_COLS, gainfr->get_data_ptr());
+    coarse.init(logger_, FRAME_ROWS, FRAME_COLS, coarsefr->get_data_ptr());
+    fine.init(logger_, FRAME_ROWS, FRAME_COLS, finefr->get_data_ptr());
+    m_splitter.splitP(in, gain, coarse, fine);
+    ++m_framesSplit;
+
+    this->push(gainfr);
+    this->push(coarsefr);
+    this->push(finefr);
+    if(m_passRaw)
+      this->push(frame);
+  }
+} /* namespace FrameProcessor */
@@ -0,0 +1,298 @@
+/*
+ * PercivalSumPlugin.cpp
+ *
+ * This is for weak signals, where single frames are mostly noise and only the
+ * integrated frames are worth writing.
+ */
+
+#include "PercivalSumPlugin.h"
+#include "percival_version.h"
+
+#include <FrameMetaData.h>
+#include <DataBlockFrame.h>
+
+#include <algorithm>
+#include <sstream>
+
+namespace FrameProcessor
+{
+    // This is how many frames go into each sum; 0 turns summing off.
+    const std::string CONFIG_FRAMES                    = "frames";
+    // This is "float" or "double", the type of the sums.
+    const std::string CONFIG_PRECISION                 = "precision";
+    // If this is true NaN pixels are left out of the sums and counted.
+    const std::string CONFIG_VALIDCOUNTS               = "validcounts";
+    // This is a comma-separated list of the dataset names to sum, eg "ecount".
+    const std::string CONFIG_DATASETS                  = "datasets";
+    // If this is false the frames that were summed are dropped.
+    const std::string CONFIG_PASSFRAMES                = "passframes";
+    // These are the tbb settings for the sums, as in PercivalCalibPlugin: the rows per
+    // chunk, the partitioner (simple, auto or static) and the threads (0 for all).
+    const std::string CONFIG_TBBGRAIN                  = "tbbgrain";
+    const std::string CONFIG_TBBPARTITIONER            = "tbbpartitioner";
+    const std::string CONFIG_TBBTHREADS                = "tbbthreads";
+
+  PercivalSumPlugin::PercivalSumPlugin() :
+    m_frames(0),
+    m_doublePrecision(false),
+    m_countValid(false),
+    m_passFrames(true),
+    m_parallel{FrameAccumulator::defaultGrain, ParallelSettings::eSimple, ParallelSettings::defaultThreads},
+    m_framesSummed(0),
+    m_sumsEmitted(0)
+  {
+    logger_ = Logger::getLogger("FP.PercivalSumPlugin");
+
+    m_datasets.insert("ecount");
+
+    LOG4CXX_INFO(logger_, "PercivalSumPlugin version " << this->get_version_long() << " loaded");
+  }
+
+  PercivalSumPlugin::~PercivalSumPlugin()
+  {
+  }
+
+  /**
+   * Set configuration options for the Percival sum plugin.
+   *
+   * The options are searched for:
+   * CONFIG_FRAMES - the number of frames in each sum
+   * CONFIG_PRECISION - float or double sums
+   * CONFIG_VALIDCOUNTS - leave out and count NaN pixels
+   * CONFIG_DATASETS - the datasets to sum
+   * CONFIG_PASSFRAMES - pass the frames on as well as the sums
+   * CONFIG_TBBGRAIN, CONFIG_TBBPARTITIONER, CONFIG_TBBTHREADS - how the sums use tbb
+   *
+   * \param[in] config - IpcMessage containing configuration data.
+   * \param[out] reply - Response IpcMessage.
+   */
+  void PercivalSumPlugin::configure(OdinData::IpcMessage& config, OdinData::IpcMessage& reply)
+  {
+    LOG4CXX_DEBUG(logger_, "configure() msg: " << config.encode());
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    bool restart = false;
+    if (config.has_param(CONFIG_FRAMES))
+    {
+      int frames = config.get_param<int>(CONFIG_FRAMES);
+      if(frames < 0)
+      {
+        LOG4CXX_ERROR(logger_, "can't sum " << frames << " frames");
+      }
+      else
+      {
+        m_frames = frames;
+        restart = true;
+        LOG4CXX_INFO(logger_, "summing " << m_frames << " frames");
+      }
+    }
+
+    if (config.has_param(CONFIG_PRECISION))
+    {
+      std::string precision = config.get_param<std::string>(CONFIG_PRECISION);
+      if(precision == "float" || precision == "double")
+      {
+        m_doublePrecision = (precision == "double");
+        restart = true;
+      }
+      else
+        LOG4CXX_ERROR(logger_, "unknown precision " << precision << "; it must be float or double");
+    }
+
+    if (config.has_param(CONFIG_VALIDCOUNTS))
+    {
+      m_countValid = config.get_param<bool>(CONFIG_VALIDCOUNTS);
+      restart = true;
+    }
+
+    if (config.has_param(CONFIG_PASSFRAMES))
+      m_passFrames = config.get_param<bool>(CONFIG_PASSFRAMES);
+
+    if (config.has_param(CONFIG_DATASETS))
+    {
+      std::stringstream names(config.get_param<std::string>(CONFIG_DATASETS));
+      std::string name;
+      m_datasets.clear();
+      while(std::getline(names, name, ','))
+      {
+        if(name.size())
+          m_datasets.insert(name);
+      }
+      restart = true;
+    }
+
+    // these don't change the sums, so the ones going keep going
+    bool parallel = false;
+    if (config.has_param(CONFIG_TBBGRAIN))
+    {
+      m_parallel.grain = std::max(1, config.get_param<int>(CONFIG_TBBGRAIN));
+      parallel = true;
+    }
+    if (config.has_param(CONFIG_TBBPARTITIONER))
+    {
+      std::string name = config.get_param<std::string>(CONFIG_TBBPARTITIONER);
+      int partitioner = ParallelSettings::partitionerFromName(name);
+      if(0 <= partitioner)
+      {
+        m_parallel.partitioner = partitioner;
+        parallel = true;
+      }
+      else
+        LOG4CXX_ERROR(logger_, "unknown tbb partitioner " << name << "; it can be simple, auto or static");
+    }
+    if (config.has_param(CONFIG_TBBTHREADS))
+    {
+      m_parallel.threads = std::max(0, config.get_param<int>(CONFIG_TBBTHREADS));
+      parallel = true;
+    }
+    if(parallel)
+    {
+      for(auto& accumulator : m_accumulators)
+        accumulator.second->setParallel(m_parallel);
+    }
+
+    // the partial sums were made the old way, so throw them away
+    if(restart)
+    {
+      m_accumulators.clear();
+      m_sumsPushed.clear();
+    }
+  }
+
+  void PercivalSumPlugin::status(OdinData::IpcMessage& status)
+  {
+    LOG4CXX_DEBUG(logger_, "status() called");
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::string names;
+    for(auto& name : m_datasets)
+    {
+      names += (names.size() ? "," : "") + name;
+    }
+    status.set_param(get_name() + "/" + CONFIG_FRAMES, m_frames);
+    status.set_param(get_name() + "/" + CONFIG_PRECISION, std::string(m_doublePrecision ? "double" : "float"));
+    status.set_param(get_name() + "/" + CONFIG_VALIDCOUNTS, m_countValid);
+    status.set_param(get_name() + "/" + CONFIG_DATASETS, names);
+    status.set_param(get_name() + "/" + CONFIG_PASSFRAMES, m_passFrames);
+    status.set_param(get_name() + "/" + CONFIG_TBBGRAIN, m_parallel.grain);
+    status.set_param(get_name() + "/" + CONFIG_TBBPARTITIONER, std::string(ParallelSettings::partitionerName(m_parallel.partitioner)));
+    status.set_param(get_name() + "/" + CONFIG_TBBTHREADS, m_parallel.threads);
+    status.set_param(get_name() + "/frames_summed", m_framesSummed);
+    status.set_param(get_name() + "/sums_emitted", m_sumsEmitted);
+  }
+
+  bool PercivalSumPlugin::reset_statistics()
+  {
+    LOG4CXX_INFO(logger_, "PercivalSumPlugin reset_statistics called");
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_framesSummed = 0;
+    m_sumsEmitted = 0;
+    return true;
+  }
+
+  int PercivalSumPlugin::get_version_major()
+  {
+    return PERCIVAL_VERSION_MAJOR;
+  }
+
+  int PercivalSumPlugin::get_version_minor()
+  {
+    return PERCIVAL_VERSION_MINOR;
+  }
+
+  int PercivalSumPlugin::get_version_patch()
+  {
+    return PERCIVAL_VERSION_PATCH;
+  }
+
+  std::string PercivalSumPlugin::get_version_short()
+  {
+    return PERCIVAL_VERSION_STR_SHORT;
+  }
+
+  std::string PercivalSumPlugin::get_version_long()
+  {
+    return PERCIVAL_VERSION_STR;
+  }
+
+  void PercivalSumPlugin::makeSums(const FrameMetaData& md, FrameAccumulator& accumulator, std::vector<boost::shared_ptr<Frame> >& out)
+  {
+    const std::string& name = md.get_dataset_name();
+    const dimensions_t& dims = md.get_dimensions();
+    const size_t pixels = (size_t)dims[0] * dims[1];
+    // each process numbers its own sums, so they don't line up with the frame numbers
+    uint64_t number = m_sumsPushed[name]++;
+
+    FrameMetaData summd(md);
+    summd.set_dataset_name(name + "_sum");
+    summd.set_frame_number(number);
+    summd.set_frame_offset(0);
+    summd.set_data_type(accumulator.doublePrecision() ? raw_64bit : raw_float);
+    size_t bytes = pixels * (accumulator.doublePrecision() ? sizeof(double) : sizeof(float));
+    boost::shared_ptr<Frame> sumfr(new DataBlockFrame(summd, bytes));
+    memcpy(sumfr->get_data_ptr(), accumulator.doublePrecision() ? (void*)accumulator.sumD().data() : (void*)accumulator.sumF().data(), bytes);
+    out.push_back(sumfr);
+
+    if(accumulator.countValid())
+    {
+      FrameMetaData countmd(summd);
+      countmd.set_dataset_name(name + "_count");
+      countmd.set_data_type(raw_32bit);
+      boost::shared_ptr<Frame> countfr(new DataBlockFrame(countmd, pixels * sizeof(uint32_t)));
+      memcpy(countfr->get_data_ptr(), accumulator.counts().data(), pixels * sizeof(uint32_t));
+      out.push_back(countfr);
+    }
+    ++m_sumsEmitted;
+  }
+
+  void PercivalSumPlugin::process_frame(boost::shared_ptr<Frame> frame)
+  {
+    std::vector<boost::shared_ptr<Frame> > out;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      sum(frame, out);
+    }
+    for(auto& outfr : out)
+      this->push(outfr);
+  }
+
+  void PercivalSumPlugin::sum(boost::shared_ptr<Frame> frame, std::vector<boost::shared_ptr<Frame> >& out)
+  {
+    const FrameMetaData& md = frame->get_meta_data();
+    const std::string& name = md.get_dataset_name();
+    const dimensions_t& dims = md.get_dimensions();
+    if(m_frames == 0 || m_datasets.count(name) == 0 || md.get_data_type() != raw_float
+       || md.get_compression_type() != no_compression || dims.size() != 2)
+    {
+      out.push_back(frame);
+      return;
+    }
+
+    boost::shared_ptr<FrameAccumulator>& accumulator = m_accumulators[name];
+    if(!accumulator)
+    {
+      accumulator.reset(new FrameAccumulator);
+      accumulator->init(dims[0], dims[1], m_doublePrecision, m_countValid);
+      accumulator->setParallel(m_parallel);
+    }
+
+    MemBlockF image;
+    image.init(logger_, dims[0], dims[1], frame->get_image_ptr());
+    if(accumulator->addP(image) < 0)
+    {
+      LOG4CXX_ERROR(logger_, "can't sum " << name << " frame " << md.get_frame_number() << "; passing it on as it is");
+      out.push_back(frame);
+      return;
+    }
+    ++m_framesSummed;
+
+    if(m_passFrames)
+      out.push_back(frame);
+
+    if(accumulator->frames() >= m_frames)
+    {
+      makeSums(md, *accumulator, out);
+      accumulator->clear();
+    }
+  }
+} /* namespace FrameProcessor */
@@ -0,0 +1,217 @@
+#include "PerfCounters.h"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// the tests take references to these, so they need a home
+const int PerfCounters::cacheLineBytes;
+
+namespace
+{
+    // one group of counters per thread, led by the cycles, so they're read in one go
+    struct ThreadCounters
+    {
+        int fds[PerfCounters::eNumCounters];
+        bool tried = false;
+        bool ok = false;
+        // Scopes open on this thread; only the outermost one counts
+        int depth = 0;
+
+        ~ThreadCounters()
+        {
+            for(int i=0;ok && i<PerfCounters::eNumCounters;++i)
+                close(fds[i]);
+        }
+
+        bool open()
+        {
+            tried = true;
+            static const uint64_t configs[PerfCounters::eNumCounters] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+            for(int i=0;i<PerfCounters::eNumCounters;++i)
+            {
+                struct perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = configs[i];
+                attr.read_format = PERF_FORMAT_GROUP;
+                // user space only, which perf_event_paranoid 2 still allows
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i ? fds[0] : -1, 0);
+                if(fds[i] < 0)
+                {
+                    for(int j=0;j<i;++j)
+                        close(fds[j]);
+                    return false;
+                }
+            }
+            ok = true;
+            return true;
+        }
+
+        bool read(uint64_t counts[PerfCounters::eNumCounters])
+        {
+            if(!tried)
+                open();
+            if(!ok)
+                return false;
+            uint64_t values[1 + PerfCounters::eNumCounters];
+            if(::read(fds[0], values, sizeof(values)) != sizeof(values))
+                return false;
+            memcpy(counts, values + 1, sizeof(uint64_t) * PerfCounters::eNumCounters);
+            return true;
+        }
+    };
+
+    thread_local ThreadCounters threadCounters;
+
+    uint64_t nowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+double PerfCounters::Window::rooflineFramesPerS(double bytesPerPixel, double peakGbPerS) const
+{
+    if(!frames || !pixels || bytesPerPixel <= 0)
+        return 0.0;
+    return peakGbPerS * 1.0e9 / (bytesPerPixel * pixels / frames);
+}
+
+PerfCounters::Scope::Scope(PerfCounters* counters) :
+    m_entered(false),
+    m_counters(nullptr)
+{
+    if(!counters || !counters->enabled())
+        return;
+    m_entered = true;
+    if(threadCounters.depth++)
+        return;
+    if(readThread(m_start))
+    {
+        m_counters = counters;
+        counters->m_available.store(true, std::memory_order_relaxed);
+    }
+}
+
+PerfCounters::Scope::~Scope()
+{
+    end();
+}
+
+void PerfCounters::Scope::end()
+{
+    uint64_t now[eNumCounters];
+    if(m_counters && readThread(now))
+    {
+        for(int i=0;i<eNumCounters;++i)
+            now[i] -= m_start[i];
+        m_counters->add(now);
+    }
+    m_counters = nullptr;
+    if(m_entered)
+        --threadCounters.depth;
+    m_entered = false;
+}
+
+PerfCounters::Frame::Frame(PerfCounters* counters, uint64_t pixels) :
+    Scope(counters),
+    m_frameCounters(nullptr),
+    m_pixels(pixels),
+    m_startNs(0)
+{
+    // the scope is already on the depth, so the outermost is 1
+    if(m_entered && threadCounters.depth == 1)
+    {
+        m_frameCounters = counters;
+        m_startNs = nowNs();
+    }
+}
+
+PerfCounters::Frame::~Frame()
+{
+    end();
+}
+
+void PerfCounters::Frame::end()
+{
+    PerfCounters* counters = m_frameCounters;
+    uint64_t ns = counters ? nowNs() - m_startNs : 0;
+    // this thread's counts have to be in before the frame ends
+    Scope::end();
+    m_frameCounters = nullptr;
+    if(counters)
+        counters->endFrame(ns, m_pixels);
+}
+
+PerfCounters::PerfCounters(int framesPerWindow) :
+    m_enabled(false),
+    m_available(false),
+    m_framesPerWindow(std::max(1, framesPerWindow))
+{
+    clear();
+}
+
+void PerfCounters::setEnabled(bool on)
+{
+    m_enabled.store(on, std::memory_order_relaxed);
+}
+
+void PerfCounters::setFramesPerWindow(int frames)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_framesPerWindow = std::max(1, frames);
+}
+
+int PerfCounters::framesPerWindow()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_framesPerWindow;
+}
+
+void PerfCounters::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(int i=0;i<eNumCounters;++i)
+        m_counts[i].store(0, std::memory_order_relaxed);
+    memset(&m_window, 0, sizeof(m_window));
+    memset(&m_last, 0, sizeof(m_last));
+}
+
+PerfCounters::Window PerfCounters::lastWindow()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_last;
+}
+
+bool PerfCounters::readThread(uint64_t counts[eNumCounters])
+{
+    return threadCounters.read(counts);
+}
+
+void PerfCounters::add(const uint64_t counts[eNumCounters])
+{
+    for(int i=0;i<eNumCounters;++i)
+        m_counts[i].fetch_add(counts[i], std::memory_order_relaxed);
+}
+
+void PerfCounters::endFrame(uint64_t ns, uint64_t pixels)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(int i=0;i<eNumCounters;++i)
+        m_window.counts[i] += m_counts[i].exchange(0, std::memory_order_relaxed);
+    m_window.ns += ns;
+    m_window.pixels += pixels;
+    if(m_framesPerWindow <= (int)++m_window.frames)
+    {
+        m_last = m_window;
+        memset(&m_window, 0, sizeof(m_window));
+    }
+}
@@ -0,0 +1,363 @@
+#include "PixelHistogram.h"
+#include "SIMDMacros.h"
+
+#include <hdf5.h>
+
+#include <boost/version.hpp>
+#include <boost/bind/bind.hpp>
+
+#if 106000 <= BOOST_VERSION
+using namespace boost::placeholders;
+#endif
+
+#include <algorithm>
+#include <sstream>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+PixelHistogram::PixelHistogram() :
+    m_rows(0),
+    m_cols(0),
+    m_bins(0),
+    m_counterBits(16),
+    m_uniform(false),
+    m_scale(0.0f),
+    m_frames(0),
+    m_outOfRange(0)
+{
+    m_logger = log4cxx::Logger::getLogger("FP.PixelHistogram");
+}
+
+PixelHistogram::~PixelHistogram()
+{
+
+}
+
+int64_t PixelHistogram::init(int rows, int cols, const std::vector<float>& edges, int counterBits)
+{
+    if(edges.size() < 2 || !std::is_sorted(edges.begin(), edges.end())
+       || std::adjacent_find(edges.begin(), edges.end()) != edges.end())
+    {
+        LOG4CXX_ERROR(m_logger, "histogram edges must go up, and there must be at least 2");
+        return -1;
+    }
+    if(counterBits != 16 && counterBits != 32)
+    {
+        LOG4CXX_ERROR(m_logger, "histogram counters must be 16 or 32 bits, not " << counterBits);
+        return -1;
+    }
+    const int bins = edges.size() - 1;
+    // FrameMem sizes are ints
+    if((size_t)rows * cols * bins * (counterBits / 8) >= 0x7fffffffu)
+    {
+        LOG4CXX_ERROR(m_logger, "can't keep " << bins << " bins of " << counterBits << " bits for " << rows << "x" << cols << " pixels; it needs 2GB or more");
+        return -1;
+    }
+
+    m_rows = rows;
+    m_cols = cols;
+    m_bins = bins;
+    m_counterBits = counterBits;
+    m_edges = edges;
+
+    // even edges can be found with a multiply
+    const float width = (edges.back() - edges.front()) / bins;
+    m_uniform = true;
+    for(int i=0;i<=bins;++i)
+    {
+        if(std::fabs(edges[i] - (edges.front() + i * width)) > 1e-5f * width)
+            m_uniform = false;
+    }
+    m_scale = 1.0f / width;
+
+    m_counts16.init(m_logger, counterBits == 16 ? rows : 0, counterBits == 16 ? cols * bins : 0);
+    m_counts32.init(m_logger, counterBits == 32 ? rows : 0, counterBits == 32 ? cols * bins : 0);
+    clear();
+    LOG4CXX_INFO(m_logger, "histogramming " << rows << "x" << cols << " pixels into " << bins
+        << (m_uniform ? " even" : " uneven") << " bins of " << counterBits << " bits");
+    return 0;
+}
+
+void PixelHistogram::clear()
+{
+    memset(m_counts16.data(), 0, (size_t)m_counts16.rows() * m_counts16.cols() * sizeof(uint16_t));
+    memset(m_counts32.data(), 0, (size_t)m_counts32.rows() * m_counts32.cols() * sizeof(uint32_t));
+    m_frames = 0;
+    m_outOfRange = 0;
+}
+
+int64_t PixelHistogram::parseEdges(const std::string& text, std::vector<float>& edges)
+{
+    std::vector<float> parsed;
+    if(text.find(':') != std::string::npos)
+    {
+        float first, last;
+        int bins;
+        char c1, c2;
+        std::stringstream ss(text);
+        if(!(ss >> first >> c1 >> last >> c2 >> bins) || c1 != ':' || c2 != ':' || bins < 1 || !(first < last))
+            return -1;
+        for(int i=0;i<=bins;++i)
+        {
+            parsed.push_back(first + i * (last - first) / bins);
+        }
+    }
+    else
+    {
+        std::stringstream ss(text);
+        std::string item;
+        while(std::getline(ss, item, ','))
+        {
+            try
+            {
+                parsed.push_back(std::stof(item));
+            }
+            catch(std::exception& e)
+            {
+                return -1;
+            }
+        }
+    }
+
+    for(size_t i=0;i<parsed.size();++i)
+    {
+        if(!std::isfinite(parsed[i]) || (i && !(parsed[i-1] < parsed[i])))
+            return -1;
+    }
+    if(parsed.size() < 2)
+        return -1;
+    edges = parsed;
+    return 0;
+}
+
+uint32_t PixelHistogram::count(int row, int col, int bin)
+{
+    size_t idx = ((size_t)row * m_cols + col) * m_bins + bin;
+    return m_counterBits == 16 ? m_counts16.data()[idx] : m_counts32.data()[idx];
+}
+
+int64_t PixelHistogram::checkShape(int rows, int cols)
+{
+    if(m_bins == 0 || rows != m_rows || cols != m_cols)
+    {
+        LOG4CXX_ERROR(m_logger, "can't histogram a " << rows << "x" << cols << " frame into "
+            << m_rows << "x" << m_cols << " histograms");
+        return -1;
+    }
+    return 0;
+}
+
+int64_t PixelHistogram::add(MemBlockF& input)
+{
+    if(checkShape(input.rows(), input.cols()) < 0)
+        return -1;
+    for(int r=0;r<input.rows();++r)
+    {
+        addRow(input.data() + (size_t)r * m_cols, r);
+    }
+    ++m_frames;
+    return 0;
+}
+
+int64_t PixelHistogram::addP(MemBlockF& input)
+{
+    if(checkShape(input.rows(), input.cols()) < 0)
+        return -1;
+    auto fn = boost::bind(&PixelHistogram::addRowsTBB, this, &input, _1);
+    tbb::parallel_for( tbb::blocked_range<int>(0,input.rows(),150), fn, tbb::simple_partitioner());
+    ++m_frames;
+    return 0;
+}
+
+int64_t PixelHistogram::addP(MemBlockI16& input)
+{
+    if(checkShape(input.rows(), input.cols()) < 0)
+        return -1;
+    auto fn = boost::bind(&PixelHistogram::addRowsI16TBB, this, &input, _1);
+    tbb::parallel_for( tbb::blocked_range<int>(0,input.rows(),150), fn, tbb::simple_partitioner());
+    ++m_frames;
+    return 0;
+}
+
+void PixelHistogram::addRowsTBB(MemBlockF* pInput, tbb::blocked_range<int> rows)
+{
+    for(int r = rows.begin(); r<rows.end(); ++r)
+    {
+        addRowSIMD(pInput->data() + (size_t)r * m_cols, r);
+    }
+}
+
+void PixelHistogram::addRowsI16TBB(MemBlockI16* pInput, tbb::blocked_range<int> rows)
+{
+    std::vector<float> values(m_cols);
+    for(int r = rows.begin(); r<rows.end(); ++r)
+    {
+        const uint16_t* in = pInput->data() + (size_t)r * m_cols;
+        for(int c=0;c<m_cols;++c)
+        {
+            values[c] = in[c];
+        }
+        addRowSIMD(values.data(), r);
+    }
+}
+
+int PixelHistogram::binOf(float value)
+{
+    if(m_uniform)
+    {
+        // NaN fails this too
+        if(!(m_edges.front() <= value && value < m_edges.back()))
+            return -1;
+        // rounding can put a value just under the last edge one bin too far
+        return std::min(std::floor((value - m_edges.front()) * m_scale), (float)(m_bins - 1));
+    }
+    int bin = std::upper_bound(m_edges.begin(), m_edges.end(), value) - m_edges.begin() - 1;
+    return (std::isnan(value) || bin < 0 || m_bins <= bin) ? -1 : bin;
+}
+
+void PixelHistogram::increment(size_t pixel, int bin)
+{
+    if(m_counterBits == 16)
+    {
+        uint16_t& count = m_counts16.data()[pixel * m_bins + bin];
+        if(count != 0xffff)
+            ++count;
+    }
+    else
+    {
+        ++m_counts32.data()[pixel * m_bins + bin];
+    }
+}
+
+void PixelHistogram::addRow(const float* values, int row)
+{
+    const size_t start = (size_t)row * m_cols;
+    uint64_t outOfRange = 0;
+    for(int col=0;col<m_cols;++col)
+    {
+        int bin = binOf(values[col]);
+        if(bin < 0)
+            ++outOfRange;
+        else
+            increment(start + col, bin);
+    }
+    if(outOfRange)
+        m_outOfRange += outOfRange;
+}
+
+#ifdef __AVX__
+
+void PixelHistogram::addRowSIMD(const float* values, int row)
+{
+    // the bins are found 8 at a time; avx has no scatter, so the counting is one by one
+    const size_t start = (size_t)row * m_cols;
+    const SIMD8f first = SetAll8f(m_edges.front());
+    const SIMD8f last = SetAll8f(m_edges.back());
+    const SIMD8f scale = SetAll8f(m_scale);
+    const SIMD8f one = SetAll8f(1.0f);
+    const SIMD8f minusOne = SetAll8f(-1.0f);
+    const SIMD8f lastBin = SetAll8f(m_bins - 1);
+    const SIMD8f binsPlusOne = SetAll8f(m_bins + 1);
+    int32_t __attribute__ ((aligned (32))) bins[8];
+    uint64_t outOfRange = 0;
+    int col = 0;
+    for(;col+8<=m_cols;col+=8)
+    {
+        SIMD8f value = Load8fu(values + col);
+        SIMD8f bin;
+        if(m_uniform)
+        {
+            SIMD8f inRange = And8fm(GreaterOrEqual8f(value, first), Greater8f(last, value));
+            bin = Min8f(Floor8f(Multiply8f(Sub8f(value, first), scale)), lastBin);
+            bin = SelectXorY8fm(minusOne, bin, inRange);
+        }
+        else
+        {
+            // count the edges at or below the value; NaN is never at or above an edge
+            SIMD8f edges = SetAll8f(0.0f);
+            for(int i=0;i<=m_bins;++i)
+            {
+                edges = Add8f(edges, And8fm(GreaterOrEqual8f(value, SetAll8f(m_edges[i])), one));
+            }
+            bin = SelectXorY8fm(Sub8f(edges, one), minusOne, Equal8f(edges, binsPlusOne));
+        }
+        Store8i(bins, Convert8fto8i(bin));
+        for(int i=0;i<8;++i)
+        {
+            if(bins[i] < 0)
+                ++outOfRange;
+            else
+                increment(start + col + i, bins[i]);
+        }
+    }
+    for(;col<m_cols;++col)
+    {
+        int bin = binOf(values[col]);
+        if(bin < 0)
+            ++outOfRange;
+        else
+            increment(start + col, bin);
+    }
+    if(outOfRange)
+        m_outOfRange += outOfRange;
+}
+
+#else
+
+void PixelHistogram::addRowSIMD(const float* values, int row)
+{
+    addRow(values, row);
+}
+
+#endif
+
+int64_t PixelHistogram::saveToH5(std::string filename)
+{
+    if(m_bins == 0)
+        return -1;
+    std::string tmpname = filename + ".tmp";
+    hid_t fh = H5Fcreate(tmpname.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if(fh < 0)
+    {
+        LOG4CXX_ERROR(m_logger, "could not create " << tmpname);
+        return -1;
+    }
+
+    herr_t status = 0;
+    hsize_t dims[3] = {(hsize_t)m_rows, (hsize_t)m_cols, (hsize_t)m_bins};
+    hid_t space = H5Screate_simple(3, dims, NULL);
+    hid_t type = m_counterBits == 16 ? H5T_NATIVE_UINT16 : H5T_NATIVE_UINT32;
+    hid_t dset = H5Dcreate(fh, "counts", type, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    status |= H5Dwrite(dset, type, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+        m_counterBits == 16 ? (void*)m_counts16.data() : (void*)m_counts32.data());
+    H5Dclose(dset);
+    H5Sclose(space);
+
+    hsize_t edgeDims[1] = {m_edges.size()};
+    space = H5Screate_simple(1, edgeDims, NULL);
+    dset = H5Dcreate(fh, "edges", H5T_NATIVE_FLOAT, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    status |= H5Dwrite(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, m_edges.data());
+    H5Dclose(dset);
+    H5Sclose(space);
+
+    uint64_t scalars[2] = {m_frames, m_outOfRange};
+    const char* names[2] = {"frames", "out_of_range"};
+    space = H5Screate(H5S_SCALAR);
+    for(int i=0;i<2;++i)
+    {
+        dset = H5Dcreate(fh, names[i], H5T_NATIVE_UINT64, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        status |= H5Dwrite(dset, H5T_NATIVE_UINT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, &scalars[i]);
+        H5Dclose(dset);
+    }
+    H5Sclose(space);
+    status |= H5Fclose(fh);
+
+    if(status < 0 || rename(tmpname.c_str(), filename.c_str()) < 0)
+    {
+        LOG4CXX_ERROR(m_logger, "could not save histograms to " << filename);
+        remove(tmpname.c_str());
+        return -1;
+    }
+    return 0;
+}
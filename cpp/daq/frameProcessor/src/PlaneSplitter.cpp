@@ -0,0 +1,100 @@
+#include "PlaneSplitter.h"
+#include "SIMDMacros.h"
+
+#include <boost/version.hpp>
+#include <boost/bind/bind.hpp>
+
+#if 106000 <= BOOST_VERSION
+using namespace boost::placeholders;
+#endif
+
+PlaneSplitter::PlaneSplitter()
+{
+    m_logger = log4cxx::Logger::getLogger("FP.PlaneSplitter");
+}
+
+PlaneSplitter::~PlaneSplitter()
+{
+
+}
+
+void PlaneSplitter::split(MemBlockI16& input, MemBlockI8& gain, MemBlockI8& coarse, MemBlockI8& fine)
+{
+    for(int r=0;r<input.rows();++r)
+    {
+        splitRow(input, gain, coarse, fine, r);
+    }
+}
+
+void PlaneSplitter::splitP(MemBlockI16& input, MemBlockI8& gain, MemBlockI8& coarse, MemBlockI8& fine)
+{
+    auto fn = boost::bind(&PlaneSplitter::splitRowsTBB, this, &input, &gain, &coarse, &fine, _1);
+    // this is mostly memory bandwidth, so the chunks can be smaller than the calibrator's
+    tbb::parallel_for( tbb::blocked_range<int>(0,input.rows(),50), fn, tbb::simple_partitioner());
+}
+
+void PlaneSplitter::splitRowsTBB(MemBlockI16* pInput, MemBlockI8* pGain, MemBlockI8* pCoarse, MemBlockI8* pFine, tbb::blocked_range<int> rows)
+{
+    for(int r = rows.begin(); r<rows.end(); ++r)
+    {
+        splitRowSIMD(*pInput, *pGain, *pCoarse, *pFine, r);
+    }
+}
+
+void PlaneSplitter::splitRow(MemBlockI16& input, MemBlockI8& gain, MemBlockI8& coarse, MemBlockI8& fine, int row)
+{
+    const int cols = input.cols();
+    const int row_start_idx = row * cols;
+    for(int col=0;col<cols;++col)
+    {
+        size_t pixel_index = row_start_idx + col;
+        uint16_t pixel = input.at(pixel_index);
+        gain.at(pixel_index) = (pixel & 0x6000) >> 13;
+        fine.at(pixel_index) = (pixel & 0x1fe0) >> 5;
+        coarse.at(pixel_index) = (pixel & 0x001f);
+    }
+}
+
+#ifdef __AVX__
+
+void PlaneSplitter::splitRowSIMD(MemBlockI16& input, MemBlockI8& gain, MemBlockI8& coarse, MemBlockI8& fine, int row)
+{
+    // odin frames aren't necessarily aligned, so the loads and stores are unaligned ones
+    const int cols = input.cols();
+    const int row_start_idx = row * cols;
+    const SIMD8i16 maskCoarse = SetAll8i16(0x1f);
+    const SIMD8i16 maskFine = SetAll8i16(0xff);
+    const SIMD8i16 maskK = SetAll8i16(0x03);
+    int col = 0;
+    for(;col+16<=cols;col+=16)
+    {
+        size_t pixel_index = row_start_idx + col;
+        SIMD8i16 lo = Load16i8u(input.data() + pixel_index);
+        SIMD8i16 hi = Load16i8u(input.data() + pixel_index + 8);
+
+        SIMD4i gains = Pack8i16x2to16i8(And4i(ShiftRight8i16(lo, 13), maskK), And4i(ShiftRight8i16(hi, 13), maskK));
+        SIMD4i fines = Pack8i16x2to16i8(And4i(ShiftRight8i16(lo, 5), maskFine), And4i(ShiftRight8i16(hi, 5), maskFine));
+        SIMD4i coarses = Pack8i16x2to16i8(And4i(lo, maskCoarse), And4i(hi, maskCoarse));
+
+        Store16i8u(gain.data() + pixel_index, gains);
+        Store16i8u(fine.data() + pixel_index, fines);
+        Store16i8u(coarse.data() + pixel_index, coarses);
+    }
+    for(;col<cols;++col)
+    {
+        size_t pixel_index = row_start_idx + col;
+        uint16_t pixel = input.at(pixel_index);
+        gain.at(pixel_index) = (pixel & 0x6000) >> 13;
+        fine.at(pixel_index) = (pixel & 0x1fe0) >> 5;
+        coarse.at(pixel_index) = (pixel & 0x001f);
+    }
+}
+
+#else
+
+void PlaneSplitter::splitRowSIMD(MemBlockI16& input, MemBlockI8& gain, MemBlockI8& coarse, MemBlockI8& fine, int row)
+{
+    splitRow(input, gain, coarse, fine, row);
+}
+
+#endif
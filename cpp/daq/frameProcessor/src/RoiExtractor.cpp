@@ -0,0 +1,67 @@
+#include "RoiExtractor.h"
+
+#include <sstream>
+#include <cstring>
+
+int RoiExtractor::parse(const std::string& text, int frameRows, int frameCols, std::vector<Roi>& rois)
+{
+    std::vector<Roi> parsed;
+    std::stringstream list(text);
+    std::string item;
+    while(std::getline(list, item, ';'))
+    {
+        if(item.find_first_not_of(" ") == std::string::npos)
+            continue;
+        Roi roi;
+        char comma1, comma2, comma3;
+        std::stringstream fields(item);
+        if(!(fields >> roi.row >> comma1 >> roi.col >> comma2 >> roi.rows >> comma3 >> roi.cols)
+           || comma1 != ',' || comma2 != ',' || comma3 != ',')
+            return -1;
+        if(roi.row < 0 || roi.col < 0 || roi.rows <= 0 || roi.cols <= 0
+           || frameRows < roi.row + roi.rows || frameCols < roi.col + roi.cols)
+            return -1;
+        parsed.push_back(roi);
+    }
+    rois = parsed;
+    return 0;
+}
+
+std::string RoiExtractor::toString(const std::vector<Roi>& rois)
+{
+    std::stringstream text;
+    for(size_t i=0;i<rois.size();++i)
+    {
+        text << (i ? ";" : "") << rois[i].row << "," << rois[i].col << "," << rois[i].rows << "," << rois[i].cols;
+    }
+    return text.str();
+}
+
+std::vector<int> RoiExtractor::rowsCovered(const std::vector<Roi>& rois, int frameRows)
+{
+    std::vector<bool> covered(frameRows, false);
+    for(auto& roi : rois)
+    {
+        for(int r=roi.row;r<roi.row+roi.rows && r<frameRows;++r)
+            covered[r] = true;
+    }
+    std::vector<int> rows;
+    for(int r=0;r<frameRows;++r)
+    {
+        if(covered[r])
+            rows.push_back(r);
+    }
+    return rows;
+}
+
+void RoiExtractor::extract(const void* input, int inputCols, int elemSize, const Roi& roi, void* output)
+{
+    // each row of the roi is contiguous, and memcpy already uses the widest loads it can
+    const uint8_t* in = static_cast<const uint8_t*>(input);
+    uint8_t* out = static_cast<uint8_t*>(output);
+    const size_t rowBytes = (size_t)roi.cols * elemSize;
+    for(int r=0;r<roi.rows;++r)
+    {
+        memcpy(out + r * rowBytes, in + ((size_t)(roi.row + r) * inputCols + roi.col) * elemSize, rowBytes);
+    }
+}
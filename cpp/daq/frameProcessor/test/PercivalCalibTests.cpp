@@ -4,14 +4,36 @@
 
 // note we only test CalibratorSample.
 #include "CalibratorSample.h"
+#include "FrameCompressor.h"
+#include "DarkAccumulator.h"
+#include "PlaneSplitter.h"
+#include "Descrambler.h"
+#include "FrameBinner.h"
+#include "FrameRing.h"
+#include "RoiExtractor.h"
+#include "FrameAccumulator.h"
+#include "PixelHistogram.h"
+#include "GainOccupancy.h"
+#include "LatencyHistogram.h"
+#include "ParallelTuner.h"
+#include "PerfCounters.h"
+#include "FrameTiming.h"
+#include "FrameTrace.h"
 #include "log4cxx/basicconfigurator.h"
 
 #include <boost/test/unit_test.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <lz4.h>
+
 #include <random>
+#include <unistd.h>
 #include <iostream>
 #include <chrono>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <atomic>
 
 
 int main(int argc, char* argv[], char* envp[])
@@ -435,6 +457,1753 @@ BOOST_AUTO_TEST_CASE(CalibratorAlgSIMDSameAsNormal)
     }
 }
 
+// this checks the half conversion is the same on the simd and normal paths, including
+// the awkward values: nan, inf, denormals and values that round past 65504.
+BOOST_AUTO_TEST_CASE(CalibratorHalfSIMDSameAsNormal)
+{
+    int rows=1, cols=32;
+    CalibratorSample calibrator(rows,cols);
+
+    MemBlockF input;
+    MemBlockI16 output1, output2;
+    input.init(logger, rows,cols);
+    output1.init(logger, rows,cols);
+    output2.init(logger, rows,cols);
+
+    float special[] = {0.0f, -0.0f, 1.0f, -2.5f, k1, 65504.0f, 65519.0f, 65520.0f, 1e9f, -1e9f,
+                       6.0e-8f, 2.98e-8f, 1.0e-5f, -3.0e-6f,
+                       std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN()};
+    const int numSpecial = sizeof(special)/sizeof(float);
+    for(int c=0;c<cols;++c)
+    {
+        input.at(0,c) = c < numSpecial ? special[c] : (rand() % 200000) / 7.0f - 10000.0f;
+    }
+
+    calibrator.convertRowToHalfSIMD(input, output1, 0);
+    calibrator.convertRowToHalf(input, output2, 0);
+
+    for(int c=0;c<cols;++c)
+    {
+        BOOST_CHECK_EQUAL(output1.at(0,c), output2.at(0,c));
+    }
+    BOOST_CHECK_EQUAL(output2.at(0,2), 0x3c00);
+    BOOST_CHECK_EQUAL(output2.at(0,5), 0x7bff);
+    BOOST_CHECK_EQUAL(output2.at(0,7), 0x7c00);
+}
+
+// this checks the photon quantisation on both paths: rounding, clipping and nan
+BOOST_AUTO_TEST_CASE(CalibratorPhotons)
+{
+    int rows=1, cols=16;
+    CalibratorSample calibrator(rows,cols);
+    // 10 electrons per photon, round to nearest, saturate at 100 photons
+    calibrator.setPhotonConversion(10.0f, 0.5f, 100);
+
+    MemBlockF input;
+    MemBlockI16 out16a, out16b;
+    MemBlockI8 out8a, out8b;
+    input.init(logger, rows,cols);
+    out16a.init(logger, rows,cols);
+    out16b.init(logger, rows,cols);
+    out8a.init(logger, rows,cols);
+    out8b.init(logger, rows,cols);
+
+    float electrons[] = {0.0f, 4.9f, 5.0f, 14.9f, 15.0f, -30.0f, 994.0f, 996.0f,
+                         1e7f, std::numeric_limits<float>::quiet_NaN(), 123.0f, 77.0f,
+                         -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), 1.0f, 2.0f};
+    uint16_t photons[] = {0, 0, 1, 1, 2, 0, 99, 100, 100, 0xffff, 12, 8, 0, 100, 0, 0};
+    for(int c=0;c<cols;++c)
+        input.at(0,c) = electrons[c];
+
+    calibrator.convertRowToPhotonsSIMD(input, out16a, 0);
+    calibrator.convertRowToPhotons(input, out16b, 0);
+    calibrator.convertRowToPhotonsSIMD(input, out8a, 0);
+    calibrator.convertRowToPhotons(input, out8b, 0);
+
+    for(int c=0;c<cols;++c)
+    {
+        BOOST_CHECK_EQUAL(out16a.at(0,c), photons[c]);
+        BOOST_CHECK_EQUAL(out16b.at(0,c), photons[c]);
+        uint8_t photons8 = photons[c] == 0xffff ? 0xff : photons[c];
+        BOOST_CHECK_EQUAL(out8a.at(0,c), photons8);
+        BOOST_CHECK_EQUAL(out8b.at(0,c), photons8);
+    }
+}
+
+// this checks the narrow outputs give the same answer as quantising the float frame
+BOOST_AUTO_TEST_CASE(CalibratorPhotonFrameSameAsFloat)
+{
+    int rows=14, cols=64;
+    CalibratorSample calibrator(rows,cols);
+    calibrator.setPhotonConversion(2.0f, 0.5f, 1000);
+
+    MemBlockF dark;
+    dark.init(logger, rows,cols);
+    MemBlockI16 input, input2;
+    input.init(logger, rows,cols);
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            calibrator.m_Gc.at(r,c) = k1;
+            calibrator.m_Oc.at(r,c) = k2;
+            calibrator.m_Gf.at(r,c) = k3;
+            calibrator.m_Of.at(r,c) = k4;
+            calibrator.m_Ped0.at(r,c) = idealOffset;
+            calibrator.m_Gain0.at(r,c) = 0.1f;
+            dark.at(r,c) = c % 3;
+
+            BitPacker bp;
+            bp.setCoarse(rand());
+            bp.setFine(rand());
+            bp.setGain(0);
+            input.at(r,c) = bp.getBits();
+        }
+    }
+    calibrator.setDarkFrame(&dark);
+    input2.clone(input);
+    MemBlockI16 input3;
+    input3.clone(input);
+
+    MemBlockF outputF;
+    MemBlockI16 outputP;
+    outputF.init(logger, rows,cols);
+    outputP.init(logger, rows,cols);
+
+    calibrator.processFrameP(input, outputF);
+    calibrator.processFramePhotonP(input2, outputP);
+
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            float expected = std::floor(outputF.at(r,c) / 2.0f + 0.5f);
+            expected = std::max(0.0f, std::min(expected, 1000.0f));
+            BOOST_CHECK_EQUAL(outputP.at(r,c), static_cast<uint16_t>(expected));
+        }
+    }
+
+    // with a float frame, the same photons come out and the electrons are kept
+    MemBlockF floatFrame;
+    MemBlockI16 outputP2;
+    floatFrame.init(logger, rows,cols);
+    outputP2.init(logger, rows,cols);
+    calibrator.setFloatFrame(&floatFrame);
+    calibrator.processFramePhotonP(input3, outputP2);
+    calibrator.setFloatFrame(nullptr);
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            BOOST_CHECK_EQUAL(outputP2.at(r,c), outputP.at(r,c));
+            BOOST_CHECK_EQUAL(floatFrame.at(r,c), outputF.at(r,c));
+        }
+    }
+}
+
+static uint32_t readUint32BE(const uint8_t* p)
+{
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// this undoes the whole chunk, the way the hdf5 bitshuffle filter would.
+static std::vector<uint8_t> decompress(const std::vector<uint8_t>& chunk, int elemSize)
+{
+    uint64_t nbytes = ((uint64_t)readUint32BE(chunk.data()) << 32) | readUint32BE(chunk.data()+4);
+    uint32_t blockBytes = readUint32BE(chunk.data()+8);
+    std::vector<uint8_t> out(nbytes), shuffled(blockBytes), tmp(blockBytes);
+
+    size_t pos = FrameCompressor::headerSize;
+    size_t done = 0;
+    size_t whole = nbytes - (nbytes / elemSize % 8) * elemSize;
+    while(done < whole)
+    {
+        size_t thisBlock = std::min<size_t>(blockBytes, whole - done);
+        uint32_t csize = readUint32BE(chunk.data() + pos);
+        pos += 4;
+        int got = LZ4_decompress_safe(reinterpret_cast<const char*>(chunk.data() + pos),
+                                      reinterpret_cast<char*>(shuffled.data()), csize, blockBytes);
+        BOOST_REQUIRE_EQUAL(got, thisBlock);
+        FrameCompressor::bitunshuffle(shuffled.data(), out.data() + done, tmp.data(), thisBlock / elemSize, elemSize);
+        pos += csize;
+        done += thisBlock;
+    }
+    memcpy(out.data() + done, chunk.data() + pos, nbytes - done);
+    BOOST_CHECK_EQUAL(pos + nbytes - done, chunk.size());
+    return out;
+}
+
+// this checks the bit layout is the one the bitshuffle library uses:
+// bit k of byte j of element i goes to bit i%8 of byte i/8 of row j*8+k.
+BOOST_AUTO_TEST_CASE(BitshuffleLayout)
+{
+    const int elems = 32;
+    uint16_t in[elems] = {};
+    uint8_t out[elems*2], tmp[elems*2];
+    // element 3, bit 9 is byte 1 bit 1
+    in[3] = 1 << 9;
+    // element 20, bit 0
+    in[20] = 1;
+
+    FrameCompressor::bitshuffle(reinterpret_cast<uint8_t*>(in), out, tmp, elems, 2);
+
+    const int rowBytes = elems / 8;
+    for(int i=0;i<elems*2;++i)
+    {
+        uint8_t expected = 0;
+        if(i == 9*rowBytes + 0)
+            expected = 1 << 3;
+        if(i == 0*rowBytes + 2)
+            expected = 1 << 4;
+        BOOST_CHECK_EQUAL(out[i], expected);
+    }
+}
+
+// the simd path does 16 elements at a time, so try a size which needs the tail too
+BOOST_AUTO_TEST_CASE(BitshuffleRoundTrip)
+{
+    const int elems = 24;
+    for(int elemSize : {1, 2, 4, 8})
+    {
+        std::vector<uint8_t> in(elems*elemSize), out(elems*elemSize), back(elems*elemSize), tmp(elems*elemSize);
+        for(auto& b : in)
+            b = rand();
+        FrameCompressor::bitshuffle(in.data(), out.data(), tmp.data(), elems, elemSize);
+        FrameCompressor::bitunshuffle(out.data(), back.data(), tmp.data(), elems, elemSize);
+        BOOST_CHECK(in == back);
+    }
+}
+
+// this compresses a frame shaped like ours, and one with a ragged end
+BOOST_AUTO_TEST_CASE(CompressFrameRoundTrip)
+{
+    FrameCompressor compressor;
+    std::mt19937 gen(42);
+    std::normal_distribution<float> noise(3000.0f, 20.0f);
+
+    for(int cols : {1408, 1405})
+    {
+        int rows = 1484;
+        MemBlockI16 frame;
+        frame.init(logger, rows, cols);
+        for(int i=0;i<rows*cols;++i)
+            frame.at(i) = static_cast<uint16_t>(noise(gen));
+
+        size_t nbytes = rows * cols * sizeof(uint16_t);
+        int64_t csize = compressor.compressP(frame.data(), nbytes, sizeof(uint16_t));
+        BOOST_REQUIRE(0 < csize);
+        // noisy data around a pedestal should still compress well
+        BOOST_CHECK(csize < (int64_t)nbytes / 2);
+
+        std::vector<uint8_t> chunk(csize);
+        compressor.gather(chunk.data());
+
+        std::vector<uint8_t> back = decompress(chunk, sizeof(uint16_t));
+        BOOST_CHECK(memcmp(back.data(), frame.data(), nbytes) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CompressBadElemSize)
+{
+    FrameCompressor compressor;
+    uint8_t data[30];
+    BOOST_CHECK(compressor.compressP(data, sizeof(data), 4) < 0);
+    BOOST_CHECK(compressor.compressP(data, sizeof(data), 0) < 0);
+}
+
+// this checks the event list is exactly the pixels above threshold
+BOOST_AUTO_TEST_CASE(CalibratorSparseEvents)
+{
+    int rows=14, cols=64;
+    CalibratorSample calibrator(rows,cols);
+    calibrator.setSparse(4.0f, false);
+
+    MemBlockI16 input, input2;
+    input.init(logger, rows,cols);
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            calibrator.m_Gc.at(r,c) = k1;
+            calibrator.m_Oc.at(r,c) = k2;
+            calibrator.m_Gf.at(r,c) = k3;
+            calibrator.m_Of.at(r,c) = k4;
+            calibrator.m_Ped0.at(r,c) = idealOffset;
+            calibrator.m_Gain0.at(r,c) = 0.01f;
+
+            BitPacker bp;
+            bp.setCoarse(rand());
+            bp.setFine(rand());
+            // a few NaNs which must never be events
+            bp.setGain(rand() % 50 == 0 ? 3 : 0);
+            input.at(r,c) = bp.getBits();
+        }
+    }
+    input2.clone(input);
+
+    MemBlockF outputF, outputS;
+    outputF.init(logger, rows,cols);
+    outputS.init(logger, rows,cols);
+
+    calibrator.processFrameP(input, outputF);
+    std::vector<PhotonEvent> events;
+    calibrator.processFrameSparseP(input2, outputS, events);
+
+    std::vector<PhotonEvent> expected;
+    for(int r=0;r<rows;++r)
+    {
+        calibrator.findEventsRow(outputF, expected, r);
+        for(int c=0;c<cols;++c)
+        {
+            if(!std::isnan(outputF.at(r,c)))
+                BOOST_CHECK_EQUAL(outputS.at(r,c), outputF.at(r,c));
+        }
+    }
+
+    BOOST_REQUIRE(0 < events.size());
+    BOOST_REQUIRE(events.size() < (size_t)(rows*cols));
+    BOOST_REQUIRE_EQUAL(events.size(), expected.size());
+    for(size_t i=0;i<events.size();++i)
+    {
+        BOOST_CHECK_EQUAL(events[i].row, expected[i].row);
+        BOOST_CHECK_EQUAL(events[i].col, expected[i].col);
+        BOOST_CHECK_EQUAL(events[i].value, expected[i].value);
+        BOOST_CHECK(4.0f < events[i].value);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CalibratorSparseCluster)
+{
+    int rows=8, cols=16;
+    CalibratorSample calibrator(rows,cols);
+    calibrator.setSparse(5.0f, true);
+
+    MemBlockF frame;
+    frame.init(logger, rows,cols);
+    frame.setAll(1.0f);
+    // a photon split over 3 pixels, with a NaN next to it
+    frame.at(3,4) = 50.0f;
+    frame.at(3,5) = 20.0f;
+    frame.at(4,4) = 10.0f;
+    frame.at(2,3) = std::numeric_limits<float>::quiet_NaN();
+    // two equal pixels; the first one wins
+    frame.at(6,10) = 30.0f;
+    frame.at(6,11) = 30.0f;
+    // one on the edge
+    frame.at(0,15) = 8.0f;
+
+    std::vector<PhotonEvent> events;
+    for(int r=0;r<rows;++r)
+        calibrator.findEventsRowSIMD(frame, events, r);
+    BOOST_REQUIRE_EQUAL(events.size(), 6);
+    calibrator.clusterEvents(frame, events);
+
+    BOOST_REQUIRE_EQUAL(events.size(), 3);
+    BOOST_CHECK_EQUAL(events[0].row, 0);
+    BOOST_CHECK_EQUAL(events[0].col, 15);
+    BOOST_CHECK_CLOSE(events[0].value, 8.0f + 3.0f, smallPercent);
+    BOOST_CHECK_EQUAL(events[1].row, 3);
+    BOOST_CHECK_EQUAL(events[1].col, 4);
+    BOOST_CHECK_CLOSE(events[1].value, 50.0f + 20.0f + 10.0f + 5.0f, smallPercent);
+    BOOST_CHECK_EQUAL(events[2].row, 6);
+    BOOST_CHECK_EQUAL(events[2].col, 10);
+    BOOST_CHECK_CLOSE(events[2].value, 60.0f + 7.0f, smallPercent);
+}
+
+// the streaming mean & var must match the two-pass answer, per gain
+BOOST_AUTO_TEST_CASE(DarkAccumulatorSameAsTwoPass)
+{
+    int rows=7, cols=32, numFrames=50;
+    DarkAccumulator accSIMD(rows, cols), accNormal(rows, cols);
+    std::vector<MemBlockF> frames(numFrames);
+    std::vector<MemBlockI16> gains(numFrames);
+
+    std::mt19937 gen(7);
+    std::normal_distribution<float> noise(0.0f, 5.0f);
+    for(int f=0;f<numFrames;++f)
+    {
+        frames[f].init(logger, rows, cols);
+        gains[f].init(logger, rows, cols);
+        for(int i=0;i<rows*cols;++i)
+        {
+            uint16_t gain = gen() % 8 == 0 ? gen() % 4 : 0;
+            gains[f].at(i) = gain;
+            frames[f].at(i) = gain == 3 ? std::numeric_limits<float>::quiet_NaN() : 1000.0f * gain + 30.0f + noise(gen);
+        }
+        accSIMD.accumulateP(gains[f], frames[f]);
+        accNormal.accumulate(gains[f], frames[f]);
+    }
+    BOOST_CHECK_EQUAL(accSIMD.frames(), numFrames);
+
+    for(int g=0;g<DarkAccumulator::numGains;++g)
+    {
+        MemBlockF var;
+        var.init(logger, rows, cols);
+        accSIMD.getVariance(g, var);
+        for(int i=0;i<rows*cols;++i)
+        {
+            double total = 0.0, total2 = 0.0;
+            int n = 0;
+            for(int f=0;f<numFrames;++f)
+            {
+                if(gains[f].at(i) == g)
+                {
+                    total += frames[f].at(i);
+                    ++n;
+                }
+            }
+            for(int f=0;f<numFrames;++f)
+            {
+                if(gains[f].at(i) == g)
+                    total2 += (frames[f].at(i) - total / n) * (frames[f].at(i) - total / n);
+            }
+            BOOST_CHECK_EQUAL(accSIMD.m_count[g].at(i), n);
+            BOOST_CHECK_EQUAL(accSIMD.m_mean[g].at(i), accNormal.m_mean[g].at(i));
+            BOOST_CHECK_EQUAL(accSIMD.m_m2[g].at(i), accNormal.m_m2[g].at(i));
+            if(n)
+            {
+                double mean = total / n;
+                BOOST_CHECK_CLOSE(accSIMD.m_mean[g].at(i), mean, 0.01);
+                // float means near 2000 only have 3 decimal places, so tiny variances can't be close in %
+                BOOST_CHECK_SMALL(var.at(i) - total2 / n, 0.01 + 0.001 * total2 / n);
+            }
+            else
+            {
+                BOOST_CHECK(std::isnan(var.at(i)));
+            }
+        }
+    }
+}
+
+// the darkframe it gives back is the residual plus the one the frames had subtracted
+BOOST_AUTO_TEST_CASE(DarkAccumulatorAddsSubtracted)
+{
+    int rows=2, cols=16;
+    DarkAccumulator acc(rows, cols);
+    MemBlockF subtracted, frame, dark;
+    MemBlockI16 gain;
+    subtracted.init(logger, rows, cols);
+    frame.init(logger, rows, cols);
+    dark.init(logger, rows, cols);
+    gain.init(logger, rows, cols);
+    for(int i=0;i<rows*cols;++i)
+    {
+        subtracted.at(i) = 100.0f + i;
+        frame.at(i) = 3.0f;
+        // pixel 5 is never in gain 0
+        gain.at(i) = i == 5 ? 1 : 0;
+    }
+    acc.setSubtracted(&subtracted);
+    // it's a copy
+    subtracted.setAll(0.0f);
+    acc.accumulateP(gain, frame);
+    acc.accumulateP(gain, frame);
+    acc.getDarkFrame(dark);
+    for(int i=0;i<rows*cols;++i)
+        BOOST_CHECK_EQUAL(dark.at(i), i == 5 ? 100.0f + i : 103.0f + i);
+
+    acc.setSubtracted(nullptr);
+    acc.getDarkFrame(dark);
+    BOOST_CHECK_EQUAL(dark.at(0), 3.0f);
+    BOOST_CHECK_EQUAL(dark.at(5), 0.0f);
+
+    // a clone keeps its sums when the original starts again
+    DarkAccumulator copy(rows, cols);
+    copy.clone(acc);
+    acc.clear();
+    BOOST_CHECK_EQUAL(copy.frames(), 2);
+    copy.getDarkFrame(dark);
+    BOOST_CHECK_EQUAL(dark.at(0), 3.0f);
+    BOOST_CHECK_EQUAL(dark.at(5), 0.0f);
+}
+
+// the pedestals should follow a drift, but not get dragged by photons or other gains
+BOOST_AUTO_TEST_CASE(CalibratorPedestalTracking)
+{
+    int rows=14, cols=64;
+    CalibratorSample calibrator(rows,cols);
+
+    MemBlockI16 input, frameIn;
+    input.init(logger, rows,cols);
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            calibrator.m_Gc.at(r,c) = k1;
+            calibrator.m_Oc.at(r,c) = k2;
+            calibrator.m_Gf.at(r,c) = k3;
+            calibrator.m_Of.at(r,c) = k4;
+            // this is what the pedestal should be, plus a drift of 3 ADU
+            calibrator.m_Ped0.at(r,c) = idealOffset + k1 * (10 - k2) + k3 * (100 - k4) - 3.0f;
+            calibrator.m_Gain0.at(r,c) = 2.0f;
+
+            BitPacker bp;
+            bp.setCoarse(10);
+            // every 5th pixel gets a big photon
+            bp.setFine(c % 5 ? 100 : 200);
+            bp.setGain(c % 7 ? 0 : 1);
+            input.at(r,c) = bp.getBits();
+        }
+    }
+
+    MemBlockF output;
+    output.init(logger, rows,cols);
+    frameIn.clone(input);
+    calibrator.processFrameP(frameIn, output);
+    BOOST_CHECK_CLOSE(output.at(3,1), 6.0f, smallPercent);
+
+    MemBlockF ped1;
+    ped1.clone(calibrator.m_Ped1);
+    calibrator.setPedestalTracking(true, 0.5f, 50.0f, 2);
+    for(int i=0;i<40;++i)
+    {
+        frameIn.clone(input);
+        calibrator.processFrameP(frameIn, output);
+    }
+
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            if(c % 7 == 0)
+            {
+                BOOST_CHECK_EQUAL(calibrator.m_Ped1.at(r,c), ped1.at(r,c));
+            }
+            else if(c % 5 == 0)
+            {
+                BOOST_CHECK_CLOSE(output.at(r,c), 2.0f * (3.0f + k3 * 100), smallPercent);
+            }
+            else
+            {
+                BOOST_CHECK_SMALL(output.at(r,c), 0.001f);
+            }
+        }
+    }
+
+    // the simd version must do the same as the scalar one
+    CalibratorSample calibrator2(rows,cols);
+    MemBlockF electrons;
+    electrons.init(logger, rows,cols);
+    for(int i=0;i<rows*cols;++i)
+    {
+        electrons.at(i) = (i % 11) * 10.0f - 20.0f;
+        calibrator2.m_Gain0.at(i) = 0.5f + (i % 3);
+    }
+    frameIn.clone(input);
+    for(int i=0;i<rows*cols;++i)
+        frameIn.at(i) = (input.at(i) & 0x6000) >> 13;
+    MemBlockF pedStart, pedNormal;
+    pedStart.clone(calibrator2.m_Ped0);
+    calibrator2.setPedestalTracking(true, 0.25f, 50.0f, 1);
+    for(int r=0;r<rows;++r)
+    {
+        calibrator2.trackPedestalRow(frameIn, electrons, r);
+    }
+    pedNormal.clone(calibrator2.m_Ped0);
+    memcpy(calibrator2.m_Ped0.data(), pedStart.data(), rows*cols*sizeof(float));
+    for(int r=0;r<rows;++r)
+    {
+        calibrator2.trackPedestalRowSIMD(frameIn, electrons, r);
+    }
+    for(int i=0;i<rows*cols;++i)
+    {
+        BOOST_CHECK_EQUAL(calibrator2.m_Ped0.at(i), pedNormal.at(i));
+        if(frameIn.at(i) == 0 && electrons.at(i) < 50.0f && electrons.at(i) != 0.0f)
+            BOOST_CHECK(pedNormal.at(i) != pedStart.at(i));
+    }
+}
+
+// the stats summed in the tbb chunks must match a plain count over the output
+BOOST_AUTO_TEST_CASE(CalibratorFrameStats)
+{
+    int rows=300, cols=64;
+    CalibratorSample calibrator(rows,cols);
+    calibrator.setStats(true, 500.0f);
+
+    MemBlockI16 input, gains;
+    input.init(logger, rows,cols);
+    gains.init(logger, rows,cols);
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            calibrator.m_Gc.at(r,c) = k1;
+            calibrator.m_Oc.at(r,c) = k2;
+            calibrator.m_Gf.at(r,c) = k3;
+            calibrator.m_Of.at(r,c) = k4;
+            calibrator.m_Ped0.at(r,c) = idealOffset;
+            calibrator.m_Gain0.at(r,c) = 0.5f;
+
+            BitPacker bp;
+            bp.setCoarse(rand());
+            bp.setFine(rand());
+            bp.setGain(rand() % 10 ? 0 : rand() % 4);
+            input.at(r,c) = bp.getBits();
+            gains.at(r,c) = (input.at(r,c) & 0x6000) >> 13;
+        }
+    }
+
+    MemBlockF output;
+    output.init(logger, rows,cols);
+    calibrator.processFrameP(input, output);
+
+    FrameStats expected, simd;
+    expected.clear();
+    simd.clear();
+    for(int r=0;r<rows;++r)
+    {
+        calibrator.statsRow(gains, output, r, expected);
+        calibrator.statsRowSIMD(gains, output, r, simd);
+    }
+
+    const FrameStats& stats = calibrator.m_frameStats;
+    BOOST_CHECK(0 < expected.nanCount);
+    BOOST_CHECK(0 < expected.saturated);
+    for(int g=0;g<4;++g)
+    {
+        BOOST_CHECK(0 < expected.gainCount[g]);
+        BOOST_CHECK_EQUAL(stats.gainCount[g], expected.gainCount[g]);
+        BOOST_CHECK_EQUAL(simd.gainCount[g], expected.gainCount[g]);
+    }
+    BOOST_CHECK_EQUAL(stats.nanCount, expected.nanCount);
+    BOOST_CHECK_EQUAL(stats.saturated, expected.saturated);
+    BOOST_CHECK_EQUAL(stats.max, expected.max);
+    BOOST_CHECK_EQUAL(simd.saturated, expected.saturated);
+    BOOST_CHECK_EQUAL(simd.max, expected.max);
+    // the sums are added up in a different order
+    BOOST_CHECK_CLOSE(stats.sum, expected.sum, 0.01);
+    BOOST_CHECK_CLOSE(simd.mean(), expected.mean(), 0.01);
+    BOOST_CHECK_EQUAL(expected.valid(), rows*cols - expected.nanCount);
+    BOOST_CHECK_EQUAL(stats.pixels(), (uint64_t)rows*cols);
+}
+
+// with a gain map the input must be untouched, and the answer the same as without one
+BOOST_AUTO_TEST_CASE(CalibratorGainMap)
+{
+    int rows=14, cols=64;
+    CalibratorSample calibrator(rows,cols);
+    calibrator.setCMA(true, 0);
+    calibrator.setStats(true, 500.0f);
+
+    MemBlockI16 input, input2, original;
+    input.init(logger, rows,cols);
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            calibrator.m_Gc.at(r,c) = k1;
+            calibrator.m_Oc.at(r,c) = k2;
+            calibrator.m_Gf.at(r,c) = k3;
+            calibrator.m_Of.at(r,c) = k4;
+            calibrator.m_Ped0.at(r,c) = idealOffset;
+
+            BitPacker bp;
+            bp.setCoarse(rand());
+            bp.setFine(rand());
+            // keep the cma columns in gain 0 on most rows
+            bp.setGain(c < numCMACols && r % 5 ? 0 : rand() % 4);
+            input.at(r,c) = bp.getBits();
+        }
+    }
+    input2.clone(input);
+    original.clone(input);
+
+    MemBlockF output, output2;
+    output.init(logger, rows,cols);
+    output2.init(logger, rows,cols);
+    calibrator.processFrameP(input, output);
+    FrameStats stats = calibrator.m_frameStats;
+
+    MemBlockI8 map;
+    map.init(logger, rows, cols/4);
+    calibrator.setGainMap(&map);
+    calibrator.processFrameP(input2, output2);
+    calibrator.setGainMap(nullptr);
+
+    BOOST_CHECK(memcmp(input2.data(), original.data(), rows*cols*sizeof(uint16_t)) == 0);
+    for(int g=0;g<4;++g)
+        BOOST_CHECK_EQUAL(calibrator.m_frameStats.gainCount[g], stats.gainCount[g]);
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            BOOST_CHECK_EQUAL(CalibratorSample::unpackGain(map, r, c), input.at(r,c));
+            if(!std::isnan(output.at(r,c)))
+                BOOST_CHECK_EQUAL(output2.at(r,c), output.at(r,c));
+            else
+                BOOST_CHECK(std::isnan(output2.at(r,c)));
+        }
+    }
+}
+
+// the planes must match the bits the calibrator decodes, including the ragged end of a row
+BOOST_AUTO_TEST_CASE(PlaneSplitterSIMDSameAsNormal)
+{
+    int rows=20, cols=45;
+    PlaneSplitter splitter;
+    MemBlockI16 input, original;
+    MemBlockI8 gain, coarse, fine, gain2, coarse2, fine2;
+    input.init(logger, rows,cols);
+    gain.init(logger, rows,cols);
+    coarse.init(logger, rows,cols);
+    fine.init(logger, rows,cols);
+    gain2.init(logger, rows,cols);
+    coarse2.init(logger, rows,cols);
+    fine2.init(logger, rows,cols);
+
+    std::vector<BitPacker> packers(rows*cols);
+    for(int i=0;i<rows*cols;++i)
+    {
+        packers[i].clear();
+        packers[i].setCoarse(rand());
+        packers[i].setFine(rand());
+        packers[i].setGain(rand());
+        input.at(i) = packers[i].getBits();
+    }
+    original.clone(input);
+
+    splitter.split(input, gain, coarse, fine);
+    splitter.splitP(input, gain2, coarse2, fine2);
+
+    BOOST_CHECK(memcmp(input.data(), original.data(), rows*cols*sizeof(uint16_t)) == 0);
+    for(int i=0;i<rows*cols;++i)
+    {
+        uint16_t pixel = input.at(i);
+        BOOST_CHECK_EQUAL(gain.at(i), (pixel >> 13) & 0x3);
+        BOOST_CHECK_EQUAL(fine.at(i), (pixel >> 5) & 0xff);
+        BOOST_CHECK_EQUAL(coarse.at(i), pixel & 0x1f);
+        BOOST_CHECK_EQUAL(gain2.at(i), gain.at(i));
+        BOOST_CHECK_EQUAL(fine2.at(i), fine.at(i));
+        BOOST_CHECK_EQUAL(coarse2.at(i), coarse.at(i));
+    }
+}
+
+// this is descramble_to_crs_fn_gn() from python/live_viewer/descrambler.py done a step at
+// a time the slow way, to check the tables in Descrambler against.
+static void referenceDescramble(const uint16_t* raw, std::vector<uint16_t>& image)
+{
+    const int NGrp = 212, NADC = 7, NCol = 1408, NDataPad = 44, NPix = 224;
+    const int half = NCol / 2, quarter = NADC * NCol / 4;
+    image.assign(NGrp * NADC * NCol, 0);
+
+    // ADCcolArray_1DA, and iP2M_ColGrp
+    int pixAdc[NPix], pixCol[NPix];
+    int i = 0;
+    for(int n=0;n<8;++n)
+        for(int adc=NADC-1;adc>=0;--adc)
+            for(int x=0;x<4;++x)
+            {
+                pixAdc[i] = adc;
+                pixCol[i] = (3 - x) * 8 + n;
+                ++i;
+            }
+    int p2m[NDataPad + 1];
+    p2m[0] = 0;
+    for(int k=0;k<22;++k)
+    {
+        p2m[1 + k] = 22 - k;
+        p2m[23 + k] = 44 - k;
+    }
+
+    std::vector<uint16_t> trans(NADC * NCol), mezz(NADC * NCol);
+    for(int grp=0;grp<NGrp;++grp)
+    {
+        // byte swap, and (NADC, 2, NCol/2) -> (2, NADC, NCol/2)
+        for(int adc=0;adc<NADC;++adc)
+            for(int h=0;h<2;++h)
+                for(int c=0;c<half;++c)
+                {
+                    uint16_t w = raw[(grp * NADC + adc) * NCol + h * half + c];
+                    trans[h * NADC * half + adc * half + c] = (w >> 8) | (w << 8);
+                }
+        // as (2, 2, quarter), the quarters go [0,0],[1,0],[0,1],[1,1]
+        const int order[4][2] = {{0,0}, {1,0}, {0,1}, {1,1}};
+        for(int q=0;q<4;++q)
+            for(int k=0;k<quarter;++k)
+                mezz[q * quarter + k] = trans[order[q][0] * 2 * quarter + order[q][1] * quarter + k];
+
+        if(mezz[0] == 0xffff)
+        {
+            std::fill(&image[grp * NADC * NCol], &image[(grp + 1) * NADC * NCol], 0xffff);
+            continue;
+        }
+
+        // (112, NDataPad, 2) -> (NDataPad, 112, 2)
+        std::vector<std::vector<uint16_t>> aux(NDataPad + 1, std::vector<uint16_t>(NADC * 32));
+        for(int p=0;p<NDataPad;++p)
+        {
+            std::vector<int> bits(NPix * 15);
+            for(int m=0;m<NPix;++m)
+            {
+                uint16_t w = mezz[(m / 2) * NDataPad * 2 + p * 2 + m % 2];
+                // bits 14..0
+                for(int j=0;j<15;++j)
+                    bits[m * 15 + j] = (w >> (14 - j)) & 1;
+            }
+            // reshape (15, NPix), transpose, invert, and bit 0 of the pixel is the last plane
+            for(int pix=0;pix<NPix;++pix)
+            {
+                uint16_t v = 0;
+                for(int k=0;k<15;++k)
+                    v |= (1 - bits[(14 - k) * NPix + pix]) << k;
+                aux[p + 1][pixAdc[pix] * 32 + pixCol[pix]] = v;
+            }
+        }
+        // the pads go in iP2M_ColGrp order, and we drop the reference column pad 0
+        for(int P=1;P<=NDataPad;++P)
+            for(int adc=0;adc<NADC;++adc)
+                for(int c=0;c<32;++c)
+                    image[(grp * NADC + adc) * NCol + (P - 1) * 32 + c] = aux[p2m[P]][adc * 32 + c];
+    }
+}
+
+// each output pixel must come from exactly one pad pixel
+BOOST_AUTO_TEST_CASE(DescramblerScatterIsPermutation)
+{
+    Descrambler descrambler;
+    std::vector<int> hits(Descrambler::numADCs * FRAME_COLS, 0);
+    std::vector<int> gathered(Descrambler::numADCs * FRAME_COLS, 0);
+    for(int i=0;i<Descrambler::numPads * Descrambler::padPixels;++i)
+    {
+        BOOST_REQUIRE(descrambler.m_scatter[i] < hits.size());
+        BOOST_REQUIRE(descrambler.m_gather[i] < gathered.size());
+        ++hits[descrambler.m_scatter[i]];
+        ++gathered[descrambler.m_gather[i]];
+    }
+    for(size_t i=0;i<hits.size();++i)
+    {
+        BOOST_REQUIRE_EQUAL(hits[i], 1);
+        BOOST_REQUIRE_EQUAL(gathered[i], 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(DescramblerUnpackSIMDSameAsNormal)
+{
+    Descrambler descrambler;
+    uint16_t words[Descrambler::padPixels], pixels[Descrambler::padPixels], pixels2[Descrambler::padPixels];
+    std::mt19937 gen(7);
+    for(auto& w : words)
+        w = gen();
+    descrambler.unpackPad(words, pixels);
+    descrambler.unpackPadSIMD(words, pixels2);
+    for(int i=0;i<Descrambler::padPixels;++i)
+        BOOST_CHECK_EQUAL(pixels[i], pixels2[i]);
+
+    // all ones is all zeros once inverted
+    std::fill(words, words + Descrambler::padPixels, 0x7fff);
+    descrambler.unpackPadSIMD(words, pixels);
+    for(int i=0;i<Descrambler::padPixels;++i)
+        BOOST_CHECK_EQUAL(pixels[i], 0);
+}
+
+BOOST_AUTO_TEST_CASE(DescramblerSameAsPython)
+{
+    const int rows = FRAME_ROWS;
+    const int cols = FRAME_COLS;
+    MemBlockI16 input, output, output2;
+    input.init(logger, rows, cols);
+    output.init(logger, rows, cols);
+    output2.init(logger, rows, cols);
+    // python/tools/descrambler_reference.py makes the same frame, and the numbers below
+    // are what live_viewer/descrambler.py makes of it
+    uint32_t x = 1;
+    for(int i=0;i<rows*cols;++i)
+    {
+        x = x * 1103515245u + 12345u;
+        input.at(i) = (x >> 16) & 0xfffe;
+    }
+    // group 5 lost a packet
+    input.at(5 * Descrambler::numADCs, 0) = 0xffff;
+    const uint64_t pythonHash = 0xe9a9ea2d14cc96beull;
+    const int pythonSamples[][3] = {
+        {0, 0, 0x4318},
+        {0, 1407, 0x069b},
+        {6, 700, 0x376b},
+        {34, 31, 0x0ed2},
+        {41, 5, 0xffff},
+        {700, 32, 0x0781},
+        {1000, 999, 0x5973},
+        {1483, 1407, 0x18de},
+    };
+
+    std::vector<uint16_t> expected;
+    referenceDescramble(input.data(), expected);
+
+    Descrambler descrambler;
+    BOOST_CHECK_EQUAL(descrambler.descramble(input, output), 1);
+    BOOST_CHECK_EQUAL(descrambler.descrambleP(input, output2), 1);
+    int wrong = 0, wrong2 = 0;
+    for(int i=0;i<rows*cols;++i)
+    {
+        wrong += (output.at(i) != expected[i]);
+        wrong2 += (output2.at(i) != expected[i]);
+    }
+    BOOST_CHECK_EQUAL(wrong, 0);
+    BOOST_CHECK_EQUAL(wrong2, 0);
+    // FNV-1a of the little-endian pixels
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(int i=0;i<rows*cols;++i)
+    {
+        hash = (hash ^ (output.at(i) & 0xff)) * 0x100000001b3ull;
+        hash = (hash ^ (output.at(i) >> 8)) * 0x100000001b3ull;
+    }
+    BOOST_CHECK_EQUAL(hash, pythonHash);
+    for(auto& sample : pythonSamples)
+        BOOST_CHECK_EQUAL(output.at(sample[0], sample[1]), sample[2]);
+    BOOST_CHECK_EQUAL(output2.at(5 * Descrambler::numADCs + 3, 100), Descrambler::missingPixel);
+
+    MemBlockI16 small;
+    small.init(logger, 10, cols);
+    BOOST_CHECK(descrambler.descrambleP(small, output) < 0);
+}
+
+// the odd size needs the scalar tail and drops the last row and columns
+BOOST_AUTO_TEST_CASE(FrameBinnerSIMDSameAsNormal)
+{
+    FrameBinner binner;
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<float> value(-10.0f, 100.0f);
+    for(int cols : {FRAME_COLS, 1410})
+    {
+        int rows = 1485;
+        MemBlockF input;
+        input.init(logger, rows, cols);
+        for(int i=0;i<rows*cols;++i)
+            input.at(i) = value(gen);
+
+        for(int factor : {1, 2, 4})
+        {
+            for(bool mean : {false, true})
+            {
+                MemBlockF out, out2;
+                out.init(logger, rows/factor, cols/factor);
+                out2.init(logger, rows/factor, cols/factor);
+                BOOST_REQUIRE_EQUAL(binner.bin(input, out, factor, mean), 0);
+                BOOST_REQUIRE_EQUAL(binner.binP(input, out2, factor, mean), 0);
+                for(int i=0;i<out.rows()*out.cols();++i)
+                    BOOST_CHECK_SMALL(out.at(i) - out2.at(i), 1e-3f * factor * factor);
+
+                // top left bin by hand
+                float sum = 0.0f;
+                for(int r=0;r<factor;++r)
+                    for(int c=0;c<factor;++c)
+                        sum += input.at(r, c);
+                if(mean)
+                    sum /= factor * factor;
+                BOOST_CHECK_CLOSE(out2.at(0, 0), sum, smallPercent * 10);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(FrameBinnerBadShape)
+{
+    FrameBinner binner;
+    MemBlockF input, out;
+    input.init(logger, 16, 16);
+    out.init(logger, 4, 4);
+    BOOST_CHECK(binner.binP(input, out, 3, true) < 0);
+    BOOST_CHECK(binner.binP(input, out, 2, true) < 0);
+    BOOST_CHECK_EQUAL(binner.binP(input, out, 4, true), 0);
+}
+
+static std::string testRingName()
+{
+    return "/percival_test_ring_" + std::to_string(getpid());
+}
+
+BOOST_AUTO_TEST_CASE(FrameRingReadInPlace)
+{
+    FrameRing ring;
+    BOOST_REQUIRE_EQUAL(ring.create(testRingName(), 4, 1000 * sizeof(float)), 0);
+    FrameRingReader reader;
+    BOOST_REQUIRE_EQUAL(reader.open(testRingName()), 0);
+    BOOST_CHECK_EQUAL(ring.readers(), 1);
+
+    FrameRingView view;
+    BOOST_CHECK(!reader.next(view));
+
+    std::vector<float> frame(1000);
+    for(int f=0;f<3;++f)
+    {
+        for(int i=0;i<1000;++i)
+            frame[i] = f * 1000 + i;
+        BOOST_REQUIRE_EQUAL(ring.write(frame.data(), frame.size() * sizeof(float), 10, 100, 4, 100 + f), 0);
+    }
+    BOOST_CHECK_EQUAL(ring.written(), 3);
+    BOOST_CHECK_EQUAL(ring.slowReaders(), 0);
+
+    for(int f=0;f<3;++f)
+    {
+        BOOST_REQUIRE(reader.next(view));
+        BOOST_CHECK_EQUAL(view.frameNumber, 100 + f);
+        BOOST_CHECK_EQUAL(view.rows, 10);
+        BOOST_CHECK_EQUAL(view.cols, 100);
+        BOOST_CHECK_EQUAL(view.bytes, 1000 * sizeof(float));
+        const float* data = static_cast<const float*>(view.data);
+        BOOST_CHECK_EQUAL(data[0], f * 1000);
+        BOOST_CHECK_EQUAL(data[999], f * 1000 + 999);
+        BOOST_CHECK(reader.done(view));
+    }
+    BOOST_CHECK(!reader.next(view));
+    BOOST_CHECK_EQUAL(reader.skipped(), 0);
+
+    // too big for a slot
+    std::vector<float> big(2000);
+    BOOST_CHECK(ring.write(big.data(), big.size() * sizeof(float), 20, 100, 4, 0) < 0);
+
+    reader.close();
+    BOOST_CHECK_EQUAL(ring.readers(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(FrameRingSlowReader)
+{
+    const int slots = 4;
+    FrameRing ring;
+    BOOST_REQUIRE_EQUAL(ring.create(testRingName(), slots, 64), 0);
+    FrameRingReader reader;
+    BOOST_REQUIRE_EQUAL(reader.open(testRingName()), 0);
+
+    uint64_t value = 0;
+    for(;value<10;++value)
+        ring.write(&value, sizeof(value), 1, 1, 8, value);
+    BOOST_CHECK_EQUAL(ring.slowReaders(), 1);
+
+    // only the last slots-1 are safe, as frame 10 goes over frame 6
+    FrameRingView view;
+    BOOST_REQUIRE(reader.next(view));
+    BOOST_CHECK_EQUAL(view.frameNumber, 10 - slots + 1);
+    BOOST_CHECK_EQUAL(reader.skipped(), 10 - slots + 1);
+    BOOST_CHECK(reader.done(view));
+
+    // the writer laps us while we hold a frame
+    BOOST_REQUIRE(reader.next(view));
+    BOOST_CHECK_EQUAL(view.frameNumber, 8);
+    for(int i=0;i<slots;++i,++value)
+        ring.write(&value, sizeof(value), 1, 1, 8, value);
+    BOOST_CHECK(!reader.done(view));
+    BOOST_CHECK_EQUAL(reader.skipped(), 10 - slots + 1 + 1);
+
+    // a second reader is fine, a second ring of the same name replaces the first
+    FrameRingReader reader2;
+    BOOST_REQUIRE_EQUAL(reader2.open(testRingName()), 0);
+    BOOST_CHECK_EQUAL(ring.readers(), 2);
+    FrameRing ring2;
+    BOOST_REQUIRE_EQUAL(ring2.create(testRingName(), slots, 64), 0);
+    FrameRingReader reader3;
+    BOOST_REQUIRE_EQUAL(reader3.open(testRingName()), 0);
+    BOOST_CHECK_EQUAL(ring2.readers(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(RoiExtractorParseAndCut)
+{
+    std::vector<Roi> rois;
+    BOOST_REQUIRE_EQUAL(RoiExtractor::parse("2,3,4,5; 10,0,1,16", 20, 16, rois), 0);
+    BOOST_REQUIRE_EQUAL(rois.size(), 2);
+    BOOST_CHECK_EQUAL(rois[1].row, 10);
+    BOOST_CHECK_EQUAL(rois[1].cols, 16);
+    BOOST_CHECK_EQUAL(RoiExtractor::toString(rois), "2,3,4,5;10,0,1,16");
+
+    // bad ones leave the old list
+    BOOST_CHECK(RoiExtractor::parse("2,3,4", 20, 16, rois) < 0);
+    BOOST_CHECK(RoiExtractor::parse("2,3,4,14", 20, 16, rois) < 0);
+    BOOST_CHECK(RoiExtractor::parse("-1,3,4,5", 20, 16, rois) < 0);
+    BOOST_CHECK_EQUAL(rois.size(), 2);
+    BOOST_CHECK_EQUAL(RoiExtractor::parse("", 20, 16, rois), 0);
+    BOOST_CHECK(rois.empty());
+
+    RoiExtractor::parse("2,3,4,5;4,0,1,16", 20, 16, rois);
+    std::vector<int> rows = RoiExtractor::rowsCovered(rois, 20);
+    BOOST_CHECK((rows == std::vector<int>{2, 3, 4, 5}));
+
+    MemBlockF frame;
+    frame.init(logger, 20, 16);
+    for(int i=0;i<20*16;++i)
+        frame.at(i) = i;
+    std::vector<float> cut(4*5);
+    RoiExtractor::extract(frame.data(), 16, sizeof(float), rois[0], cut.data());
+    for(int r=0;r<4;++r)
+        for(int c=0;c<5;++c)
+            BOOST_CHECK_EQUAL(cut[r*5 + c], frame.at(2 + r, 3 + c));
+}
+
+// only the active rows are calibrated, and they come out the same as in a full frame
+BOOST_AUTO_TEST_CASE(CalibratorActiveRows)
+{
+    int rows=300, cols=64;
+    CalibratorSample calibrator(rows,cols);
+
+    MemBlockI16 input, input2;
+    input.init(logger, rows,cols);
+    input2.init(logger, rows,cols);
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            calibrator.m_Gc.at(r,c) = k1;
+            calibrator.m_Oc.at(r,c) = k2;
+            calibrator.m_Gf.at(r,c) = k3;
+            calibrator.m_Of.at(r,c) = k4;
+            calibrator.m_Ped0.at(r,c) = idealOffset;
+            calibrator.m_Gain0.at(r,c) = 0.5f;
+
+            BitPacker bp;
+            bp.setCoarse(rand());
+            bp.setFine(rand());
+            bp.setGain(0);
+            input.at(r,c) = bp.getBits();
+            input2.at(r,c) = input.at(r,c);
+        }
+    }
+
+    MemBlockF full, part;
+    full.init(logger, rows,cols);
+    part.init(logger, rows,cols);
+    calibrator.processFrameP(input, full);
+
+    std::vector<Roi> rois;
+    BOOST_REQUIRE_EQUAL(RoiExtractor::parse("10,0,5,8;200,30,100,20", rows, cols, rois), 0);
+    calibrator.setActiveRows(RoiExtractor::rowsCovered(rois, rows));
+    BOOST_CHECK_EQUAL(calibrator.numActiveRows(), 105);
+    calibrator.setStats(true, 1.0e6f);
+    calibrator.processFrameP(input2, part);
+    // the stats are only over the rows calibrated
+    BOOST_CHECK_EQUAL(calibrator.m_frameStats.pixels(), (uint64_t)105*cols);
+    for(int r=0;r<rows;++r)
+    {
+        bool active = (10 <= r && r < 15) || 200 <= r;
+        for(int c=0;c<cols;++c)
+        {
+            if(active)
+                BOOST_CHECK_EQUAL(part.at(r,c), full.at(r,c));
+            else
+                BOOST_CHECK(std::isnan(part.at(r,c)));
+        }
+    }
+
+    // photons too; 0xff bytes are the photon NaN value
+    MemBlockI8 photons;
+    photons.init(logger, rows,cols);
+    calibrator.processFramePhotonP(input2, photons);
+    BOOST_CHECK_EQUAL(photons.at(0, 0), 0xff);
+
+    calibrator.setActiveRows(std::vector<int>());
+    BOOST_CHECK_EQUAL(calibrator.numActiveRows(), rows);
+}
+
+// the rows can be changed from another thread while frames go through, and each frame
+// is calibrated with one set of rows or the other, never a mixture
+BOOST_AUTO_TEST_CASE(CalibratorActiveRowsChangeDuringFrames)
+{
+    int rows=300, cols=64;
+    CalibratorSample calibrator(rows,cols);
+
+    MemBlockI16 raw, input;
+    raw.init(logger, rows,cols);
+    input.init(logger, rows,cols);
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            calibrator.m_Gc.at(r,c) = k1;
+            calibrator.m_Oc.at(r,c) = k2;
+            calibrator.m_Gf.at(r,c) = k3;
+            calibrator.m_Of.at(r,c) = k4;
+            calibrator.m_Ped0.at(r,c) = idealOffset;
+            calibrator.m_Gain0.at(r,c) = 0.5f;
+
+            BitPacker bp;
+            bp.setCoarse(rand());
+            bp.setFine(rand());
+            bp.setGain(0);
+            raw.at(r,c) = bp.getBits();
+        }
+    }
+
+    std::vector<int> top, bottom;
+    for(int r=0;r<rows/2;++r)
+    {
+        top.push_back(r);
+        bottom.push_back(rows/2 + r);
+    }
+
+    calibrator.setActiveRows(top);
+    std::atomic<bool> done(false);
+    std::thread changer([&]()
+    {
+        for(int i=1;!done;++i)
+        {
+            calibrator.setActiveRows(i % 2 ? bottom : top);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    MemBlockF output;
+    output.init(logger, rows,cols);
+    for(int frame=0;frame<50;++frame)
+    {
+        memcpy(input.data(), raw.data(), (size_t)rows * cols * sizeof(uint16_t));
+        calibrator.processFrameP(input, output);
+        int topRows = 0, bottomRows = 0;
+        for(int r=0;r<rows;++r)
+        {
+            if(!std::isnan(output.at(r, 0)))
+                ++(r < rows/2 ? topRows : bottomRows);
+        }
+        BOOST_CHECK((topRows == rows/2 && bottomRows == 0) || (topRows == 0 && bottomRows == rows/2));
+    }
+    done = true;
+    changer.join();
+}
+
+// the SIMD sums are the same as the plain ones, in both precisions, with and without counts
+BOOST_AUTO_TEST_CASE(FrameAccumulatorSIMDSameAsNormal)
+{
+    // 61 columns so the SIMD rows have an odd tail
+    int rows=20, cols=61;
+    MemBlockF input;
+    input.init(logger, rows,cols);
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<float> dist(-100.0f, 1000.0f);
+
+    for(int precision=0;precision<2;++precision)
+    {
+        for(int counting=0;counting<2;++counting)
+        {
+            FrameAccumulator normal, simd;
+            normal.init(rows, cols, precision, counting);
+            simd.init(rows, cols, precision, counting);
+            // small chunks, so the rows really are split up
+            simd.setParallel({3, counting ? ParallelSettings::eAuto : ParallelSettings::eStatic, 2});
+            for(int frame=0;frame<5;++frame)
+            {
+                for(int i=0;i<rows*cols;++i)
+                    input.at(i) = (i % 7 == frame) ? NAN : dist(gen);
+                BOOST_REQUIRE_EQUAL(normal.add(input), 0);
+                BOOST_REQUIRE_EQUAL(simd.addP(input), 0);
+            }
+            BOOST_CHECK_EQUAL(simd.frames(), 5);
+            for(int i=0;i<rows*cols;++i)
+            {
+                if(precision)
+                    BOOST_CHECK((normal.sumD().at(i) == simd.sumD().at(i)) || (std::isnan(normal.sumD().at(i)) && std::isnan(simd.sumD().at(i))));
+                else
+                    BOOST_CHECK((normal.sumF().at(i) == simd.sumF().at(i)) || (std::isnan(normal.sumF().at(i)) && std::isnan(simd.sumF().at(i))));
+                if(counting)
+                    BOOST_CHECK_EQUAL(normal.counts().at(i), simd.counts().at(i));
+            }
+        }
+    }
+}
+
+// NaN pixels are left out when counting, and make the sum NaN when not
+BOOST_AUTO_TEST_CASE(FrameAccumulatorValidCounts)
+{
+    int rows=4, cols=16;
+    MemBlockF input;
+    input.init(logger, rows,cols);
+    FrameAccumulator counted, plain;
+    counted.init(rows, cols, true, true);
+    plain.init(rows, cols, false, false);
+    for(int frame=0;frame<3;++frame)
+    {
+        input.setAll(2.0f);
+        // pixel 3 is bad in one frame, pixel 5 in all of them
+        if(frame == 1)
+            input.at(3) = NAN;
+        input.at(5) = NAN;
+        counted.addP(input);
+        plain.addP(input);
+    }
+    BOOST_CHECK_EQUAL(counted.sumD().at(0), 6.0);
+    BOOST_CHECK_EQUAL(counted.counts().at(0), 3);
+    BOOST_CHECK_EQUAL(counted.sumD().at(3), 4.0);
+    BOOST_CHECK_EQUAL(counted.counts().at(3), 2);
+    BOOST_CHECK_EQUAL(counted.sumD().at(5), 0.0);
+    BOOST_CHECK_EQUAL(counted.counts().at(5), 0);
+    BOOST_CHECK_EQUAL(plain.sumF().at(0), 6.0f);
+    BOOST_CHECK(std::isnan(plain.sumF().at(3)));
+
+    counted.clear();
+    BOOST_CHECK_EQUAL(counted.frames(), 0);
+    BOOST_CHECK_EQUAL(counted.counts().at(0), 0);
+
+    MemBlockF wrong;
+    wrong.init(logger, rows+1,cols);
+    BOOST_CHECK(counted.addP(wrong) < 0);
+}
+
+// the SIMD bins are the same as the plain ones, for even and uneven edges
+BOOST_AUTO_TEST_CASE(PixelHistogramSIMDSameAsNormal)
+{
+    int rows=20, cols=61;
+    MemBlockF input;
+    input.init(logger, rows,cols);
+    std::mt19937 gen(4321);
+    std::uniform_real_distribution<float> dist(-20.0f, 120.0f);
+
+    std::vector<float> even, uneven;
+    BOOST_REQUIRE_EQUAL(PixelHistogram::parseEdges("0:100:20", even), 0);
+    BOOST_REQUIRE_EQUAL(PixelHistogram::parseEdges("0,1,2,5,10,50,100", uneven), 0);
+    BOOST_CHECK_EQUAL(even.size(), 21);
+    BOOST_CHECK_EQUAL(even[1], 5.0f);
+
+    for(auto edges : {even, uneven})
+    {
+        PixelHistogram normal, simd;
+        BOOST_REQUIRE_EQUAL(normal.init(rows, cols, edges, 32), 0);
+        BOOST_REQUIRE_EQUAL(simd.init(rows, cols, edges, 32), 0);
+        for(int frame=0;frame<5;++frame)
+        {
+            for(int i=0;i<rows*cols;++i)
+                input.at(i) = (i % 11 == frame) ? NAN : dist(gen);
+            // the edges themselves, which go in the bin above, and the last edge, which goes in none
+            input.at(1) = edges[1];
+            input.at(2) = edges.back();
+            BOOST_REQUIRE_EQUAL(normal.add(input), 0);
+            BOOST_REQUIRE_EQUAL(simd.addP(input), 0);
+            BOOST_CHECK_EQUAL(simd.binOf(edges[1]), 1);
+        }
+        BOOST_CHECK_EQUAL(normal.outOfRange(), simd.outOfRange());
+        uint64_t total = simd.outOfRange();
+        for(int r=0;r<rows;++r)
+            for(int c=0;c<cols;++c)
+                for(int b=0;b<simd.bins();++b)
+                {
+                    BOOST_CHECK_EQUAL(normal.count(r,c,b), simd.count(r,c,b));
+                    total += simd.count(r,c,b);
+                }
+        BOOST_CHECK_EQUAL(total, 5 * rows * cols);
+        BOOST_CHECK_EQUAL(simd.count(0,1,1), 5);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(PixelHistogramCountersAndSave)
+{
+    int rows=2, cols=8;
+    std::vector<float> edges;
+    BOOST_CHECK(PixelHistogram::parseEdges("0,5,5", edges) < 0);
+    BOOST_CHECK(PixelHistogram::parseEdges("0:10", edges) < 0);
+    BOOST_CHECK(PixelHistogram::parseEdges("1,x", edges) < 0);
+    BOOST_CHECK(edges.empty());
+    BOOST_REQUIRE_EQUAL(PixelHistogram::parseEdges("0:4:4", edges), 0);
+
+    // 16 bit counters stop at the top
+    PixelHistogram histogram;
+    BOOST_CHECK(histogram.init(rows, cols, edges, 8) < 0);
+    BOOST_REQUIRE_EQUAL(histogram.init(rows, cols, edges, 16), 0);
+    MemBlockI16 adc;
+    adc.init(logger, rows,cols);
+    adc.setAll(2);
+    for(int i=0;i<70000;++i)
+        histogram.addP(adc);
+    BOOST_CHECK_EQUAL(histogram.count(1,7,2), 0xffff);
+    BOOST_CHECK_EQUAL(histogram.count(1,7,1), 0);
+
+    std::string filename = "/tmp/pixel_histogram_test_" + std::to_string(getpid()) + ".h5";
+    BOOST_CHECK_EQUAL(histogram.saveToH5(filename), 0);
+    BOOST_CHECK_EQUAL(access(filename.c_str(), R_OK), 0);
+    BOOST_CHECK(access((filename + ".tmp").c_str(), F_OK) < 0);
+    remove(filename.c_str());
+}
+
+// the SIMD counts are the same as the plain ones, across the flush of the byte counters
+BOOST_AUTO_TEST_CASE(GainOccupancySIMDSameAsNormal)
+{
+    int rows=4, cols=40;
+    GainOccupancy normal(rows, cols), simd(rows, cols);
+    MemBlockI16 gain;
+    gain.init(logger, rows,cols);
+    std::mt19937 gen(99);
+    const int frames = 2 * GainOccupancy::flushFrames + 10;
+    for(int frame=0;frame<frames;++frame)
+    {
+        for(int i=0;i<rows*cols;++i)
+            gain.at(i) = (i == 0) ? 2 : gen() % 4;
+        normal.startFrame();
+        simd.startFrame();
+        for(int r=0;r<rows;++r)
+        {
+            normal.addRow(gain, r);
+            simd.addRowSIMD(gain, r);
+        }
+    }
+    BOOST_CHECK_EQUAL(simd.frames(), frames);
+    double percent = 0.0;
+    for(int g=0;g<GainOccupancy::numGains;++g)
+    {
+        BOOST_CHECK_CLOSE(normal.percent(g), simd.percent(g), 1e-9);
+        percent += simd.percent(g);
+        for(int r=0;r<rows;++r)
+            for(int c=0;c<cols;++c)
+                BOOST_CHECK_EQUAL(normal.count(g, r, c), simd.count(g, r, c));
+    }
+    BOOST_CHECK_CLOSE(percent, 100.0, 1e-9);
+    BOOST_CHECK_EQUAL(simd.count(2, 0, 0), frames);
+    uint32_t total = 0;
+    for(int g=0;g<GainOccupancy::numGains;++g)
+        total += simd.count(g, 3, 39);
+    BOOST_CHECK_EQUAL(total, frames);
+
+    simd.clear();
+    BOOST_CHECK_EQUAL(simd.count(2, 0, 0), 0);
+    BOOST_CHECK_EQUAL(simd.percent(2), 0.0);
+}
+
+// the calibration feeds it the gains it decodes
+BOOST_AUTO_TEST_CASE(CalibratorGainOccupancy)
+{
+    int rows=20, cols=64;
+    CalibratorSample calibrator(rows,cols);
+    GainOccupancy occupancy(rows, cols);
+    calibrator.setGainOccupancy(&occupancy);
+
+    MemBlockI16 input;
+    MemBlockF output;
+    input.init(logger, rows,cols);
+    output.init(logger, rows,cols);
+    for(int frame=0;frame<3;++frame)
+    {
+        for(int i=0;i<rows*cols;++i)
+        {
+            BitPacker bp;
+            bp.setCoarse(rand());
+            bp.setFine(rand());
+            bp.setGain(i % 4 == 1 ? 1 : 0);
+            input.at(i) = bp.getBits();
+        }
+        calibrator.processFrameP(input, output);
+    }
+    BOOST_CHECK_EQUAL(occupancy.frames(), 3);
+    BOOST_CHECK_EQUAL(occupancy.count(1, 0, 1), 3);
+    BOOST_CHECK_EQUAL(occupancy.count(0, 0, 1), 0);
+    BOOST_CHECK_EQUAL(occupancy.count(0, 5, 4), 3);
+    BOOST_CHECK_CLOSE(occupancy.percent(1), 25.0, 1e-9);
+
+    GainOccupancy wrong(rows+1, cols);
+    calibrator.setGainOccupancy(&wrong);
+    BOOST_CHECK(calibrator.m_pOccupancy == nullptr);
+}
+
+// the plugin clears the occupancy by taking it off the calibrator first, and that
+// has to wait for the frame being calibrated, so every pixel counts every frame
+BOOST_AUTO_TEST_CASE(CalibratorGainOccupancyClearedDuringFrames)
+{
+    int rows=200, cols=64;
+    CalibratorSample calibrator(rows,cols);
+    GainOccupancy occupancy(rows, cols);
+    calibrator.setGainOccupancy(&occupancy);
+
+    MemBlockI16 input;
+    MemBlockF output;
+    input.init(logger, rows,cols);
+    output.init(logger, rows,cols);
+    for(int i=0;i<rows*cols;++i)
+    {
+        BitPacker bp;
+        bp.setCoarse(rand());
+        bp.setFine(rand());
+        bp.setGain(0);
+        input.at(i) = bp.getBits();
+    }
+
+    std::atomic<bool> done(false);
+    std::thread clearer([&]()
+    {
+        while(!done)
+        {
+            calibrator.setGainOccupancy(nullptr);
+            occupancy.clear();
+            calibrator.setGainOccupancy(&occupancy);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    // the gains are written over the input, but they are all 0 anyway
+    for(int frame=0;frame<50;++frame)
+        calibrator.processFrameP(input, output);
+    done = true;
+    clearer.join();
+
+    int wrong = 0;
+    for(int r=0;r<rows;++r)
+        for(int c=0;c<cols;++c)
+            wrong += (occupancy.count(0, r, c) != occupancy.frames());
+    BOOST_CHECK_EQUAL(wrong, 0);
+}
+
+// setDarkFrame waits for the frame being calibrated, so a frame has the darkframe
+// taken off every row or none
+BOOST_AUTO_TEST_CASE(CalibratorDarkFrameChangeDuringFrames)
+{
+    int rows=300, cols=64;
+    CalibratorSample calibrator(rows,cols);
+
+    MemBlockI16 raw, input;
+    MemBlockF dark, output, expected;
+    raw.init(logger, rows,cols);
+    input.init(logger, rows,cols);
+    dark.init(logger, rows,cols);
+    output.init(logger, rows,cols);
+    expected.init(logger, rows,cols);
+    for(int i=0;i<rows*cols;++i)
+    {
+        BitPacker bp;
+        bp.setCoarse(rand());
+        bp.setFine(rand());
+        bp.setGain(0);
+        raw.at(i) = bp.getBits();
+        dark.at(i) = 1000.0f;
+    }
+    memcpy(input.data(), raw.data(), (size_t)rows * cols * sizeof(uint16_t));
+    calibrator.processFrameP(input, expected);
+
+    std::atomic<bool> done(false);
+    std::thread changer([&]()
+    {
+        for(int i=0;!done;++i)
+        {
+            calibrator.setDarkFrame(i % 2 ? nullptr : &dark);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    for(int frame=0;frame<50;++frame)
+    {
+        memcpy(input.data(), raw.data(), (size_t)rows * cols * sizeof(uint16_t));
+        calibrator.processFrameP(input, output);
+        int withDark = 0, withoutDark = 0;
+        for(int i=0;i<rows*cols;++i)
+        {
+            withDark += output.at(i) == expected.at(i) - 1000.0f;
+            withoutDark += output.at(i) == expected.at(i);
+        }
+        BOOST_CHECK(withDark == rows*cols || withoutDark == rows*cols);
+    }
+    done = true;
+    changer.join();
+}
+
+BOOST_AUTO_TEST_CASE(LatencyHistogramPercentiles)
+{
+    // every value must land in a bucket whose top is at least it, and within 12.5%
+    for(uint64_t ns : {0ull, 1ull, 7ull, 8ull, 9ull, 15ull, 16ull, 1000ull, 123456789ull, ~0ull})
+    {
+        int bucket = LatencyHistogram::bucketOf(ns);
+        BOOST_CHECK(0 <= bucket && bucket < LatencyHistogram::numBuckets);
+        BOOST_CHECK(ns <= LatencyHistogram::bucketTop(bucket));
+        BOOST_CHECK(LatencyHistogram::bucketTop(bucket) - ns <= ns / 8);
+        if(bucket)
+            BOOST_CHECK(LatencyHistogram::bucketTop(bucket - 1) < ns);
+    }
+
+    LatencyHistogram histogram;
+    BOOST_CHECK_EQUAL(histogram.percentile(50), 0);
+    for(uint64_t ns=1;ns<=1000;++ns)
+        histogram.add(ns * 1000);
+    BOOST_CHECK_EQUAL(histogram.count(), 1000);
+    BOOST_CHECK_EQUAL(histogram.max(), 1000000);
+    BOOST_CHECK_EQUAL(histogram.percentile(100), 1000000);
+    uint64_t p50 = histogram.percentile(50);
+    BOOST_CHECK(500000 <= p50 && p50 <= 500000 * 9 / 8);
+    uint64_t p99 = histogram.percentile(99);
+    BOOST_CHECK(990000 <= p99 && p99 <= 1000000);
+
+    histogram.clear();
+    BOOST_CHECK_EQUAL(histogram.count(), 0);
+    BOOST_CHECK_EQUAL(histogram.max(), 0);
+}
+
+// the tbb settings only change how the rows are shared out, not the answers
+BOOST_AUTO_TEST_CASE(CalibratorParallelSettings)
+{
+    int rows=300, cols=64;
+    CalibratorSample calibrator(rows,cols);
+    BOOST_CHECK_EQUAL(calibrator.getParallel().grain, CalibratorSample::defaultGrain);
+
+    MemBlockI16 frame, input;
+    frame.init(logger, rows,cols);
+    input.init(logger, rows,cols);
+    for(int r=0;r<rows;++r)
+    {
+        for(int c=0;c<cols;++c)
+        {
+            calibrator.m_Gc.at(r,c) = k1;
+            calibrator.m_Oc.at(r,c) = k2;
+            calibrator.m_Gf.at(r,c) = k3;
+            calibrator.m_Of.at(r,c) = k4;
+            calibrator.m_Ped0.at(r,c) = idealOffset;
+            calibrator.m_Gain0.at(r,c) = 0.5f;
+
+            BitPacker bp;
+            bp.setCoarse(rand());
+            bp.setFine(rand());
+            bp.setGain(0);
+            frame.at(r,c) = bp.getBits();
+        }
+    }
+
+    MemBlockF expected, output;
+    expected.init(logger, rows,cols);
+    output.init(logger, rows,cols);
+    memcpy(input.data(), frame.data(), rows*cols*sizeof(uint16_t));
+    calibrator.processFrameP(input, expected);
+
+    for(int partitioner=0;partitioner<ParallelSettings::ePartitionerMax;++partitioner)
+    {
+        for(int grain : {0, 1, 7, 300, 1000})
+        {
+            for(int threads : {0, 1, 3})
+            {
+                calibrator.setParallel({grain, partitioner, threads});
+                memcpy(input.data(), frame.data(), rows*cols*sizeof(uint16_t));
+                calibrator.processFrameP(input, output);
+                BOOST_CHECK_EQUAL(memcmp(output.data(), expected.data(), rows*cols*sizeof(float)), 0);
+            }
+        }
+    }
+    BOOST_CHECK_EQUAL(calibrator.getParallel().grain, 1000);
+    BOOST_CHECK_EQUAL(ParallelSettings::partitionerFromName("auto"), ParallelSettings::eAuto);
+    BOOST_CHECK_EQUAL(ParallelSettings::partitionerFromName("guided"), -1);
+
+    // the tuner tries everything in its lists, and leaves the fastest in place
+    ParallelTuner tuner(rows, cols);
+    tuner.m_grains = {10, 100};
+    tuner.m_threads = {1, 2};
+    tuner.m_repeats = 1;
+    ParallelTuner::Trial best = tuner.tuneSample();
+    BOOST_CHECK_EQUAL(tuner.m_trials.size(), 2 * 2 * ParallelSettings::ePartitionerMax);
+    for(auto& trial : tuner.m_trials)
+        BOOST_CHECK(best.msPerFrame <= trial.msPerFrame);
+    BOOST_CHECK(best.settings.grain == 10 || best.settings.grain == 100);
+    best = tuner.tuneReset();
+    BOOST_CHECK(best.settings.threads == 1 || best.settings.threads == 2);
+}
+
+// the hardware counts may not be there (eg in a VM), so this checks the windows and
+// the nesting, which don't need them
+BOOST_AUTO_TEST_CASE(PerfCountersWindows)
+{
+    PerfCounters perf(2);
+    uint64_t counts[PerfCounters::eNumCounters] = {4000, 6000, 10};
+    perf.add(counts);
+    perf.endFrame(2000000, 1000);
+    BOOST_CHECK_EQUAL(perf.lastWindow().frames, 0);
+    perf.add(counts);
+    perf.endFrame(2000000, 1000);
+    PerfCounters::Window window = perf.lastWindow();
+    BOOST_CHECK_EQUAL(window.frames, 2);
+    BOOST_CHECK_CLOSE(window.ipc(), 1.5, 1e-9);
+    BOOST_CHECK_CLOSE(window.perPixel(PerfCounters::eCycles), 4.0, 1e-9);
+    BOOST_CHECK_CLOSE(window.memoryBytesPerPixel(), 0.01 * PerfCounters::cacheLineBytes, 1e-9);
+    BOOST_CHECK_CLOSE(window.msPerFrame(), 2.0, 1e-9);
+    // 1000 pixels at 10 bytes is 10kB a frame, so 1 GB/s is 100000 frames/s
+    BOOST_CHECK_CLOSE(window.rooflineFramesPerS(10, 1.0), 100000.0, 1e-9);
+
+    // off, nothing is counted
+    perf.clear();
+    perf.setFramesPerWindow(1);
+    {
+        PerfCounters::Frame frame(&perf, 100);
+    }
+    BOOST_CHECK_EQUAL(perf.lastWindow().frames, 0);
+
+    // a frame inside another is part of it
+    perf.setEnabled(true);
+    {
+        PerfCounters::Frame outer(&perf, 100);
+        {
+            PerfCounters::Frame inner(&perf, 50);
+        }
+        outer.end();
+        BOOST_CHECK_EQUAL(perf.lastWindow().frames, 1);
+        BOOST_CHECK_EQUAL(perf.lastWindow().pixels, 100);
+    }
+    BOOST_CHECK_EQUAL(perf.lastWindow().pixels, 100);
+
+    // each processFrameP is a frame, however many threads it's on
+    int rows=64, cols=32;
+    CalibratorSample calibrator(rows, cols);
+    calibrator.setParallel({4, ParallelSettings::eSimple, 3});
+    calibrator.setPerfCounters(&perf);
+    MemBlockI16 input;
+    MemBlockF output;
+    input.init(logger, rows, cols);
+    output.init(logger, rows, cols);
+    input.setAll(0);
+    calibrator.processFrameP(input, output);
+    window = perf.lastWindow();
+    BOOST_CHECK_EQUAL(window.frames, 1);
+    BOOST_CHECK_EQUAL(window.pixels, rows * cols);
+    if(perf.available())
+        BOOST_CHECK(window.counts[PerfCounters::eInstructions] > 0);
+}
+
+BOOST_AUTO_TEST_CASE(FrameTimingWaitAndRate)
+{
+    // a wait that's not known, or from the future, is left out
+    BOOST_CHECK_EQUAL(FrameTiming::waitSince(0, 1000), -1);
+    BOOST_CHECK_EQUAL(FrameTiming::waitSince(2000, 1000), -1);
+    BOOST_CHECK_EQUAL(FrameTiming::waitSince(1000, 3500), 2500);
+    struct timespec time = {2, 5};
+    BOOST_CHECK_EQUAL(FrameTiming::toNs(time), 2000000005);
+
+    FrameTiming timing;
+    BOOST_CHECK_EQUAL(timing.framesPerS(), 0.0);
+    timing.add(1000000, 500000);
+    timing.add(2000000, -1);
+    {
+        FrameTiming::Scope scope(timing, 100000);
+        usleep(2000);
+    }
+    BOOST_CHECK_EQUAL(timing.m_process.count(), 3);
+    BOOST_CHECK_EQUAL(timing.m_wait.count(), 2);
+    BOOST_CHECK(timing.m_process.max() >= 2000000);
+    BOOST_CHECK(timing.framesPerS() > 0.0);
+    // nothing since the last call
+    BOOST_CHECK_EQUAL(timing.framesPerS(), 0.0);
+
+    timing.clear();
+    BOOST_CHECK_EQUAL(timing.m_process.count(), 0);
+    BOOST_CHECK_EQUAL(timing.m_wait.count(), 0);
+    BOOST_CHECK_EQUAL(timing.framesPerS(), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(FrameTraceRingsAndJson)
+{
+    // a ring keeps the last ringEvents, oldest first
+    std::unique_ptr<FrameTrace::Ring> ring(new FrameTrace::Ring);
+    for(uint64_t i=0;i<FrameTrace::ringEvents + 10;++i)
+        ring->add(1000 + i, i, FrameTrace::eCalibRows, FrameTrace::eBegin);
+    std::vector<FrameTrace::Event> events = ring->snapshot();
+    // the writer could be writing over the first one still
+    BOOST_CHECK_EQUAL(events.size(), FrameTrace::ringEvents - 1);
+    BOOST_CHECK_EQUAL(events.front().frame, 11);
+    BOOST_CHECK_EQUAL(events.back().frame, FrameTrace::ringEvents + 9);
+    BOOST_CHECK_EQUAL(events.back().tsc, 1000 + FrameTrace::ringEvents + 9);
+    BOOST_CHECK_EQUAL(events.back().stage, FrameTrace::eCalibRows);
+    BOOST_CHECK_EQUAL(events.back().phase, FrameTrace::eBegin);
+
+    // each thread gets its own ring, and the JSON has them all after a clear
+    FrameTrace::clear();
+    std::thread other([]()
+    {
+        FrameTrace::Span span(7, FrameTrace::eProcess2);
+        FrameTrace::add(7, FrameTrace::ePush, FrameTrace::eInstant);
+    });
+    other.join();
+    {
+        FrameTrace::Span span(8, FrameTrace::eCalib);
+        BOOST_CHECK_EQUAL(FrameTrace::threadFrame(), 8);
+    }
+    std::stringstream ss;
+    BOOST_CHECK_EQUAL(FrameTrace::toJson(ss), 5);
+    std::string json = ss.str();
+    BOOST_CHECK(json.find("\"name\":\"process2\",\"cat\":\"percival\",\"ph\":\"B\"") != std::string::npos);
+    BOOST_CHECK(json.find("\"name\":\"push\",\"cat\":\"percival\",\"ph\":\"i\",\"s\":\"t\"") != std::string::npos);
+    BOOST_CHECK(json.find("\"args\":{\"frame\":8}") != std::string::npos);
+    BOOST_CHECK_EQUAL(json.substr(0, 15), "{\"displayTimeUn");
+}
+
 #if 0
 // this one offers timing stats on processing a whole frame
 BOOST_AUTO_TEST_CASE(CalibratorFrameRun)
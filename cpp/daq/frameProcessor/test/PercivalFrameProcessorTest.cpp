@@ -4,8 +4,13 @@
 #include <boost/shared_ptr.hpp>
 
 #include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 #include "PercivalProcess2Plugin.h"
+#include "PercivalCalibPlugin.h"
+#include "PercivalHistogramPlugin.h"
 
 class PercivalProcess2PluginTestFixture
 {
@@ -29,4 +34,72 @@ BOOST_AUTO_TEST_CASE(PercivalProcess2PluginTestFixture)
     BOOST_CHECK(true);
 }
 
+BOOST_AUTO_TEST_CASE(PercivalCalibPluginPhotonDefaults)
+{
+    // outputformat alone has to give the calibrator the plugin's photon defaults,
+    // not its own 1 electron per photon
+    FrameProcessor::PercivalCalibPlugin calib;
+    // configure() and status() are only public in the base
+    FrameProcessor::FrameProcessorPlugin& plugin = calib;
+    OdinData::IpcMessage config, reply, status;
+    config.set_param("outputformat", std::string("photon16"));
+    plugin.configure(config, reply);
+    plugin.status(status);
+    BOOST_CHECK_EQUAL(status.get_param<std::string>(plugin.get_name() + "/outputformat"), "photon16");
+    BOOST_CHECK_CLOSE(status.get_param<float>(plugin.get_name() + "/photon_electrons"),
+                      status.get_param<float>(plugin.get_name() + "/photonenergy") / 3.6f, 0.01);
+}
+
+// configure clears and restarts the histograms under the lock the frames take, so
+// every pixel has counted every frame they have
+BOOST_AUTO_TEST_CASE(PercivalHistogramPluginClearedDuringFrames)
+{
+    FrameProcessor::PercivalHistogramPlugin hist;
+    FrameProcessor::FrameProcessorPlugin& plugin = hist;
+    OdinData::IpcMessage config, reply;
+    config.set_param("edges", std::string("0:100:10"));
+    plugin.configure(config, reply);
+
+    int rows=200, cols=64;
+    MemBlockI16 image;
+    image.init(log4cxx::Logger::getLogger("FP.Test"), rows, cols);
+    image.setAll(55);
+    FrameProcessor::FrameMetaData md;
+    FrameProcessor::dimensions_t dims(2); dims[0] = rows; dims[1] = cols;
+    md.set_dataset_name("ecount");
+    md.set_data_type(FrameProcessor::raw_16bit);
+    md.set_compression_type(FrameProcessor::no_compression);
+    md.set_dimensions(dims);
+
+    std::atomic<bool> done(false);
+    std::thread changer([&]()
+    {
+        for(int i=0;!done;++i)
+        {
+            OdinData::IpcMessage change, changeReply;
+            if(i % 2)
+                change.set_param("clear", true);
+            else
+                change.set_param("edges", std::string("0:100:10"));
+            plugin.configure(change, changeReply);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    for(int frame=0;frame<50;++frame)
+        hist.add(md, image.data());
+    done = true;
+    changer.join();
+
+    // the last restart may have come after the last frame
+    boost::shared_ptr<PixelHistogram> histogram = hist.histogram();
+    if(histogram)
+    {
+        int wrong = 0;
+        for(int r=0;r<rows;++r)
+            for(int c=0;c<cols;++c)
+                wrong += (histogram->count(r, c, 5) != histogram->frames());
+        BOOST_CHECK_EQUAL(wrong, 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,361 @@
+
+#include "CalibratorSample.h"
+#include "CalibratorReset.h"
+#include "PerfCounters.h"
+
+#include "log4cxx/basicconfigurator.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include <hdf5.h>
+#include <tbb/tbb.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <thread>
+
+namespace bfs = boost::filesystem;
+namespace po = boost::program_options;
+int rows = 1484;
+int cols = 1440;
+static log4cxx::LoggerPtr logger = log4cxx::Logger::getLogger("Calib-bench");
+
+// This times each of the calibration kernels on synthetic frames made from a fixed seed,
+// so two builds (or two machines) can be compared by diffing the JSON it writes.
+// Each case is run --warmup times untimed, then --repeats times, one frame per repeat;
+// anything a case has to do between frames (eg restoring an input the kernel wrote its
+// gains over) is not in the times.
+
+struct BenchCase
+{
+    std::string name;
+    // the bytes each pixel has to move at least, in and out, for the GB/s
+    int bytesPerPixel;
+    // this is done once before the case, prepare before every frame, and only run is timed
+    std::function<void()> setup;
+    std::function<void()> prepare;
+    std::function<void()> run;
+};
+
+struct BenchResult
+{
+    std::string name;
+    int bytesPerPixel;
+    // ns per frame, sorted
+    std::vector<double> ns;
+    // the timed frames, if --perf is on
+    PerfCounters::Window perf;
+};
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    // nearest-rank
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(sorted.size() - 1, rank ? rank - 1 : 0)];
+}
+
+// the perf counters count each timed frame, on all the threads that work on it
+static BenchResult runCase(BenchCase& bench, int warmup, int repeats, PerfCounters& perf)
+{
+    BenchResult result;
+    result.name = bench.name;
+    result.bytesPerPixel = bench.bytesPerPixel;
+    if(bench.setup)
+        bench.setup();
+    perf.setFramesPerWindow(repeats);
+    for(int i=0;i<warmup+repeats;++i)
+    {
+        if(i == warmup)
+            perf.clear();
+        if(bench.prepare)
+            bench.prepare();
+        PerfCounters::Frame frame(&perf, (uint64_t)rows * cols);
+        auto t1 = std::chrono::steady_clock::now();
+        bench.run();
+        auto t2 = std::chrono::steady_clock::now();
+        frame.end();
+        if(warmup <= i)
+            result.ns.push_back(std::chrono::duration<double, std::nano>(t2 - t1).count());
+    }
+    std::sort(result.ns.begin(), result.ns.end());
+    result.perf = perf.lastWindow();
+    return result;
+}
+
+// the gains are mostly 0, as in a real frame, so the gain 1-3 branches are taken too
+static void makeFrame(std::mt19937& rng, MemBlockI16& frame, bool reset)
+{
+    std::uniform_int_distribution<int> fine(0, 255), coarse(0, 31), gainPick(0, 99);
+    for(int i=0;i<rows*cols;++i)
+    {
+        int p = gainPick(rng);
+        uint16_t gain = reset ? 0 : (p < 90 ? 0 : p < 96 ? 1 : p < 99 ? 2 : 3);
+        frame.data()[i] = (gain << 13) | (fine(rng) << 5) | coarse(rng);
+    }
+}
+
+static void makeConstants(std::mt19937& rng, CalibratorSample& calibS, CalibratorReset& calibR)
+{
+    std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+    for(int i=0;i<rows*cols;++i)
+    {
+        float Gc = 1.0f + jitter(rng), Oc = 16.0f + jitter(rng), Gf = 1.0f/32 + jitter(rng)/32, Of = 128.0f + jitter(rng);
+        calibS.m_Gc.at(i) = calibR.m_Gc.at(i) = Gc;
+        calibS.m_Oc.at(i) = calibR.m_Oc.at(i) = Oc;
+        calibS.m_Gf.at(i) = calibR.m_Gf.at(i) = Gf;
+        calibS.m_Of.at(i) = calibR.m_Of.at(i) = Of;
+        calibS.m_Ped0.at(i) = 100.0f + 10*jitter(rng);
+        calibS.m_Ped1.at(i) = 200.0f + 10*jitter(rng);
+        calibS.m_Ped2.at(i) = 300.0f + 10*jitter(rng);
+        calibS.m_Gain0.at(i) = 1.0f + jitter(rng);
+        calibS.m_Gain1.at(i) = 0.1f + jitter(rng)/10;
+        calibS.m_Gain2.at(i) = 0.01f + jitter(rng)/100;
+        calibS.m_resetFrame.at(i) = 50.0f + 10*jitter(rng);
+    }
+}
+
+// the same layout as a capture file: /data is frames x rows x cols uint16, and there's a
+// rows x cols double /constant for the double load.
+static int64_t writeH5(const std::string& filename, std::vector<MemBlockI16>& frames, MemBlockF& constant)
+{
+    hid_t fh = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if(fh < 0)
+        return -1;
+    herr_t status = 0;
+    hsize_t dims[3] = {(hsize_t)frames.size(), (hsize_t)rows, (hsize_t)cols};
+    std::vector<uint16_t> data;
+    for(auto& frame : frames)
+        data.insert(data.end(), frame.data(), frame.data() + (size_t)rows * cols);
+    hid_t space = H5Screate_simple(3, dims, NULL);
+    hid_t dset = H5Dcreate(fh, "/data", H5T_STD_U16LE, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    status |= H5Dwrite(dset, H5T_NATIVE_UINT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, data.data());
+    H5Dclose(dset);
+    H5Sclose(space);
+
+    std::vector<double> values(constant.data(), constant.data() + (size_t)rows * cols);
+    space = H5Screate_simple(2, dims + 1, NULL);
+    dset = H5Dcreate(fh, "/constant", H5T_IEEE_F64LE, space, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    status |= H5Dwrite(dset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, values.data());
+    H5Dclose(dset);
+    H5Sclose(space);
+    status |= H5Fclose(fh);
+    return status < 0 ? -1 : 0;
+}
+
+static void writeJSON(std::ostream& out, const std::vector<BenchResult>& results, unsigned seed, int warmup, int repeats,
+                      PerfCounters& perf, double peakGbPerS)
+{
+    const double pixels = (double)rows * cols;
+    out << "{\n";
+    out << "  \"tool\": \"calib-bench\",\n";
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+#ifdef __AVX__
+    out << "  \"avx\": true,\n";
+#else
+    out << "  \"avx\": false,\n";
+#endif
+    out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"rows\": " << rows << ",\n";
+    out << "  \"cols\": " << cols << ",\n";
+    out << "  \"seed\": " << seed << ",\n";
+    out << "  \"warmup\": " << warmup << ",\n";
+    out << "  \"repeats\": " << repeats << ",\n";
+    out << "  \"perf\": " << (perf.enabled() ? "true" : "false") << ",\n";
+    out << "  \"perf_available\": " << (perf.available() ? "true" : "false") << ",\n";
+    out << "  \"peak_gb_per_s\": " << peakGbPerS << ",\n";
+    out << "  \"cases\": [";
+    for(size_t i=0;i<results.size();++i)
+    {
+        const BenchResult& result = results[i];
+        double p50 = percentile(result.ns, 50);
+        out << (i ? ",\n" : "\n");
+        out << "    {\n";
+        out << "      \"name\": \"" << result.name << "\",\n";
+        out << "      \"bytes_per_pixel\": " << result.bytesPerPixel << ",\n";
+        out << "      \"frames_per_s\": " << 1e9 / p50 << ",\n";
+        out << "      \"gb_per_s\": " << result.bytesPerPixel * pixels / p50 << ",\n";
+        out << "      \"ns_per_pixel\": {";
+        out << "\"min\": " << result.ns.front() / pixels;
+        out << ", \"p50\": " << p50 / pixels;
+        out << ", \"p90\": " << percentile(result.ns, 90) / pixels;
+        out << ", \"p99\": " << percentile(result.ns, 99) / pixels;
+        out << ", \"max\": " << result.ns.back() / pixels << "}";
+        if(perf.enabled())
+        {
+            const PerfCounters::Window& w = result.perf;
+            out << ",\n      \"perf\": {";
+            out << "\"cycles_per_pixel\": " << w.perPixel(PerfCounters::eCycles);
+            out << ", \"instructions_per_pixel\": " << w.perPixel(PerfCounters::eInstructions);
+            out << ", \"ipc\": " << w.ipc();
+            out << ", \"cache_misses_per_pixel\": " << w.perPixel(PerfCounters::eCacheMisses);
+            out << ", \"memory_bytes_per_pixel\": " << w.memoryBytesPerPixel();
+            out << ", \"memory_gb_per_s\": " << w.memoryGbPerS() << "}";
+        }
+        if(0 < peakGbPerS)
+            out << ",\n      \"roofline_frames_per_s\": " << peakGbPerS * 1e9 / (result.bytesPerPixel * pixels);
+        out << "\n    }";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    log4cxx::BasicConfigurator::configure();
+    log4cxx::Logger::getRootLogger()->setLevel(log4cxx::Level::getWarn());
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+    ("help,h", "This times the calibration kernels on synthetic frames and writes frames/s, GB/s and\
+                ns/pixel percentiles for each as JSON.")
+    ("out,o", po::value<std::string>(), "file to write the JSON to (def stdout)")
+    ("repeats,r", po::value<int>()->default_value(50), "timed frames per case")
+    ("warmup,w", po::value<int>()->default_value(3), "untimed frames per case first")
+    ("seed,s", po::value<unsigned>()->default_value(1234), "seed for the synthetic frames and constants")
+    ("filter", po::value<std::string>()->default_value(""), "only run the cases with this in their name")
+    ("list", po::bool_switch()->default_value(false), "list the cases and stop")
+    ("perf", po::bool_switch()->default_value(false), "count cycles, instructions and cache misses with perf_event_open")
+    ("peak-gbs", po::value<double>()->default_value(0.0), "memory bandwidth of this host, for the roofline frames/s of each case")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << desc;
+        exit(0);
+    }
+
+    int repeats = vm["repeats"].as<int>();
+    int warmup = vm["warmup"].as<int>();
+    unsigned seed = vm["seed"].as<unsigned>();
+    std::string filter = vm["filter"].as<std::string>();
+    if(repeats < 1 || warmup < 0)
+    {
+        std::cout << "Error: repeats must be at least 1" << std::endl; exit(1);
+    }
+
+    CalibratorSample calibS(rows, cols);
+    CalibratorReset calibR(rows, cols);
+    // the calibrators count their tbb chunks in this too, so the workers are counted
+    PerfCounters perf;
+    perf.setEnabled(vm["perf"].as<bool>());
+    calibS.setPerfCounters(&perf);
+    calibR.setPerfCounters(&perf);
+    double peakGbPerS = vm["peak-gbs"].as<double>();
+    std::mt19937 rng(seed);
+    makeConstants(rng, calibS, calibR);
+
+    // a few different frames, so the branch predictor can't learn one
+    const int numFrames = 4;
+    std::vector<MemBlockI16> frames(numFrames);
+    MemBlockI16 resetInput, input, loadU16;
+    MemBlockF output, dark, constant;
+    MemBlockD loadD;
+    for(auto& frame : frames)
+    {
+        frame.init(logger, rows, cols);
+        makeFrame(rng, frame, false);
+    }
+    resetInput.init(logger, rows, cols);
+    makeFrame(rng, resetInput, true);
+    input.init(logger, rows, cols);
+    loadU16.init(logger, rows, cols);
+    output.init(logger, rows, cols);
+    dark.init(logger, rows, cols);
+    dark.setAll(5.0f);
+    constant.init(logger, rows, cols);
+    constant.setAll(1.0f);
+    loadD.init(logger, rows, cols);
+
+    bfs::path h5file = bfs::temp_directory_path() / bfs::unique_path("calib-bench-%%%%%%%%.h5");
+    if(writeH5(h5file.string(), frames, constant) < 0)
+    {
+        std::cout << "Error: could not write " << h5file << std::endl; exit(1);
+    }
+
+    // the sample kernels write the gains over their input, so it's put back before each frame
+    int frameIdx = 0;
+    auto nextFrame = [&]() {
+        MemBlockI16& frame = frames[frameIdx++ % numFrames];
+        memcpy(input.data(), frame.data(), (size_t)rows * cols * sizeof(uint16_t));
+    };
+    auto sampleSetup = [&](bool cma, MemBlockF* pDark) {
+        return [&, cma, pDark]() {
+            calibS.setCMA(cma, 0);
+            calibS.setDarkFrame(pDark);
+        };
+    };
+    auto sampleRows = [&](void (CalibratorSample::*fn)(MemBlockI16&, MemBlockF&, int)) {
+        return [&, fn]() {
+            for(int r=0;r<rows;++r)
+                (calibS.*fn)(input, output, r);
+        };
+    };
+    auto resetRows = [&](void (CalibratorReset::*fn)(MemBlockI16&, MemBlockF&, int)) {
+        return [&, fn]() {
+            for(int r=0;r<rows;++r)
+                (calibR.*fn)(resetInput, output, r);
+        };
+    };
+    auto sampleP = [&]() { calibS.processFrameP(input, output); };
+
+    // sample: input 2, gains 2, output 4, Gc/Oc/Gf/Of 16, reset 4, ped 4, gain 4
+    const int sampleBytes = 36;
+    // reset: input 2, Gc/Oc/Gf/Of 16, output 4
+    const int resetBytes = 22;
+    std::vector<BenchCase> cases = {
+        {"sample_row_scalar", sampleBytes, sampleSetup(false, nullptr), nextFrame, sampleRows(&CalibratorSample::processFrameRow)},
+        {"sample_row_simd", sampleBytes, sampleSetup(false, nullptr), nextFrame, sampleRows(&CalibratorSample::processFrameRowSIMD)},
+        {"sample_frame_serial", sampleBytes, sampleSetup(false, nullptr), nextFrame, [&]() { calibS.processFrame(input, output); }},
+        {"sample_frame_tbb", sampleBytes, sampleSetup(false, nullptr), nextFrame, sampleP},
+        {"sample_frame_tbb_cma", sampleBytes, sampleSetup(true, nullptr), nextFrame, sampleP},
+        {"sample_frame_tbb_dark", sampleBytes + 4, sampleSetup(false, &dark), nextFrame, sampleP},
+        {"sample_frame_tbb_cma_dark", sampleBytes + 4, sampleSetup(true, &dark), nextFrame, sampleP},
+        {"reset_row_scalar", resetBytes, nullptr, nullptr, resetRows(&CalibratorReset::processFrameRow)},
+        {"reset_row_simd", resetBytes, nullptr, nullptr, resetRows(&CalibratorReset::processFrameRowSIMD)},
+        {"reset_frame_serial", resetBytes, nullptr, nullptr, [&]() { calibR.processFrame(resetInput, output); }},
+        {"reset_frame_tbb", resetBytes, nullptr, nullptr, [&]() { calibR.processFrameP(resetInput, output); }},
+        {"framemem_load_h5_u16", 2, nullptr, nullptr, [&]() { loadU16.loadFromH5(h5file.string(), "/data", frameIdx++ % numFrames); }},
+        {"framemem_load_h5_double", 8, nullptr, nullptr, [&]() { loadD.loadFromH5(h5file.string(), "/constant", 0); }},
+    };
+
+    std::vector<BenchResult> results;
+    for(auto& bench : cases)
+    {
+        if(bench.name.find(filter) == std::string::npos)
+            continue;
+        if(vm["list"].as<bool>())
+        {
+            std::cout << bench.name << std::endl;
+            continue;
+        }
+        results.push_back(runCase(bench, warmup, repeats, perf));
+        std::cerr << bench.name << ": " << percentile(results.back().ns, 50) / 1e6 << " ms/frame" << std::endl;
+    }
+    bfs::remove(h5file);
+
+    if(vm["list"].as<bool>())
+        return 0;
+    if(vm.count("out"))
+    {
+        std::ofstream out(vm["out"].as<std::string>());
+        writeJSON(out, results, seed, warmup, repeats, perf, peakGbPerS);
+        if(!out)
+        {
+            std::cout << "Error: could not write " << vm["out"].as<std::string>() << std::endl; exit(1);
+        }
+    }
+    else
+    {
+        writeJSON(std::cout, results, seed, warmup, repeats, perf, peakGbPerS);
+    }
+    return 0;
+}
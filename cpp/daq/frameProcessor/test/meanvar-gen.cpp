@@ -1,6 +1,7 @@
 
 #include "CalibratorSample.h"
 #include "CalibratorReset.h"
+#include "DarkAccumulator.h"
 
 #include <hdf5.h>
 
@@ -11,6 +12,7 @@
 
 #include <cassert>
 #include <map>
+#include <limits>
 
 namespace bfs = boost::filesystem;
 // using namespace boost::program_options;
@@ -25,8 +27,8 @@ int g_cma = -1;
 std::map<int,int> g_rows_to_use;
 const int ROWSPERROWGP = 7;
 
-// this func needs rewriting to accept counts too.
-void saveMultigainToH5(std::string filename, std::vector<MemBlockF>& gain2tot, std::vector<MemBlockI16>& gain2count)
+// the counts come from the GainOccupancy the calibration filled in
+void saveMultigainToH5(std::string filename, std::vector<MemBlockF>& gain2tot, GainOccupancy& occupancy)
 {
     herr_t status;
     std::cout << "saving " << filename << std::endl;
@@ -36,6 +38,8 @@ void saveMultigainToH5(std::string filename, std::vector<MemBlockF>& gain2tot, s
 
     hid_t space = H5Screate_simple (ndims, dims, NULL);
 
+    MemBlockI32 counts;
+    counts.init(logger, rows, cols);
     for (int i=0;i<gain2tot.size();++i)
     {
       char totname[128];
@@ -46,12 +50,15 @@ void saveMultigainToH5(std::string filename, std::vector<MemBlockF>& gain2tot, s
       hid_t dset;
       dset = H5Dcreate (fh, totname, H5T_NATIVE_FLOAT, space, H5P_DEFAULT,
                   H5P_DEFAULT, H5P_DEFAULT);
-      status = H5Dwrite (dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, gain2tot.data());
+      status = H5Dwrite (dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, gain2tot[i].data());
       status = H5Dclose (dset);
 
-      dset = H5Dcreate (fh, countname, H5T_NATIVE_FLOAT, space, H5P_DEFAULT,
+      for(int r=0;r<rows;++r)
+        for(int c=0;c<cols;++c)
+          counts.at(r,c) = occupancy.count(i, r, c);
+      dset = H5Dcreate (fh, countname, H5T_NATIVE_UINT32, space, H5P_DEFAULT,
                   H5P_DEFAULT, H5P_DEFAULT);
-      status = H5Dwrite (dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, gain2count.data());
+      status = H5Dwrite (dset, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, counts.data());
       status = H5Dclose (dset);
     }
 
@@ -121,14 +128,20 @@ void process_file_meanvar(bfs::path filename, bool saveMV=false, int minFrame=3,
       g_calibratorS.setCMA(true,g_cma);
     // note AM drops the first sample frame in his python because there's no reset for it.
     std::cout << "processing " << filename << std::endl;
-    std::vector<MemBlockF> oframes(maxFrames);
+    // the frames are accumulated as they are calibrated, so we only ever hold one.
+    // all pixels are treated as one gain here, so the gain block is all zeros.
+    DarkAccumulator accumulator(rows, cols);
+    MemBlockF oframe;
+    MemBlockI16 allGain0;
+    oframe.init(logger, rows, cols);
+    allGain0.init(logger, rows, cols);
+    allGain0.setAll(0);
     int64_t rc=0ull;
     for(int frameIdx=minFrame;frameIdx<maxFrames;++frameIdx)
     {
       MemBlockI16 rinput, sinput;
       rinput.init(logger,rows, cols);
       sinput.init(logger,rows, cols);
-      oframes.at(frameIdx).init(logger,rows, cols);
 
       // loadFromH5 will check the dims match ok.
       rc = rinput.loadFromH5(filename.string(), "/reset", frameIdx-1);
@@ -137,7 +150,8 @@ void process_file_meanvar(bfs::path filename, bool saveMV=false, int minFrame=3,
       {
         if(g_cds)
           g_calibratorR.processFrameP(rinput, g_calibratorS.m_resetFrame);
-        g_calibratorS.processFrameP(sinput, oframes[frameIdx]);
+        g_calibratorS.processFrameP(sinput, oframe);
+        accumulator.accumulateP(allGain0, oframe);
       }
       else
       {
@@ -146,28 +160,16 @@ void process_file_meanvar(bfs::path filename, bool saveMV=false, int minFrame=3,
       }
     }
 
-    // calculate mean and variance pixelwise
+    // NaN pixels are left out of the mean and variance; a pixel that was always NaN stays NaN.
     MemBlockF avg, var;
     avg.init(logger, rows, cols);
     var.init(logger, rows, cols);
-    avg.setAll(0.0f);
-    var.setAll(0.0f);
+    accumulator.getVariance(0, var);
     for(int r=0;r<rows;++r)
     {
       for(int c=0;c<cols;++c)
       {
-        for(int frameIdx=minFrame;frameIdx<maxFrames;++frameIdx)
-        {
-          avg.at(r,c) += oframes.at(frameIdx).at(r,c);
-        }
-        avg.at(r,c) /= (float) (maxFrames - minFrame);
-        float thisAvg = avg.at(r,c);
-        for(int frameIdx=minFrame;frameIdx<maxFrames;++frameIdx)
-        {
-          float dif = (oframes.at(frameIdx).at(r,c) - thisAvg);
-          var.at(r,c) += dif * dif;
-        }
-        var.at(r,c) /= (float) (maxFrames - minFrame);
+        avg.at(r,c) = accumulator.m_count[0].at(r,c) ? accumulator.m_mean[0].at(r,c) : std::numeric_limits<float>::quiet_NaN();
       }
     }
 
@@ -231,56 +233,50 @@ void process_file_meanvar(bfs::path filename, bool saveMV=false, int minFrame=3,
 
 void process_file_multigain(bfs::path filename, bool saveMG=false, int minFrame=3, int maxFrames=20)
 {
-    // note that this function assumes that the number of frames is small, say 1000. If you want more
-    // than this you will need to alter the totals to double, and the counts to int32.
     if(0<=g_cma)
       g_calibratorS.setCMA(true,g_cma);
     // note AM drops the first sample frame in his python because there's no reset for it.
     std::cout << "Processing " << filename << std::endl;
-    std::vector<MemBlockF> oframes(maxFrames);
-    std::vector<MemBlockI16> sframes(maxFrames);
+    // the gain modes are counted inside the calibration, as PercivalCalibPlugin does with
+    // gainoccupancy on, so we only hold one frame. Use that on-line if you only want the counts.
+    const int numGains = GainOccupancy::numGains;
+    GainOccupancy occupancy(rows, cols);
+    g_calibratorS.setGainOccupancy(&occupancy);
+
+    // we total pixelwise for each of the gain modes. 0 is the result if there are no pixels
+    // in that mode. AM thinks the pedestals are better calculated pixelwise, and this is
+    // what you need to do so.
+    std::vector<MemBlockF> gain2tot(numGains);
+    for(int gain=0;gain<numGains;++gain)
+    {
+      gain2tot.at(gain).init(logger, rows, cols);
+      gain2tot.at(gain).setAll(0.0f);
+    }
+
+    MemBlockI16 rinput, sinput;
+    MemBlockF oframe;
+    rinput.init(logger,rows, cols);
+    sinput.init(logger,rows, cols);
+    oframe.init(logger,rows, cols);
     int64_t rc=0ull;
     for(int frameIdx=minFrame;frameIdx<maxFrames;++frameIdx)
     {
-      MemBlockI16 rinput;
-      rinput.init(logger,rows, cols);
-      sframes.at(frameIdx).init(logger,rows, cols);
-      oframes.at(frameIdx).init(logger,rows, cols);
-
       if(g_cds)
         rc |= rinput.loadFromH5(filename.string(), "/reset", frameIdx-1);
-      rc |= sframes[frameIdx].loadFromH5(filename.string(), "/data", frameIdx);
+      rc |= sinput.loadFromH5(filename.string(), "/data", frameIdx);
       if(rc==0)
       {
         if(g_cds)
           g_calibratorR.processFrameP(rinput, g_calibratorS.m_resetFrame);
-        g_calibratorS.processFrameP(sframes[frameIdx], oframes[frameIdx]);
+        // this writes the gain of each pixel over sinput
+        g_calibratorS.processFrameP(sinput, oframe);
       }
       else
       {
         std::cout << "failed to load frame " << frameIdx << std::endl;
         exit(1);
       }
-    }
 
-    // calculate the results pixelwise
-    const int numGains = 4;
-    std::vector<MemBlockF> gain2tot(numGains);
-    std::vector<MemBlockI16> gain2count(numGains);
-    for(int gain=0;gain<numGains;++gain)
-    {
-      gain2tot.at(gain).init(logger, rows, cols);
-      gain2tot.at(gain).setAll(0.0f);
-      gain2count.at(gain).init(logger, rows, cols);
-      gain2count.at(gain).setAll(0);
-    }
-
-    // we loop over the frames in this acquisition, and pixelwise calculate the total&count
-    // for each of the gain modes. 0 is the result if there are no pixels in that mode.
-    // we keep the count because it is interesting information. AM thinks the pedestals are
-    // better calculated pixelwise, and this is what you need to do so.    
-    for(int frameIdx=minFrame;frameIdx<maxFrames;++frameIdx)
-    {
       for(int r=0;r<rows;++r)
       {
         int subrow = r % 7;
@@ -288,19 +284,20 @@ void process_file_multigain(bfs::path filename, bool saveMG=false, int minFrame=
         {
           for(int c=0;c<cols;++c)
           {
-            int gain = sframes.at(frameIdx).at(r,c);
-            gain2tot.at(gain).at(r,c) += oframes.at(frameIdx).at(r,c);
-            gain2count.at(gain).at(r,c) += 1;
+            float val = oframe.at(r,c);
+            if(!isnan(val))
+              gain2tot.at(sinput.at(r,c)).at(r,c) += val;
           }
         }
       }
     }
+    g_calibratorS.setGainOccupancy(nullptr);
 
     std::string outfile = filename.string();
     outfile.replace(outfile.length() - 3, 3, "_mg.h5");
     if(saveMG && filename.string().length() < outfile.length())
     {
-      saveMultigainToH5(outfile, gain2tot, gain2count);
+      saveMultigainToH5(outfile, gain2tot, occupancy);
     }
 
     double avg_tot[numGains] = {};
@@ -319,7 +316,7 @@ void process_file_multigain(bfs::path filename, bool saveMG=false, int minFrame=
             if(val && !isnan(val))
             {
               avg_tot[gain] += val;
-              count[gain] += gain2count[gain].at(r,c);
+              count[gain] += occupancy.count(gain, r, c);
             }
           }
         }
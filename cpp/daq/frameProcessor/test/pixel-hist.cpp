@@ -0,0 +1,150 @@
+
+#include "CalibratorSample.h"
+#include "CalibratorReset.h"
+#include "PixelHistogram.h"
+
+#include "log4cxx/basicconfigurator.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+namespace bfs = boost::filesystem;
+namespace po = boost::program_options;
+int rows = 1484;
+int cols = 1440;
+CalibratorSample g_calibratorS(rows, cols);
+CalibratorReset g_calibratorR(rows, cols);
+static log4cxx::LoggerPtr logger = log4cxx::Logger::getLogger("Calib-ph");
+
+// This builds the same per-pixel histograms as PercivalHistogramPlugin, from capture
+// files: of the electrons the calibration gives, or with --adc of the raw sample values.
+
+int main(int argc, char* argv[])
+{
+    log4cxx::BasicConfigurator::configure();
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+    ("help,h", "This makes a histogram for each pixel over the frames of a capture file _combined.h5,\
+                and saves them as counts (rows x cols x bins), edges and frames in the outfile.")
+    ("file,f", po::value<std::string>(), "capture file _combined.h5")
+    ("out,o", po::value<std::string>(), "h5 file to save the histograms to")
+    ("edges,e", po::value<std::string>()->default_value("0:1000:100"), "bin edges a,b,c or first:last:bins")
+    ("bits", po::value<int>()->default_value(16), "16 or 32 bit counters")
+    ("minframe", po::value<int>()->default_value(2), "first frame to consider (def 2)")
+    ("maxframe", po::value<int>()->default_value(0), "last frame to consider +1")
+    ("checkpoint", po::value<int>()->default_value(0), "save the histograms every n frames as well as at the end")
+    ("adc", po::bool_switch()->default_value(false), "histogram the raw sample values, not electrons")
+    ("no-cds", po::bool_switch()->default_value(false), "do not subtract reset-frames")
+    ("calib,c", po::value<std::string>(), "filepath to h5 file containing calibration coefficients")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << desc;
+        exit(0);
+    }
+
+    bfs::path infile, outfile, calibfile;
+    if (vm.count("file"))
+      infile = vm["file"].as<std::string>();
+    if (vm.count("out"))
+      outfile = vm["out"].as<std::string>();
+    if(!bfs::is_regular_file(infile) || outfile.empty())
+    {
+      std::cout << "Error: you must specify the capture file and the outfile" << std::endl;
+      exit(1);
+    }
+
+    bool adc = vm["adc"].as<bool>();
+    bool cds = !(vm["no-cds"].as<bool>());
+    if (vm.count("calib"))
+      calibfile = vm["calib"].as<std::string>();
+    if(!adc && !bfs::is_regular_file(calibfile))
+    {
+      std::cout << "Error: you must specify calib file, unless it is --adc" << std::endl;
+      exit(1);
+    }
+
+    int minframe = vm["minframe"].as<int>();
+    int maxframe = vm["maxframe"].as<int>();
+    if(minframe==0 && cds && !adc)
+    {
+      std::cout << "you can not have minframe 0 because of the reset frame numbering" << std::endl;
+      exit(1);
+    }
+    if(maxframe < minframe)
+    {
+      std::cout << "Error in frames specified" << std::endl; exit(1);
+    }
+
+    std::vector<float> edges;
+    if(PixelHistogram::parseEdges(vm["edges"].as<std::string>(), edges) < 0)
+    {
+      std::cout << "Error in --edges " << vm["edges"].as<std::string>() << std::endl; exit(1);
+    }
+    PixelHistogram histogram;
+    if(histogram.init(rows, cols, edges, vm["bits"].as<int>()) < 0)
+    {
+      std::cout << "Error: can't make the histograms" << std::endl; exit(1);
+    }
+
+    if(!adc)
+    {
+      int64_t rc = g_calibratorR.loadADCGain(calibfile.string());
+      rc |= g_calibratorS.loadADCGain(calibfile.string());
+      if(rc)
+      {
+        std::cout << "failed to load adc gain file" << std::endl;
+        exit(1);
+      }
+    }
+
+    int checkpoint = vm["checkpoint"].as<int>();
+    std::cout << "histogramming frames " << minframe << " to " << maxframe << " of " << infile
+      << (adc ? " adc" : " electrons") << " into " << histogram.bins() << " bins" << std::endl;
+    MemBlockI16 rinput, sinput;
+    MemBlockF oframe;
+    rinput.init(logger, rows, cols);
+    sinput.init(logger, rows, cols);
+    oframe.init(logger, rows, cols);
+    for(int frameIdx=minframe;frameIdx<maxframe;++frameIdx)
+    {
+      int64_t rc = sinput.loadFromH5(infile.string(), "/data", frameIdx);
+      if(!adc && cds)
+        rc |= rinput.loadFromH5(infile.string(), "/reset", frameIdx-1);
+      if(rc)
+      {
+        std::cout << "failed to load frame " << frameIdx << std::endl;
+        exit(1);
+      }
+
+      if(adc)
+      {
+        histogram.addP(sinput);
+      }
+      else
+      {
+        if(cds)
+          g_calibratorR.processFrameP(rinput, g_calibratorS.m_resetFrame);
+        g_calibratorS.processFrameP(sinput, oframe);
+        histogram.addP(oframe);
+      }
+
+      if(checkpoint && histogram.frames() % checkpoint == 0)
+        histogram.saveToH5(outfile.string());
+    }
+
+    if(histogram.saveToH5(outfile.string()) < 0)
+    {
+      std::cout << "failed to save " << outfile << std::endl;
+      exit(1);
+    }
+    std::cout << "saved " << histogram.frames() << " frames to " << outfile << "; " << histogram.outOfRange()
+      << " pixel values were outside the edges" << std::endl;
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * PacketCapture.h
+ *
+ * A binary ring of the packet headers the decoder sees, in an mmap'ed file.
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#include "PercivalTransport.h"
+
+#include <string>
+#include <vector>
+
+namespace FrameReceiver
+{
+    /** This records every packet header the decoder sees, with its arrival time (the
+     * TSC) and where it came from, into a ring in a file that is mmap'ed shared, so the
+     * last packets are there to look at even if the FR dies. Recording one is a rdtsc
+     * and a 72 byte copy; the file is written by the kernel in its own time.
+     *
+     * With freeze on, it's a flight recorder: the first anomaly (a bad packet, a frame
+     * timing out or being dropped) records afterTrigger more packets and then stops, so
+     * what led up to it and what followed it stay in the file until rearm(). A frozen
+     * file that is found when the capture is opened again is kept as <file>.last.
+     *
+     * packet-capture-decode reads the file back.
+     */
+    class PacketCapture
+    {
+    public:
+        enum Reason
+        {
+            eNone = 0,
+            eBadPacket,
+            eTimeout,
+            eDropped,
+            eNumReasons,
+        };
+        enum RecordFlags
+        {
+            eFlagBad = 1,
+            eFlagTrigger = 2,
+            // for a frame that was released already
+            eFlagLate = 4,
+        };
+
+        static const char magic[8];
+        static const uint32_t version = 1;
+
+        // the start of the file; the records follow it
+        struct FileHeader
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t record_size;
+            uint64_t capacity;
+            // the number of packets recorded; the last is at (head - 1) % capacity
+            uint64_t head;
+            uint32_t frozen;
+            uint32_t freeze_reason;
+            // the index (before the % capacity) of the packet that froze it
+            uint64_t trigger;
+            // to turn a TSC into CLOCK_REALTIME ns: start_ns + (tsc - start_tsc) / tsc_per_ns
+            uint64_t start_tsc;
+            uint64_t start_ns;
+            double tsc_per_ns;
+            uint8_t spare[4096 - 72];
+        };
+
+        struct Record
+        {
+            uint64_t tsc;
+            // both in network order, as they came in the sockaddr_in
+            uint32_t source_address;
+            uint16_t source_port;
+            uint16_t rx_port;
+            uint8_t flags;
+            uint8_t spare;
+            uint8_t header[PercivalTransport::packet_header_size];
+        };
+
+        PacketCapture();
+        ~PacketCapture();
+
+        // capacity is rounded up to a power of 2.
+        // @ret 0, or the errno of what went wrong
+        int open(const std::string& filename, uint64_t capacity, bool freeze, uint64_t afterTrigger);
+        void close();
+        bool is_open() const { return m_header != 0; }
+
+        inline void record(const void* header, const struct sockaddr_in* from, int port)
+        {
+            m_recordedLast = false;
+            if(!m_header || m_header->frozen)
+                return;
+            uint64_t i = m_header->head;
+            Record& r = m_records[i & m_mask];
+            r.tsc = __rdtsc();
+            r.source_address = from ? from->sin_addr.s_addr : 0;
+            r.source_port = from ? from->sin_port : 0;
+            r.rx_port = port;
+            r.flags = 0;
+            memcpy(r.header, header, PercivalTransport::packet_header_size);
+            m_header->head = i + 1;
+            m_recordedLast = true;
+            if(m_stopAt && m_stopAt <= i + 1)
+                m_header->frozen = 1;
+        }
+        // flags the packet recorded last, eg as bad once its payload has been looked at
+        void flag_last(uint8_t flags);
+        // this freezes it, afterTrigger packets from now, if freeze is on
+        void anomaly(int reason);
+        // this starts recording again, after a freeze
+        void rearm();
+        // this brings the TSC rate in the file up to date; call it now and then
+        void sync();
+
+        bool frozen() const { return m_header && m_header->frozen; }
+        int freeze_reason() const { return m_header ? (int)m_header->freeze_reason : (int)eNone; }
+        uint64_t packets() const { return m_header ? m_header->head : 0; }
+        const std::string& filename() const { return m_filename; }
+
+        static const char* reason_name(int reason);
+        static uint64_t realtime_ns();
+
+        // this reads a capture file, with the records that are in it oldest first.
+        // @ret 0, or -1 with error set
+        static int read(const std::string& filename, FileHeader& header, std::vector<Record>& records, std::string& error);
+
+    private:
+        std::string m_filename;
+        FileHeader* m_header;
+        Record* m_records;
+        uint64_t m_mask;
+        size_t m_mapBytes;
+        bool m_freeze;
+        uint64_t m_afterTrigger;
+        // the head at which it freezes, or 0 for not yet
+        uint64_t m_stopAt;
+        // false if the last packet came while it was frozen
+        bool m_recordedLast;
+    };
+
+    static_assert(sizeof(PacketCapture::FileHeader) == 4096, "PacketCapture::FileHeader is malformed");
+    static_assert(sizeof(PacketCapture::Record) == 72, "PacketCapture::Record is malformed");
+
+} // namespace FrameReceiver
@@ -9,6 +9,8 @@
 
 #include "FrameDecoderUDP.h"
 #include "PercivalTransport.h"
+#include "PacketCapture.h"
+#include "ReleasedFrames.h"
 #include <iostream>
 #include <stdint.h>
 #include <time.h>
@@ -19,6 +21,18 @@ namespace FrameReceiver
     class PercivalFrameDecoder : public FrameDecoderUDP
     {
     public:
+        // why a packet was rejected; one packet can have more than one
+        enum BadPacketReason
+        {
+            eBadSize = 0,
+            eBadDatablock,
+            eBadType,
+            eBadSubframe,
+            eBadPacketNumber,
+            eBadDuplicate,
+            eNumBadPacketReasons,
+        };
+        static const char* bad_packet_reason_name(int reason);
 
         PercivalFrameDecoder();
         ~PercivalFrameDecoder();
@@ -60,6 +74,7 @@ namespace FrameReceiver
         uint32_t get_packet_offset_in_frame(uint8_t type, uint8_t subframe, uint16_t packet) const;
         uint8_t* raw_packet_header(void) const;
         unsigned int elapsed_ms(struct timespec& start, struct timespec& end);
+        void log_bad_packets(struct timespec& now);
 
         bool frame_blanking_;
 
@@ -67,6 +82,19 @@ namespace FrameReceiver
         boost::shared_ptr<void> dropped_frame_buffer_;
 
         int bad_packets_seen_;
+        // these count each reason, and are summed up in the log every
+        // bad_packet_log_interval_ms rather than logged packet by packet
+        uint64_t bad_packet_reasons_[eNumBadPacketReasons];
+        uint64_t bad_packet_reasons_logged_[eNumBadPacketReasons];
+        int bad_packets_logged_;
+        unsigned int bad_packet_log_interval_ms_;
+        struct timespec bad_packet_log_time_;
+        // the fields of the last bad packet, for the summary
+        uint32_t last_bad_frame_;
+        int last_bad_type_;
+        int last_bad_subframe_;
+        int last_bad_packet_number_;
+        size_t last_bad_bytes_;
         int current_frame_num_;
         int current_frame_buffer_id_;
         void* current_frame_buffer_;
@@ -76,7 +104,23 @@ namespace FrameReceiver
         bool current_packet_valid(size_t bytes_received);
         PercivalTransport::FrameHeader* current_frame_header_;
 
-        std::map<int,int> frames_we_drop_;
+        // the frames let go of lately, so their late packets (eg duplicates arriving after
+        // the frame is complete) are counted and thrown away, not taken for a new frame.
+        // This is only on if late_packet_window_frames is set.
+        ReleasedFrames released_frames_;
+        // the frames dropped lately for want of a buffer, so the rest of their packets are
+        // thrown away even after current_frame_num_ has been reset. This is always on.
+        ReleasedFrames dropped_frames_;
+        // true while the packets coming in are for a frame that was released already
+        bool current_frame_late_;
+        uint64_t late_packets_;
+
+        // the binary ring of packet headers, open while packet logging is enabled
+        PacketCapture packet_capture_;
+        std::string packet_capture_file_;
+        unsigned int packet_capture_packets_;
+        bool packet_capture_freeze_;
+        unsigned int packet_capture_after_;
 
     };
 
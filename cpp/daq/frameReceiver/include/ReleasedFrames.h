@@ -0,0 +1,128 @@
+/*
+ * ReleasedFrames.h
+ *
+ * The frame numbers the decoder has finished with recently.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include <deque>
+#include <vector>
+
+namespace FrameReceiver
+{
+    /** This remembers the frames the decoder has let go of lately, released (complete or
+     * timed out) or dropped for want of a buffer, so a packet that turns up for one of
+     * them afterwards isn't taken for the start of a new frame.
+     *
+     * A frame is looked up in its slot, frame % window frames, so looking is O(1) on the
+     * rx thread. Each one is kept until window_ms after it was let go, or until window
+     * newer ones have been, whichever is first; window_ms of 0 keeps them on frames alone.
+     * A window of 0 frames, the default, remembers none, so nothing is taken for late.
+     * Leave it off if the sender reuses frame numbers, eg a simulator that's run again,
+     * or its first frames will be taken for late ones.
+     */
+    class ReleasedFrames
+    {
+    public:
+        enum State
+        {
+            eNone = 0,
+            eReleased,
+            eDropped,
+        };
+
+        ReleasedFrames(size_t window = 0, unsigned int window_ms = 0) :
+            window_ms_(window_ms)
+        {
+            set_window(window, window_ms);
+        }
+
+        // this forgets them all
+        void set_window(size_t window, unsigned int window_ms)
+        {
+            slots_.assign(window, Slot());
+            order_.clear();
+            window_ms_ = window_ms;
+        }
+        size_t window() const { return slots_.size(); }
+        unsigned int window_ms() const { return window_ms_; }
+
+        void add(uint32_t frame, State state, const struct timespec& now)
+        {
+            if (slots_.empty())
+                return;
+            uint64_t ms = to_ms(now);
+            Slot& slot = slots_[frame % slots_.size()];
+            slot.frame = frame;
+            slot.state = state;
+            slot.ms = ms;
+            order_.push_back(Entry(frame, ms));
+            while (slots_.size() < order_.size())
+                forget_oldest();
+        }
+
+        State state(uint32_t frame) const
+        {
+            if (slots_.empty())
+                return eNone;
+            const Slot& slot = slots_[frame % slots_.size()];
+            return slot.frame == frame ? slot.state : eNone;
+        }
+
+        // this forgets the ones that went more than window_ms before now
+        void expire(const struct timespec& now)
+        {
+            if (!window_ms_)
+                return;
+            uint64_t ms = to_ms(now);
+            while (!order_.empty() && order_.front().ms + window_ms_ < ms)
+                forget_oldest();
+        }
+
+        void clear()
+        {
+            set_window(slots_.size(), window_ms_);
+        }
+
+        size_t size() const { return order_.size(); }
+
+    private:
+        struct Slot
+        {
+            Slot() : frame(0), state(eNone), ms(0) {}
+            uint32_t frame;
+            State state;
+            uint64_t ms;
+        };
+        struct Entry
+        {
+            Entry(uint32_t f, uint64_t m) : frame(f), ms(m) {}
+            uint32_t frame;
+            uint64_t ms;
+        };
+
+        void forget_oldest()
+        {
+            const Entry& oldest = order_.front();
+            Slot& slot = slots_[oldest.frame % slots_.size()];
+            // unless a newer one has the slot now
+            if (slot.frame == oldest.frame && slot.ms == oldest.ms)
+                slot = Slot();
+            order_.pop_front();
+        }
+
+        static uint64_t to_ms(const struct timespec& time)
+        {
+            return (uint64_t)time.tv_sec * 1000 + time.tv_nsec / 1000000;
+        }
+
+        std::vector<Slot> slots_;
+        std::deque<Entry> order_;
+        unsigned int window_ms_;
+    };
+
+} // namespace FrameReceiver
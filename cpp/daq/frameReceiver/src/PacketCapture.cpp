@@ -0,0 +1,193 @@
+/*
+ * PacketCapture.cpp
+ */
+
+#include "PacketCapture.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace FrameReceiver;
+
+const char PacketCapture::magic[8] = {'P', 'C', 'V', 'L', 'P', 'K', 'T', 'S'};
+// the tests take references to these, so they need a home
+const uint32_t PacketCapture::version;
+
+PacketCapture::PacketCapture() :
+    m_header(0),
+    m_records(0),
+    m_mask(0),
+    m_mapBytes(0),
+    m_freeze(false),
+    m_afterTrigger(0),
+    m_stopAt(0),
+    m_recordedLast(false)
+{
+}
+
+PacketCapture::~PacketCapture()
+{
+    close();
+}
+
+int PacketCapture::open(const std::string& filename, uint64_t capacity, bool freeze, uint64_t afterTrigger)
+{
+    close();
+    uint64_t records = 1;
+    while(records < capacity)
+        records <<= 1;
+
+    // don't write over what the last flight recorder caught
+    FileHeader old;
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if(0 <= fd)
+    {
+        bool wasFrozen = ::read(fd, &old, sizeof(old)) == sizeof(old)
+            && memcmp(old.magic, magic, sizeof(magic)) == 0 && old.frozen;
+        ::close(fd);
+        if(wasFrozen)
+            rename(filename.c_str(), (filename + ".last").c_str());
+    }
+
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return errno;
+    size_t bytes = sizeof(FileHeader) + records * sizeof(Record);
+    if(ftruncate(fd, bytes) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        return err;
+    }
+    // populated now, so the rx thread doesn't take the page faults
+    void* map = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if(map == MAP_FAILED)
+        return err;
+
+    m_filename = filename;
+    m_header = static_cast<FileHeader*>(map);
+    m_records = reinterpret_cast<Record*>(m_header + 1);
+    m_mask = records - 1;
+    m_mapBytes = bytes;
+    m_freeze = freeze;
+    m_afterTrigger = afterTrigger;
+    m_stopAt = 0;
+
+    memset(m_header, 0, sizeof(FileHeader));
+    memcpy(m_header->magic, magic, sizeof(magic));
+    m_header->version = version;
+    m_header->record_size = sizeof(Record);
+    m_header->capacity = records;
+    m_header->start_tsc = __rdtsc();
+    m_header->start_ns = realtime_ns();
+    m_header->tsc_per_ns = 1.0;
+    return 0;
+}
+
+void PacketCapture::close()
+{
+    if(m_header)
+        munmap(m_header, m_mapBytes);
+    m_header = 0;
+    m_records = 0;
+    m_stopAt = 0;
+    m_recordedLast = false;
+}
+
+void PacketCapture::flag_last(uint8_t flags)
+{
+    if(m_header && m_recordedLast)
+        m_records[(m_header->head - 1) & m_mask].flags |= flags;
+}
+
+void PacketCapture::anomaly(int reason)
+{
+    if(!m_header || !m_freeze || m_stopAt || m_header->frozen)
+        return;
+    m_header->freeze_reason = reason;
+    // a bad packet is the one just recorded; a timeout or a drop is about what has
+    // come in so far
+    m_header->trigger = m_header->head ? m_header->head - 1 : 0;
+    if(m_header->head)
+        m_records[m_header->trigger & m_mask].flags |= eFlagTrigger;
+    m_stopAt = m_header->head + m_afterTrigger;
+    if(m_afterTrigger == 0)
+        m_header->frozen = 1;
+    sync();
+}
+
+void PacketCapture::rearm()
+{
+    if(!m_header)
+        return;
+    m_stopAt = 0;
+    m_header->freeze_reason = eNone;
+    m_header->trigger = 0;
+    m_header->frozen = 0;
+}
+
+void PacketCapture::sync()
+{
+    if(!m_header)
+        return;
+    uint64_t tsc = __rdtsc();
+    uint64_t ns = realtime_ns();
+    if(m_header->start_ns < ns && m_header->start_tsc < tsc)
+        m_header->tsc_per_ns = (double)(tsc - m_header->start_tsc) / (ns - m_header->start_ns);
+}
+
+const char* PacketCapture::reason_name(int reason)
+{
+    static const char* names[eNumReasons] = {"none", "bad_packet", "timeout", "dropped"};
+    return (0 <= reason && reason < eNumReasons) ? names[reason] : "unknown";
+}
+
+uint64_t PacketCapture::realtime_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int PacketCapture::read(const std::string& filename, FileHeader& header, std::vector<Record>& records, std::string& error)
+{
+    records.clear();
+    FILE* f = fopen(filename.c_str(), "rb");
+    if(!f)
+    {
+        error = "can't open " + filename;
+        return -1;
+    }
+    int rc = -1;
+    if(fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, magic, sizeof(magic)) != 0)
+        error = filename + " is not a packet capture";
+    else if(header.version != version || header.record_size != sizeof(Record))
+        error = filename + " is from a different version of the packet capture";
+    else if(header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0)
+        error = filename + " has a bad capacity";
+    else
+    {
+        std::vector<Record> ring(header.capacity);
+        if(fread(ring.data(), sizeof(Record), ring.size(), f) != ring.size())
+            error = filename + " is cut short";
+        else
+        {
+            uint64_t n = std::min(header.head, header.capacity);
+            records.reserve(n);
+            for(uint64_t i=header.head-n;i<header.head;++i)
+                records.push_back(ring[i & (header.capacity - 1)]);
+            rc = 0;
+        }
+    }
+    fclose(f);
+    return rc;
+}
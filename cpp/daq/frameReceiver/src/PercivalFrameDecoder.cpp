@@ -6,9 +6,10 @@
  */
 
 #include "PercivalFrameDecoder.h"
+#include "FrameTrace.h"
 #include "gettime.h"
 #include <iostream>
-#include <iomanip>
+#include <cstring>
 #include <sstream>
 #include <arpa/inet.h>
 #include "percival_version.h"
@@ -20,6 +21,31 @@ static const int NOFRAME = -1;
 // normally on, the FR will blank the entire frame if it notices missing packets;
 // if frame_blanking is off, it only blanks the missing portion of the frame.
 static const std::string CONFIG_ENABLE_FRAME_BLANKING("enable_frame_blanking");
+// this is a command: write this process's frame trace to the given file as Chrome trace
+// JSON. It needs the build to have PERCIVAL_TRACE on.
+static const std::string CONFIG_TRACE_SAVE("trace_save");
+// with enable_packet_logging on, every packet header goes into a binary ring in this
+// file (see PacketCapture), which holds the last packet_capture_packets of them.
+// With packet_capture_freeze on, the first bad packet, timeout or dropped frame stops
+// it packet_capture_after packets later, until reset_statistics.
+static const std::string CONFIG_PACKET_CAPTURE_FILE("packet_capture_file");
+static const std::string CONFIG_PACKET_CAPTURE_PACKETS("packet_capture_packets");
+static const std::string CONFIG_PACKET_CAPTURE_FREEZE("packet_capture_freeze");
+static const std::string CONFIG_PACKET_CAPTURE_AFTER("packet_capture_after");
+// bad packets are counted by reason in the status, and summed up in the log at most
+// this often, so a storm of them can't hold up the rx thread
+static const std::string CONFIG_BAD_PACKET_LOG_INTERVAL_MS("bad_packet_log_interval_ms");
+// a frame that is complete or timed out is remembered for this long, or until this many
+// newer ones have gone, so its late packets are counted and thrown away rather than
+// starting the frame again. It is off (0 frames) unless set. Leave it off if the sender
+// reuses frame numbers, eg a simulator run again, or the repeats are thrown away.
+static const std::string CONFIG_LATE_PACKET_WINDOW_FRAMES("late_packet_window_frames");
+static const std::string CONFIG_LATE_PACKET_WINDOW_MS("late_packet_window_ms");
+
+// a frame dropped for want of a buffer is always remembered, for this long or until this
+// many newer ones have been dropped, so the rest of its packets are thrown away too
+static const size_t dropped_frames_window = 16;
+static const unsigned int dropped_frames_window_ms = 1000;
 
 PercivalFrameDecoder::PercivalFrameDecoder() :
         FrameDecoderUDP(),
@@ -28,8 +54,25 @@ PercivalFrameDecoder::PercivalFrameDecoder() :
 		current_frame_buffer_(0),
 		current_frame_header_(0),
     bad_packets_seen_(0),
-    frame_blanking_(true)
+    frame_blanking_(true),
+    bad_packets_logged_(0),
+    bad_packet_log_interval_ms_(1000),
+    last_bad_frame_(0),
+    last_bad_type_(0),
+    last_bad_subframe_(0),
+    last_bad_packet_number_(0),
+    last_bad_bytes_(0),
+    dropped_frames_(dropped_frames_window, dropped_frames_window_ms),
+    current_frame_late_(false),
+    late_packets_(0),
+    packet_capture_file_("/dev/shm/percival_packet_capture.bin"),
+    packet_capture_packets_(1 << 18),
+    packet_capture_freeze_(false),
+    packet_capture_after_(4096)
 {
+    memset(bad_packet_reasons_, 0, sizeof(bad_packet_reasons_));
+    memset(bad_packet_reasons_logged_, 0, sizeof(bad_packet_reasons_logged_));
+    memset(&bad_packet_log_time_, 0, sizeof(bad_packet_log_time_));
     current_packet_header_.reset(new uint8_t[PercivalTransport::packet_header_size]);
     dropped_frame_buffer_.reset(new uint8_t[PercivalTransport::total_frame_size]);
 }
@@ -71,18 +114,24 @@ void PercivalFrameDecoder::init(LoggerPtr& logger, OdinData::IpcMessage& config_
 {
 	  FrameDecoder::init(logger, config_msg);
 
+    if(config_msg.has_param(CONFIG_PACKET_CAPTURE_FILE))
+      packet_capture_file_ = config_msg.get_param<std::string>(CONFIG_PACKET_CAPTURE_FILE);
+    if(config_msg.has_param(CONFIG_PACKET_CAPTURE_PACKETS))
+      packet_capture_packets_ = config_msg.get_param<unsigned int>(CONFIG_PACKET_CAPTURE_PACKETS);
+    if(config_msg.has_param(CONFIG_PACKET_CAPTURE_FREEZE))
+      packet_capture_freeze_ = config_msg.get_param<bool>(CONFIG_PACKET_CAPTURE_FREEZE);
+    if(config_msg.has_param(CONFIG_PACKET_CAPTURE_AFTER))
+      packet_capture_after_ = config_msg.get_param<unsigned int>(CONFIG_PACKET_CAPTURE_AFTER);
+
+    packet_capture_.close();
     if (enable_packet_logging_) {
-        LOG4CXX_INFO(packet_logger_, "PktHdr: SourceAddress");
-        LOG4CXX_INFO(packet_logger_, "PktHdr: |               SourcePort");
-        LOG4CXX_INFO(packet_logger_, "PktHdr: |               |     DestinationPort");
-        LOG4CXX_INFO(packet_logger_, "PktHdr: |               |     |      DataSize [2 Bytes]");
-        LOG4CXX_INFO(packet_logger_, "PktHdr: |               |     |      |     PacketType [1 Byte]");
-        LOG4CXX_INFO(packet_logger_, "PktHdr: |               |     |      |     |  SubframeNumber [1 Byte]");
-        LOG4CXX_INFO(packet_logger_, "PktHdr: |               |     |      |     |  |  FrameNumber [4 Bytes]");
-        LOG4CXX_INFO(packet_logger_, "PktHdr: |               |     |      |     |  |  |             PacketNumber [2 Bytes]");
-        LOG4CXX_INFO(packet_logger_, "PktHdr: |               |     |      |     |  |  |             |     PacketOffset [2 Bytes]");
-        LOG4CXX_INFO(packet_logger_, "PktHdr: |               |     |      |     |  |  |             |     |     Info [42 Bytes]");
-        LOG4CXX_INFO(packet_logger_, "PktHdr: |               |     |      |     |  |  |             |     |     |");
+        int err = packet_capture_.open(packet_capture_file_, packet_capture_packets_, packet_capture_freeze_, packet_capture_after_);
+        if (err)
+          LOG4CXX_ERROR(logger_, "can not open the packet capture " << packet_capture_file_ << ": " << strerror(err));
+        else
+          LOG4CXX_INFO(packet_logger_, "Capturing packet headers to " << packet_capture_file_
+                       << (packet_capture_freeze_ ? ", freezing on the first anomaly" : "")
+                       << "; read it with packet-capture-decode");
     }
 
    if(config_msg.has_param(CONFIG_ENABLE_FRAME_BLANKING))
@@ -90,6 +139,40 @@ void PercivalFrameDecoder::init(LoggerPtr& logger, OdinData::IpcMessage& config_
      frame_blanking_ = config_msg.get_param<bool>(CONFIG_ENABLE_FRAME_BLANKING);
      LOG4CXX_INFO(logger_, "Setting Frame-Blanking to " << frame_blanking_);
    }
+
+   if(config_msg.has_param(CONFIG_BAD_PACKET_LOG_INTERVAL_MS))
+     bad_packet_log_interval_ms_ = config_msg.get_param<unsigned int>(CONFIG_BAD_PACKET_LOG_INTERVAL_MS);
+
+   if(config_msg.has_param(CONFIG_LATE_PACKET_WINDOW_FRAMES) || config_msg.has_param(CONFIG_LATE_PACKET_WINDOW_MS))
+   {
+     size_t window = released_frames_.window();
+     unsigned int window_ms = released_frames_.window_ms();
+     if(config_msg.has_param(CONFIG_LATE_PACKET_WINDOW_FRAMES))
+       window = config_msg.get_param<unsigned int>(CONFIG_LATE_PACKET_WINDOW_FRAMES);
+     if(config_msg.has_param(CONFIG_LATE_PACKET_WINDOW_MS))
+       window_ms = config_msg.get_param<unsigned int>(CONFIG_LATE_PACKET_WINDOW_MS);
+     released_frames_.set_window(window, window_ms);
+     if(released_frames_.window())
+       LOG4CXX_INFO(logger_, "Remembering released frames for " << released_frames_.window_ms()
+                             << "ms or " << released_frames_.window() << " frames");
+     else
+       LOG4CXX_INFO(logger_, "Not remembering released frames; late packets start frames again");
+   }
+
+   if(config_msg.has_param(CONFIG_TRACE_SAVE))
+   {
+     std::string filename = config_msg.get_param<std::string>(CONFIG_TRACE_SAVE);
+     if(!FrameTrace::compiledIn())
+       LOG4CXX_ERROR(logger_, "can't save the frame trace; this was built without PERCIVAL_TRACE");
+     else
+     {
+       long events = FrameTrace::saveJson(filename);
+       if(events < 0)
+         LOG4CXX_ERROR(logger_, "can not save the frame trace to " << filename);
+       else
+         LOG4CXX_INFO(logger_, "saved " << events << " frame trace events to " << filename);
+     }
+   }
 }
 
 const size_t PercivalFrameDecoder::get_frame_buffer_size(void) const
@@ -116,25 +199,8 @@ void PercivalFrameDecoder::process_packet_header(size_t bytes_received, int port
 {
     if(bytes_received == get_packet_header_size())
     {
-      // Dump raw header if packet logging enabled
-      if (enable_packet_logging_)
-      {
-          std::stringstream ss;
-          uint8_t* hdr_ptr = raw_packet_header();
-          ss << "PktHdr: " << std::setw(15) << std::left << inet_ntoa(from_addr->sin_addr) << std::right << " "
-             << std::setw(5) << ntohs(from_addr->sin_port) << " "
-             << std::setw(5) << port << std::hex;
-          for (unsigned int hdr_byte = 0; hdr_byte < PercivalTransport::packet_header_size; hdr_byte++)
-          {
-              if (hdr_byte % 8 == 0) {
-                  ss << "  ";
-              }
-              ss << std::setw(2) << std::setfill('0') << (unsigned int)*hdr_ptr << " ";
-              hdr_ptr++;
-          }
-          ss << std::dec;
-          LOG4CXX_INFO(packet_logger_, ss.str());
-      }
+      // record the raw header if packet logging is enabled; it does nothing otherwise
+      packet_capture_.record(raw_packet_header(), from_addr, port);
 
 	    int frame = static_cast<int>(get_frame_number());
 	    uint16_t packet_number = get_packet_number();
@@ -151,21 +217,35 @@ void PercivalFrameDecoder::process_packet_header(size_t bytes_received, int port
       {
         current_frame_num_ = frame;
         bool bNeedInitializeHeader = false;
+        bool mapped = frame_buffer_map_.count(current_frame_num_) != 0;
+        ReleasedFrames::State released = ReleasedFrames::eNone;
+        if(!mapped)
+        {
+          released = dropped_frames_.state(current_frame_num_);
+          if(released == ReleasedFrames::eNone)
+            released = released_frames_.state(current_frame_num_);
+        }
+        current_frame_late_ = released == ReleasedFrames::eReleased;
 
-      	if (frame_buffer_map_.count(current_frame_num_) == 0 && frames_we_drop_.count(current_frame_num_) == 0)
+      	if (!mapped && released == ReleasedFrames::eNone)
       	{
           // new frame appears, allocate a buffer for it.
           if (empty_buffer_queue_.empty())
           {
               LOG4CXX_ERROR(logger_, "First packet from frame " << current_frame_num_ << " but no free buffers. Dropping frame.");
-              frames_we_drop_[current_frame_num_] = DUMMY_BUFFER;
+              struct timespec now;
+              gettime(&now);
+              dropped_frames_.add(current_frame_num_, ReleasedFrames::eDropped, now);
               frames_dropped_ += 1;
+              packet_capture_.anomaly(PacketCapture::eDropped);
+              PERCIVAL_TRACE_EVENT(current_frame_num_, eDecoderDrop);
           }
 	        else
 	        {
               current_frame_buffer_id_ = empty_buffer_queue_.front();
               empty_buffer_queue_.pop();
               frame_buffer_map_[current_frame_num_] = current_frame_buffer_id_;
+              PERCIVAL_TRACE_EVENT(current_frame_num_, eDecoderFirstPacket);
 
               LOG4CXX_DEBUG_LEVEL(2, logger_, "First packet from frame " << current_frame_num_ << " detected, allocating frame buffer ID " << current_frame_buffer_id_);
 	        }
@@ -178,8 +258,9 @@ void PercivalFrameDecoder::process_packet_header(size_t bytes_received, int port
       		current_frame_buffer_id_ = frame_buffer_map_[current_frame_num_];
           current_frame_buffer_ = buffer_manager_->get_buffer_address(current_frame_buffer_id_);
       	}
-        else if(frames_we_drop_.count(current_frame_num_))
+        else
         {
+            // dropped, or late; either way the payload goes nowhere
             current_frame_buffer_id_ = DUMMY_BUFFER;
             current_frame_buffer_ = dropped_frame_buffer_.get();
         }
@@ -202,8 +283,8 @@ void PercivalFrameDecoder::process_packet_header(size_t bytes_received, int port
     {
       // this means the packet is smaller than the header-size, as the framework only requests the header.
       // as such there is no chance of a buffer overrun.
-      LOG4CXX_ERROR(logger_, "Packet arrived with size " << bytes_received << " which is too small."
-                              << " Needs to be bytes " << get_packet_header_size());
+      ++bad_packet_reasons_[eBadSize];
+      last_bad_bytes_ = bytes_received;
     }
 }
 
@@ -246,9 +327,17 @@ size_t PercivalFrameDecoder::get_next_payload_size(void) const
 FrameDecoder::FrameReceiveState PercivalFrameDecoder::process_packet(size_t bytes_received, int port, struct sockaddr_in* from_addr)
 {
     FrameDecoder::FrameReceiveState frame_state = FrameDecoder::FrameReceiveStateIncomplete;
-    if(current_packet_valid(bytes_received) == false)
+    // the frame has gone already, so there's nothing to check it against
+    if(current_frame_late_)
+    {
+      ++late_packets_;
+      packet_capture_.flag_last(PacketCapture::eFlagLate);
+    }
+    else if(current_packet_valid(bytes_received) == false)
     {
       ++bad_packets_seen_;
+      packet_capture_.flag_last(PacketCapture::eFlagBad);
+      packet_capture_.anomaly(PacketCapture::eBadPacket);
     }
     // we must check the current frame buffer is valid or we could release the dummy buffer to the FP!
     else if(current_frame_buffer_id_ != DUMMY_BUFFER)
@@ -267,10 +356,15 @@ FrameDecoder::FrameReceiveState PercivalFrameDecoder::process_packet(size_t byte
 		    frame_buffer_map_.erase(current_frame_num_);
 
 		    // Notify main thread that frame is ready
+		    PERCIVAL_TRACE_EVENT(current_frame_num_, eDecoderComplete);
+		    PERCIVAL_TRACE_EVENT(current_frame_num_, eDecoderRelease);
+		    gettime(&current_frame_header_->frame_ready_time);
+		    released_frames_.add(current_frame_num_, ReleasedFrames::eReleased, current_frame_header_->frame_ready_time);
 		    ready_callback_(current_frame_buffer_id_, current_frame_num_);
 
-		    // Reset current frame seen ID so that if next frame has same number (e.g. repeated
-		    // sends of single frame 0), it is detected properly
+		    // Reset current frame seen ID so the next packet is looked up again. If it has the
+		    // same number (e.g. repeated sends of single frame 0) it starts a new frame, unless
+		    // the late packet window is on, when it is counted as late and thrown away
 		    current_frame_num_ = NOFRAME;
 	    }
     }
@@ -301,6 +395,8 @@ void PercivalFrameDecoder::monitor_buffers(void)
                     << " with " << frame_header->packets_received << " packets received");
 
             frame_header->frame_state = FrameReceiveStateTimedout;
+            PERCIVAL_TRACE_EVENT(frame_num, eDecoderTimeout);
+            packet_capture_.anomaly(PacketCapture::eTimeout);
             if(frame_blanking_)
             {
               // fill this frame to make it clear it's invalid
@@ -321,7 +417,7 @@ void PercivalFrameDecoder::monitor_buffers(void)
                   for(int packetid=0;packetid<PercivalTransport::num_primary_packets;++packetid)
                   {
                     // check for specific packets missing
-                    if(current_frame_header_->packet_state[type][subframe][packetid]==0)
+                    if(frame_header->packet_state[type][subframe][packetid]==0)
                     {
                       // blank the memory with 0xff which can not be created by the detector
                       uint8_t* packet_location = reinterpret_cast<uint8_t*>(buffer_addr) +
@@ -336,6 +432,9 @@ void PercivalFrameDecoder::monitor_buffers(void)
               }
             }
 
+            PERCIVAL_TRACE_EVENT(frame_num, eDecoderRelease);
+            frame_header->frame_ready_time = current_time;
+            released_frames_.add(frame_num, ReleasedFrames::eReleased, current_time);
             ready_callback_(buffer_id, frame_num);
             frames_timedout++;
 
@@ -353,21 +452,29 @@ void PercivalFrameDecoder::monitor_buffers(void)
 		    current_frame_num_ = NOFRAME;
     }
     frames_timedout_ += frames_timedout;
+    packet_capture_.sync();
+    log_bad_packets(current_time);
 
     LOG4CXX_DEBUG_LEVEL(3, logger_, get_num_mapped_buffers() << " frame buffers in use, "
             << get_num_empty_buffers() << " empty buffers available, "
             << frames_timedout_ << " incomplete frames timed out");
 
-    // iterate over frames that go to dummy buffer and delete the old ones
-    while(3<frames_we_drop_.size())
-    {
-        frames_we_drop_.erase(frames_we_drop_.begin());
-    }
+    released_frames_.expire(current_time);
+    dropped_frames_.expire(current_time);
 }
 
 void PercivalFrameDecoder::get_status(const std::string param_prefix, OdinData::IpcMessage& status_msg)
 {
   status_msg.set_param(param_prefix + "bad_packets", this->bad_packets_seen_);
+  status_msg.set_param(param_prefix + "late_packets", late_packets_);
+  for (int reason = 0; reason < eNumBadPacketReasons; ++reason)
+    status_msg.set_param(param_prefix + "bad_packet_reasons/" + bad_packet_reason_name(reason), bad_packet_reasons_[reason]);
+  if (packet_capture_.is_open())
+  {
+    status_msg.set_param(param_prefix + "packet_capture/packets", packet_capture_.packets());
+    status_msg.set_param(param_prefix + "packet_capture/frozen", packet_capture_.frozen());
+    status_msg.set_param(param_prefix + "packet_capture/freeze_reason", std::string(PacketCapture::reason_name(packet_capture_.freeze_reason())));
+  }
 }
 
 uint16_t PercivalFrameDecoder::get_datablock_size(void) const
@@ -414,6 +521,36 @@ inline uint8_t* PercivalFrameDecoder::raw_packet_header(void) const
 }
 
 
+const char* PercivalFrameDecoder::bad_packet_reason_name(int reason)
+{
+  static const char* names[eNumBadPacketReasons] = {"size", "datablock", "type", "subframe", "packet_number", "duplicate"};
+  return (0 <= reason && reason < eNumBadPacketReasons) ? names[reason] : "unknown";
+}
+
+void PercivalFrameDecoder::log_bad_packets(struct timespec& now)
+{
+  bool any = bad_packets_seen_ != bad_packets_logged_;
+  for (int reason = 0; reason < eNumBadPacketReasons; ++reason)
+    any = any || bad_packet_reasons_[reason] != bad_packet_reasons_logged_[reason];
+  if (!any || (bad_packet_log_time_.tv_sec && elapsed_ms(bad_packet_log_time_, now) < bad_packet_log_interval_ms_))
+    return;
+
+  std::ostringstream reasons;
+  for (int reason = 0; reason < eNumBadPacketReasons; ++reason)
+  {
+    uint64_t count = bad_packet_reasons_[reason] - bad_packet_reasons_logged_[reason];
+    if (count)
+      reasons << " " << bad_packet_reason_name(reason) << ":" << count;
+    bad_packet_reasons_logged_[reason] = bad_packet_reasons_[reason];
+  }
+  LOG4CXX_WARN(logger_, bad_packets_seen_ - bad_packets_logged_ << " bad packets rejected since the last summary;"
+                        << reasons.str() << ". The last was frame " << last_bad_frame_ << " type " << last_bad_type_
+                        << " subframe " << last_bad_subframe_ << " packet " << last_bad_packet_number_
+                        << " size " << last_bad_bytes_);
+  bad_packets_logged_ = bad_packets_seen_;
+  bad_packet_log_time_ = now;
+}
+
 inline unsigned int PercivalFrameDecoder::elapsed_ms(struct timespec& start, struct timespec& end)
 {
 
@@ -425,8 +562,16 @@ inline unsigned int PercivalFrameDecoder::elapsed_ms(struct timespec& start, str
 
 void PercivalFrameDecoder::reset_statistics(void)
 {
-    frames_we_drop_.clear();
+    released_frames_.clear();
+    dropped_frames_.clear();
+    late_packets_ = 0;
+    // so the next packet looks its frame up again
+    current_frame_num_ = NOFRAME;
     bad_packets_seen_ = 0;
+    bad_packets_logged_ = 0;
+    memset(bad_packet_reasons_, 0, sizeof(bad_packet_reasons_));
+    memset(bad_packet_reasons_logged_, 0, sizeof(bad_packet_reasons_logged_));
+    packet_capture_.rearm();
     
     FrameDecoderUDP::reset_statistics();
 }
@@ -441,30 +586,31 @@ inline bool PercivalFrameDecoder::current_packet_valid(size_t bytes_received)
   int  type = get_packet_type();
   uint16_t datablock_size = get_datablock_size();
 
-  // check the header-info for bad parameters
+  // check the header-info for bad parameters. These only count; log_bad_packets() sums
+  // them up in the log now and then.
 
   if(__builtin_expect(bytes_received != PercivalTransport::packet_pixeldata_size + PercivalTransport::packet_header_size, false))
   {
-      LOG4CXX_ERROR(logger_, "bad packet has actual size:" << bytes_received << " and claims to have db-size " << get_datablock_size());
+      ++bad_packet_reasons_[eBadSize];
       valid = false;
   }
 
   if(__builtin_expect(datablock_size != PercivalTransport::packet_pixeldata_size, false))
   {
-      LOG4CXX_ERROR(logger_, "Packet num " << packet_number << " claims to have size " << get_datablock_size());
+      ++bad_packet_reasons_[eBadDatablock];
       valid = false;
   }
 
   if(__builtin_expect(type >= PercivalTransport::num_data_types, false))
   {
-      LOG4CXX_ERROR(logger_, "Packet num " << packet_number << " claims to have type " << type);
+      ++bad_packet_reasons_[eBadType];
       valid = false;
   }
 
   if(__builtin_expect(subframe >= PercivalTransport::num_subframes, false))
   {
       // reference frames have subframe 128, but they are not used any more.
-      LOG4CXX_ERROR(logger_, "Packet num " << packet_number << " claims to have subframe " << subframe);
+      ++bad_packet_reasons_[eBadSubframe];
       valid = false;
   }
 
@@ -476,13 +622,13 @@ inline bool PercivalFrameDecoder::current_packet_valid(size_t bytes_received)
 
   if (__builtin_expect(packet_number >= PercivalTransport::num_primary_packets, false))
   {
-      LOG4CXX_ERROR(logger_, "Packet claims to have packet_number " << packet_number);
+      ++bad_packet_reasons_[eBadPacketNumber];
       valid = false;
   }
 
   if(valid && __builtin_expect(current_frame_header_->packet_state[type][subframe][packet_number], false))
   {
-      LOG4CXX_ERROR(logger_, "Packet type " << type << " subframe " << subframe << " packet " << packet_number << " has already been seen");
+      ++bad_packet_reasons_[eBadDuplicate];
       valid = false;
   }
 
@@ -492,12 +638,15 @@ inline bool PercivalFrameDecoder::current_packet_valid(size_t bytes_received)
   }
   else
   {
-    // this is really just a separator to distinguish the packets in the logfile.
-      LOG4CXX_WARN(logger_, "BAD PACKET REJECTED");
+      last_bad_frame_ = frame_num;
+      last_bad_type_ = type;
+      last_bad_subframe_ = subframe;
+      last_bad_packet_number_ = packet_number;
+      last_bad_bytes_ = bytes_received;
+      LOG4CXX_DEBUG_LEVEL(3, logger_, "bad packet: frame " << frame_num << " type " << type << " subframe " << subframe
+                          << " packet " << packet_number << " size " << bytes_received << " db-size " << datablock_size);
   }
 
-
-
   return valid;
 }
 
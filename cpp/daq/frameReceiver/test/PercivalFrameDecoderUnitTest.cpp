@@ -17,6 +17,11 @@
 #include <log4cxx/simplelayout.h>
 
 #include "PercivalFrameDecoder.h"
+#include "PacketCapture.h"
+#include "ReleasedFrames.h"
+
+#include <arpa/inet.h>
+#include <unistd.h>
 
 class FrameDecoderTestFixture
 {
@@ -73,5 +78,171 @@ BOOST_AUTO_TEST_CASE( PercivalDecoderTest )
 
 }
 
+BOOST_AUTO_TEST_CASE( PacketCaptureFreezeTest )
+{
+    std::string filename = "/tmp/PacketCaptureFreezeTest" + std::to_string(getpid()) + ".bin";
+    FrameReceiver::PacketCapture capture;
+    // 5 is rounded up to 8 packets, and it freezes 2 after the anomaly
+    BOOST_REQUIRE_EQUAL(capture.open(filename, 5, true, 2), 0);
+
+    uint8_t header[PercivalTransport::packet_header_size] = {0};
+    PercivalTransport::PacketHeaderFields* fields = reinterpret_cast<PercivalTransport::PacketHeaderFields*>(header);
+    struct sockaddr_in from;
+    memset(&from, 0, sizeof(from));
+    from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    from.sin_port = htons(1234);
+    for(int p=0;p<20;++p)
+    {
+        fields->m_packet_number = htons(p);
+        capture.record(header, &from, 8000);
+        if(p == 10)
+        {
+            capture.flag_last(FrameReceiver::PacketCapture::eFlagBad);
+            capture.anomaly(FrameReceiver::PacketCapture::eBadPacket);
+        }
+    }
+    BOOST_CHECK(capture.frozen());
+    BOOST_CHECK_EQUAL(capture.packets(), 13);
+
+    FrameReceiver::PacketCapture::FileHeader fileHeader;
+    std::vector<FrameReceiver::PacketCapture::Record> records;
+    std::string error;
+    BOOST_REQUIRE_EQUAL(FrameReceiver::PacketCapture::read(filename, fileHeader, records, error), 0);
+    BOOST_CHECK_EQUAL(fileHeader.version, FrameReceiver::PacketCapture::version);
+    BOOST_CHECK_EQUAL(fileHeader.capacity, 8);
+    BOOST_CHECK_EQUAL(fileHeader.trigger, 10);
+    BOOST_CHECK_EQUAL(fileHeader.freeze_reason, FrameReceiver::PacketCapture::eBadPacket);
+    // the last 8 packets are 5..12, with the bad one in the middle
+    BOOST_REQUIRE_EQUAL(records.size(), 8);
+    for(int i=0;i<8;++i)
+    {
+        const PercivalTransport::PacketHeaderFields* got = reinterpret_cast<const PercivalTransport::PacketHeaderFields*>(records[i].header);
+        BOOST_CHECK_EQUAL(ntohs(got->m_packet_number), 5 + i);
+        BOOST_CHECK_EQUAL(ntohs(records[i].source_port), 1234);
+        BOOST_CHECK_EQUAL(records[i].rx_port, 8000);
+    }
+    BOOST_CHECK_EQUAL(records[5].flags, FrameReceiver::PacketCapture::eFlagBad | FrameReceiver::PacketCapture::eFlagTrigger);
+    BOOST_CHECK_EQUAL(records[4].flags, 0);
+
+    // opening it again keeps the frozen one
+    capture.rearm();
+    BOOST_CHECK(!capture.frozen());
+    capture.anomaly(FrameReceiver::PacketCapture::eTimeout);
+    capture.record(header, &from, 8000);
+    capture.record(header, &from, 8000);
+    BOOST_CHECK(capture.frozen());
+    BOOST_REQUIRE_EQUAL(capture.open(filename, 8, false, 0), 0);
+    BOOST_REQUIRE_EQUAL(FrameReceiver::PacketCapture::read(filename + ".last", fileHeader, records, error), 0);
+    BOOST_CHECK_EQUAL(fileHeader.freeze_reason, FrameReceiver::PacketCapture::eTimeout);
+    BOOST_CHECK_EQUAL(fileHeader.head, 15);
+    capture.close();
+    unlink(filename.c_str());
+    unlink((filename + ".last").c_str());
+}
+
+BOOST_AUTO_TEST_CASE( ReleasedFramesWindowTest )
+{
+    using FrameReceiver::ReleasedFrames;
+    ReleasedFrames released(4, 100);
+    struct timespec now = {1000, 0};
+
+    released.add(7, ReleasedFrames::eReleased, now);
+    released.add(8, ReleasedFrames::eDropped, now);
+    BOOST_CHECK_EQUAL(released.state(7), ReleasedFrames::eReleased);
+    BOOST_CHECK_EQUAL(released.state(8), ReleasedFrames::eDropped);
+    BOOST_CHECK_EQUAL(released.state(9), ReleasedFrames::eNone);
+    // 11 has 7's slot, and is the one looked for there now
+    released.add(11, ReleasedFrames::eReleased, now);
+    BOOST_CHECK_EQUAL(released.state(7), ReleasedFrames::eNone);
+    BOOST_CHECK_EQUAL(released.state(11), ReleasedFrames::eReleased);
+
+    // no more than the window of them, oldest out first
+    released.add(12, ReleasedFrames::eReleased, now);
+    released.add(13, ReleasedFrames::eReleased, now);
+    BOOST_CHECK_EQUAL(released.size(), 4);
+    BOOST_CHECK_EQUAL(released.state(8), ReleasedFrames::eNone);
+    BOOST_CHECK_EQUAL(released.state(13), ReleasedFrames::eReleased);
+
+    // and no older than window_ms
+    struct timespec later = {1000, 50000000};
+    released.add(14, ReleasedFrames::eReleased, later);
+    later.tv_nsec = 120000000;
+    released.expire(later);
+    BOOST_CHECK_EQUAL(released.size(), 1);
+    BOOST_CHECK_EQUAL(released.state(12), ReleasedFrames::eNone);
+    BOOST_CHECK_EQUAL(released.state(14), ReleasedFrames::eReleased);
+
+    released.clear();
+    BOOST_CHECK_EQUAL(released.state(14), ReleasedFrames::eNone);
+
+    // it's off unless a window is set, so a frame number sent again is a new frame
+    ReleasedFrames off;
+    off.add(7, ReleasedFrames::eReleased, now);
+    BOOST_CHECK_EQUAL(off.window(), 0);
+    BOOST_CHECK_EQUAL(off.size(), 0);
+    BOOST_CHECK_EQUAL(off.state(7), ReleasedFrames::eNone);
+    off.expire(later);
+    released.set_window(0, 100);
+    released.add(15, ReleasedFrames::eReleased, now);
+    BOOST_CHECK_EQUAL(released.state(15), ReleasedFrames::eNone);
+}
+
+BOOST_AUTO_TEST_CASE( DroppedFrameAfterTimeoutTest )
+{
+    // a dropped frame is remembered whatever the late packet window, so the rest of its
+    // packets are thrown away even after a timeout has reset the current frame
+    FrameReceiver::PercivalFrameDecoder decoder;
+    OdinData::IpcMessage config;
+    config.set_param("frame_timeout_ms", 1u);
+    decoder.init(logger, config);
+
+    std::string shmName = "PercivalDroppedFrameTest" + std::to_string(getpid());
+    OdinData::SharedBufferManagerPtr bufferManager(new OdinData::SharedBufferManager(
+        shmName, decoder.get_frame_buffer_size(), decoder.get_frame_buffer_size(), true));
+    decoder.register_buffer_manager(bufferManager);
+    std::vector<int> released;
+    decoder.register_frame_ready_callback([&](int buffer_id, int frame_number) {
+        released.push_back(frame_number);
+        decoder.push_empty_buffer(buffer_id);
+    });
+    decoder.push_empty_buffer(0);
+
+    const size_t headerSize = decoder.get_packet_header_size();
+    struct sockaddr_in from;
+    memset(&from, 0, sizeof(from));
+    from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    auto packet = [&](uint32_t frame, uint16_t packet_number) {
+        PercivalTransport::PacketHeaderFields* fields = reinterpret_cast<PercivalTransport::PacketHeaderFields*>(decoder.get_packet_header_buffer());
+        memset(fields, 0, headerSize);
+        fields->m_datablock_size = htons(PercivalTransport::packet_pixeldata_size);
+        fields->m_frame_number = htonl(frame);
+        fields->m_packet_number = htons(packet_number);
+        decoder.process_packet_header(headerSize, 8000, &from);
+        decoder.process_packet(headerSize + PercivalTransport::packet_pixeldata_size, 8000, &from);
+    };
+
+    // frame 1 has the only buffer, so frame 2 is dropped
+    packet(1, 0);
+    packet(2, 0);
+    BOOST_CHECK_EQUAL(decoder.get_num_frames_dropped(), 1);
+
+    // frame 1 times out, which frees the buffer
+    usleep(5000);
+    decoder.monitor_buffers();
+    BOOST_REQUIRE_EQUAL(released.size(), 1);
+    BOOST_CHECK_EQUAL(released[0], 1);
+    BOOST_CHECK_EQUAL(decoder.get_num_empty_buffers(), 1);
+
+    // and the rest of frame 2 still goes nowhere
+    packet(2, 1);
+    packet(2, 2);
+    BOOST_CHECK_EQUAL(decoder.get_num_frames_dropped(), 1);
+    BOOST_CHECK_EQUAL(decoder.get_num_mapped_buffers(), 0);
+    BOOST_CHECK_EQUAL(decoder.get_num_empty_buffers(), 1);
+    usleep(5000);
+    decoder.monitor_buffers();
+    BOOST_CHECK_EQUAL(released.size(), 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END();
 
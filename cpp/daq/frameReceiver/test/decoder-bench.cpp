@@ -0,0 +1,276 @@
+/*
+ * decoder-bench.cpp
+ *
+ * This drives PercivalFrameDecoder the way the odin-data UDP rx thread does, from packets
+ * built in memory, so the decoder's CPU per packet can be measured without a detector,
+ * a simulator or any sockets. The packet stream can have loss, reordering, duplicates
+ * and frames interleaved with each other.
+ */
+
+#include "PercivalFrameDecoder.h"
+
+#include <log4cxx/logger.h>
+#include <log4cxx/basicconfigurator.h>
+
+#include <boost/program_options.hpp>
+
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+using namespace FrameReceiver;
+
+// one packet of the stream; the payload is the same for all of them
+struct BenchPacket
+{
+    uint8_t header[PercivalTransport::packet_header_size];
+};
+
+struct BenchCounts
+{
+    uint64_t complete = 0;
+    uint64_t timedout = 0;
+};
+
+static void makeHeader(BenchPacket& packet, uint32_t frame, uint8_t type, uint8_t subframe, uint16_t packet_number)
+{
+    PercivalTransport::PacketHeaderFields* fields = reinterpret_cast<PercivalTransport::PacketHeaderFields*>(packet.header);
+    memset(packet.header, 0, sizeof(packet.header));
+    fields->m_datablock_size = htons(PercivalTransport::packet_pixeldata_size);
+    fields->m_packet_type = type;
+    fields->m_subframe_number = subframe;
+    fields->m_frame_number = htonl(frame);
+    fields->m_packet_number = htons(packet_number);
+}
+
+// the packets of one frame, in the order the detector sends them: by type, then packet
+// number, with the subframes interleaved packet by packet if subframeInterleave is set.
+static void framePackets(uint32_t frame, bool subframeInterleave, std::vector<BenchPacket>& packets)
+{
+    BenchPacket packet;
+    for(uint8_t type=0;type<PercivalTransport::num_data_types;++type)
+    {
+        if(subframeInterleave)
+        {
+            for(uint16_t p=0;p<PercivalTransport::num_primary_packets;++p)
+                for(uint8_t subframe=0;subframe<PercivalTransport::num_subframes;++subframe)
+                {
+                    makeHeader(packet, frame, type, subframe, p);
+                    packets.push_back(packet);
+                }
+        }
+        else
+        {
+            for(uint8_t subframe=0;subframe<PercivalTransport::num_subframes;++subframe)
+                for(uint16_t p=0;p<PercivalTransport::num_primary_packets;++p)
+                {
+                    makeHeader(packet, frame, type, subframe, p);
+                    packets.push_back(packet);
+                }
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    log4cxx::BasicConfigurator::configure();
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+    ("help,h", "This times PercivalFrameDecoder on a packet stream built in memory, and writes\
+                ns/packet and frames/s as JSON.")
+    ("out,o", po::value<std::string>(), "file to write the JSON to (def stdout)")
+    ("frames,f", po::value<int>()->default_value(200), "frames in the stream")
+    ("buffers,b", po::value<int>()->default_value(8), "frame buffers the decoder has")
+    ("seed,s", po::value<unsigned>()->default_value(1234), "seed for the loss, reordering and duplicates")
+    ("loss", po::value<double>()->default_value(0.0), "fraction of packets lost")
+    ("duplicates", po::value<double>()->default_value(0.0), "fraction of packets sent twice")
+    ("reorder", po::value<int>()->default_value(0), "shuffle the packets within windows of this many")
+    ("interleave", po::value<int>()->default_value(1), "frames sent at once, packet by packet")
+    ("subframe-interleave", po::bool_switch()->default_value(false), "send the subframes of a frame packet by packet")
+    ("monitor", po::value<int>()->default_value(1000), "call monitor_buffers every this many packets")
+    ("timeout", po::value<unsigned>()->default_value(10), "frame timeout in ms")
+    ("late-window", po::value<unsigned>()->default_value(1024), "late_packet_window_frames, 0 for off")
+    ("late-window-ms", po::value<unsigned>()->default_value(1000), "late_packet_window_ms")
+    ("no-copy", po::bool_switch()->default_value(false), "don't copy the payloads into the frame buffers")
+    ("blanking", po::value<bool>()->default_value(true), "enable_frame_blanking")
+    ("capture", po::value<std::string>(), "capture the packet headers to this file, as enable_packet_logging does")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << desc;
+        exit(0);
+    }
+
+    int frames = vm["frames"].as<int>();
+    int buffers = vm["buffers"].as<int>();
+    unsigned seed = vm["seed"].as<unsigned>();
+    double loss = vm["loss"].as<double>();
+    double duplicates = vm["duplicates"].as<double>();
+    int reorder = vm["reorder"].as<int>();
+    int interleave = vm["interleave"].as<int>();
+    bool subframeInterleave = vm["subframe-interleave"].as<bool>();
+    int monitor = vm["monitor"].as<int>();
+    unsigned timeout = vm["timeout"].as<unsigned>();
+    bool copy = !vm["no-copy"].as<bool>();
+    if(frames < 1 || buffers < 1 || interleave < 1 || monitor < 1)
+    {
+        std::cout << "Error: frames, buffers, interleave and monitor must be at least 1" << std::endl; exit(1);
+    }
+
+    // build the stream: interleave frames at a time, a packet from each in turn
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::vector<BenchPacket> stream;
+    for(int first=0;first<frames;first+=interleave)
+    {
+        std::vector<std::vector<BenchPacket>> group;
+        for(int frame=first;frame<std::min(frames, first+interleave);++frame)
+        {
+            group.emplace_back();
+            framePackets(frame, subframeInterleave, group.back());
+        }
+        for(size_t p=0;p<PercivalTransport::num_frame_packets;++p)
+        {
+            for(auto& framePackets : group)
+            {
+                if(chance(rng) < loss)
+                    continue;
+                stream.push_back(framePackets[p]);
+                if(chance(rng) < duplicates)
+                    stream.push_back(framePackets[p]);
+            }
+        }
+    }
+    if(1 < reorder)
+    {
+        for(size_t start=0;start<stream.size();start+=reorder)
+            std::shuffle(stream.begin() + start, stream.begin() + std::min(stream.size(), start + reorder), rng);
+    }
+
+    LoggerPtr decoderLogger = log4cxx::Logger::getLogger("FR.PercivalFrameDecoder");
+    OdinData::IpcMessage config;
+    config.set_param("frame_timeout_ms", timeout);
+    config.set_param("enable_frame_blanking", vm["blanking"].as<bool>());
+    // the stream sends each frame number once, so the duplicates can be told from new frames
+    config.set_param("late_packet_window_frames", vm["late-window"].as<unsigned>());
+    config.set_param("late_packet_window_ms", vm["late-window-ms"].as<unsigned>());
+    bool capture = vm.count("capture");
+    if(capture)
+    {
+        config.set_param("enable_packet_logging", true);
+        config.set_param("packet_capture_file", vm["capture"].as<std::string>());
+    }
+    PercivalFrameDecoder decoder;
+    decoder.init(decoderLogger, config);
+
+    // the decoder only needs the buffer addresses, so the shared memory is never shared
+    std::string shmName = "PercivalDecoderBench" + std::to_string(getpid());
+    OdinData::SharedBufferManagerPtr bufferManager(new OdinData::SharedBufferManager(
+        shmName, buffers * decoder.get_frame_buffer_size(), decoder.get_frame_buffer_size(), true));
+    decoder.register_buffer_manager(bufferManager);
+    // this plays the part of the frame processor, and hands each buffer straight back
+    BenchCounts counts;
+    decoder.register_frame_ready_callback([&](int buffer_id, int frame_number) {
+        PercivalTransport::FrameHeader* header = reinterpret_cast<PercivalTransport::FrameHeader*>(bufferManager->get_buffer_address(buffer_id));
+        if(header->frame_state == FrameDecoder::FrameReceiveStateComplete)
+            ++counts.complete;
+        else
+            ++counts.timedout;
+        decoder.push_empty_buffer(buffer_id);
+    });
+    for(int i=0;i<buffers;++i)
+        decoder.push_empty_buffer(i);
+
+    std::vector<uint8_t> payload(PercivalTransport::packet_pixeldata_size, 0x5a);
+    const size_t headerSize = decoder.get_packet_header_size();
+    const size_t packetSize = headerSize + PercivalTransport::packet_pixeldata_size;
+    struct sockaddr_in from;
+    memset(&from, 0, sizeof(from));
+    from.sin_family = AF_INET;
+    from.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    const int port = 8000;
+
+    // this is what the rx thread does for each packet, without the recvmsg
+    auto t1 = std::chrono::steady_clock::now();
+    for(size_t i=0;i<stream.size();++i)
+    {
+        memcpy(decoder.get_packet_header_buffer(), stream[i].header, headerSize);
+        decoder.process_packet_header(headerSize, port, &from);
+        void* buffer = decoder.get_next_payload_buffer();
+        if(copy)
+            memcpy(buffer, payload.data(), PercivalTransport::packet_pixeldata_size);
+        decoder.process_packet(packetSize, port, &from);
+        if((i + 1) % monitor == 0)
+            decoder.monitor_buffers();
+    }
+    auto t2 = std::chrono::steady_clock::now();
+
+    // let the last incomplete frames time out; this isn't in the times
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout + 1));
+    decoder.monitor_buffers();
+
+    OdinData::IpcMessage status;
+    decoder.get_status("decoder/", status);
+    double ns = std::chrono::duration<double, std::nano>(t2 - t1).count();
+    std::ostringstream json;
+    json << "{\n";
+    json << "  \"tool\": \"decoder-bench\",\n";
+    json << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+    json << "  \"seed\": " << seed << ",\n";
+    json << "  \"frames\": " << frames << ",\n";
+    json << "  \"buffers\": " << buffers << ",\n";
+    json << "  \"loss\": " << loss << ",\n";
+    json << "  \"duplicates\": " << duplicates << ",\n";
+    json << "  \"reorder\": " << reorder << ",\n";
+    json << "  \"interleave\": " << interleave << ",\n";
+    json << "  \"subframe_interleave\": " << (subframeInterleave ? "true" : "false") << ",\n";
+    json << "  \"copy\": " << (copy ? "true" : "false") << ",\n";
+    json << "  \"capture\": " << (capture ? "true" : "false") << ",\n";
+    json << "  \"packets\": " << stream.size() << ",\n";
+    json << "  \"ns_per_packet\": " << ns / stream.size() << ",\n";
+    json << "  \"frames_complete\": " << counts.complete << ",\n";
+    json << "  \"frames_timedout\": " << counts.timedout << ",\n";
+    json << "  \"frames_dropped\": " << decoder.get_num_frames_dropped() << ",\n";
+    json << "  \"bad_packets\": " << status.get_param<int>("decoder/bad_packets") << ",\n";
+    json << "  \"bad_packet_reasons\": {";
+    for(int reason=0;reason<PercivalFrameDecoder::eNumBadPacketReasons;++reason)
+    {
+        std::string name = PercivalFrameDecoder::bad_packet_reason_name(reason);
+        json << (reason ? ", " : "") << "\"" << name << "\": " << status.get_param<uint64_t>("decoder/bad_packet_reasons/" + name);
+    }
+    json << "},\n";
+    json << "  \"late_packets\": " << status.get_param<uint64_t>("decoder/late_packets") << ",\n";
+    json << "  \"frames_complete_per_s\": " << counts.complete * 1e9 / ns << "\n";
+    json << "}\n";
+
+    if(vm.count("out"))
+    {
+        std::ofstream out(vm["out"].as<std::string>());
+        out << json.str();
+        if(!out)
+        {
+            std::cout << "Error: could not write " << vm["out"].as<std::string>() << std::endl; exit(1);
+        }
+    }
+    else
+    {
+        std::cout << json.str();
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * packet-capture-decode.cpp
+ *
+ * This prints the packet headers PercivalFrameDecoder captured with enable_packet_logging
+ * (see PacketCapture), oldest first, one per line: the arrival time, where the packet
+ * came from, the header fields and whether it was bad or froze the capture.
+ */
+
+#include "PacketCapture.h"
+
+#include <boost/program_options.hpp>
+
+#include <arpa/inet.h>
+
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+using namespace FrameReceiver;
+
+int main(int argc, char* argv[])
+{
+    po::options_description desc("Allowed options");
+
+    desc.add_options()
+    ("help,h", "This prints a packet capture file from the frame receiver.")
+    ("file", po::value<std::string>(), "the capture file (def /dev/shm/percival_packet_capture.bin)")
+    ("frame,f", po::value<long>(), "only print the packets of this frame")
+    ("around,a", po::value<long>(), "only print this many packets either side of the one that froze it")
+    ("raw,r", po::bool_switch()->default_value(false), "print the whole header in hex as well")
+    ;
+    po::positional_options_description positional;
+    positional.add("file", 1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << "usage: packet-capture-decode [options] [file]" << std::endl << desc;
+        exit(0);
+    }
+
+    std::string filename = vm.count("file") ? vm["file"].as<std::string>() : "/dev/shm/percival_packet_capture.bin";
+    PacketCapture::FileHeader header;
+    std::vector<PacketCapture::Record> records;
+    std::string error;
+    if(PacketCapture::read(filename, header, records, error) != 0)
+    {
+        std::cout << "Error: " << error << std::endl; exit(1);
+    }
+
+    uint64_t first = header.head - records.size();
+    std::cout << "# " << filename << ": " << header.head << " packets recorded, the last "
+              << records.size() << " kept";
+    if(header.frozen || header.freeze_reason)
+        std::cout << (header.frozen ? ", frozen" : ", freezing") << " by " << PacketCapture::reason_name(header.freeze_reason)
+                  << " at packet " << header.trigger;
+    std::cout << std::endl;
+    std::cout << "# index time source rx_port type subframe frame packet datablock_size flags" << std::endl;
+
+    bool onlyFrame = vm.count("frame");
+    long frame = onlyFrame ? vm["frame"].as<long>() : 0;
+    bool onlyAround = vm.count("around") && header.freeze_reason;
+    long around = onlyAround ? vm["around"].as<long>() : 0;
+    for(size_t i=0;i<records.size();++i)
+    {
+        const PacketCapture::Record& r = records[i];
+        uint64_t index = first + i;
+        const PercivalTransport::PacketHeaderFields* fields = reinterpret_cast<const PercivalTransport::PacketHeaderFields*>(r.header);
+        uint32_t frameNumber = ntohl(fields->m_frame_number);
+        if(onlyFrame && frameNumber != (uint32_t)frame)
+            continue;
+        if(onlyAround && (index + around < header.trigger || header.trigger + around < index))
+            continue;
+
+        uint64_t ns = header.start_ns + (int64_t)(((int64_t)(r.tsc - header.start_tsc)) / header.tsc_per_ns);
+        time_t seconds = ns / 1000000000;
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        char when[64];
+        size_t len = strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+        snprintf(when + len, sizeof(when) - len, ".%09luZ", (unsigned long)(ns % 1000000000));
+
+        struct in_addr source;
+        source.s_addr = r.source_address;
+        std::cout << index << " " << when << " " << inet_ntoa(source) << ":" << ntohs(r.source_port)
+                  << " " << r.rx_port
+                  << " " << (int)fields->m_packet_type << " " << (int)fields->m_subframe_number
+                  << " " << frameNumber << " " << ntohs(fields->m_packet_number)
+                  << " " << ntohs(fields->m_datablock_size);
+        if(r.flags & PacketCapture::eFlagBad)
+            std::cout << " BAD";
+        if(r.flags & PacketCapture::eFlagTrigger)
+            std::cout << " TRIGGER";
+        if(r.flags & PacketCapture::eFlagLate)
+            std::cout << " LATE";
+        std::cout << std::endl;
+        if(vm["raw"].as<bool>())
+        {
+            char hex[4];
+            std::cout << "  ";
+            for(size_t b=0;b<PercivalTransport::packet_header_size;++b)
+            {
+                snprintf(hex, sizeof(hex), "%02x ", r.header[b]);
+                std::cout << (b && b % 8 == 0 ? " " : "") << hex;
+            }
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+"""
+Make the reference numbers DescramblerSameAsPython in
+cpp/daq/frameProcessor/test/PercivalCalibTests.cpp checks against.
+
+It builds the same pseudo-random raw frame as the test, with row group 5 lost,
+descrambles it with descramble_to_crs_fn_gn() from live_viewer/descrambler.py, and
+prints an FNV-1a hash of the whole frame and a few of its pixels. Run it again and
+paste its output into the test if the input there is changed.
+"""
+
+import os
+import sys
+
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "live_viewer"))
+import descrambler  # noqa: E402
+
+ROWS = descrambler.NRow
+COLS = descrambler.NColInBlock * (descrambler.NPad - 1)
+LOST_GROUP = 5
+MISSING = 0xffff
+SAMPLES = [(0, 0), (0, 1407), (6, 700), (34, 31), (41, 5), (700, 32), (1000, 999), (1483, 1407)]
+
+
+def raw_frame():
+    """ the test's input: the top 16 bits of a 32-bit LCG, with bit 0 clear """
+    frame = np.zeros(ROWS * COLS, dtype="uint16")
+    x = 1
+    for i in range(ROWS * COLS):
+        x = (x * 1103515245 + 12345) & 0xffffffff
+        frame[i] = (x >> 16) & 0xfffe
+    frame = frame.reshape((ROWS, COLS))
+    frame[LOST_GROUP * descrambler.NADC, 0] = MISSING
+    return frame
+
+
+def fnv1a(pixels):
+    h = 0xcbf29ce484222325
+    for b in pixels.astype("<u2").tobytes():
+        h = ((h ^ b) * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+
+def main():
+    coarse, fine, gain = descrambler.descramble_to_crs_fn_gn(raw_frame(), False, False, False)
+    # the pixels of a lost row group come out of it as ERRint16
+    lost = gain == (descrambler.ERRint16 & 0xffff)
+    image = ((gain.astype("uint32") << 13) | (fine.astype("uint32") << 5) | coarse).astype("uint16")
+    image[lost] = MISSING
+
+    print("    const uint64_t pythonHash = 0x%016xull;" % fnv1a(image))
+    print("    const int pythonSamples[][3] = {")
+    for row, col in SAMPLES:
+        print("        {%d, %d, 0x%04x}," % (row, col, image[row, col]))
+    print("    };")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,273 @@
+#!/bin/env python
+'''
+Loopback end-to-end benchmark: frameSimulator -> frameReceiver (PercivalFrameDecoder)
+-> frameProcessor (PercivalProcess2Plugin -> PercivalCalibPlugin), all on this host.
+
+It starts the FR and FP with their own configs and control ports, sends frames from the
+simulator over 127.0.0.1 at a target rate, polls the status of both while they run, and
+writes sustained frames/s, drops and the latency from the FR's frame_start_time to the
+calib plugin's output as JSON.
+
+The latency comes from the calib plugin's latency/ status, which needs this version of
+the plugins on both sides. The FR and FP must be on the same host for it to mean
+anything, which they are here.
+'''
+
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+import zmq
+
+# PercivalTransport::total_frame_size, rounded up
+FRAME_BUFFER_SIZE = 8400000
+PACKETS_PER_FRAME = 1696
+
+
+class StatusClient(object):
+
+    def __init__(self, context, endpoint):
+        self.socket = context.socket(zmq.DEALER)
+        self.socket.setsockopt(zmq.LINGER, 0)
+        self.socket.connect(endpoint)
+        self.msg_id = 0
+
+    def send(self, msg_type, msg_val, params=None, timeout_ms=2000):
+        self.msg_id += 1
+        msg = {
+            'msg_type': msg_type,
+            'msg_val': msg_val,
+            'id': self.msg_id,
+            'timestamp': time.strftime('%Y-%m-%dT%H:%M:%S'),
+            'params': params or {},
+        }
+        self.socket.send_string(json.dumps(msg))
+        if not self.socket.poll(timeout_ms):
+            raise RuntimeError('no reply to %s from %s' % (msg_val, self.socket.getsockopt_string(zmq.LAST_ENDPOINT)))
+        return json.loads(self.socket.recv_string()).get('params', {})
+
+    def status(self):
+        return self.send('cmd', 'status')
+
+    def reset_statistics(self):
+        return self.send('cmd', 'reset_statistics')
+
+
+def lookup(params, path, default=0):
+    for key in path.split('/'):
+        if not isinstance(params, dict) or key not in params:
+            return default
+        params = params[key]
+    return params
+
+
+def fr_config(args):
+    return [{
+        'debug_level': 0,
+        'max_buffer_mem': args.buffers * FRAME_BUFFER_SIZE,
+        'frame_ready_endpoint': 'tcp://127.0.0.1:%d' % (args.base_port + 1),
+        'frame_release_endpoint': 'tcp://127.0.0.1:%d' % (args.base_port + 2),
+        'shared_buffer_name': 'PercivalLoopbackBench',
+        'rx_address': '127.0.0.1',
+        'rx_ports': args.ports,
+        'decoder_type': 'Percival',
+        'decoder_path': os.path.join(args.prefix, 'lib'),
+        'decoder_config': {
+            'enable_packet_logging': False,
+            'frame_timeout_ms': args.frame_timeout_ms,
+            'late_packet_window_frames': args.late_packet_window,
+            'late_packet_window_ms': args.late_packet_window_ms,
+        },
+    }]
+
+
+def fp_config(args):
+    lib = os.path.join(args.prefix, 'lib')
+    calib = {}
+    if args.calib:
+        calib['constantsfile'] = args.calib
+    if args.cmacol >= 0:
+        calib['cmacol'] = args.cmacol
+    return [
+        {
+            'debug_level': 0,
+            'fr_setup': {
+                'fr_ready_cnxn': 'tcp://127.0.0.1:%d' % (args.base_port + 1),
+                'fr_release_cnxn': 'tcp://127.0.0.1:%d' % (args.base_port + 2),
+            },
+        },
+        {'plugin': {'load': {'index': 'percival', 'name': 'PercivalProcess2Plugin',
+                             'library': os.path.join(lib, 'libPercivalProcess2Plugin.so')}}},
+        {'plugin': {'load': {'index': 'calib', 'name': 'PercivalCalibPlugin',
+                             'library': os.path.join(lib, 'libPercivalCalibPlugin.so')}}},
+        {'plugin': {'connect': {'index': 'percival', 'connection': 'frame_receiver'}}},
+        {'plugin': {'connect': {'index': 'calib', 'connection': 'percival'}}},
+        {'percival': {'process': {'number': 1, 'rank': 0}}},
+        {'calib': calib},
+    ]
+
+
+def main():
+    parser = argparse.ArgumentParser(prog='loopback_bench',
+                                     description='simulator -> receiver -> Process2 -> Calib over loopback',
+                                     formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+    parser.add_argument('--prefix', default='/opt/percival-detector', help='where the percival libs are installed')
+    parser.add_argument('--odin-prefix', default=None, help='where odin-data is installed (def <prefix>/odin)')
+    parser.add_argument('--calib', default=None, help='calibration constants file for the calib plugin')
+    parser.add_argument('--cmacol', type=int, default=-1, help='cma first column, -1 for off')
+    parser.add_argument('--rate', type=float, default=50.0, help='target frames/s from the simulator')
+    parser.add_argument('--frames', type=int, default=50, help='frames the simulator makes (it holds them all in memory)')
+    parser.add_argument('--runs', type=int, default=4, help='times to run the simulator one after the other')
+    parser.add_argument('--packet-gap', type=int, default=0, help='simulator pauses after this many packets, 0 for never')
+    parser.add_argument('--ports', default='8000,8001', help='udp ports the FR listens on')
+    parser.add_argument('--base-port', type=int, default=5100, help='FR ctrl, ready, release and FP ctrl are this +0..3')
+    parser.add_argument('--buffers', type=int, default=20, help='frame buffers between the FR and FP')
+    parser.add_argument('--frame-timeout-ms', type=int, default=1000, help='FR decoder frame timeout')
+    # each run of the simulator sends the same frame numbers again, so with the window on
+    # the frames of the runs after the first can be thrown away as late packets
+    parser.add_argument('--late-packet-window', type=int, default=0,
+                        help='FR decoder late packet window in frames, 0 for off')
+    parser.add_argument('--late-packet-window-ms', type=int, default=0,
+                        help='FR decoder late packet window in ms, 0 for no time limit')
+    parser.add_argument('--settle', type=float, default=3.0, help='seconds to wait for the last frames to get through')
+    parser.add_argument('--poll', type=float, default=0.5, help='seconds between status polls')
+    parser.add_argument('--out', '-o', default=None, help='file to write the JSON to (def stdout)')
+    parser.add_argument('--keep', action='store_true', help='keep the configs and logs in the work dir')
+    args = parser.parse_args()
+
+    odin_prefix = args.odin_prefix or os.path.join(args.prefix, 'odin')
+    bindir = os.path.join(odin_prefix, 'bin')
+    workdir = tempfile.mkdtemp(prefix='loopback_bench_')
+    fr_ctrl = 'tcp://127.0.0.1:%d' % args.base_port
+    fp_ctrl = 'tcp://127.0.0.1:%d' % (args.base_port + 3)
+
+    with open(os.path.join(workdir, 'fr.json'), 'w') as f:
+        json.dump(fr_config(args), f, indent=2)
+    with open(os.path.join(workdir, 'fp.json'), 'w') as f:
+        json.dump(fp_config(args), f, indent=2)
+
+    procs = []
+    logs = []
+
+    def start(name, cmd):
+        log = open(os.path.join(workdir, name + '.log'), 'w')
+        logs.append(log)
+        procs.append(subprocess.Popen(cmd, stdout=log, stderr=subprocess.STDOUT))
+
+    context = zmq.Context()
+    try:
+        start('fr', [os.path.join(bindir, 'frameReceiver'), '--ctrl=' + fr_ctrl,
+                     '--json_file=' + os.path.join(workdir, 'fr.json')])
+        start('fp', [os.path.join(bindir, 'frameProcessor'), '--ctrl=' + fp_ctrl,
+                     '--json_file=' + os.path.join(workdir, 'fp.json')])
+
+        # wait for both to answer, then start from zero. A client that timed out is
+        # thrown away, so a late reply can't be taken for the answer to the next request.
+        deadline = time.time() + 30
+        while True:
+            fr = StatusClient(context, fr_ctrl)
+            fp = StatusClient(context, fp_ctrl)
+            try:
+                fr.status()
+                fp.status()
+                break
+            except RuntimeError:
+                fr.socket.close()
+                fp.socket.close()
+                if time.time() > deadline or any(p.poll() is not None for p in procs):
+                    raise RuntimeError('the FR and FP did not start; see the logs in ' + workdir)
+                time.sleep(0.5)
+        fr.reset_statistics()
+        fp.reset_statistics()
+
+        sim = [os.path.join(bindir, 'frameSimulator'), 'PercivalFrameSimulatorPlugin',
+               '--lib-path=' + os.path.join(args.prefix, 'lib'),
+               '--frames=%d' % args.frames,
+               '--interval=%f' % (1.0 / args.rate),
+               '--dest-ip=127.0.0.1',
+               '--ports=' + args.ports]
+        if args.packet_gap:
+            sim.append('--packet-gap=%d' % args.packet_gap)
+
+        # (time, frames out of calib) while frames are going through
+        samples = []
+        for run in range(args.runs):
+            start('sim%d' % run, sim)
+            while procs[-1].poll() is None:
+                time.sleep(args.poll)
+                samples.append((time.time(), lookup(fp.status(), 'calib/latency/frames')))
+        end = time.time() + args.settle
+        while time.time() < end:
+            time.sleep(args.poll)
+            samples.append((time.time(), lookup(fp.status(), 'calib/latency/frames')))
+
+        fr_status = fr.status()
+        fp_status = fp.status()
+    finally:
+        for p in procs:
+            if p.poll() is None:
+                p.terminate()
+        for p in procs:
+            p.wait()
+        for log in logs:
+            log.close()
+        context.destroy()
+
+    # sustained only counts the polls in which frames came out, so the simulator
+    # making its frames between runs, and the settle time, don't count
+    active = 0.0
+    calibrated = 0
+    for before, after in zip(samples, samples[1:]):
+        if after[1] > before[1]:
+            active += after[0] - before[0]
+            calibrated += after[1] - before[1]
+    sustained = calibrated / active if active else 0.0
+
+    sent = args.frames * args.runs
+    result = {
+        'tool': 'loopback_bench',
+        'target_frames_per_s': args.rate,
+        'target_packets_per_s': args.rate * PACKETS_PER_FRAME,
+        'frames_sent': sent,
+        'frames_received': lookup(fr_status, 'frames/received'),
+        'frames_released': lookup(fr_status, 'frames/released'),
+        'frames_timedout': lookup(fr_status, 'frames/timedout'),
+        'frames_dropped': lookup(fr_status, 'frames/dropped'),
+        'bad_packets': lookup(fr_status, 'decoder/bad_packets'),
+        'late_packets': lookup(fr_status, 'decoder/late_packets'),
+        'frames_calibrated': lookup(fp_status, 'calib/latency/frames'),
+        'frames_lost': sent - lookup(fp_status, 'calib/latency/frames'),
+        'sustained_frames_per_s': sustained,
+        'latency_us': {
+            'p50': lookup(fp_status, 'calib/latency/p50_us'),
+            'p90': lookup(fp_status, 'calib/latency/p90_us'),
+            'p99': lookup(fp_status, 'calib/latency/p99_us'),
+            'max': lookup(fp_status, 'calib/latency/max_us'),
+        },
+        # each plugin's process_frame time and the time frames waited for it
+        'timing_us': dict((plugin, dict((key, lookup(fp_status, '%s/timing/%s_us' % (plugin, key)))
+                                        for key in ('process_p50', 'process_p99', 'process_max',
+                                                    'wait_p50', 'wait_p99', 'wait_max')))
+                          for plugin in ('percival', 'calib')),
+    }
+
+    text = json.dumps(result, indent=2)
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write(text + '\n')
+    else:
+        print(text)
+
+    if args.keep:
+        sys.stderr.write('configs and logs are in %s\n' % workdir)
+    else:
+        shutil.rmtree(workdir)
+
+
+if __name__ == '__main__':
+    main()
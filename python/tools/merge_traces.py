@@ -0,0 +1,36 @@
+#!/bin/env python
+'''
+Puts the frame traces saved by the FR (decoder_config trace_save) and the FP (a plugin's
+tracesave) into one Chrome trace JSON file, so ui.perfetto.dev or chrome://tracing shows
+a frame going from the decoder through the plugins on one timeline. They're all in
+CLOCK_MONOTONIC us, so the FR and FP have to have been on the same host.
+
+With --frame, only that frame's events are kept.
+'''
+
+import argparse
+import json
+
+
+def main():
+    parser = argparse.ArgumentParser(prog='merge_traces', description='merge FR and FP frame traces')
+    parser.add_argument('traces', nargs='+', help='trace JSON files saved by the FR and FP')
+    parser.add_argument('--frame', type=int, default=None, help='only keep this frame number')
+    parser.add_argument('--out', '-o', required=True, help='file to write the merged trace to')
+    args = parser.parse_args()
+
+    events = []
+    for name in args.traces:
+        with open(name) as f:
+            events.extend(json.load(f)['traceEvents'])
+    if args.frame is not None:
+        events = [e for e in events if e.get('args', {}).get('frame') == args.frame]
+    events.sort(key=lambda e: e['ts'])
+
+    with open(args.out, 'w') as f:
+        json.dump({'displayTimeUnit': 'ns', 'traceEvents': events}, f)
+    print('%d events from %d files' % (len(events), len(args.traces)))
+
+
+if __name__ == '__main__':
+    main()